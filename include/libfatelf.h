@@ -0,0 +1,144 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+/*
+ * libfatelf: the FatELF utilities as a library.
+ *
+ * Everything here reports failure by returning one of the FATELF_E* codes
+ *  below; nothing calls exit(). When a call fails, anything it opened or
+ *  allocated has been released, and any output file it was writing has
+ *  been deleted. The context that was passed in holds a description of
+ *  what went wrong, in the same words the command line tools would use.
+ *
+ * A context may only be used by one thread at a time, but any number of
+ *  threads can use their own contexts at once.
+ */
+
+#ifndef __INCL_LIBFATELF_H__
+#define __INCL_LIBFATELF_H__ 1
+
+#include "fatelf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Only what's declared here is visible outside of libfatelf.a; the rest of
+ *  the library is built hidden, so it can't collide with a program's own
+ *  names. */
+#if defined(__GNUC__) && (__GNUC__ >= 4)
+#pragma GCC visibility push(default)
+#endif
+
+/* Return codes. Everything that isn't FATELF_OK is negative. */
+#define FATELF_OK          (0)
+#define FATELF_EFAIL       (-1)  /* something else went wrong. */
+#define FATELF_EIO         (-2)  /* a system call failed; see fatelf_ctx_errno(). */
+#define FATELF_ENOMEM      (-3)  /* out of memory. */
+#define FATELF_EFORMAT     (-4)  /* not an ELF or FatELF file, or a damaged one. */
+#define FATELF_ENOTFOUND   (-5)  /* no record matches the target. */
+#define FATELF_EAMBIGUOUS  (-6)  /* more than one record matches the target. */
+#define FATELF_EDUPLICATE  (-7)  /* two binaries for the same target. */
+#define FATELF_EINVAL      (-8)  /* bad arguments. */
+
+typedef struct fatelf_ctx fatelf_ctx;
+
+/* Returns NULL if out of memory. */
+fatelf_ctx *fatelf_ctx_create(void);
+void fatelf_ctx_destroy(fatelf_ctx *ctx);
+
+/* What the last call made with (ctx) returned, and why. */
+int fatelf_ctx_error(const fatelf_ctx *ctx);
+int fatelf_ctx_errno(const fatelf_ctx *ctx);  /* errno, for FATELF_EIO. */
+const char *fatelf_ctx_message(const fatelf_ctx *ctx);  /* "" if it worked. */
+
+/* List the records of files glued with (ctx) by (order), a comma-separated
+ *  list of targets ("x86_64,i386:linux,arm"), instead of in the order of
+ *  the binaries. Records that match an earlier target come first; the rest
+ *  go last, in their own order. Loaders try records in the order they're
+ *  listed, so the most common target should lead. "default" is a list of
+ *  the most common hosts; NULL goes back to the binaries' order. */
+int fatelf_ctx_set_order(fatelf_ctx *ctx, const char *order);
+
+/* Read the header of FatELF file (fname), which is open as (fd). This
+ *  doesn't use or move the file position. Free (*header) with
+ *  fatelf_free_header(). */
+int fatelf_read_header(fatelf_ctx *ctx, const char *fname, const int fd,
+                       FATELF_header **header);
+
+/* Write (header) to the start of (fd). */
+int fatelf_write_header(fatelf_ctx *ctx, const char *fname, const int fd,
+                        const FATELF_header *header);
+
+void fatelf_free_header(FATELF_header *header);
+
+/* Find the record in (header) that (target) names, in any of the forms the
+ *  command line tools accept ("x86_64", "record12", "osabi:linux:0", ...).
+ *  Returns the record's index, or a negative FATELF_E* code. */
+int fatelf_find_record(fatelf_ctx *ctx, const FATELF_header *header,
+                       const char *target);
+
+/* Build FatELF file (out) from (bincount) ELF binaries. */
+int fatelf_glue(fatelf_ctx *ctx, const char *out, const char **bins,
+                const int bincount);
+
+/* Write the record of FatELF file (in) that (target) names to (out). (in)
+ *  can be a packed FatELF file, too. */
+int fatelf_extract(fatelf_ctx *ctx, const char *out, const char *in,
+                   const char *target);
+
+/* fatelf_glue(), but to (outfd), which is only ever written front to back,
+ *  so it can be a pipe or a socket. (out) just names it in error messages.
+ *  Nothing is deleted on failure; that's up to the caller. */
+int fatelf_glue_stream(fatelf_ctx *ctx, const char *out, const int outfd,
+                       const char **bins, const int bincount);
+
+/* fatelf_extract(), but reading (infd) in one pass from its current
+ *  position, so it can be a pipe, and writing (outfd) front to back. (in)
+ *  and (out) just name them in error messages. A packed (in) has to be
+ *  seekable. If the record is over 64K and has Haiku resources, (outfd)
+ *  must be a regular file opened for reading and writing. */
+int fatelf_extract_stream(fatelf_ctx *ctx, const char *out, const int outfd,
+                          const char *in, const int infd,
+                          const char *target);
+
+/* Write FatELF file (in) to (out) as a packed FatELF file: every record
+ *  compressed, in blocks, on as many threads as there are CPUs. Packed
+ *  files are for shipping and storing FatELF binaries; no loader will run
+ *  them, but fatelf_extract() reads them. */
+int fatelf_pack(fatelf_ctx *ctx, const char *out, const char *in);
+
+/* Write a copy of FatELF file (in) to (out), without the record that
+ *  (target) names. */
+int fatelf_remove(fatelf_ctx *ctx, const char *out, const char *in,
+                  const char *target);
+
+/* Write a copy of FatELF file (in) to (out), with ELF binary (newelf) in
+ *  place of the record for the same target. */
+int fatelf_replace(fatelf_ctx *ctx, const char *out, const char *in,
+                   const char *newelf);
+
+/* Put ELF binary (newelf) in place of the record for the same target,
+ *  in FatELF file (fname) itself. If it won't fit where the old record
+ *  was, (fname) is rewritten and atomically renamed over. */
+int fatelf_replace_in_place(fatelf_ctx *ctx, const char *fname,
+                            const char *newelf);
+
+/* List the records of FatELF file (fname) in (order), as
+ *  fatelf_ctx_set_order() takes it. Only the header is rewritten. */
+int fatelf_reorder(fatelf_ctx *ctx, const char *fname, const char *order);
+
+#if defined(__GNUC__) && (__GNUC__ >= 4)
+#pragma GCC visibility pop
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* end of libfatelf.h ... */
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "libfatelf.h"
+
+/* Names the library uses inside. A program can have its own, since nothing
+   but the libfatelf.h API is visible in libfatelf.a. */
+void *xmalloc(size_t len) { return malloc(len); }
+void xfail(const char *fmt, ...) { fprintf(stderr, "%s\n", fmt); exit(1); }
+int get_machine_by_id(int id) { return id; }
+
+static int check(fatelf_ctx *ctx, const int rc, const char *what)
+{
+    if (rc >= 0)
+        return 0;
+    fprintf(stderr, "%s failed (%d): %s\n", what, rc, fatelf_ctx_message(ctx));
+    return 1;
+}
+
+/* Usage: libfatelf-test <out> <bin1> <bin2>
+   Glues the two binaries into (out), checks its header, and extracts the
+   second one again to (out).extracted. */
+int main(int argc, const char **argv)
+{
+    fatelf_ctx *ctx = fatelf_ctx_create();
+    FATELF_header *header = NULL;
+    char extracted[1024];
+    int retval = 1;
+    int fd, rc;
+
+    if ((argc != 4) || (ctx == NULL))
+        return 1;
+
+    snprintf(extracted, sizeof (extracted), "%s.extracted", argv[1]);
+
+    if (check(ctx, fatelf_glue(ctx, argv[1], &argv[2], 2), "fatelf_glue"))
+        goto done;
+
+    if ((fd = open(argv[1], O_RDONLY)) == -1)
+        goto done;
+    rc = fatelf_read_header(ctx, argv[1], fd, &header);
+    close(fd);
+    if (check(ctx, rc, "fatelf_read_header"))
+        goto done;
+    else if (header->num_records != 2)
+        goto done;
+
+    rc = fatelf_find_record(ctx, header, "record1");
+    if (check(ctx, rc, "fatelf_find_record") || (rc != 1))
+        goto done;
+
+    rc = fatelf_extract(ctx, extracted, argv[1], "record1");
+    if (check(ctx, rc, "fatelf_extract"))
+        goto done;
+
+    /* A failure is a code and a message, with nothing left behind. */
+    unlink(extracted);
+    rc = fatelf_extract(ctx, extracted, argv[1], "record9");
+    if ((rc != FATELF_ENOTFOUND) || (*fatelf_ctx_message(ctx) == '\0'))
+        goto done;
+    else if (access(extracted, F_OK) == 0)
+        goto done;
+
+    rc = fatelf_extract(ctx, extracted, argv[1], "record1");
+    if (check(ctx, rc, "fatelf_extract"))
+        goto done;
+
+    retval = 0;
+
+done:
+    fatelf_free_header(header);
+    fatelf_ctx_destroy(ctx);
+    return retval;
+}
+
+/* end of libfatelf-test.c ... */
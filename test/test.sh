@@ -49,6 +49,215 @@ diff --brief ./hello-x86 ./extract-x86
 ./fatelf-extract ./extract-amd64 ./hello x86_64:sysv:osabiver0:le:64bit
 diff --brief ./hello-amd64 ./extract-amd64
 
+# Streaming: glue to a pipe and extract from one, with the same results as
+#  going through files.
+./fatelf-glue - hello-x86 hello-amd64 | cat > ./hello-stream
+cmp ./hello ./hello-stream
+cat ./hello | ./fatelf-extract - - record0 | cat > ./extract-x86-stream
+cmp ./hello-x86 ./extract-x86-stream
+cat ./hello | ./fatelf-extract ./extract-amd64-stream - x86_64
+cmp ./hello-amd64 ./extract-amd64-stream
+
+# Haiku resources: a real resource table (see Haiku's ResourcesDef.h)
+#  appended to an ELF, with garbage after it that must not be carried along.
+#  Two resources: 'APPV' #1 "vers" (8 bytes) and 'ICON' #101 (4 bytes).
+u16() { printf "$(printf '\\x%02x\\x%02x' $(($1 & 255)) $(($1 >> 8 & 255)))"; }
+u32() { u16 $(($1 & 65535)); u16 $(($1 >> 16 & 65535)); }
+rsrc() {
+    u32 0x444F1000; u32 2; u32 68; u32 224; head -c 52 /dev/zero  # header
+    u32 68; u32 156; u32 0; u32 224; u32 0; head -c 100 /dev/zero  # index
+    u32 236; u32 57; u32 0
+    u32 224; u32 8; u32 0; u32 232; u32 4; u32 0  # index entries
+    printf 'APPVDATAICON'  # the resources themselves
+    u32 0x41505056; u32 1; u32 1; u16 5; printf 'vers\0'  # info table
+    u32 0xFFFFFFFF; u32 0xFFFFFFFF
+    u32 0x49434F4E; u32 101; u32 2; u16 0
+    u32 0xFFFFFFFF; u32 0xFFFFFFFF
+    u32 0; u32 0xFFFFFFFE
+}
+cp hello-amd64 hello-amd64-rsrc
+head -c $(( (8 - $(stat -c %s hello-amd64) % 8) % 8 )) /dev/zero >> hello-amd64-rsrc
+rsrc >> hello-amd64-rsrc
+[ $(( $(stat -c %s hello-amd64-rsrc) % 8 )) = 5 ]  # 293 bytes of resources.
+cp hello-amd64-rsrc hello-amd64-rsrc-junk
+printf 'GARBAGE!' >> hello-amd64-rsrc-junk
+./fatelf-glue hello-rsrc hello-amd64-rsrc-junk hello-x86
+./fatelf-validate hello-rsrc
+./fatelf-info hello-rsrc > info-rsrc.txt
+grep -q "^293 bytes of shared Haiku resource data" info-rsrc.txt
+grep -q "Resource 'APPV' #1 \"vers\": 8 bytes" info-rsrc.txt
+grep -q "Resource 'ICON' #101: 4 bytes" info-rsrc.txt
+./fatelf-extract ./extract-rsrc ./hello-rsrc x86_64
+cmp ./hello-amd64-rsrc ./extract-rsrc
+./fatelf-split --output-dir=split-rsrc ./hello-rsrc
+cmp ./hello-amd64-rsrc ./split-rsrc/x86_64
+cat ./hello-rsrc | ./fatelf-extract - - x86_64 | cat > ./extract-rsrc-stream
+cmp ./hello-amd64-rsrc ./extract-rsrc-stream
+
+# Packed: --compress, then extract and split unpack to the same bytes as the
+#  plain file gives; a damaged block fails, without leaving output behind.
+./fatelf-glue --compress hello-packed hello-x86 hello-amd64
+./fatelf-info ./hello-packed | grep -q "packed FatELF file"
+./fatelf-extract ./extract-x86-packed ./hello-packed record0
+cmp ./extract-x86 ./extract-x86-packed
+./fatelf-extract ./extract-amd64-packed ./hello-packed x86_64
+cmp ./extract-amd64 ./extract-amd64-packed
+./fatelf-split --output-dir=split-plain ./hello
+./fatelf-split --output-dir=split-packed ./hello-packed
+diff -r ./split-plain ./split-packed
+rd() { od -An -tu$2 -j$1 -N$2 "$3" | tr -d ' '; }
+index=$(rd 32 8 hello-packed)  # record0's block index.
+[ $(rd $((index + 12)) 4 hello-packed) = 0 ]  # its first block is compressed.
+cp hello-packed hello-damaged
+head -c $(rd $((index + 8)) 4 hello-packed) /dev/zero | \
+    dd of=hello-damaged bs=1 seek=$(rd $index 8 hello-packed) conv=notrunc
+if ./fatelf-extract ./extract-damaged ./hello-damaged record0 2> err.txt; then
+    exit 1
+fi
+grep -q "damaged block" err.txt
+[ ! -e ./extract-damaged ]
+
+# Packed Haiku resources go where the binary that's unpacked wants them,
+#  even when it goes down a pipe.
+./fatelf-glue --compress hello-rsrc-packed hello-amd64-rsrc-junk hello-x86
+./fatelf-extract ./extract-rsrc-packed ./hello-rsrc-packed x86_64
+cmp ./hello-amd64-rsrc ./extract-rsrc-packed
+./fatelf-split --output-dir=split-rsrc-packed ./hello-rsrc-packed
+cmp ./hello-amd64-rsrc ./split-rsrc-packed/x86_64
+./fatelf-extract - ./hello-rsrc-packed x86_64 | cat > ./extract-rsrc-packed-stream
+cmp ./hello-amd64-rsrc ./extract-rsrc-packed-stream
+
+# fatelf-replace --in-place: a binary that fits in the old one's slack is
+#  written over it in the same file, to the same bytes a plain replace
+#  makes; one that doesn't fit rewrites the file; and whatever follows the
+#  last record, Haiku resources or anything else, stays put.
+./fatelf-glue --slack=64K hello-slack hello-x86 hello-amd64
+# Grow it, but not past the page it ends in, so the layout doesn't change.
+cp hello-x86 hello-x86-grown
+head -c $(( (4096 - $(stat -c %s hello-x86) % 4096) % 4096 / 2 )) /dev/zero \
+    >> hello-x86-grown
+cp hello-slack hello-inplace
+inode=$(stat -c %i hello-inplace)
+./fatelf-replace --in-place hello-inplace hello-x86-grown
+[ $(stat -c %i hello-inplace) = $inode ]
+./fatelf-replace --slack=64K hello-replaced hello-slack hello-x86-grown
+cmp ./hello-replaced ./hello-inplace
+./fatelf-validate hello-inplace
+
+cp hello-x86 hello-x86-huge
+head -c 100000 /dev/zero >> hello-x86-huge
+cp hello-slack hello-inplace
+./fatelf-replace --in-place hello-inplace hello-x86-huge
+[ $(stat -c %i hello-inplace) != $inode ]
+./fatelf-replace hello-replaced hello-slack hello-x86-huge
+cmp ./hello-replaced ./hello-inplace
+./fatelf-extract ./extract-huge ./hello-inplace i386
+cmp ./hello-x86-huge ./extract-huge
+
+cp hello-x86 hello-x86-patched
+printf 'P' | dd of=hello-x86-patched bs=1 conv=notrunc \
+    seek=$(( $(stat -c %s hello-x86) - 1 ))
+for new in hello-x86-patched hello-x86-huge; do
+    cp hello-rsrc hello-rsrc-inplace
+    ./fatelf-replace --in-place hello-rsrc-inplace $new
+    ./fatelf-extract ./extract-rsrc-inplace ./hello-rsrc-inplace x86_64
+    cmp ./hello-amd64-rsrc ./extract-rsrc-inplace
+    ./fatelf-extract ./extract-x86-inplace ./hello-rsrc-inplace i386
+    cmp -n $(stat -c %s $new) ./$new ./extract-x86-inplace
+    cp hello hello-junk-inplace
+    printf 'GARBAGE!' >> hello-junk-inplace
+    ./fatelf-replace --in-place hello-junk-inplace $new
+    [ "$(tail -c 8 hello-junk-inplace)" = 'GARBAGE!' ]
+    ./fatelf-extract ./extract-x86-inplace ./hello-junk-inplace i386
+    cmp -n $(stat -c %s $new) ./$new ./extract-x86-inplace
+done
+
+# libfatelf: only the libfatelf.h API is visible in libfatelf.a, and a
+#  program that uses it can have names of its own that the library also
+#  uses inside.
+[ -z "$(nm -g --defined-only libfatelf.a | awk 'NF == 3 && $3 !~ /^fatelf_/')" ]
+gcc --std=c99 -O0 -ggdb3 -I../../include -o libfatelf-test \
+    ../libfatelf-test.c libfatelf.a -lpthread
+./libfatelf-test hello-libfatelf hello-x86 hello-amd64
+cmp ./extract-amd64 ./hello-libfatelf.extracted
+
+# fatelf-index: build an index, ask it things, then change the tree and
+#  update the index over itself.
+mkdir -p index-tree/sub
+cp hello hello-x86 hello-amd64 index-tree/
+cp hello-rsrc index-tree/sub/
+printf 'not an ELF' > index-tree/readme
+./fatelf-index update --quiet tree.idx index-tree
+[ "$(./fatelf-index query --count tree.idx)" = 4 ]
+[ "$(./fatelf-index query --fatelf --rsrc tree.idx)" = index-tree/sub/hello-rsrc ]
+[ "$(./fatelf-index query --has=x86_64 --lacks=i386 tree.idx)" = \
+  index-tree/hello-amd64 ]
+[ "$(./fatelf-index query --elf --has=i386 --null tree.idx | tr '\0' '\n')" = \
+  index-tree/hello-x86 ]
+./fatelf-index targets tree.idx | grep -q "^3	i386"
+rm index-tree/hello-x86
+cp hello-dlopen index-tree/
+./fatelf-index update tree.idx index-tree 2>&1 | grep -q "1 read, 4 unchanged"
+[ "$(./fatelf-index query --fatelf --count tree.idx)" = 3 ]
+if ./fatelf-index query --elf --has=i386 tree.idx; then
+    exit 1
+fi
+
+# fatelf --batch: shell-style quoting, --null, a status line per command,
+#  and a non-zero exit if any one of them failed.
+mkdir -p "batch dir"
+cat > batch.txt <<'END'
+# Comments and blank lines don't count as commands.
+
+validate ./hello
+extract "batch dir/x86 one" ./hello record0
+extract batch\ dir/'amd64 two' ./hello x86_64
+validate ./no-such-file
+END
+if ./fatelf --batch batch.txt > batch-out.txt; then
+    exit 1
+fi
+[ "$(grep -c ' ok$' batch-out.txt)" = 3 ]
+grep -q "^4 failed: .*no-such-file" batch-out.txt
+cmp ./hello-x86 "batch dir/x86 one"
+cmp ./hello-amd64 "batch dir/amd64 two"
+printf 'extract\0batch dir/x86 "three"\0./hello\0record0\0\0' > batch.bin
+printf 'validate\0./hello\0\0' >> batch.bin
+./fatelf --batch --null < batch.bin > batch-out.txt
+[ "$(cat batch-out.txt)" = "$(printf '1 ok\n2 ok')" ]
+cmp ./hello-x86 'batch dir/x86 "three"'
+
+# --align: one size for every record, each machine's biggest page, or each
+#  binary's own p_align.
+gcc --std=c99 -O0 -o hello-amd64-2m ../hello-dlopen.c -ldl -m64 \
+    -Wl,-z,max-page-size=0x200000
+cp hello-amd64 hello-ppc64le
+printf '\25\0' | dd of=hello-ppc64le bs=1 seek=18 conv=notrunc  # ppc64.
+cp hello-amd64 hello-aarch64
+printf '\267\0' | dd of=hello-aarch64 bs=1 seek=18 conv=notrunc
+offset() { ./fatelf-info $1 | grep -A1 "Machine $2 " | sed -n 's/  Offset //p'; }
+./fatelf-glue --align=64K hello-64k hello-x86 hello-amd64
+[ $(( $(offset hello-64k 3) % 65536 )) = 0 ]
+[ $(( $(offset hello-64k 62) % 65536 )) = 0 ]
+./fatelf-validate --align=64K hello-64k
+if ./fatelf-validate --align=2M hello-64k; then
+    exit 1
+fi
+./fatelf-glue --align=arch hello-arch hello-x86 hello-ppc64le hello-aarch64
+[ $(offset hello-arch 3) = 4096 ]
+[ $(( $(offset hello-arch 21) % 65536 )) = 0 ]
+[ $(( $(offset hello-arch 183) % 65536 )) = 0 ]
+./fatelf-info hello-arch | grep -q "Machine 183 (aarch64: "
+./fatelf-validate --align=arch hello-arch
+./fatelf-glue --align=elf hello-elf hello-x86 hello-amd64-2m
+[ $(offset hello-elf 3) = 4096 ]
+[ $(( $(offset hello-elf 62) % 2097152 )) = 0 ]
+./fatelf-validate --align=elf hello-elf
+./fatelf-glue hello-4k hello-x86 hello-amd64-2m
+if ./fatelf-validate --align=elf hello-4k; then
+    exit 1
+fi
+
 # file(1) tests.
 file ./hello
 file ./hello.o
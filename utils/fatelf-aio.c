@@ -0,0 +1,565 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+/* batched, asynchronous copies for bulk record moves... */
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-aio.h"
+#include "fatelf-stats.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#if FATELF_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+// Each slot is one chunk in flight: a read into the slot's buffer, linked
+//  to a write out of it. This many slots means up to this many reads and
+//  writes queued in the kernel at any moment.
+#define AIO_SLOTS 16
+#define AIO_CHUNK (256 * 1024)
+
+typedef struct aio_segment
+{
+    const char *in;
+    int infd;
+    uint64_t inoff;
+    const char *out;
+    int outfd;
+    uint64_t outoff;
+    uint64_t size;
+} aio_segment;
+
+// An output that has to be at least (end) bytes long once we're done,
+//  because the copy ended in a hole we didn't write.
+typedef struct aio_extent
+{
+    const char *out;
+    int outfd;
+    uint64_t end;
+} aio_extent;
+
+#if FATELF_HAVE_IO_URING
+typedef struct aio_slot
+{
+    const aio_segment *seg;
+    uint64_t inoff;
+    uint64_t outoff;
+    size_t len;
+    int pending;  // completions we're still waiting for; zero if idle.
+    int failed;   // something came back short; redo it synchronously.
+    struct iovec iov;
+} aio_slot;
+
+typedef struct aio_ring
+{
+    int fd;
+    int fixed;  // non-zero if our buffers are registered with the kernel.
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_local_tail;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_map_len;
+    uint8_t *buffers;
+    aio_slot slots[AIO_SLOTS];
+} aio_ring;
+#endif
+
+struct fatelf_aio
+{
+    aio_segment *segs;
+    size_t num_segs;
+    size_t alloc_segs;
+    aio_extent *extents;
+    size_t num_extents;
+    size_t alloc_extents;
+    #if FATELF_HAVE_IO_URING
+    aio_ring *ring;  // NULL if we're running synchronously.
+    #endif
+};
+
+
+#if FATELF_HAVE_IO_URING
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+} // sys_io_uring_setup
+
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, NULL, 0);
+} // sys_io_uring_enter
+
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+                                 unsigned nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+} // sys_io_uring_register
+
+
+static void ring_destroy(aio_ring *ring)
+{
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_map_len);
+    if ((ring->cq_map != NULL) && (ring->cq_map != ring->sq_map))
+        munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map != NULL)
+        munmap(ring->sq_map, ring->sq_map_len);
+    if (ring->fd != -1)
+        close(ring->fd);  // also drops the buffer registration.
+    free(ring->buffers);
+    free(ring);
+} // ring_destroy
+
+
+// Set up a ring, or return NULL if this kernel (or sandbox) won't let us.
+static aio_ring *ring_create(void)
+{
+    struct io_uring_params params;
+    struct iovec iov[AIO_SLOTS];
+    aio_ring *ring = (aio_ring *) xmalloc(sizeof (aio_ring));
+    uint8_t *sq, *cq;
+    void *buffers = NULL;
+    int i;
+
+    memset(&params, '\0', sizeof (params));
+    ring->fd = sys_io_uring_setup(AIO_SLOTS * 2, &params);
+    if (ring->fd == -1)
+    {
+        free(ring);
+        return NULL;
+    } // if
+
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_map_len > ring->sq_map_len)
+            ring->sq_map_len = ring->cq_map_len;
+        ring->cq_map_len = ring->sq_map_len;
+    } // if
+
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+    {
+        ring->sq_map = NULL;
+        ring_destroy(ring);
+        return NULL;
+    } // if
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_map = ring->sq_map;
+    else
+    {
+        ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED)
+        {
+            ring->cq_map = NULL;
+            ring_destroy(ring);
+            return NULL;
+        } // if
+    } // else
+
+    ring->sqes_map_len = params.sq_entries * sizeof (struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_map_len,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE,
+                                              ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        ring_destroy(ring);
+        return NULL;
+    } // if
+
+    sq = (uint8_t *) ring->sq_map;
+    cq = (uint8_t *) ring->cq_map;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    if (posix_memalign(&buffers, 4096, AIO_SLOTS * AIO_CHUNK) != 0)
+    {
+        ring_destroy(ring);
+        return NULL;  // we can still copy synchronously.
+    } // if
+    ring->buffers = (uint8_t *) buffers;
+
+    for (i = 0; i < AIO_SLOTS; i++)
+    {
+        iov[i].iov_base = ring->buffers + (i * AIO_CHUNK);
+        iov[i].iov_len = AIO_CHUNK;
+        ring->slots[i].iov = iov[i];
+    } // for
+
+    // Registered buffers save the kernel from mapping them on every
+    //  request, but we can live without them (RLIMIT_MEMLOCK, etc).
+    ring->fixed = (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS,
+                                         iov, AIO_SLOTS) == 0);
+    return ring;
+} // ring_create
+
+
+static struct io_uring_sqe *ring_get_sqe(aio_ring *ring)
+{
+    const unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+        return NULL;  // full.
+
+    idx = ring->sq_local_tail & *ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+    sqe = &ring->sqes[idx];
+    memset(sqe, '\0', sizeof (*sqe));
+    return sqe;
+} // ring_get_sqe
+
+
+static void ring_prep_rw(aio_ring *ring, struct io_uring_sqe *sqe,
+                         const int slotidx, const int is_write)
+{
+    aio_slot *slot = &ring->slots[slotidx];
+
+    if (ring->fixed)
+    {
+        sqe->opcode = is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t) (uintptr_t) slot->iov.iov_base;
+        sqe->len = (uint32_t) slot->len;
+        sqe->buf_index = (uint16_t) slotidx;
+    } // if
+    else
+    {
+        slot->iov.iov_len = slot->len;
+        sqe->opcode = is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (uint64_t) (uintptr_t) &slot->iov;
+        sqe->len = 1;
+    } // else
+
+    sqe->fd = is_write ? slot->seg->outfd : slot->seg->infd;
+    sqe->off = is_write ? slot->outoff : slot->inoff;
+    sqe->flags = is_write ? 0 : IOSQE_IO_LINK;  // write waits on the read.
+    sqe->user_data = (((uint64_t) slotidx) << 1) | (is_write ? 1 : 0);
+} // ring_prep_rw
+
+
+// Finish a chunk the kernel gave back short, or that failed outright.
+//  Doing it again the slow way either works or gives us a useful error.
+static void slot_retire(aio_slot *slot)
+{
+    if (slot->failed)
+    {
+        const aio_segment *seg = slot->seg;
+        xcopyfile_at(seg->in, seg->infd, slot->inoff,
+                     seg->out, seg->outfd, slot->outoff, slot->len);
+    } // if
+    slot->seg = NULL;
+} // slot_retire
+
+
+// Returns how many times we entered the kernel, for --stats.
+static uint64_t ring_run(aio_ring *ring, const aio_segment *segs,
+                         const size_t num_segs)
+{
+    uint64_t syscalls = 0;
+    size_t segidx = 0;
+    uint64_t segpos = 0;  // bytes of segs[segidx] already handed out.
+    unsigned to_submit = 0;
+    int inflight = 0;
+    int i;
+
+    while (1)
+    {
+        unsigned head, tail;
+        int rc;
+
+        // Hand a chunk to every idle slot, while there's work left.
+        for (i = 0; (i < AIO_SLOTS) && (segidx < num_segs); i++)
+        {
+            aio_slot *slot = &ring->slots[i];
+            const aio_segment *seg = &segs[segidx];
+            struct io_uring_sqe *rsqe, *wsqe;
+            uint64_t remaining;
+
+            if (slot->pending)
+                continue;
+
+            remaining = seg->size - segpos;
+            slot->seg = seg;
+            slot->inoff = seg->inoff + segpos;
+            slot->outoff = seg->outoff + segpos;
+            slot->len = (size_t) ((remaining < AIO_CHUNK) ? remaining : AIO_CHUNK);
+            slot->failed = 0;
+
+            rsqe = ring_get_sqe(ring);
+            wsqe = rsqe ? ring_get_sqe(ring) : NULL;
+            assert(wsqe != NULL);  // two per slot always fit.
+            ring_prep_rw(ring, rsqe, i, 0);
+            ring_prep_rw(ring, wsqe, i, 1);
+            slot->pending = 2;
+            inflight++;
+            to_submit += 2;
+
+            segpos += slot->len;
+            if (segpos == seg->size)
+            {
+                segidx++;
+                segpos = 0;
+            } // if
+        } // for
+
+        if (inflight == 0)
+            break;  // all done.
+
+        __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+        rc = sys_io_uring_enter(ring->fd, to_submit, 1,
+                                IORING_ENTER_GETEVENTS);
+        syscalls++;
+        if ((rc == -1) && ((errno == EINTR) || (errno == EAGAIN)))
+            continue;
+        else if (rc == -1)
+            xfailc(FATELF_EIO, "io_uring_enter failed: %s", strerror(errno));
+        to_submit -= (unsigned) rc;
+
+        // Reap whatever has completed.
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            aio_slot *slot = &ring->slots[cqe->user_data >> 1];
+
+            // a short or failed read cancels its write (-ECANCELED).
+            if ((cqe->res < 0) || (((size_t) cqe->res) != slot->len))
+                slot->failed = 1;
+
+            if (--slot->pending == 0)
+            {
+                slot_retire(slot);
+                inflight--;
+            } // if
+            head++;
+        } // while
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    } // while
+
+    return syscalls;
+} // ring_run
+#endif
+
+
+// Release (aio) without running anything; this is its cleanup, too.
+static void aio_free(void *ptr)
+{
+    fatelf_aio *aio = (fatelf_aio *) ptr;
+    #if FATELF_HAVE_IO_URING
+    if (aio->ring != NULL)
+        ring_destroy(aio->ring);
+    #endif
+    free(aio->extents);
+    free(aio->segs);
+    free(aio);
+} // aio_free
+
+
+fatelf_aio *xaio_create(void)
+{
+    fatelf_aio *aio = (fatelf_aio *) xmalloc(sizeof (fatelf_aio));
+    fatelf_cleanup_push(aio_free, aio);
+    #if FATELF_HAVE_IO_URING
+    // --reflink shares extents in O(1); that beats any amount of queueing.
+    if (!(fatelf_copy_flags & (FATELF_COPY_NO_IO_URING | FATELF_COPY_REFLINK)))
+        aio->ring = ring_create();
+    #endif
+    return aio;
+} // xaio_create
+
+
+static void add_segment(fatelf_aio *aio, const char *in, const int infd,
+                        const uint64_t inoff, const char *out,
+                        const int outfd, const uint64_t outoff,
+                        const uint64_t size)
+{
+    aio_segment *seg;
+
+    if (size == 0)
+        return;
+
+    if (aio->num_segs == aio->alloc_segs)
+    {
+        const size_t newalloc = aio->alloc_segs ? (aio->alloc_segs * 2) : 32;
+        aio_segment *ptr = (aio_segment *) realloc(aio->segs,
+                                        newalloc * sizeof (aio_segment));
+        if (ptr == NULL)
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        aio->segs = ptr;
+        aio->alloc_segs = newalloc;
+    } // if
+
+    seg = &aio->segs[aio->num_segs++];
+    seg->in = in;
+    seg->infd = infd;
+    seg->inoff = inoff;
+    seg->out = out;
+    seg->outfd = outfd;
+    seg->outoff = outoff;
+    seg->size = size;
+} // add_segment
+
+
+static void add_extent(fatelf_aio *aio, const char *out, const int outfd,
+                       const uint64_t end)
+{
+    if (aio->num_extents == aio->alloc_extents)
+    {
+        const size_t newalloc = aio->alloc_extents ? (aio->alloc_extents * 2) : 8;
+        aio_extent *ptr = (aio_extent *) realloc(aio->extents,
+                                        newalloc * sizeof (aio_extent));
+        if (ptr == NULL)
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        aio->extents = ptr;
+        aio->alloc_extents = newalloc;
+    } // if
+
+    aio->extents[aio->num_extents].out = out;
+    aio->extents[aio->num_extents].outfd = outfd;
+    aio->extents[aio->num_extents].end = end;
+    aio->num_extents++;
+} // add_extent
+
+
+void xaio_copy(fatelf_aio *aio, const char *in, const int infd,
+               const uint64_t inoff, const char *out, const int outfd,
+               const uint64_t outoff, const uint64_t size)
+{
+    const uint64_t end = inoff + size;
+    uint64_t fsize, pos, start, stop, outsize;
+
+    // Huge copies go around the page cache with O_DIRECT, which the ring's
+    //  buffered reads and writes can't do, so those run right away.
+    #if FATELF_HAVE_IO_URING
+    if ((aio->ring == NULL) || (fatelf_want_direct(size)))
+    #endif
+    {
+        xcopyfile_at(in, infd, inoff, out, outfd, outoff, size);
+        return;
+    } // if
+
+    fatelf_io_begin(infd, inoff, outfd, outoff, size);
+
+    // Nothing has been written yet, so we can sort out the input's holes
+    //  now: the ones past the output's current end stay holes, and the
+    //  rest get real zeros.
+    fsize = sparse_input_size(infd);
+    if (fsize == 0)
+    {
+        add_segment(aio, in, infd, inoff, out, outfd, outoff, size);
+        return;
+    } // if
+
+    fsize = (end < fsize) ? end : fsize;  // past EOF fails in the copy.
+    outsize = xget_file_size(out, outfd);
+    pos = inoff;
+    while (pos < fsize)
+    {
+        if (!find_data_extent(infd, pos, fsize, &start, &stop))
+            start = stop = fsize;
+
+        if (start > pos)
+        {
+            const uint64_t holeoff = outoff + (pos - inoff);
+            if (holeoff < outsize)
+                xpwrite_zeros(out, outfd, holeoff, start - pos);
+            if (start == fsize)  // nothing after this hole will extend it.
+                add_extent(aio, out, outfd, outoff + (start - inoff));
+        } // if
+
+        add_segment(aio, in, infd, start, out, outfd,
+                    outoff + (start - inoff), stop - start);
+        pos = stop;
+    } // while
+
+    add_segment(aio, in, infd, pos, out, outfd, outoff + (pos - inoff),
+                end - pos);
+} // xaio_copy
+
+
+void xaio_finish(fatelf_aio *aio)
+{
+    size_t i;
+
+    #if FATELF_HAVE_IO_URING
+    if (aio->ring != NULL)
+    {
+        const uint64_t start = fatelf_stats_start();
+        const uint64_t syscalls = ring_run(aio->ring, aio->segs,
+                                           aio->num_segs);
+        uint64_t bytes = 0;
+
+        ring_destroy(aio->ring);
+        aio->ring = NULL;
+
+        for (i = 0; i < aio->num_segs; i++)
+        {
+            const aio_segment *seg = &aio->segs[i];
+            fatelf_io_end(seg->infd, seg->inoff, seg->outfd, seg->outoff,
+                          seg->size);
+            bytes += seg->size;
+        } // for
+
+        FATELF_STATS_OP(FATELF_OP_AIO, syscalls, bytes, start);
+    } // if
+    #endif
+
+    // All the writes have landed; make sure trailing holes are there, too.
+    for (i = 0; i < aio->num_extents; i++)
+    {
+        const aio_extent *ext = &aio->extents[i];
+        if (xget_file_size(ext->out, ext->outfd) < ext->end)
+        {
+            if (ftruncate(ext->outfd, (off_t) ext->end) == -1)
+                xfailc(FATELF_EIO, "Failed to extend '%s': %s",
+                       ext->out, strerror(errno));
+        } // if
+    } // for
+
+    fatelf_cleanup_pop(aio_free, aio, 1);
+} // xaio_finish
+
+// end of fatelf-aio.c ...
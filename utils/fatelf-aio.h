@@ -0,0 +1,29 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#ifndef FATELF_AIO_H
+#define FATELF_AIO_H
+
+// A batch of positional copies that run with many reads and writes in
+//  flight at once (via io_uring, where the kernel has it). Queue every copy
+//  a tool needs, across records and files, then run them all together.
+//  Without io_uring, each copy runs synchronously as it is queued.
+//
+// None of this uses or moves file positions. The names and descriptors
+//  handed to xaio_copy() must stay valid until xaio_finish() returns.
+typedef struct fatelf_aio fatelf_aio;
+
+fatelf_aio *xaio_create(void);
+
+// Queue a copy of (size) bytes from (inoff) in infd to (outoff) in outfd.
+void xaio_copy(fatelf_aio *aio, const char *in, const int infd,
+               const uint64_t inoff, const char *out, const int outfd,
+               const uint64_t outoff, const uint64_t size);
+
+// Run everything queued to completion, and free (aio). xfail()s on error.
+void xaio_finish(fatelf_aio *aio);
+
+#endif /* FATELF_AIO_H */
@@ -0,0 +1,952 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Build a corpus of synthetic ELF binaries, time every FatELF tool on it,
+//  and write the results as JSON, so runs from different commits can be
+//  compared. The tools are run through the multicall "fatelf" binary, one
+//  process per operation, just like a user (or a package build) runs them.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1  // nftw(), wait4().
+#endif
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+
+#define BENCH_FORMAT_VERSION 1
+#define BENCH_MAX_OPS 8
+#define BENCH_MAX_RECORDS 255  // as many as a FatELF header holds.
+#define BENCH_MAX_ARGS (BENCH_MAX_RECORDS + 16)
+#define BENCH_MAX_TOOL_OPTIONS 16
+#define BENCH_PATTERN_SIZE (64 * 1024)
+
+// The shape of one synthetic ELF binary.
+typedef struct bench_elf
+{
+    char name[32];
+    uint8_t word_size;
+    uint8_t byte_order;
+    uint16_t machine;
+    uint8_t osabi_version;
+    uint64_t size;  // bytes of section data.
+    uint32_t sections;  // including the null one at index zero.
+    uint64_t rsrc;  // bytes of Haiku resources after the ELF data, or zero.
+} bench_elf;
+
+// One of every word size and byte order, as a real target would have it.
+static const struct
+{
+    const char *name;
+    uint8_t word_size;
+    uint8_t byte_order;
+    uint16_t machine;
+} combos[] =
+{
+    { "i386", FATELF_32BITS, FATELF_LITTLEENDIAN, 3 },
+    { "ppc", FATELF_32BITS, FATELF_BIGENDIAN, 20 },
+    { "x86_64", FATELF_64BITS, FATELF_LITTLEENDIAN, 62 },
+    { "ppc64", FATELF_64BITS, FATELF_BIGENDIAN, 21 },
+};
+
+#define NUM_COMBOS ((int) (sizeof (combos) / sizeof (combos[0])))
+
+// The sets of binaries that each get glued and taken apart again.
+static const struct
+{
+    const char *name;
+    int records;  // all x86_64, by osabi version; zero for the combos.
+    uint64_t size;
+    uint32_t sections;
+    uint64_t rsrc;
+} sets[] =
+{
+    { "tiny", 0, 4 * 1024, 8, 0 },
+    { "small", 0, 256 * 1024, 64, 0 },
+    { "large", 0, 16 * 1024 * 1024, 256, 0 },
+    { "sections", 0, 1024 * 1024, 16384, 0 },
+    { "haiku", 0, 1024 * 1024, 64, 256 * 1024 },
+    { "many", BENCH_MAX_RECORDS, 64 * 1024, 16, 0 },
+};
+
+#define NUM_SETS ((int) (sizeof (sets) / sizeof (sets[0])))
+
+// Every timed run of one operation.
+typedef struct bench_op
+{
+    const char *name;
+    int runs;
+    uint64_t *wall_ns;
+    uint64_t user_ns;
+    uint64_t sys_ns;
+    long max_rss_kb;
+} bench_op;
+
+typedef struct bench_state
+{
+    const char *fatelf;  // the multicall binary we're timing.
+    const char **tool_options;
+    int num_tool_options;
+    const char *workdir;
+    double scale;
+    int iterations;
+    int quiet;
+    int keep;  // don't delete the corpus.
+    FILE *out;
+    int first_result;
+    uint8_t pattern[BENCH_PATTERN_SIZE];
+} bench_state;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+} // now_ns
+
+
+static inline uint64_t timeval_ns(const struct timeval *tv)
+{
+    return (((uint64_t) tv->tv_sec) * 1000000000ULL) +
+           (((uint64_t) tv->tv_usec) * 1000ULL);
+} // timeval_ns
+
+
+static uint64_t scaled(const bench_state *state, const uint64_t val)
+{
+    const uint64_t retval = (uint64_t) (((double) val) * state->scale);
+    return retval ? retval : 1;
+} // scaled
+
+
+static char *xpath(const char *dir, const char *name)
+{
+    const size_t len = strlen(dir) + strlen(name) + 2;
+    char *retval = (char *) xmalloc(len);
+    snprintf(retval, len, "%s/%s", dir, name);
+    return retval;
+} // xpath
+
+
+static void xmkdir(const char *path)
+{
+    if ((mkdir(path, 0755) == -1) && (errno != EEXIST))
+        xfail("Failed to create directory '%s': %s", path, strerror(errno));
+} // xmkdir
+
+
+static int remove_entry(const char *path, const struct stat *st,
+                        int flag, struct FTW *ftw)
+{
+    return remove(path);
+} // remove_entry
+
+
+// rm -rf (path).
+static void xremove_tree(const char *path)
+{
+    if ((nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS) == -1) &&
+        (errno != ENOENT))
+        xfail("Failed to remove '%s': %s", path, strerror(errno));
+} // xremove_tree
+
+
+// Data that compresses about as well as real code does: half noise, half
+//  runs of zeros.
+static void make_pattern(bench_state *state)
+{
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    size_t i;
+
+    for (i = 0; i < sizeof (state->pattern); i++)
+    {
+        if ((i / 256) & 1)
+            state->pattern[i] = 0;
+        else
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            state->pattern[i] = (uint8_t) x;
+        } // else
+    } // for
+} // make_pattern
+
+
+static uint8_t *put16(uint8_t *ptr, const uint16_t val, const int be)
+{
+    ptr[be ? 0 : 1] = (uint8_t) (val >> 8);
+    ptr[be ? 1 : 0] = (uint8_t) val;
+    return ptr + 2;
+} // put16
+
+
+static uint8_t *put32(uint8_t *ptr, const uint32_t val, const int be)
+{
+    put16(ptr + (be ? 0 : 2), (uint16_t) (val >> 16), be);
+    put16(ptr + (be ? 2 : 0), (uint16_t) val, be);
+    return ptr + 4;
+} // put32
+
+
+static uint8_t *put64(uint8_t *ptr, const uint64_t val, const int be)
+{
+    put32(ptr + (be ? 0 : 4), (uint32_t) (val >> 32), be);
+    put32(ptr + (be ? 4 : 0), (uint32_t) val, be);
+    return ptr + 8;
+} // put64
+
+
+// Addresses and offsets are 32 or 64 bits wide, depending on the class.
+static uint8_t *putaddr(uint8_t *ptr, const uint64_t val, const int be,
+                        const int is64)
+{
+    return is64 ? put64(ptr, val, be) : put32(ptr, (uint32_t) val, be);
+} // putaddr
+
+
+static inline uint64_t align_up(const uint64_t val, const uint64_t align)
+{
+    return ((val + align - 1) / align) * align;
+} // align_up
+
+
+static void xwrite_pattern(const bench_state *state, const char *fname,
+                           const int fd, uint64_t len)
+{
+    while (len > 0)
+    {
+        const size_t chunk = (len < sizeof (state->pattern)) ?
+                                (size_t) len : sizeof (state->pattern);
+        xwrite(fname, fd, state->pattern, chunk);
+        len -= chunk;
+    } // while
+} // xwrite_pattern
+
+
+// Haiku resources, laid out the way Haiku writes them (see its
+//  ResourcesDef.h): a header, an index section with an entry for each
+//  resource, their data, then the info table that says what they are. The
+//  tools size them from the index, so it has to hold together. They're
+//  shared by every record of a FatELF file, so they're always little
+//  endian, as Haiku's own targets are.
+#define BENCH_RSRC_COUNT 16
+#define BENCH_RSRC_HEADER_SIZE 68
+#define BENCH_RSRC_INDEX_SIZE (132 + (12 * BENCH_RSRC_COUNT))
+#define BENCH_RSRC_INFO_SIZE (4 + (10 * BENCH_RSRC_COUNT) + 8 + 8)
+#define BENCH_RSRC_MIN_SIZE (BENCH_RSRC_HEADER_SIZE + BENCH_RSRC_INDEX_SIZE + \
+                             BENCH_RSRC_COUNT + BENCH_RSRC_INFO_SIZE)
+
+static void xwrite_rsrc(const bench_state *state, const char *fname,
+                        const int fd, const uint64_t size)
+{
+    const uint32_t index = BENCH_RSRC_HEADER_SIZE;
+    const uint32_t dataoff = index + BENCH_RSRC_INDEX_SIZE;
+    const uint32_t infooff = (uint32_t) (size - BENCH_RSRC_INFO_SIZE);
+    const uint32_t each = (infooff - dataoff) / BENCH_RSRC_COUNT;
+    uint8_t head[BENCH_RSRC_HEADER_SIZE + BENCH_RSRC_INDEX_SIZE];
+    uint8_t info[BENCH_RSRC_INFO_SIZE];
+    uint8_t *ptr;
+    uint32_t i;
+
+    assert(size >= BENCH_RSRC_MIN_SIZE);
+    memset(head, '\0', sizeof (head));
+    ptr = put32(head, 0x444F1000, 0);  // magic
+    ptr = put32(ptr, BENCH_RSRC_COUNT, 0);
+    ptr = put32(ptr, index, 0);
+    put32(ptr, dataoff, 0);  // end of the admin section.
+
+    ptr = put32(head + index, index, 0);  // the index repeats its offset.
+    ptr = put32(ptr, BENCH_RSRC_INDEX_SIZE, 0);
+    ptr = put32(ptr, 0, 0);
+    ptr = put32(ptr, dataoff, 0);  // the "unknown" section, empty.
+    put32(ptr, 0, 0);
+    ptr = put32(head + index + 120, infooff, 0);
+    put32(ptr, BENCH_RSRC_INFO_SIZE, 0);
+
+    ptr = head + index + 132;
+    for (i = 0; i < BENCH_RSRC_COUNT; i++)
+    {
+        const uint32_t offset = dataoff + (i * each);
+        ptr = put32(ptr, offset, 0);
+        ptr = put32(ptr, (i == BENCH_RSRC_COUNT - 1) ?
+                            (infooff - offset) : each, 0);
+        ptr = put32(ptr, 0, 0);
+    } // for
+    assert(ptr == head + sizeof (head));
+
+    // One type, 'DATA', with a nameless info for each resource.
+    ptr = put32(info, 0x44415441, 0);
+    for (i = 0; i < BENCH_RSRC_COUNT; i++)
+    {
+        ptr = put32(ptr, i + 1, 0);  // id
+        ptr = put32(ptr, i + 1, 0);  // its index entry, from one.
+        ptr = put16(ptr, 0, 0);  // no name.
+    } // for
+    ptr = put32(ptr, 0xFFFFFFFF, 0);  // end of the type.
+    ptr = put32(ptr, 0xFFFFFFFF, 0);
+    ptr = put32(ptr, 0, 0);  // checksum
+    ptr = put32(ptr, 0xFFFFFFFE, 0);  // end of the table.
+    assert(ptr == info + sizeof (info));
+
+    xwrite(fname, fd, head, sizeof (head));
+    xwrite_pattern(state, fname, fd, infooff - dataoff);
+    xwrite(fname, fd, info, sizeof (info));
+} // xwrite_rsrc
+
+
+// Write a synthetic ELF binary: a header, one PT_LOAD program header that
+//  covers everything, (elf->sections) section headers that split up the
+//  data between them, and then Haiku resources, if it has any. It isn't
+//  runnable, but every tool sees exactly what it would in a real one.
+static void xwrite_elf(const bench_state *state, const char *fname,
+                       const bench_elf *elf)
+{
+    const int is64 = (elf->word_size == FATELF_64BITS);
+    const int be = (elf->byte_order == FATELF_BIGENDIAN);
+    const uint64_t ehsize = is64 ? 64 : 52;
+    const uint64_t phentsize = is64 ? 56 : 32;
+    const uint64_t shentsize = is64 ? 64 : 40;
+    const uint64_t dataoff = align_up(ehsize + phentsize, 16);
+    const uint64_t shoff = align_up(dataoff + elf->size, 8);
+    const uint32_t shnum = (elf->sections < 2) ? 2 : elf->sections;
+    const uint64_t end = shoff + (shentsize * shnum);
+    const uint64_t chunk = elf->size / (shnum - 1);
+    const size_t headlen = (size_t) dataoff;
+    const size_t shlen = (size_t) (shentsize * shnum);
+    uint8_t *head = (uint8_t *) xmalloc(headlen);
+    uint8_t *sh = (uint8_t *) xmalloc(shlen);
+    uint8_t *ptr;
+    uint32_t i;
+    int fd;
+
+    // The ELF header.
+    memcpy(head, "\177ELF", 4);
+    head[4] = elf->word_size;
+    head[5] = elf->byte_order;
+    head[6] = 1;  // EV_CURRENT
+    head[8] = elf->osabi_version;
+    ptr = put16(head + 16, 2, be);  // ET_EXEC
+    ptr = put16(ptr, elf->machine, be);
+    ptr = put32(ptr, 1, be);  // EV_CURRENT
+    ptr = putaddr(ptr, 0x400000 + dataoff, be, is64);  // e_entry
+    ptr = putaddr(ptr, ehsize, be, is64);  // e_phoff
+    ptr = putaddr(ptr, shoff, be, is64);  // e_shoff
+    ptr = put32(ptr, 0, be);  // e_flags
+    ptr = put16(ptr, (uint16_t) ehsize, be);
+    ptr = put16(ptr, (uint16_t) phentsize, be);
+    ptr = put16(ptr, 1, be);  // e_phnum
+    ptr = put16(ptr, (uint16_t) shentsize, be);
+    ptr = put16(ptr, (uint16_t) shnum, be);
+    ptr = put16(ptr, 0, be);  // e_shstrndx
+    assert(ptr == head + ehsize);
+
+    // The program header. The fields are in a different order for ELF64.
+    ptr = put32(ptr, 1, be);  // PT_LOAD
+    if (is64)
+        ptr = put32(ptr, 5, be);  // p_flags: PF_R | PF_X
+    ptr = putaddr(ptr, 0, be, is64);  // p_offset
+    ptr = putaddr(ptr, 0x400000, be, is64);  // p_vaddr
+    ptr = putaddr(ptr, 0x400000, be, is64);  // p_paddr
+    ptr = putaddr(ptr, end, be, is64);  // p_filesz
+    ptr = putaddr(ptr, end, be, is64);  // p_memsz
+    if (!is64)
+        ptr = put32(ptr, 5, be);  // p_flags: PF_R | PF_X
+    ptr = putaddr(ptr, 0x1000, be, is64);  // p_align
+    assert(ptr == head + ehsize + phentsize);
+
+    // Section headers; the first one stays all zeros.
+    for (i = 1; i < shnum; i++)
+    {
+        const uint64_t off = dataoff + ((i - 1) * chunk);
+        const uint64_t len = (i == shnum - 1) ? (elf->size - (off - dataoff))
+                                              : chunk;
+        ptr = sh + (i * shentsize);
+        ptr = put32(ptr, 0, be);  // sh_name
+        ptr = put32(ptr, 1, be);  // SHT_PROGBITS
+        ptr = putaddr(ptr, 2, be, is64);  // sh_flags: SHF_ALLOC
+        ptr = putaddr(ptr, 0x400000 + off, be, is64);  // sh_addr
+        ptr = putaddr(ptr, off, be, is64);  // sh_offset
+        ptr = putaddr(ptr, len, be, is64);  // sh_size
+    } // for
+
+    fd = xopen(fname, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    xwrite(fname, fd, head, headlen);
+    xwrite_pattern(state, fname, fd, elf->size);
+    xwrite_zeros(fname, fd, (size_t) (shoff - (dataoff + elf->size)));
+    xwrite(fname, fd, sh, shlen);
+
+    if (elf->rsrc > 0)
+    {
+        // Haiku puts resources on an 8 byte boundary for ELF64, and on the
+        //  biggest p_align for ELF32.
+        const uint64_t rsrcoff = align_up(end, is64 ? 8 : 0x1000);
+        xwrite_zeros(fname, fd, (size_t) (rsrcoff - end));
+        xwrite_rsrc(state, fname, fd, elf->rsrc);
+    } // if
+
+    xclose(fname, fd);
+    free(sh);
+    free(head);
+} // xwrite_elf
+
+
+// Run "fatelf [tool options] argv..." in (cwd), with stdout thrown away,
+//  and add its times to (op).
+static void xrun(bench_state *state, bench_op *op, const char *cwd,
+                 const char **argv)
+{
+    const char *args[BENCH_MAX_ARGS + BENCH_MAX_TOOL_OPTIONS + 2];
+    struct rusage ru;
+    uint64_t start;
+    int argc = 0;
+    int status = 0;
+    pid_t pid;
+    int i;
+
+    args[argc++] = state->fatelf;
+    for (i = 0; i < state->num_tool_options; i++)
+        args[argc++] = state->tool_options[i];
+    for (i = 0; argv[i] != NULL; i++)
+    {
+        assert(argc < (int) (sizeof (args) / sizeof (args[0])) - 1);
+        args[argc++] = argv[i];
+    } // for
+    args[argc] = NULL;
+
+    start = now_ns();
+    pid = fork();
+    if (pid == -1)
+        xfail("fork() failed: %s", strerror(errno));
+    else if (pid == 0)
+    {
+        const int nullfd = open("/dev/null", O_WRONLY);
+        if ((nullfd == -1) || (dup2(nullfd, 1) == -1))
+            _exit(126);
+        else if ((cwd != NULL) && (chdir(cwd) == -1))
+            _exit(126);
+        execv(state->fatelf, (char * const *) args);
+        _exit(127);
+    } // else if
+
+    while (wait4(pid, &status, 0, &ru) == -1)
+    {
+        if (errno != EINTR)
+            xfail("wait4() failed: %s", strerror(errno));
+    } // while
+
+    op->wall_ns[op->runs++] = now_ns() - start;
+    op->user_ns += timeval_ns(&ru.ru_utime);
+    op->sys_ns += timeval_ns(&ru.ru_stime);
+    if (ru.ru_maxrss > op->max_rss_kb)
+        op->max_rss_kb = ru.ru_maxrss;
+
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+        xfail("'%s %s' failed while benchmarking", state->fatelf, argv[0]);
+} // xrun
+
+
+static int cmp_u64(const void *_a, const void *_b)
+{
+    const uint64_t a = *((const uint64_t *) _a);
+    const uint64_t b = *((const uint64_t *) _b);
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+} // cmp_u64
+
+
+static void write_result(bench_state *state, const char *scenario,
+                         const uint64_t input_bytes, bench_op *op)
+{
+    FILE *out = state->out;
+    uint64_t total = 0;
+    uint64_t median;
+    int i;
+
+    qsort(op->wall_ns, op->runs, sizeof (uint64_t), cmp_u64);
+    for (i = 0; i < op->runs; i++)
+        total += op->wall_ns[i];
+    median = op->wall_ns[op->runs / 2];
+    if ((op->runs % 2) == 0)
+        median = (median + op->wall_ns[(op->runs / 2) - 1]) / 2;
+
+    fprintf(out, "%s\n    { \"scenario\": \"%s\", \"op\": \"%s\","
+                 " \"runs\": %d, \"input_bytes\": %llu,\n"
+                 "      \"wall_ns\": { \"min\": %llu, \"median\": %llu,"
+                 " \"mean\": %llu, \"max\": %llu },\n"
+                 "      \"user_ns\": %llu, \"sys_ns\": %llu,"
+                 " \"max_rss_kb\": %ld }",
+            state->first_result ? "" : ",", scenario, op->name, op->runs,
+            (unsigned long long) input_bytes,
+            (unsigned long long) op->wall_ns[0],
+            (unsigned long long) median,
+            (unsigned long long) (total / op->runs),
+            (unsigned long long) op->wall_ns[op->runs - 1],
+            (unsigned long long) (op->user_ns / op->runs),
+            (unsigned long long) (op->sys_ns / op->runs),
+            op->max_rss_kb);
+    state->first_result = 0;
+
+    if (!state->quiet)
+    {
+        fprintf(stderr, "  %-10s %-14s median %10.3f ms\n", scenario,
+                op->name, ((double) median) / 1000000.0);
+    } // if
+} // write_result
+
+
+static void init_ops(bench_state *state, bench_op *ops, const char **names,
+                     const int count)
+{
+    int i;
+    memset(ops, '\0', sizeof (bench_op) * count);
+    for (i = 0; i < count; i++)
+    {
+        ops[i].name = names[i];
+        ops[i].wall_ns = (uint64_t *) xmalloc(sizeof (uint64_t) *
+                                              state->iterations);
+    } // for
+} // init_ops
+
+
+// Write every op's results, plus one for all of them in a row, which is
+//  the sum of each iteration's times.
+static void finish_ops(bench_state *state, const char *scenario,
+                       const uint64_t input_bytes, bench_op *ops,
+                       const int count)
+{
+    bench_op all;
+    int i, j;
+
+    memset(&all, '\0', sizeof (all));
+    all.name = "end-to-end";
+    all.runs = state->iterations;
+    all.wall_ns = (uint64_t *) xmalloc(sizeof (uint64_t) * all.runs);
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < all.runs; j++)
+            all.wall_ns[j] += ops[i].wall_ns[j];
+        all.user_ns += ops[i].user_ns;
+        all.sys_ns += ops[i].sys_ns;
+        if (ops[i].max_rss_kb > all.max_rss_kb)
+            all.max_rss_kb = ops[i].max_rss_kb;
+    } // for
+
+    for (i = 0; i < count; i++)
+    {
+        write_result(state, scenario, input_bytes, &ops[i]);
+        free(ops[i].wall_ns);
+    } // for
+    write_result(state, scenario, input_bytes, &all);
+    free(all.wall_ns);
+} // finish_ops
+
+
+// Glue one set of binaries, then run every tool on the result.
+static void bench_set(bench_state *state, const int set)
+{
+    static const char *names[] =
+    {
+        "glue", "info", "validate", "extract", "split", "replace", "remove"
+    };
+    const int numops = (int) (sizeof (names) / sizeof (names[0]));
+    const int records = sets[set].records ? sets[set].records : NUM_COMBOS;
+    char *dir = xpath(state->workdir, sets[set].name);
+    char *splitdir = xpath(dir, "split");
+    char *fat = xpath(dir, "fat");
+    char *splitfat = xpath(splitdir, "fat");
+    char **bins = (char **) xmalloc(sizeof (char *) * records);
+    const char *argv[BENCH_MAX_ARGS];
+    bench_op ops[BENCH_MAX_OPS];
+    char lastrec[32];
+    uint64_t input_bytes = 0;
+    int it, i;
+
+    assert(numops <= BENCH_MAX_OPS);
+    xmkdir(dir);
+    for (i = 0; i < records; i++)
+    {
+        const int combo = sets[set].records ? 2 : i;
+        bench_elf elf;
+        struct stat st;
+
+        memset(&elf, '\0', sizeof (elf));
+        snprintf(elf.name, sizeof (elf.name), "%s-%d", combos[combo].name, i);
+        elf.word_size = combos[combo].word_size;
+        elf.byte_order = combos[combo].byte_order;
+        elf.machine = combos[combo].machine;
+        elf.osabi_version = sets[set].records ? (uint8_t) i : 0;
+        elf.size = scaled(state, sets[set].size);
+        elf.sections = sets[set].sections;
+        elf.rsrc = sets[set].rsrc ? scaled(state, sets[set].rsrc) : 0;
+        if (elf.rsrc && (elf.rsrc < BENCH_RSRC_MIN_SIZE))
+            elf.rsrc = BENCH_RSRC_MIN_SIZE;
+        bins[i] = xpath(dir, elf.name);
+        xwrite_elf(state, bins[i], &elf);
+        if (stat(bins[i], &st) == 0)
+            input_bytes += (uint64_t) st.st_size;
+    } // for
+
+    snprintf(lastrec, sizeof (lastrec), "record%d", records - 1);
+    init_ops(state, ops, names, numops);
+    for (it = 0; it < state->iterations; it++)
+    {
+        // "many" is past the loader's window on purpose; don't time warnings.
+        argv[0] = "glue"; argv[1] = "--window=ignore"; argv[2] = "fat";
+        for (i = 0; i < records; i++)
+            argv[3 + i] = bins[i];
+        argv[3 + records] = NULL;
+        xrun(state, &ops[0], dir, argv);
+
+        argv[0] = "info"; argv[1] = "fat"; argv[2] = NULL;
+        xrun(state, &ops[1], dir, argv);
+
+        argv[0] = "validate"; argv[1] = "--window=ignore"; argv[2] = "fat";
+        argv[3] = NULL;
+        xrun(state, &ops[2], dir, argv);
+
+        argv[0] = "extract"; argv[1] = "extracted"; argv[2] = "fat";
+        argv[3] = lastrec; argv[4] = NULL;
+        xrun(state, &ops[3], dir, argv);
+
+        // split writes next to its input, so give it a directory to itself.
+        xremove_tree(splitdir);
+        xmkdir(splitdir);
+        if (link(fat, splitfat) == -1)
+            xfail("Failed to link '%s': %s", splitfat, strerror(errno));
+        argv[0] = "split"; argv[1] = "fat"; argv[2] = NULL;
+        xrun(state, &ops[4], splitdir, argv);
+
+        argv[0] = "replace"; argv[1] = "replaced"; argv[2] = "fat";
+        argv[3] = bins[0]; argv[4] = NULL;
+        xrun(state, &ops[5], dir, argv);
+
+        argv[0] = "remove"; argv[1] = "removed"; argv[2] = "fat";
+        argv[3] = "record0"; argv[4] = NULL;
+        xrun(state, &ops[6], dir, argv);
+    } // for
+
+    finish_ops(state, sets[set].name, input_bytes, ops, numops);
+
+    if (!state->keep)
+        xremove_tree(dir);
+    for (i = 0; i < records; i++)
+        free(bins[i]);
+    free(bins);
+    free(splitfat);
+    free(fat);
+    free(splitdir);
+    free(dir);
+} // bench_set
+
+
+// Write a root filesystem of (count) files for one target: mostly ELF
+//  binaries of various sizes, with some scripts and symlinks mixed in, like
+//  a real one. (extra) adds files the other tree doesn't have.
+static uint64_t xwrite_rootfs(bench_state *state, const char *root,
+                              const int combo, const int count,
+                              const int extra)
+{
+    static const char *dirs[] =
+    {
+        "bin", "sbin", "lib", "usr", "usr/bin", "usr/lib", "usr/lib/sub0",
+        "usr/lib/sub1", "usr/lib/sub2", "usr/libexec"
+    };
+    const int numdirs = (int) (sizeof (dirs) / sizeof (dirs[0]));
+    uint64_t total = 0;
+    char name[64];
+    int i;
+
+    xmkdir(root);
+    for (i = 0; i < numdirs; i++)
+    {
+        char *path = xpath(root, dirs[i]);
+        xmkdir(path);
+        free(path);
+    } // for
+
+    for (i = 0; i < count + extra; i++)
+    {
+        const char *dir = dirs[(i * 7) % numdirs];
+        const int kind = (i < count) ? (i % 16) : 1;  // extras are ELF.
+        char *path;
+
+        snprintf(name, sizeof (name), "%s/%s%d", dir,
+                 (i < count) ? "file" : "only", i);
+        path = xpath(root, name);
+
+        if (kind == 15)  // a symlink to the file before it.
+        {
+            char target[64];
+            snprintf(target, sizeof (target), "file%d", i - 1);
+            if (symlink(target, path) == -1)
+                xfail("Failed to create '%s': %s", path, strerror(errno));
+        } // if
+        else if (kind == 8)  // a script.
+        {
+            const int fd = xopen(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+            static const char script[] = "#!/bin/sh\nexec true \"$@\"\n";
+            xwrite(path, fd, script, sizeof (script) - 1);
+            xclose(path, fd);
+            total += sizeof (script) - 1;
+        } // else if
+        else
+        {
+            bench_elf elf;
+            memset(&elf, '\0', sizeof (elf));
+            elf.word_size = combos[combo].word_size;
+            elf.byte_order = combos[combo].byte_order;
+            elf.machine = combos[combo].machine;
+            // 16K to 1M, mostly on the small side.
+            elf.size = scaled(state, (16 * 1024) << ((i * 5) % 7));
+            elf.sections = 32;
+            xwrite_elf(state, path, &elf);
+            total += elf.size;
+        } // else
+
+        free(path);
+    } // for
+
+    return total;
+} // xwrite_rootfs
+
+
+// Merge the root filesystem of one target into another's, then merge it
+//  again, which replaces records in the FatELF files the first merge made.
+static void bench_rootfs(bench_state *state)
+{
+    static const char *names[] = { "merge", "merge-again" };
+    const int numops = (int) (sizeof (names) / sizeof (names[0]));
+    const int count = (int) scaled(state, 500);
+    char *dir = xpath(state->workdir, "rootfs");
+    char *src = xpath(dir, "src");
+    char *dest = xpath(dir, "dest");
+    const char *argv[] = { "merge", dest, src, NULL };
+    bench_op ops[BENCH_MAX_OPS];
+    uint64_t input_bytes;
+    int it;
+
+    xmkdir(dir);
+    input_bytes = xwrite_rootfs(state, src, 3, count, count / 10);
+    init_ops(state, ops, names, numops);
+    for (it = 0; it < state->iterations; it++)
+    {
+        xremove_tree(dest);
+        xwrite_rootfs(state, dest, 2, count, 0);
+        xrun(state, &ops[0], NULL, argv);
+        xrun(state, &ops[1], NULL, argv);
+    } // for
+
+    finish_ops(state, "rootfs", input_bytes, ops, numops);
+
+    if (!state->keep)
+        xremove_tree(dir);
+    free(dest);
+    free(src);
+    free(dir);
+} // bench_rootfs
+
+
+static void write_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++)
+    {
+        const unsigned char ch = (unsigned char) *str;
+        if ((ch == '"') || (ch == '\\'))
+            fprintf(out, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(out, "\\u%04x", ch);
+        else
+            fputc(ch, out);
+    } // for
+    fputc('"', out);
+} // write_json_string
+
+
+static void write_preamble(bench_state *state)
+{
+    FILE *out = state->out;
+    struct utsname un;
+    int i;
+
+    if (uname(&un) == -1)
+        memset(&un, '\0', sizeof (un));
+
+    fprintf(out, "{\n  \"format\": \"fatelf-bench\", \"format_version\": %d,\n"
+                 "  \"version\": ", BENCH_FORMAT_VERSION);
+    write_json_string(out, fatelf_build_version);
+    fprintf(out, ",\n  \"host\": { \"system\": ");
+    write_json_string(out, un.sysname);
+    fprintf(out, ", \"release\": ");
+    write_json_string(out, un.release);
+    fprintf(out, ", \"machine\": ");
+    write_json_string(out, un.machine);
+    fprintf(out, ", \"cpus\": %ld },\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "  \"iterations\": %d, \"scale\": %g,\n  \"tool_options\": [",
+            state->iterations, state->scale);
+    for (i = 0; i < state->num_tool_options; i++)
+    {
+        fprintf(out, "%s", i ? ", " : "");
+        write_json_string(out, state->tool_options[i]);
+    } // for
+    fprintf(out, "],\n  \"results\": [");
+} // write_preamble
+
+
+// Where the multicall binary is, if we weren't told: next to this one.
+static char *default_fatelf_path(const char *argv0)
+{
+    const char *slash = strrchr(argv0, '/');
+    const size_t dirlen = slash ? (size_t) (slash - argv0) : 1;
+    char *dir = (char *) xmalloc(dirlen + 1);
+    char *retval;
+    memcpy(dir, slash ? argv0 : ".", dirlen);
+    retval = xpath(dir, "fatelf");
+    free(dir);
+    return retval;
+} // default_fatelf_path
+
+
+static void xusage(const char *argv0)
+{
+    xfail("USAGE: %s [--fatelf=PATH] [--iterations=N] [--scale=N]"
+          " [--only=NAME]\n"
+          "       [--tool-option=OPT] [--workdir=DIR] [--output=FILE]"
+          " [--keep] [--quiet]", argv0);
+} // xusage
+
+
+int main(int argc, const char **argv)
+{
+    bench_state state;
+    const char *output = NULL;
+    const char *only = NULL;
+    char *fatelf = NULL;
+    char *path = NULL;
+    char *workdir = NULL;
+    const char *parent = NULL;
+    int argi;
+    int i;
+
+    memset(&state, '\0', sizeof (state));
+    state.iterations = 5;
+    state.scale = 1.0;
+    state.first_result = 1;
+    state.tool_options = (const char **)
+        xmalloc(sizeof (char *) * BENCH_MAX_TOOL_OPTIONS);
+
+    for (argi = 1; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if (strncmp(arg, "--fatelf=", 9) == 0)
+            state.fatelf = arg + 9;
+        else if (strncmp(arg, "--iterations=", 13) == 0)
+        {
+            char *end = NULL;
+            const long val = strtol(arg + 13, &end, 10);
+            if ((end == arg + 13) || (*end != '\0') || (val < 1) ||
+                (val > 10000))
+                xfail("Invalid --iterations: '%s'", arg + 13);
+            state.iterations = (int) val;
+        } // else if
+        else if (strncmp(arg, "--scale=", 8) == 0)
+        {
+            char *end = NULL;
+            state.scale = strtod(arg + 8, &end);
+            if ((end == arg + 8) || (*end != '\0') || !(state.scale > 0.0) ||
+                (state.scale > 100.0))
+                xfail("Invalid --scale: '%s'", arg + 8);
+        } // else if
+        else if (strncmp(arg, "--only=", 7) == 0)
+            only = arg + 7;
+        else if (strncmp(arg, "--tool-option=", 14) == 0)
+        {
+            if (state.num_tool_options >= BENCH_MAX_TOOL_OPTIONS)
+                xfail("Too many --tool-option arguments");
+            state.tool_options[state.num_tool_options++] = arg + 14;
+        } // else if
+        else if (strncmp(arg, "--workdir=", 10) == 0)
+            parent = arg + 10;
+        else if (strncmp(arg, "--output=", 9) == 0)
+            output = arg + 9;
+        else if (strcmp(arg, "--keep") == 0)
+            state.keep = 1;
+        else if (strcmp(arg, "--quiet") == 0)
+            state.quiet = 1;
+        else
+            xusage(argv[0]);
+    } // for
+
+    if ((only != NULL) && (strcmp(only, "rootfs") != 0))
+    {
+        for (i = 0; i < NUM_SETS; i++)
+        {
+            if (strcmp(only, sets[i].name) == 0)
+                break;
+        } // for
+        if (i == NUM_SETS)
+            xfail("No benchmark named '%s'", only);
+    } // if
+
+    // Some of the tools run in other directories, so this can't be relative.
+    path = state.fatelf ? NULL : default_fatelf_path(argv[0]);
+    if (state.fatelf == NULL)
+        state.fatelf = path;
+    if ((fatelf = realpath(state.fatelf, NULL)) == NULL)
+        xfail("Can't find '%s': %s", state.fatelf, strerror(errno));
+    else if (access(fatelf, X_OK) == -1)
+        xfail("Can't run '%s': %s", fatelf, strerror(errno));
+    state.fatelf = fatelf;
+    free(path);
+
+    if (parent == NULL)
+        parent = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    workdir = xpath(parent, "fatelf-bench.XXXXXX");
+    if (mkdtemp(workdir) == NULL)
+        xfail("Failed to create '%s': %s", workdir, strerror(errno));
+    state.workdir = workdir;
+    make_pattern(&state);
+
+    state.out = stdout;
+    if ((output != NULL) && ((state.out = fopen(output, "w")) == NULL))
+        xfail("Failed to open '%s': %s", output, strerror(errno));
+
+    if (!state.quiet)
+        fprintf(stderr, "Benchmarking '%s' in '%s'...\n", state.fatelf,
+                state.workdir);
+
+    write_preamble(&state);
+    for (i = 0; i < NUM_SETS; i++)
+    {
+        if ((only == NULL) || (strcmp(only, sets[i].name) == 0))
+            bench_set(&state, i);
+    } // for
+
+    if ((only == NULL) || (strcmp(only, "rootfs") == 0))
+        bench_rootfs(&state);
+
+    fprintf(state.out, "\n  ]\n}\n");
+    if ((state.out != stdout) && (fclose(state.out) == EOF))
+        xfail("Failed to write '%s': %s", output, strerror(errno));
+
+    if (!state.keep)
+        xremove_tree(workdir);
+
+    free(workdir);
+    free(fatelf);
+    free(state.tool_options);
+    return 0;
+} // main
+
+// end of fatelf-bench.c ...
@@ -9,36 +9,63 @@
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 
-static int fatelf_extract(const char *out, const char *fname, 
-                          const char *target)
+#include <unistd.h>
+
+// "-" for either file means stdout or stdin, read or written in one pass.
+static void xextract_stream(const char *out, const char *in,
+                            const char *target)
 {
-    const int fd = xopen(fname, O_RDONLY, 0755);
-    FATELF_header *header = xread_fatelf_header(fname, fd);
-    const int recidx = xfind_fatelf_record(header, target);
-    const int outfd = xopen(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
-    const FATELF_record *rec = &header->records[recidx];
+    const int outstd = (strcmp(out, "-") == 0);
+    const int instd = (strcmp(in, "-") == 0);
+    const char *outname = outstd ? "stdout" : out;
+    const char *inname = instd ? "stdin" : in;
+    const int infd = instd ? STDIN_FILENO : xopen_held(in, O_RDONLY, 0755);
+    fatelf_ctx *ctx = xfatelf_ctx_create();
+    int outfd = STDOUT_FILENO;
+    int rc;
+
+    if (!outstd)
+    {
+        outfd = xopen_held(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
+        unlink_on_xfail_add(out);
+    } // if
 
-    unlink_on_xfail = out;
+    rc = fatelf_extract_stream(ctx, outname, outfd, inname, infd, target);
+    xfatelf_ctx_finish(ctx, rc);
 
-    xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
-    xappend_junk(fname, fd, out, outfd);
-    xclose(out, outfd);
-    xclose(fname, fd);
-    free(header);
+    if (!outstd)
+    {
+        xclose_held(out, outfd);
+        unlink_on_xfail_remove(out);
+    } // if
+    if (!instd)
+        xclose_held(in, infd);
+} // xextract_stream
 
-    unlink_on_xfail = NULL;
 
+int fatelf_extract_main(int argc, const char **argv)
+{
+    fatelf_ctx *ctx;
+    if (argc != 4)  // this could stand to use getopt(), later.
+        xfail("USAGE: %s <out> <in> <target>", argv[0]);
+    else if ((strcmp(argv[1], "-") == 0) || (strcmp(argv[2], "-") == 0))
+    {
+        xextract_stream(argv[1], argv[2], argv[3]);
+        return 0;  // success.
+    } // else if
+    ctx = xfatelf_ctx_create();
+    xfatelf_ctx_finish(ctx, fatelf_extract(ctx, argv[1], argv[2], argv[3]));
     return 0;  // success.
-} // fatelf_extract
+} // fatelf_extract_main
 
 
+#if !FATELF_MULTICALL
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
-    if (argc != 4)  // this could stand to use getopt(), later.
-        xfail("USAGE: %s <out> <in> <target>", argv[0]);
-    return fatelf_extract(argv[1], argv[2], argv[3]);
+    argc = xfatelf_init(argc, argv);
+    return fatelf_extract_main(argc, argv);
 } // main
+#endif
 
 // end of fatelf-extract.c ...
 
@@ -8,110 +8,117 @@
 
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
-#include "fatelf-haiku.h"
 
-static int fatelf_glue(const char *out, const char **bins, const int bincount)
+#include <unistd.h>
+
+// Glue (bins) into (out), then warn about, or fail on, the records the
+//  kernel won't see, calling the file (name).
+static int glue_checked(fatelf_ctx *ctx, const char *out, const char *name,
+                        const char **bins, const int bincount,
+                        const fatelf_window_policy policy)
 {
-    int i = 0;
-    const size_t struct_size = fatelf_header_size(bincount);
-    FATELF_header *header = (FATELF_header *) xmalloc(struct_size);
-    const int outfd = xopen(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
-    uint64_t offset = FATELF_DISK_FORMAT_SIZE(bincount);
-
-    unlink_on_xfail = out;
-
-    if (bincount == 0)
-        xfail("Nothing to do.");
-    else if (bincount > 0xFF)
-        xfail("Too many binaries (max is 255).");
-
-    // pad out some bytes for the header we'll write at the end...
-    xwrite_zeros(out, outfd, (size_t) offset);
-
-    header->magic = FATELF_MAGIC;
-    header->version = FATELF_FORMAT_VERSION;
-    header->num_records = bincount;
-
-    struct {
-        int idx;
-        uint64_t offset;
-        uint64_t size;
-    } resource;
-
-    resource.idx = -1;
-    for (i = 0; i < bincount; i++)
+    FATELF_header *header = NULL;
+    const int rc = fatelf_glue_header(ctx, out, bins, bincount, &header);
+    if (rc == FATELF_OK)
     {
-        int j = 0;
-        const uint64_t binary_offset = align_to_page(offset);
-        const char *fname = bins[i];
-        const int fd = xopen(fname, O_RDONLY, 0755);
-        FATELF_record *record = &header->records[i];
-
-        xread_elf_header(fname, fd, 0, record);
-        record->offset = binary_offset;
-
-        // make sure we don't have a duplicate target.
-        for (j = 0; j < i; j++)
-        {
-            if (fatelf_record_matches(record, &header->records[j]))
-                xfail("'%s' and '%s' are for the same target.", bins[j], fname);
-        } // for
-
-        // append this binary to the final file, padded to page alignment.
-        xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
-
-        // detect and skip Haiku resource data
-        if (haiku_find_rsrc(fname, fd, &resource.offset, &resource.size))
-        {
-            if (resource.idx == -1)
-                resource.idx = i;
-
-            record->size = xget_file_size(fname, fd) - resource.size;
-            xcopyfile_range(fname, fd, out, outfd, 0, record->size);
-        } else {
-            record->size = xcopyfile(fname, fd, out, outfd);
-        }
-
-        offset = binary_offset + record->size;
-
-        // done with this binary!
-        xclose(fname, fd);
-    } // for
+        fatelf_cleanup_push(free, header);
+        xfatelf_warn_loader_window(name, header, policy);
+        fatelf_cleanup_pop(free, header, 1);
+    } // if
+    return rc;
+} // glue_checked
 
-    // Write the actual FatELF header now...
-    xwrite_fatelf_header(out, outfd, header);
 
-    // rather then perform any complex merging of resources, we select the
-    // resources from the first file.
-    if (resource.idx >= 0) {
-        const char *fname = bins[resource.idx];
-        const int fd = xopen(fname, O_RDONLY, 0755);
+int fatelf_glue_main(int argc, const char **argv)
+{
+    fatelf_ctx *ctx;
+    fatelf_window_policy window = FATELF_WINDOW_WARN;
+    const char *order = NULL;
+    int compress = 0;
+    const char *out;
+    char *tmp = NULL;
+    int fd;
+    int rc;
+
+    while ((argc > 1) && (strncmp(argv[1], "--", 2) == 0))
+    {
+        if (strcmp(argv[1], "--compress") == 0)
+            compress = 1;
+        else if (strncmp(argv[1], "--order=", 8) == 0)
+            order = argv[1] + 8;
+        else if (strncmp(argv[1], "--window=", 9) == 0)
+            window = xfatelf_parse_window_policy(argv[1] + 9);
+        else
+            break;
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    } // while
 
-        if (haiku_rsrc_offset(out, outfd, &offset)) {
-            xlseek(out, outfd, offset, SEEK_SET);
-            xcopyfile_range(fname, fd, out, outfd, resource.offset,
-                resource.size);
-        }
+    if (argc < 4)  // this could stand to use getopt(), later.
+    {
+        xfail("USAGE: %s [--compress] [--order=TARGETS] [--window=POLICY]"
+              " <out> <bin1> <bin2> [... binN]", argv[0]);
+    } // if
 
-        xclose(fname, fd);
-    }
+    out = argv[1];
 
-    xclose(out, outfd);
-    free(header);
+    // Which binaries end up past the window depends on the order, but that
+    //  there are some doesn't, so don't write anything we'd refuse.
+    if ((window == FATELF_WINDOW_FAIL) && ((argc - 2) > FATELF_LOADER_WINDOW))
+    {
+        xfailc(FATELF_EINVAL, "Can't glue %d binaries: the kernel's loader"
+               " only sees the first %d records", argc - 2,
+               FATELF_LOADER_WINDOW);
+    } // if
 
-    unlink_on_xfail = NULL;
+    ctx = xfatelf_ctx_create();
+    if ((rc = fatelf_ctx_set_order(ctx, order)) != FATELF_OK)
+        xfatelf_ctx_finish(ctx, rc);  // bad --order; this fails.
 
+    if (strcmp(out, "-") == 0)  // stream it to stdout.
+    {
+        if (compress)
+            xfail("--compress can't write to stdout.");
+        xfatelf_ctx_finish(ctx, fatelf_glue_stream(ctx, "stdout",
+                                STDOUT_FILENO, &argv[2], argc - 2));
+        if ((window == FATELF_WINDOW_WARN) &&
+            ((argc - 2) > FATELF_LOADER_WINDOW))
+        {
+            fprintf(stderr, "Warning: glued %d binaries, but the kernel's"
+                    " loader only sees the first %d records\n", argc - 2,
+                    FATELF_LOADER_WINDOW);
+        } // if
+        return 0;  // success.
+    } // if
+    else if (!compress)
+    {
+        xfatelf_ctx_finish(ctx, glue_checked(ctx, out, out, &argv[2],
+                                             argc - 2, window));
+        return 0;  // success.
+    } // if
+
+    // Glue next to (out), then pack that into (out) itself.
+    fd = xcreate_temp(out, &tmp);
+    xclose_held(tmp, fd);
+    rc = glue_checked(ctx, tmp, out, &argv[2], argc - 2, window);
+    if (rc == FATELF_OK)
+        rc = fatelf_pack(ctx, out, tmp);
+    unlink(tmp);
+    unlink_on_xfail_remove(tmp);
+    fatelf_cleanup_pop(free, tmp, 1);
+    xfatelf_ctx_finish(ctx, rc);
     return 0;  // success.
-} // fatelf_glue
+} // fatelf_glue_main
 
 
+#if !FATELF_MULTICALL
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
-    if (argc < 4)  // this could stand to use getopt(), later.
-        xfail("USAGE: %s <out> <bin1> <bin2> [... binN]", argv[0]);
-    return fatelf_glue(argv[1], &argv[2], argc - 2);
+    argc = xfatelf_init(argc, argv);
+    return fatelf_glue_main(argc, argv);
 } // main
+#endif
 
 // end of fatelf-glue.c ...
 
@@ -14,9 +14,20 @@
 #include "fatelf-utils.h"
 
 #include "fatelf-haiku.h"
+#include "fatelf-stats.h"
 
 #define HAIKU_RSRC_HEADER_MAGIC     0x444f1000
 
+// The rest of the resource layout, from Haiku's ResourcesDef.h. Every
+// field is a 32-bit word (but for a name's length) in the resources' own
+// byte order, which the header's magic tells us. Offsets are from the
+// start of the resources.
+#define HAIKU_RSRC_INDEX_HEADER_SIZE    132 // resource_index_section_header
+#define HAIKU_RSRC_INDEX_ENTRY_SIZE     12  // resource_index_entry
+#define HAIKU_RSRC_INFO_SIZE            10  // resource_info, less its name
+#define HAIKU_RSRC_INFO_SEPARATOR       0xffffffff
+#define HAIKU_RSRC_INFO_TABLE_END       0xfffffffe
+
 #define HAIKU_ELF32_RSRC_ALIGN_MIN  32
 // FATELF_REVIEW: Should we recommend this be changed to page alignment before
 // the Haiku binary ABI is stabilized?
@@ -146,6 +157,10 @@ struct elf_layout {
     uint32_t header_size;
     struct elf_table_layout prog;
     struct elf_table_layout sect;
+    // Byteswap handlers for the file's byte order.
+    uint64_t (*get64)(uint64_t v);
+    uint32_t (*get32)(uint32_t v);
+    uint16_t (*get16)(uint16_t v);
 };
 
 // Byteswap handlers
@@ -162,8 +177,7 @@ static uint64_t nswap64 (uint64_t v) { return v; }
 // Determine the file position of the Haiku resources within a FatELF file. The
 // returned offset may extend past the end of the file if no resources
 // are available in the file.
-static int haiku_fat_rsrc_offset(const char *fname, const int fd,
-                                 const FATELF_header *header, uint64_t *offset)
+int haiku_fat_rsrc_offset(const FATELF_header *header, uint64_t *offset)
 {
     const int furthest = find_furthest_record(header);
     if (furthest < 0)
@@ -176,64 +190,143 @@ static int haiku_fat_rsrc_offset(const char *fname, const int fd,
     return 1;
 }
 
-// Determine the file position of the Haiku resources within an ELF file. The
-// returned offset may extend past the end of the file if no resources
-// are available in the file.
-static int haiku_elf_rsrc_offset(const char *fname, const int fd,
-                                 uint64_t *offset)
+// The part of a file we have in memory, and how to get at the rest of it.
+struct file_image {
+    const char *fname;
+    int fd;             // -1 if we can't read any more of the file.
+    const uint8_t *buf; // the first (buflen) bytes of the file.
+    uint64_t buflen;
+    uint64_t fsize;
+    // For a file read front to back: its ELF program and section header
+    // tables, kept as they went past. NULL if there are none.
+    const uint8_t *const *tables;
+    const uint64_t *table_offsets;
+    const uint64_t *table_lens;
+};
+
+// Return a pointer to the (len) bytes at (offset) within the file, or fail
+// if they aren't all there. Bytes we don't have in memory yet are read into
+// (*scratch), which the caller frees.
+static const uint8_t *elf_bytes(const struct file_image *img,
+                                const uint64_t offset, const uint64_t len,
+                                uint8_t **scratch)
 {
-    uint8_t ident[EI_NIDENT];
+    if ((offset > img->fsize) || (len > img->fsize - offset))
+        xfailc(FATELF_EFORMAT, "'%s' has a truncated ELF header or table",
+               img->fname);
+    else if ((offset <= img->buflen) && (len <= img->buflen - offset))
+        return img->buf + offset;
+
+    if (img->tables != NULL) {
+        int i;
+        for (i = 0; i < HAIKU_ELF_TABLES; i++) {
+            const uint64_t start = img->table_offsets[i];
+            if ((img->tables[i] != NULL) && (offset >= start) &&
+                (offset - start <= img->table_lens[i]) &&
+                (len <= img->table_lens[i] - (offset - start)))
+                return img->tables[i] + (offset - start);
+        }
+    }
 
-    xlseek(fname, fd, 0, SEEK_SET);
-    xread(fname, fd, ident, sizeof(ident), 1);
-    if (memcmp(ident, ELF_MAGIC, 4) != 0)
-        return 0;
+    if (img->fd == -1)
+        xfailc(FATELF_EFORMAT, "'%s' has a truncated ELF header or table",
+               img->fname);
 
-    uint64_t (*get64)(uint64_t v) = nswap64;
-    uint32_t (*get32)(uint32_t v) = nswap32;
-    uint16_t (*get16)(uint16_t v) = nswap16;
+    free(*scratch);
+    *scratch = (uint8_t *) xmalloc(len ? len : 1);
+    xpread(img->fname, img->fd, *scratch, (size_t) len, offset, 1);
+    return *scratch;
+}
+
+// Cleanup for the (*scratch) that elf_bytes() fills in.
+static void free_scratch(void *scratch)
+{
+    free(*((uint8_t **) scratch));
+}
+
+// Read the ELF header of (img) into (elfData). Returns false if it isn't
+// an ELF file.
+static bool elf_read_layout(const struct file_image *img,
+                            struct elf_layout *elfData, uint8_t **scratch)
+{
+    const char *fname = img->fname;
+    const uint8_t *ident = img->buf;
+
+    if ((img->buflen < EI_NIDENT) || (memcmp(ident, ELF_MAGIC, 4) != 0))
+        return false;
+
+    elfData->get64 = nswap64;
+    elfData->get32 = nswap32;
+    elfData->get16 = nswap16;
 
     if (ident[EI_DATA] != FATELF_HOST_ENDIAN) {
-        get64 = swap64;
-        get32 = swap32;
-        get16 = swap16;
+        elfData->get64 = swap64;
+        elfData->get32 = swap32;
+        elfData->get16 = swap16;
     }
 
-    xlseek(fname, fd, 0, SEEK_SET);
+    uint32_t (*get32)(uint32_t v) = elfData->get32;
+    uint16_t (*get16)(uint16_t v) = elfData->get16;
 
     /* Parse the ELF header */
-    struct elf_layout elfData;
     if (ident[EI_CLASS] == FATELF_32BITS) {
         struct Elf32_Ehdr ehdr;
 
-        xread(fname, fd, &ehdr, sizeof(ehdr), 1);
-        elfData.header_size = get16(ehdr.e_ehsize);
+        memcpy(&ehdr, elf_bytes(img, 0, sizeof(ehdr), scratch),
+               sizeof(ehdr));
+        elfData->header_size = get16(ehdr.e_ehsize);
 
-        elfData.prog.offset = get32(ehdr.e_phoff);
-        elfData.prog.header_size = get16(ehdr.e_phentsize);
-        elfData.prog.header_count = get16(ehdr.e_phnum);
+        elfData->prog.offset = get32(ehdr.e_phoff);
+        elfData->prog.header_size = get16(ehdr.e_phentsize);
+        elfData->prog.header_count = get16(ehdr.e_phnum);
 
-        elfData.sect.offset = get32(ehdr.e_shoff);
-        elfData.sect.header_size = get16(ehdr.e_shentsize);
-        elfData.sect.header_count = get16(ehdr.e_shnum);
+        elfData->sect.offset = get32(ehdr.e_shoff);
+        elfData->sect.header_size = get16(ehdr.e_shentsize);
+        elfData->sect.header_count = get16(ehdr.e_shnum);
 
     } else if (ident[EI_CLASS] == FATELF_64BITS) {
+        uint64_t (*get64)(uint64_t v) = elfData->get64;
         struct Elf64_Ehdr ehdr;
 
-        xread(fname, fd, &ehdr, sizeof(ehdr), 1);
-        elfData.header_size = get32(ehdr.e_ehsize);
+        memcpy(&ehdr, elf_bytes(img, 0, sizeof(ehdr), scratch),
+               sizeof(ehdr));
+        elfData->header_size = get32(ehdr.e_ehsize);
 
-        elfData.prog.offset = get64(ehdr.e_phoff);
-        elfData.prog.header_size = get16(ehdr.e_phentsize);
-        elfData.prog.header_count = get16(ehdr.e_phnum);
+        elfData->prog.offset = get64(ehdr.e_phoff);
+        elfData->prog.header_size = get16(ehdr.e_phentsize);
+        elfData->prog.header_count = get16(ehdr.e_phnum);
 
-        elfData.sect.offset = get64(ehdr.e_shoff);
-        elfData.sect.header_size = get16(ehdr.e_shentsize);
-        elfData.sect.header_count = get16(ehdr.e_shnum);
+        elfData->sect.offset = get64(ehdr.e_shoff);
+        elfData->sect.header_size = get16(ehdr.e_shentsize);
+        elfData->sect.header_count = get16(ehdr.e_shnum);
     } else {
-        xfail("'%s' has an invalid ELF EI_CLASS", fname);
+        xfailc(FATELF_EFORMAT, "'%s' has an invalid ELF EI_CLASS", fname);
     }
 
+    return true;
+}
+
+// Determine the file position of the Haiku resources within an ELF file. The
+// returned offset may extend past the end of the file if no resources
+// are available in the file.
+static int haiku_elf_rsrc_offset(const struct file_image *img,
+                                 uint64_t *offset)
+{
+    const char *fname = img->fname;
+    const uint8_t *ident = img->buf;
+    struct elf_layout elfData;
+    uint8_t *scratch = NULL;
+
+    fatelf_cleanup_push(free_scratch, &scratch);
+
+    if (!elf_read_layout(img, &elfData, &scratch)) {
+        fatelf_cleanup_pop(free_scratch, &scratch, 1);
+        return 0;
+    }
+
+    uint64_t (*get64)(uint64_t v) = elfData.get64;
+    uint32_t (*get32)(uint32_t v) = elfData.get32;
+
     /* Compute the offset to non-ELF data. For ELF files, this is based
      * on the offset to the end of the ELF data, plus either a fixed
      * alignment of 8 on ELF64, or on ELF32, the largest alignment value
@@ -251,18 +344,22 @@ static int haiku_elf_rsrc_offset(const char *fname, const int fd,
         if (tableEnd > rsrcOffset)
             rsrcOffset = tableEnd;
 
-        void *headers = xmalloc(tableSize);
-
-        xread(fname, fd, headers, tableSize, 1);
+        const uint8_t *headers = elf_bytes(img, elfData.prog.offset,
+                                           tableSize, &scratch);
 
         if (ident[EI_CLASS] == FATELF_32BITS) {
-            struct Elf32_Phdr *phdrs = headers;
             for (i = 0; i < elfData.prog.header_count; i++) {
-                struct Elf32_Phdr *phdr = phdrs + i;
-                uint32_t type = get32(phdr->p_type);
-                uint64_t offset = get32(phdr->p_offset);
-                uint64_t size = get32(phdr->p_filesz);
-                uint64_t alignment = get32(phdr->p_align);
+                struct Elf32_Phdr phdr;
+                if (elfData.prog.header_size < sizeof(phdr))
+                    xfailc(FATELF_EFORMAT, "'%s' has an invalid e_phentsize",
+                           fname);
+                memcpy(&phdr, headers + (i * elfData.prog.header_size),
+                       sizeof(phdr));
+
+                uint32_t type = get32(phdr.p_type);
+                uint64_t offset = get32(phdr.p_offset);
+                uint64_t size = get32(phdr.p_filesz);
+                uint64_t alignment = get32(phdr.p_align);
 
                 if (type == PT_NULL)
                     continue;
@@ -275,13 +372,18 @@ static int haiku_elf_rsrc_offset(const char *fname, const int fd,
                     rsrcAlign = alignment;
             }
         } else {
-            struct Elf64_Phdr *phdrs = headers;
             for (i = 0; i < elfData.prog.header_count; i++) {
-                struct Elf64_Phdr *phdr = phdrs + i;
-                uint32_t type = get32(phdr->p_type);
-                uint64_t offset = get64(phdr->p_offset);
-                uint64_t size = get64(phdr->p_filesz);
-                uint64_t alignment = get64(phdr->p_align);
+                struct Elf64_Phdr phdr;
+                if (elfData.prog.header_size < sizeof(phdr))
+                    xfailc(FATELF_EFORMAT, "'%s' has an invalid e_phentsize",
+                           fname);
+                memcpy(&phdr, headers + (i * elfData.prog.header_size),
+                       sizeof(phdr));
+
+                uint32_t type = get32(phdr.p_type);
+                uint64_t offset = get64(phdr.p_offset);
+                uint64_t size = get64(phdr.p_filesz);
+                uint64_t alignment = get64(phdr.p_align);
 
                 if (type == PT_NULL)
                     continue;
@@ -305,15 +407,21 @@ static int haiku_elf_rsrc_offset(const char *fname, const int fd,
         if (tableEnd > rsrcOffset)
             rsrcOffset = tableEnd;
 
-        void *headers = xmalloc(tableSize);
-        xread(fname, fd, headers, tableSize, 1);
+        const uint8_t *headers = elf_bytes(img, elfData.sect.offset,
+                                           tableSize, &scratch);
+
         if (ident[EI_CLASS] == FATELF_32BITS) {
-            struct Elf32_Shdr *shdrs = headers;
             for (i = 0; i < elfData.sect.header_count; i++) {
-                struct Elf32_Shdr *shdr = shdrs + i;
-                uint32_t type = get32(shdr->sh_type);
-                uint64_t offset = get32(shdr->sh_offset);
-                uint64_t size = get32(shdr->sh_size);
+                struct Elf32_Shdr shdr;
+                if (elfData.sect.header_size < sizeof(shdr))
+                    xfailc(FATELF_EFORMAT, "'%s' has an invalid e_shentsize",
+                           fname);
+                memcpy(&shdr, headers + (i * elfData.sect.header_size),
+                       sizeof(shdr));
+
+                uint32_t type = get32(shdr.sh_type);
+                uint64_t offset = get32(shdr.sh_offset);
+                uint64_t size = get32(shdr.sh_size);
 
                 /* Skip sections that occupy no file space */
                 if (type == SHT_NULL || type == SHT_NOBITS)
@@ -324,12 +432,17 @@ static int haiku_elf_rsrc_offset(const char *fname, const int fd,
                     rsrcOffset = sectEnd;
             }
         } else {
-            struct Elf64_Shdr *shdrs = headers;
             for (i = 0; i < elfData.sect.header_count; i++) {
-                struct Elf64_Shdr *shdr = shdrs + i;
-                uint32_t type = get32(shdr->sh_type);
-                uint64_t offset = get64(shdr->sh_offset);
-                uint64_t size = get64(shdr->sh_size);
+                struct Elf64_Shdr shdr;
+                if (elfData.sect.header_size < sizeof(shdr))
+                    xfailc(FATELF_EFORMAT, "'%s' has an invalid e_shentsize",
+                           fname);
+                memcpy(&shdr, headers + (i * elfData.sect.header_size),
+                       sizeof(shdr));
+
+                uint32_t type = get32(shdr.sh_type);
+                uint64_t offset = get64(shdr.sh_offset);
+                uint64_t size = get64(shdr.sh_size);
 
                 /* Skip sections that occupy no file space */
                 if (type == SHT_NULL || type == SHT_NOBITS)
@@ -350,53 +463,167 @@ static int haiku_elf_rsrc_offset(const char *fname, const int fd,
 
     *offset = ALIGN(rsrcOffset, rsrcAlign);
 
+    fatelf_cleanup_pop(free_scratch, &scratch, 1);
     return 1;
 }
 
-static bool haiku_parse_rsrc_header(const char *fname, const int fd,
+static uint32_t rsrc_get32(const uint8_t *ptr, bool swapped)
+{
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return swapped ? xswap32(v) : v;
+}
+
+static uint16_t rsrc_get16(const uint8_t *ptr, bool swapped)
+{
+    uint16_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return swapped ? xswap16(v) : v;
+}
+
+static bool rsrc_magic(const uint8_t *ptr, bool *swapped)
+{
+    const uint32_t magic = rsrc_get32(ptr, false);
+
+    *swapped = (magic != HAIKU_RSRC_HEADER_MAGIC);
+    return (magic == HAIKU_RSRC_HEADER_MAGIC ||
+            xswap32(magic) == HAIKU_RSRC_HEADER_MAGIC);
+}
+
+uint64_t haiku_rsrc_index_span(const uint8_t *buf, const uint64_t buflen)
+{
+    bool swapped;
+
+    if (buflen < HAIKU_RSRC_HEADER_SIZE || !rsrc_magic(buf, &swapped))
+        return 0;
+
+    const uint64_t count = rsrc_get32(buf + 4, swapped);
+    const uint64_t index = rsrc_get32(buf + 8, swapped);
+    if (index < HAIKU_RSRC_HEADER_SIZE)
+        return 0;
+
+    return index + HAIKU_RSRC_INDEX_HEADER_SIZE +
+           (count * HAIKU_RSRC_INDEX_ENTRY_SIZE);
+}
+
+int haiku_rsrc_size_mem(const uint8_t *buf, const uint64_t buflen,
+                        uint64_t *size)
+{
+    const uint64_t span = haiku_rsrc_index_span(buf, buflen);
+    bool swapped;
+
+    if (span == 0 || span > buflen)
+        return 0;
+
+    rsrc_magic(buf, &swapped);
+    const uint32_t count = rsrc_get32(buf + 4, swapped);
+    const uint32_t index = rsrc_get32(buf + 8, swapped);
+    const uint8_t *section = buf + index;
+
+    // The index section starts by repeating its own offset, and has to
+    // hold its header and an entry for every resource.
+    const uint64_t indexSize = rsrc_get32(section + 4, swapped);
+    if (rsrc_get32(section, swapped) != index || indexSize < span - index)
+        return 0;
+
+    // The resources end with whichever of their parts ends last; usually
+    // that's the info table, which Haiku writes after all of the data.
+    uint64_t end = index + indexSize;
+    uint64_t partEnd;
+    uint32_t i;
+
+    partEnd = rsrc_get32(buf + 12, swapped);  // the admin section.
+    if (partEnd > end)
+        end = partEnd;
+
+    partEnd = (uint64_t) rsrc_get32(section + 12, swapped) +
+              rsrc_get32(section + 16, swapped);  // the "unknown" section.
+    if (partEnd > end)
+        end = partEnd;
+
+    partEnd = (uint64_t) rsrc_get32(section + 120, swapped) +
+              rsrc_get32(section + 124, swapped);  // the info table.
+    if (partEnd > end)
+        end = partEnd;
+
+    for (i = 0; i < count; i++) {
+        const uint8_t *entry = section + HAIKU_RSRC_INDEX_HEADER_SIZE +
+                               ((uint64_t) i * HAIKU_RSRC_INDEX_ENTRY_SIZE);
+        partEnd = (uint64_t) rsrc_get32(entry, swapped) +
+                  rsrc_get32(entry + 4, swapped);
+        if (partEnd > end)
+            end = partEnd;
+    }
+
+    *size = end;
+    return 1;
+}
+
+static bool haiku_parse_rsrc_header(const struct file_image *img,
                                     uint64_t offset, uint64_t *size)
 {
-    // TODO - compute actual resource size by reading the resource table
-    uint64_t fileSize = xget_file_size(fname, fd);
-    if (fileSize <= offset) {
+    if ((img->fsize <= offset) || (img->fsize - offset < sizeof(uint32_t))) {
         return false;
     }
-    *size = fileSize - offset;
+    const uint64_t avail = img->fsize - offset;
 
-    uint32_t magic;
-    xlseek(fname, fd, offset, SEEK_SET);
-    xread(fname, fd, &magic, sizeof(magic), 1);
+    uint8_t magic[sizeof(uint32_t)];
+    bool swapped;
+    if (offset + sizeof(magic) <= img->buflen)
+        memcpy(magic, img->buf + offset, sizeof(magic));
+    else
+        xpread(img->fname, img->fd, magic, sizeof(magic), offset, 1);
 
-    if (magic != HAIKU_RSRC_HEADER_MAGIC &&
-        xswap32(magic) != HAIKU_RSRC_HEADER_MAGIC)
-    {
+    if (!rsrc_magic(magic, &swapped))
         return false;
+
+    // Size them from their index. If the table doesn't hold together,
+    // assume they run to the end of the file, rather than cut off data we
+    // don't understand.
+    *size = avail;
+    if (avail >= HAIKU_RSRC_HEADER_SIZE) {
+        uint8_t *scratch = NULL;
+        const uint8_t *ptr;
+        uint64_t span, exact;
+
+        fatelf_cleanup_push(free_scratch, &scratch);
+        ptr = elf_bytes(img, offset, HAIKU_RSRC_HEADER_SIZE, &scratch);
+        span = haiku_rsrc_index_span(ptr, HAIKU_RSRC_HEADER_SIZE);
+        if (span != 0 && span <= avail) {
+            ptr = elf_bytes(img, offset, span, &scratch);
+            if (haiku_rsrc_size_mem(ptr, span, &exact) && exact <= avail)
+                *size = exact;
+        }
+        fatelf_cleanup_pop(free_scratch, &scratch, 1);
     }
 
     return true;
 }
 
-int haiku_rsrc_offset(const char *fname, const int fd, uint64_t *offset)
+static int haiku_image_locate_rsrc(const struct file_image *img,
+                                   uint64_t *offset)
 {
     union {
         uint8_t elf[4];
         uint32_t fatelf;
     } magic;
 
-    xlseek(fname, fd, 0, SEEK_SET);
-    xread(fname, fd, &magic, sizeof(magic), 1);
+    if (img->buflen < sizeof(magic))
+        return 0;
+    memcpy(&magic, img->buf, sizeof(magic));
 
     // ELF file
     if (memcmp(magic.elf, ELF_MAGIC, sizeof(magic.elf)) == 0)
-        return haiku_elf_rsrc_offset(fname, fd, offset);
+        return haiku_elf_rsrc_offset(img, offset);
 
     // FatELF file
     if (FATELF_HOST_ENDIAN == FATELF_BIGENDIAN)
         magic.fatelf = xswap32(magic.fatelf);
 
     if (magic.fatelf == FATELF_MAGIC) {
-        FATELF_header *header = xread_fatelf_header(fname, fd);
-        int ret = haiku_fat_rsrc_offset(fname, fd, header, offset);
+        FATELF_header *header = xdecode_fatelf_header(img->fname, img->buf,
+                                                      img->buflen);
+        int ret = haiku_fat_rsrc_offset(header, offset);
         free(header);
 
         return ret;
@@ -406,14 +633,259 @@ int haiku_rsrc_offset(const char *fname, const int fd, uint64_t *offset)
     return 0;
 }
 
-int haiku_find_rsrc(const char *fname, const int fd, uint64_t *offset,
-                    uint64_t *size)
+static int haiku_image_rsrc_offset(const struct file_image *img,
+                                   uint64_t *offset)
+{
+    const uint64_t start = fatelf_stats_start();
+    int ret = haiku_image_locate_rsrc(img, offset);
+
+    FATELF_STATS_PHASE(FATELF_PHASE_RSRC, img->fname, start);
+    return ret;
+}
+
+static int haiku_image_find_rsrc(const struct file_image *img,
+                                 uint64_t *offset, uint64_t *size)
 {
-    if (!haiku_rsrc_offset(fname, fd, offset))
+    if (!haiku_image_rsrc_offset(img, offset))
+        return 0;
+
+    if (!haiku_parse_rsrc_header(img, *offset, size))
         return 0;
 
-    if (!haiku_parse_rsrc_header(fname, fd, *offset, size))
+    return 1;
+}
+
+int haiku_rsrc_offset_mem(const char *fname, const uint8_t *buf,
+                          const uint64_t buflen, uint64_t *offset)
+{
+    const struct file_image img = { fname, -1, buf, buflen, buflen };
+    return haiku_image_rsrc_offset(&img, offset);
+}
+
+int haiku_elf_rsrc_tables(const char *fname, const uint8_t *buf,
+                          const uint64_t buflen, uint64_t *offsets,
+                          uint64_t *lens)
+{
+    const struct file_image img = { fname, -1, buf, buflen, buflen };
+    struct elf_layout elfData;
+    uint8_t *scratch = NULL;  // (buf) has the header, or we fail.
+
+    if (!elf_read_layout(&img, &elfData, &scratch))
         return 0;
 
+    offsets[0] = elfData.prog.offset;
+    lens[0] = elfData.prog.offset ? elfData.prog.header_size *
+                                    elfData.prog.header_count : 0;
+    offsets[1] = elfData.sect.offset;
+    lens[1] = elfData.sect.offset ? elfData.sect.header_size *
+                                    elfData.sect.header_count : 0;
     return 1;
 }
+
+int haiku_rsrc_offset_tables(const char *fname, const uint8_t *buf,
+                             const uint64_t buflen, const uint64_t fsize,
+                             const uint8_t *const *tables,
+                             const uint64_t *offsets, const uint64_t *lens,
+                             uint64_t *offset)
+{
+    const struct file_image img = { fname, -1, buf, buflen, fsize,
+                                    tables, offsets, lens };
+    return haiku_image_rsrc_offset(&img, offset);
+}
+
+int haiku_find_rsrc_mem(const char *fname, const uint8_t *buf,
+                        const uint64_t buflen, uint64_t *offset,
+                        uint64_t *size)
+{
+    const struct file_image img = { fname, -1, buf, buflen, buflen };
+    return haiku_image_find_rsrc(&img, offset, size);
+}
+
+int haiku_find_rsrc_prefix(const char *fname, const int fd,
+                           const uint8_t *buf, const uint64_t buflen,
+                           const uint64_t fsize, uint64_t *offset,
+                           uint64_t *size)
+{
+    const struct file_image img = { fname, fd, buf, buflen, fsize };
+    return haiku_image_find_rsrc(&img, offset, size);
+}
+
+int haiku_find_rsrc_view(const fatelf_view *view, uint64_t *offset,
+                         uint64_t *size)
+{
+    const struct file_image img = { view->fname, -1, view->map.ptr,
+                                    view->map.size, view->map.size };
+    const uint64_t start = fatelf_stats_start();
+    int ret;
+
+    // we already have the decoded header, so skip straight to the edge.
+    ret = haiku_fat_rsrc_offset(view->header, offset) &&
+          haiku_parse_rsrc_header(&img, *offset, size);
+
+    FATELF_STATS_PHASE(FATELF_PHASE_RSRC, view->fname, start);
+    return ret;
+}
+
+static void rsrc_malformed(const char *fname)
+{
+    xfailc(FATELF_EFORMAT, "'%s' has a malformed Haiku resource table",
+           fname);
+}
+
+haiku_rsrc_index *xhaiku_rsrc_index_view(const fatelf_view *view)
+{
+    uint64_t offset, size;
+
+    if (!haiku_find_rsrc_view(view, &offset, &size))
+        return NULL;
+
+    const char *fname = view->fname;
+    const uint8_t *buf = view->map.ptr + offset;
+    uint64_t exact;
+    if (!haiku_rsrc_size_mem(buf, size, &exact) || exact > size)
+        rsrc_malformed(fname);
+
+    bool swapped;
+    rsrc_magic(buf, &swapped);
+    const uint32_t count = rsrc_get32(buf + 4, swapped);
+    const uint8_t *section = buf + rsrc_get32(buf + 8, swapped);
+
+    haiku_rsrc_index *index = (haiku_rsrc_index *) xmalloc(sizeof(*index));
+    index->offset = offset;
+    index->size = exact;
+    index->count = count;
+    index->rsrcs = NULL;
+    fatelf_cleanup_push(haiku_cleanup_rsrc_index, index);
+    index->rsrcs = (haiku_rsrc *) xmalloc(sizeof(haiku_rsrc) *
+                                          (count ? count : 1));
+
+    // Where each resource's bytes are comes from the index entries...
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        const uint8_t *entry = section + HAIKU_RSRC_INDEX_HEADER_SIZE +
+                               ((uint64_t) i * HAIKU_RSRC_INDEX_ENTRY_SIZE);
+        haiku_rsrc *rsrc = &index->rsrcs[i];
+        rsrc->type = 0;
+        rsrc->id = 0;
+        rsrc->name = "";
+        rsrc->offset = offset + rsrc_get32(entry, swapped);
+        rsrc->size = rsrc_get32(entry + 4, swapped);
+    }
+
+    // ...and what they are, from the info table: for each type, its code
+    // and then an info (id, 1-based index entry, name) for each resource,
+    // ending in a separator. The table ends with a checksum and a
+    // terminator, which we also take as the end of a type's infos, as an
+    // info can't have that index. Names point straight into the mapped
+    // file.
+    uint64_t pos = rsrc_get32(section + 120, swapped);
+    const uint64_t end = pos + rsrc_get32(section + 124, swapped);
+    for (;;) {
+        if (end - pos < 8)
+            rsrc_malformed(fname);
+        if (rsrc_get32(buf + pos + 4, swapped) == HAIKU_RSRC_INFO_TABLE_END)
+            break;
+
+        const uint32_t type = rsrc_get32(buf + pos, swapped);
+        pos += 4;
+
+        for (;;) {
+            if (end - pos < 8)
+                rsrc_malformed(fname);
+
+            const uint32_t next = rsrc_get32(buf + pos + 4, swapped);
+            if (next == HAIKU_RSRC_INFO_TABLE_END)
+                break;
+            else if (next == HAIKU_RSRC_INFO_SEPARATOR &&
+                     rsrc_get32(buf + pos, swapped) ==
+                        HAIKU_RSRC_INFO_SEPARATOR) {
+                pos += 8;
+                break;
+            } else if (end - pos < HAIKU_RSRC_INFO_SIZE) {
+                rsrc_malformed(fname);
+            }
+
+            const int32_t id = (int32_t) rsrc_get32(buf + pos, swapped);
+            const uint32_t entry = rsrc_get32(buf + pos + 4, swapped);
+            const uint16_t namelen = rsrc_get16(buf + pos + 8, swapped);
+            pos += HAIKU_RSRC_INFO_SIZE;
+
+            if (entry < 1 || entry > count || namelen > end - pos)
+                rsrc_malformed(fname);
+            if (namelen > 0 && buf[pos + namelen - 1] != '\0')
+                rsrc_malformed(fname);
+
+            haiku_rsrc *rsrc = &index->rsrcs[entry - 1];
+            rsrc->type = type;
+            rsrc->id = id;
+            if (namelen > 0)
+                rsrc->name = (const char *) (buf + pos);
+            pos += namelen;
+        }
+    }
+
+    fatelf_cleanup_pop(haiku_cleanup_rsrc_index, index, 0);
+    return index;
+}
+
+void haiku_rsrc_index_free(haiku_rsrc_index *index)
+{
+    if (index != NULL) {
+        free(index->rsrcs);
+        free(index);
+    }
+}
+
+void haiku_cleanup_rsrc_index(void *index)
+{
+    haiku_rsrc_index_free((haiku_rsrc_index *) index);
+}
+
+int haiku_fat_rsrc_stream(const uint64_t edge, const uint8_t *buf,
+                          const uint64_t buflen, uint64_t *skip)
+{
+    const uint64_t pad = ALIGN(edge, HAIKU_FAT_RSRC_ALIGN) - edge;
+    uint32_t magic;
+
+    if ((buflen < pad) || (buflen - pad < sizeof(magic)))
+        return 0;
+
+    memcpy(&magic, buf + pad, sizeof(magic));
+    if (magic != HAIKU_RSRC_HEADER_MAGIC &&
+        xswap32(magic) != HAIKU_RSRC_HEADER_MAGIC)
+    {
+        return 0;
+    }
+
+    *skip = pad;
+    return 1;
+}
+
+int haiku_rsrc_offset(const char *fname, const int fd, uint64_t *offset)
+{
+    uint8_t *buf = (uint8_t *) xmalloc(FATELF_PROBE_SIZE);
+    struct file_image img = { fname, fd, buf, 0, 0 };
+    int ret;
+
+    fatelf_cleanup_push(free, buf);
+    img.buflen = xread_prefix(fname, fd, buf, &img.fsize);
+    ret = haiku_image_rsrc_offset(&img, offset);
+    fatelf_cleanup_pop(free, buf, 1);
+
+    return ret;
+}
+
+int haiku_find_rsrc(const char *fname, const int fd, uint64_t *offset,
+                    uint64_t *size)
+{
+    uint8_t *buf = (uint8_t *) xmalloc(FATELF_PROBE_SIZE);
+    struct file_image img = { fname, fd, buf, 0, 0 };
+    int ret;
+
+    fatelf_cleanup_push(free, buf);
+    img.buflen = xread_prefix(fname, fd, buf, &img.fsize);
+    ret = haiku_image_find_rsrc(&img, offset, size);
+    fatelf_cleanup_pop(free, buf, 1);
+
+    return ret;
+}
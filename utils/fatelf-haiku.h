@@ -10,7 +10,98 @@
 int haiku_rsrc_offset(const char *fname, const int fd,
                       uint64_t *offset);
 
+// Where the Haiku resources go in a FatELF file with (header), without
+// reading it.
+int haiku_fat_rsrc_offset(const FATELF_header *header, uint64_t *offset);
+
 int haiku_find_rsrc(const char *fname, const int fd, uint64_t *offset,
                     uint64_t *size);
 
+// The same, for a whole file image that is already in memory.
+int haiku_rsrc_offset_mem(const char *fname, const uint8_t *buf,
+                          const uint64_t buflen, uint64_t *offset);
+
+// For an ELF file that is only read front to back, so it can't be read
+// again: haiku_rsrc_offset() needs its header and the HAIKU_ELF_TABLES
+// tables (program headers, then section headers) at (offsets), (lens)
+// bytes each. Find them from its first (buflen) bytes, which must hold
+// the ELF header. Returns zero if it isn't an ELF file.
+#define HAIKU_ELF_TABLES 2
+int haiku_elf_rsrc_tables(const char *fname, const uint8_t *buf,
+                          const uint64_t buflen, uint64_t *offsets,
+                          uint64_t *lens);
+
+// haiku_rsrc_offset_mem(), for an (fsize)-byte ELF file when we only have
+// its first (buflen) bytes, and the (tables) named above, kept as they
+// went past. A NULL table is one we don't need.
+int haiku_rsrc_offset_tables(const char *fname, const uint8_t *buf,
+                             const uint64_t buflen, const uint64_t fsize,
+                             const uint8_t *const *tables,
+                             const uint64_t *offsets, const uint64_t *lens,
+                             uint64_t *offset);
+
+int haiku_find_rsrc_mem(const char *fname, const uint8_t *buf,
+                        const uint64_t buflen, uint64_t *offset,
+                        uint64_t *size);
+
+// The same, for a (fsize)-byte file whose first (buflen) bytes are already
+// in (buf). Anything else we need is read from (fd) with pread().
+int haiku_find_rsrc_prefix(const char *fname, const int fd,
+                           const uint8_t *buf, const uint64_t buflen,
+                           const uint64_t fsize, uint64_t *offset,
+                           uint64_t *size);
+
+// Find the Haiku resources of a mapped FatELF file.
+int haiku_find_rsrc_view(const fatelf_view *view, uint64_t *offset,
+                         uint64_t *size);
+
+// Haiku resources start with a header this big.
+#define HAIKU_RSRC_HEADER_SIZE 68
+
+// If the (buflen) bytes at (buf) start Haiku resources, return how many
+// bytes from there haiku_rsrc_size_mem() needs to size them (their header
+// and index section), else zero. (buflen) should be at least
+// HAIKU_RSRC_HEADER_SIZE.
+uint64_t haiku_rsrc_index_span(const uint8_t *buf, const uint64_t buflen);
+
+// Put the exact size of the Haiku resources that start (buf) in (*size),
+// from their index section; non-zero if the table is sane. (buflen) must
+// cover haiku_rsrc_index_span(), but not the whole resources.
+int haiku_rsrc_size_mem(const uint8_t *buf, const uint64_t buflen,
+                        uint64_t *size);
+
+// One resource, from the index.
+typedef struct haiku_rsrc {
+    uint32_t type;      // a four character code, like 'ICON'.
+    int32_t id;
+    const char *name;   // in the mapped file; "" if it has none.
+    uint64_t offset;    // from the start of the file.
+    uint64_t size;
+} haiku_rsrc;
+
+typedef struct haiku_rsrc_index {
+    uint64_t offset;    // where the resources start in the file.
+    uint64_t size;
+    uint32_t count;
+    haiku_rsrc *rsrcs;  // in the order of their index entries.
+} haiku_rsrc_index;
+
+// Read the index of a mapped FatELF file's Haiku resources, so a single
+// resource is at view->map.ptr + rsrc->offset. NULL if there are none;
+// fails if their table is malformed. The index is only good while the
+// view is.
+haiku_rsrc_index *xhaiku_rsrc_index_view(const fatelf_view *view);
+void haiku_rsrc_index_free(haiku_rsrc_index *index);
+void haiku_cleanup_rsrc_index(void *index);  // the same, as a cleanup.
+
+// Enough of what follows the furthest record of a FatELF file to tell if
+// it's Haiku resources.
+#define HAIKU_FAT_RSRC_LOOKAHEAD 16
+
+// For a FatELF file read front to back: if the (buflen) bytes in (buf),
+// which follow the furthest record's end at (edge), start Haiku resources,
+// return non-zero and put how far into (buf) they begin in (*skip).
+int haiku_fat_rsrc_stream(const uint64_t edge, const uint8_t *buf,
+                          const uint64_t buflen, uint64_t *skip);
+
 #endif /* FATELF_HAIKU_H */
@@ -0,0 +1,874 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Keep the headers of every file in a directory tree in one index file, so
+//  questions like "which of these lack an x86_64 record?" are answered from
+//  the index, instead of by reading every file again. Updating the index
+//  only reads files that changed since it was last written.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-walk.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Everything on disk is little endian:
+//
+//   header: uint32 magic, uint16 version, uint16 zero, uint32 num_files,
+//           uint32 num_records, uint32 num_targets, uint32 zero, uint64
+//           size of the strings.
+//   files: num_files of them, sorted by path. uint64 device, uint64 inode,
+//           uint64 size, uint64 mtime seconds, uint32 mtime nanoseconds,
+//           uint32 first record, uint64 path (an offset into the strings),
+//           uint64 resource offset, uint64 resource size, uint64 junk
+//           offset, uint64 junk size, uint8 type (a FATELF_PROBE_* value),
+//           uint8 record count, uint8 flags, five zero bytes.
+//   records: num_records of them, just like in a FatELF header. An ELF
+//           file has one, at offset zero.
+//   targets: every distinct target among the records: eight target bytes
+//           each, like in a FatELF header.
+//   bitmaps: for each target, a bit for every file, set if the file has a
+//           record for it. Each is a run of uint64s.
+//   strings: the paths, each ending with a null byte.
+
+#define INDEX_MAGIC 0x58494546  // "FEIX"
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 32
+#define INDEX_FILE_SIZE 88
+#define INDEX_RECORD_SIZE 24
+#define INDEX_TARGET_SIZE 8
+
+#define INDEX_HAS_RSRC (1 << 0)
+#define INDEX_HAS_JUNK (1 << 1)
+
+#define INDEX_WORDS(files) (((uint64_t) (files) + 63) / 64)
+#define INDEX_ENTRY(index, i) \
+    ((index)->files + (((uint64_t) (i)) * INDEX_FILE_SIZE))
+
+// One file, as we keep it in memory.
+typedef struct index_file
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime;
+    uint32_t mtime_nsec;
+    uint8_t type;
+    uint8_t flags;
+    uint8_t num_records;
+    uint64_t rsrc_offset;
+    uint64_t rsrc_size;
+    uint64_t junk_offset;
+    uint64_t junk_size;
+    char *path;
+    FATELF_record *records;  // num_records of them; NULL if there are none.
+} index_file;
+
+// An index file, mapped into memory and checked.
+typedef struct fatelf_index
+{
+    fatelf_mapping map;
+    uint32_t num_files;
+    uint32_t num_records;
+    uint32_t num_targets;
+    const uint8_t *files;
+    const uint8_t *records;
+    const uint8_t *targets;
+    const uint8_t *bitmaps;
+    const char *strings;
+    uint64_t strings_size;
+} fatelf_index;
+
+
+// Decode file (idx) of (index), but not its records.
+static void decode_file(const fatelf_index *index, const uint32_t idx,
+                        index_file *file, uint32_t *first_record)
+{
+    const uint8_t *ptr = INDEX_ENTRY(index, idx);
+    uint64_t path = 0;
+
+    ptr = getui64(ptr, &file->dev);
+    ptr = getui64(ptr, &file->ino);
+    ptr = getui64(ptr, &file->size);
+    ptr = getui64(ptr, &file->mtime);
+    ptr = getui32(ptr, &file->mtime_nsec);
+    ptr = getui32(ptr, first_record);
+    ptr = getui64(ptr, &path);
+    ptr = getui64(ptr, &file->rsrc_offset);
+    ptr = getui64(ptr, &file->rsrc_size);
+    ptr = getui64(ptr, &file->junk_offset);
+    ptr = getui64(ptr, &file->junk_size);
+    ptr = getui8(ptr, &file->type);
+    ptr = getui8(ptr, &file->num_records);
+    getui8(ptr, &file->flags);
+    file->path = (char *) (index->strings + path);
+    file->records = NULL;
+} // decode_file
+
+
+static void close_index(fatelf_index *index)
+{
+    unmap_file(&index->map);
+} // close_index
+
+
+static void cleanup_index(void *index)
+{
+    close_index((fatelf_index *) index);
+} // cleanup_index
+
+
+// Map and check an index file. Everything in it is checked here, so the
+//  rest of this file can trust it.
+static void xopen_index(const char *fname, fatelf_index *index)
+{
+    const int fd = xopen_held(fname, O_RDONLY, 0);
+    const uint8_t *ptr;
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    uint64_t size, words;
+    uint32_t i;
+
+    memset(index, '\0', sizeof (*index));
+    xmap_file(fname, fd, &index->map);
+    xclose_held(fname, fd);
+    fatelf_cleanup_push(cleanup_index, index);
+
+    ptr = index->map.ptr;
+    size = index->map.size;
+    if (size >= INDEX_HEADER_SIZE)
+        getui16(getui32(ptr, &magic), &version);
+
+    if ((size < INDEX_HEADER_SIZE) || (magic != INDEX_MAGIC))
+        xfailc(FATELF_EFORMAT, "'%s' is not a FatELF index", fname);
+    else if (version != INDEX_VERSION)
+        xfailc(FATELF_EFORMAT, "'%s' is an unsupported index version", fname);
+
+    getui32(ptr + 8, &index->num_files);
+    getui32(ptr + 12, &index->num_records);
+    getui32(ptr + 16, &index->num_targets);
+    getui64(ptr + 24, &index->strings_size);
+    words = INDEX_WORDS(index->num_files);
+
+    // None of these can overflow; the counts are only 32 bits.
+    index->files = ptr + INDEX_HEADER_SIZE;
+    index->records = index->files +
+                     (((uint64_t) index->num_files) * INDEX_FILE_SIZE);
+    index->targets = index->records +
+                     (((uint64_t) index->num_records) * INDEX_RECORD_SIZE);
+    index->bitmaps = index->targets +
+                     (((uint64_t) index->num_targets) * INDEX_TARGET_SIZE);
+    index->strings = (const char *) (index->bitmaps +
+                     (((uint64_t) index->num_targets) * words * 8));
+
+    if ( ((uint64_t) (((const uint8_t *) index->strings) - ptr) > size) ||
+         (size - (((const uint8_t *) index->strings) - ptr) !=
+            index->strings_size) ||
+         ((index->strings_size) &&
+            (index->strings[index->strings_size - 1] != '\0')) )
+    {
+        xfailc(FATELF_EFORMAT, "'%s' is a damaged FatELF index", fname);
+    } // if
+
+    for (i = 0; i < index->num_files; i++)
+    {
+        const uint8_t *entry = INDEX_ENTRY(index, i);
+        uint32_t first = 0;
+        uint64_t path = 0;
+
+        getui64(getui32(entry + 36, &first), &path);
+        if ( (path >= index->strings_size) ||
+             (((uint64_t) first) + entry[81] > index->num_records) ||
+             (entry[80] > FATELF_PROBE_FATELF) )
+        {
+            xfailc(FATELF_EFORMAT, "'%s' is a damaged FatELF index", fname);
+        } // if
+    } // for
+
+    fatelf_cleanup_pop(cleanup_index, index, 0);
+} // xopen_index
+
+
+typedef struct update_state
+{
+    const fatelf_index *old;
+    uint32_t *slots;  // old files by device and inode, plus one; 0 is empty.
+    size_t slot_count;  // a power of two.
+    const char *root;
+    const char *sep;  // "/", unless root already ends with one.
+    pthread_mutex_t lock;
+    index_file *files;
+    size_t count;
+    size_t alloc;
+    uint64_t reused;
+    uint64_t reread;
+    uint64_t errors;
+} update_state;
+
+
+// Hash the old index's files by device and inode, so the walk can find
+//  them without a lock.
+static void hash_old_files(update_state *state)
+{
+    const fatelf_index *old = state->old;
+    uint32_t i;
+
+    state->slot_count = 1024;
+    while (state->slot_count < ((size_t) old->num_files) * 2)
+        state->slot_count *= 2;
+    state->slots = (uint32_t *) xmalloc(state->slot_count * sizeof (uint32_t));
+
+    for (i = 0; i < old->num_files; i++)
+    {
+        uint64_t dev = 0, ino = 0;
+        size_t slot;
+
+        getui64(getui64(INDEX_ENTRY(old, i), &dev), &ino);
+        slot = fatelf_hash_inode(dev, ino);
+        slot &= state->slot_count - 1;
+        while (state->slots[slot] != 0)
+            slot = (slot + 1) & (state->slot_count - 1);
+        state->slots[slot] = i + 1;
+    } // for
+} // hash_old_files
+
+
+// If the old index has this file, unchanged, copy what it knew about it.
+static int reuse_old_file(const update_state *state, index_file *file)
+{
+    const fatelf_index *old = state->old;
+    size_t slot;
+
+    if (state->slot_count == 0)
+        return 0;
+
+    slot = fatelf_hash_inode(file->dev, file->ino);
+    slot &= state->slot_count - 1;
+    while (state->slots[slot] != 0)
+    {
+        index_file prev;
+        uint32_t first;
+        int i;
+
+        decode_file(old, state->slots[slot] - 1, &prev, &first);
+        slot = (slot + 1) & (state->slot_count - 1);
+        if ( (prev.dev != file->dev) || (prev.ino != file->ino) ||
+             (prev.size != file->size) || (prev.mtime != file->mtime) ||
+             (prev.mtime_nsec != file->mtime_nsec) )
+        {
+            continue;
+        } // if
+
+        file->type = prev.type;
+        file->flags = prev.flags;
+        file->num_records = prev.num_records;
+        file->rsrc_offset = prev.rsrc_offset;
+        file->rsrc_size = prev.rsrc_size;
+        file->junk_offset = prev.junk_offset;
+        file->junk_size = prev.junk_size;
+        if (prev.num_records > 0)
+        {
+            const uint8_t *ptr = old->records +
+                                 (((uint64_t) first) * INDEX_RECORD_SIZE);
+            file->records = (FATELF_record *)
+                xmalloc(sizeof (FATELF_record) * prev.num_records);
+            for (i = 0; i < (int) prev.num_records; i++)
+                ptr = fatelf_decode_record(ptr, &file->records[i]);
+        } // if
+        return 1;
+    } // while
+
+    return 0;
+} // reuse_old_file
+
+
+// Read a file's headers the hard way.
+static void xread_file(const int dirfd, const char *name, index_file *file)
+{
+    const int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    const FATELF_record *records = NULL;
+    fatelf_probe probe;
+    int count = 0;
+
+    if (fd == -1)
+    {
+        xfailc(FATELF_EIO, "Failed to open '%s': %s", file->path,
+               strerror(errno));
+    } // if
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(fd));
+    xfatelf_probe(file->path, fd, &probe);
+    fatelf_cleanup_push(fatelf_cleanup_probe, &probe);
+
+    file->type = (uint8_t) probe.type;
+    if (probe.type == FATELF_PROBE_ELF)
+    {
+        records = &probe.elf;
+        count = 1;
+    } // if
+    else if (probe.type == FATELF_PROBE_FATELF)
+    {
+        records = probe.header->records;
+        count = (int) probe.header->num_records;
+    } // else if
+
+    if (count > 0)
+    {
+        const size_t len = sizeof (FATELF_record) * count;
+        file->records = (FATELF_record *) xmalloc(len);
+        memcpy(file->records, records, len);
+        file->num_records = (uint8_t) count;
+    } // if
+
+    if (probe.has_rsrc)
+    {
+        file->flags |= INDEX_HAS_RSRC;
+        file->rsrc_offset = probe.rsrc_offset;
+        file->rsrc_size = probe.rsrc_size;
+    } // if
+
+    if (probe.has_junk)
+    {
+        file->flags |= INDEX_HAS_JUNK;
+        file->junk_offset = probe.junk_offset;
+        file->junk_size = probe.junk_size;
+    } // if
+
+    fatelf_cleanup_pop(fatelf_cleanup_probe, &probe, 1);
+    fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(fd), 1);
+} // xread_file
+
+
+static void add_file(update_state *state, const index_file *file)
+{
+    pthread_mutex_lock(&state->lock);
+    if (state->count == state->alloc)
+    {
+        const size_t newalloc = state->alloc ? (state->alloc * 2) : 1024;
+        void *ptr = realloc(state->files, newalloc * sizeof (index_file));
+        if (ptr == NULL)
+        {
+            pthread_mutex_unlock(&state->lock);
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        } // if
+        state->files = (index_file *) ptr;
+        state->alloc = newalloc;
+    } // if
+    state->files[state->count++] = *file;
+    pthread_mutex_unlock(&state->lock);
+} // add_file
+
+
+static void update_entry(void *data, const char *path, const int dirfd,
+                         const char *name, const struct stat *st)
+{
+    update_state *state = (update_state *) data;
+    const size_t len = strlen(state->root) + strlen(state->sep) +
+                       strlen(path) + 1;
+    fatelf_catch frame;
+    index_file file;
+
+    if (!S_ISREG(st->st_mode))
+        return;
+
+    memset(&file, '\0', sizeof (file));
+    file.dev = (uint64_t) st->st_dev;
+    file.ino = (uint64_t) st->st_ino;
+    file.size = (uint64_t) st->st_size;
+    file.mtime = (uint64_t) st->st_mtim.tv_sec;
+    file.mtime_nsec = (uint32_t) st->st_mtim.tv_nsec;
+    file.path = (char *) xmalloc(len);
+    snprintf(file.path, len, "%s%s%s", state->root, state->sep, path);
+
+    if (reuse_old_file(state, &file))
+    {
+        __atomic_add_fetch(&state->reused, 1, __ATOMIC_RELAXED);
+        add_file(state, &file);
+        return;
+    } // if
+
+    fatelf_catch_enter(&frame);
+    if (setjmp(frame.env) != 0)
+    {
+        // a file we can't read isn't indexed, so it's tried again next time.
+        fprintf(stderr, "%s\n", frame.message);
+        free(file.path);
+        __atomic_add_fetch(&state->errors, 1, __ATOMIC_RELAXED);
+        return;
+    } // if
+
+    xread_file(dirfd, name, &file);
+    fatelf_catch_leave(&frame);
+    __atomic_add_fetch(&state->reread, 1, __ATOMIC_RELAXED);
+    add_file(state, &file);
+} // update_entry
+
+
+static int compare_files(const void *_a, const void *_b)
+{
+    const index_file *a = (const index_file *) _a;
+    const index_file *b = (const index_file *) _b;
+    return strcmp(a->path, b->path);
+} // compare_files
+
+
+static int find_target(const FATELF_record *targets, const int count,
+                       const FATELF_record *rec)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        if (fatelf_record_matches(&targets[i], rec))
+            return i;
+    } // for
+    return -1;
+} // find_target
+
+
+// Write (files) out as a new index, next to (fname), and rename it over.
+static void xwrite_index(const char *fname, const index_file *files,
+                         const uint32_t count)
+{
+    const uint64_t words = INDEX_WORDS(count);
+    FATELF_record *targets = NULL;
+    uint64_t *bitmaps = NULL;
+    int num_targets = 0;
+    uint64_t num_records = 0;
+    uint64_t strings_size = 0;
+    uint8_t *buf, *ptr;
+    uint64_t buflen;
+    uint64_t w;
+    uint32_t i;
+    char *tmp = NULL;
+    struct stat st;
+    int fd;
+    int j;
+
+    // Every distinct target gets a bitmap. There are only ever a few.
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < (int) files[i].num_records; j++)
+        {
+            const FATELF_record *rec = &files[i].records[j];
+            int t = find_target(targets, num_targets, rec);
+            if (t < 0)
+            {
+                const size_t oldlen = sizeof (uint64_t) * words * num_targets;
+                FATELF_record *newtargets = (FATELF_record *)
+                    xmalloc(sizeof (FATELF_record) * (num_targets + 1));
+                uint64_t *newbitmaps = (uint64_t *)
+                    xmalloc(oldlen + (sizeof (uint64_t) * (words ? words : 1)));
+                if (num_targets)
+                {
+                    memcpy(newtargets, targets,
+                           sizeof (FATELF_record) * num_targets);
+                    memcpy(newbitmaps, bitmaps, oldlen);
+                } // if
+                free(targets);
+                free(bitmaps);
+                targets = newtargets;
+                bitmaps = newbitmaps;
+                t = num_targets++;
+                targets[t] = *rec;
+            } // if
+            bitmaps[(t * words) + (i / 64)] |= ((uint64_t) 1) << (i % 64);
+        } // for
+        num_records += files[i].num_records;
+        strings_size += strlen(files[i].path) + 1;
+    } // for
+
+    if (num_records > 0xFFFFFFFF)
+        xfailc(FATELF_EINVAL, "Too many records for one index");
+
+    buflen = INDEX_HEADER_SIZE + (((uint64_t) count) * INDEX_FILE_SIZE) +
+             (num_records * INDEX_RECORD_SIZE) +
+             (((uint64_t) num_targets) * INDEX_TARGET_SIZE) +
+             (((uint64_t) num_targets) * words * 8) + strings_size;
+    if (buflen != (uint64_t) ((size_t) buflen))
+        xfailc(FATELF_ENOMEM, "Out of memory!");
+
+    fatelf_cleanup_push(free, targets);
+    fatelf_cleanup_push(free, bitmaps);
+    buf = (uint8_t *) xmalloc((size_t) buflen);
+    fatelf_cleanup_push(free, buf);
+
+    ptr = putui32(buf, INDEX_MAGIC);
+    ptr = putui16(ptr, INDEX_VERSION);
+    ptr = putui16(ptr, 0);
+    ptr = putui32(ptr, count);
+    ptr = putui32(ptr, (uint32_t) num_records);
+    ptr = putui32(ptr, (uint32_t) num_targets);
+    ptr = putui32(ptr, 0);
+    ptr = putui64(ptr, strings_size);
+
+    num_records = 0;
+    strings_size = 0;
+    for (i = 0; i < count; i++)
+    {
+        const index_file *file = &files[i];
+        ptr = putui64(ptr, file->dev);
+        ptr = putui64(ptr, file->ino);
+        ptr = putui64(ptr, file->size);
+        ptr = putui64(ptr, file->mtime);
+        ptr = putui32(ptr, file->mtime_nsec);
+        ptr = putui32(ptr, (uint32_t) num_records);
+        ptr = putui64(ptr, strings_size);
+        ptr = putui64(ptr, file->rsrc_offset);
+        ptr = putui64(ptr, file->rsrc_size);
+        ptr = putui64(ptr, file->junk_offset);
+        ptr = putui64(ptr, file->junk_size);
+        ptr = putui8(ptr, file->type);
+        ptr = putui8(ptr, file->num_records);
+        ptr = putui8(ptr, file->flags);
+        memset(ptr, '\0', 5);
+        ptr += 5;
+        num_records += file->num_records;
+        strings_size += strlen(file->path) + 1;
+    } // for
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < (int) files[i].num_records; j++)
+            ptr = fatelf_encode_record(ptr, &files[i].records[j]);
+    } // for
+
+    for (j = 0; j < num_targets; j++)
+        ptr = fatelf_encode_target(ptr, &targets[j]);
+
+    for (w = 0; w < num_targets * words; w++)
+        ptr = putui64(ptr, bitmaps[w]);
+
+    for (i = 0; i < count; i++)
+    {
+        const size_t len = strlen(files[i].path) + 1;
+        memcpy(ptr, files[i].path, len);
+        ptr += len;
+    } // for
+
+    assert(ptr == buf + buflen);
+
+    fd = xcreate_temp(fname, &tmp);
+    if (stat(fname, &st) == 0)
+        xcopy_file_attrs(tmp, fd, &st, 0);
+    else if (fchmod(fd, 0644) == -1)
+        xfailc(FATELF_EIO, "Failed to chmod '%s': %s", tmp, strerror(errno));
+    xwrite(tmp, fd, buf, (size_t) buflen);
+    xclose_held(tmp, fd);
+    xrename(tmp, fname);
+    unlink_on_xfail_remove(tmp);
+    fatelf_cleanup_pop(free, tmp, 1);
+
+    fatelf_cleanup_pop(free, buf, 1);
+    fatelf_cleanup_pop(free, bitmaps, 1);
+    fatelf_cleanup_pop(free, targets, 1);
+} // xwrite_index
+
+
+static void xusage(const char *argv0)
+{
+    xfail("USAGE: %s update [--jobs=N] [--quiet] <index> <dir> [dir...]\n"
+          "       %s query [--has=TARGET] [--lacks=TARGET] [--elf]"
+          " [--fatelf]\n"
+          "             [--rsrc] [--junk] [--count] [--null] <index>\n"
+          "       %s targets <index>", argv0, argv0, argv0);
+} // xusage
+
+
+// Reuse what we can from the last index. If it's damaged, start over.
+static void open_old_index(const char *fname, fatelf_index *old,
+                           update_state *state)
+{
+    fatelf_catch frame;
+
+    fatelf_catch_enter(&frame);
+    if (setjmp(frame.env) != 0)
+    {
+        fprintf(stderr, "%s; rebuilding it.\n", frame.message);
+        memset(old, '\0', sizeof (*old));
+        return;
+    } // if
+
+    xopen_index(fname, old);
+    fatelf_catch_leave(&frame);
+    state->old = old;
+    hash_old_files(state);
+} // open_old_index
+
+
+static int index_update(int argc, const char **argv)
+{
+    update_state state;
+    fatelf_index old;
+    uint64_t unreadable = 0;
+    const char *fname;
+    int threads = 0;
+    int quiet = 0;
+    int argi;
+    size_t i;
+
+    memset(&state, '\0', sizeof (state));
+    memset(&old, '\0', sizeof (old));
+    for (argi = 2; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if (strncmp(arg, "--jobs=", 7) == 0)
+            threads = xfatelf_parse_jobs(arg + 7);
+        else if (strcmp(arg, "--quiet") == 0)
+            quiet = 1;
+        else if (strncmp(arg, "--", 2) == 0)
+            xusage(argv[0]);
+        else
+            break;
+    } // for
+
+    if (argc - argi < 2)
+        xusage(argv[0]);
+
+    fname = argv[argi++];
+    if (access(fname, F_OK) == 0)
+        open_old_index(fname, &old, &state);
+
+    pthread_mutex_init(&state.lock, NULL);
+    for (; argi < argc; argi++)
+    {
+        const size_t len = strlen(argv[argi]);
+        state.root = argv[argi];
+        state.sep = (len && (argv[argi][len-1] == '/')) ? "" : "/";
+        unreadable += xfatelf_walk(state.root, threads, update_entry, &state);
+    } // for
+    pthread_mutex_destroy(&state.lock);
+
+    if (state.count > 0xFFFFFFFF)
+        xfail("Too many files for one index");
+
+    qsort(state.files, state.count, sizeof (index_file), compare_files);
+    xwrite_index(fname, state.files, (uint32_t) state.count);
+
+    if (!quiet)
+    {
+        fprintf(stderr, "%llu files indexed, %llu read, %llu unchanged,"
+                " %llu unreadable.\n",
+                (unsigned long long) state.count,
+                (unsigned long long) state.reread,
+                (unsigned long long) state.reused,
+                (unsigned long long) (state.errors + unreadable));
+    } // if
+
+    for (i = 0; i < state.count; i++)
+    {
+        free(state.files[i].path);
+        free(state.files[i].records);
+    } // for
+    free(state.files);
+    free(state.slots);
+    close_index(&old);
+
+    return ((state.errors > 0) || (unreadable > 0)) ? 1 : 0;
+} // index_update
+
+
+// OR together the bitmaps of every target in (index) that (target) names.
+static void xtarget_bits(const fatelf_index *index, const char *target,
+                         uint64_t *bits)
+{
+    const uint64_t words = INDEX_WORDS(index->num_files);
+    fatelf_target want;
+    uint32_t t;
+    uint64_t i;
+
+    xfatelf_compile_target(target, &want);
+    if (want.by_index)
+        xfail("'%s' names a record's position, not a target", target);
+    memset(bits, '\0', words * sizeof (uint64_t));
+    for (t = 0; t < index->num_targets; t++)
+    {
+        const uint8_t *bitmap = index->bitmaps + (((uint64_t) t) * words * 8);
+        FATELF_record rec;
+
+        memset(&rec, '\0', sizeof (rec));
+        fatelf_decode_target(index->targets + (t * INDEX_TARGET_SIZE), &rec);
+        if (!fatelf_target_matches(&want, &rec))
+            continue;
+
+        for (i = 0; i < words; i++)
+        {
+            uint64_t word = 0;
+            getui64(bitmap + (i * 8), &word);
+            bits[i] |= word;
+        } // for
+    } // for
+} // xtarget_bits
+
+
+static int index_query(int argc, const char **argv)
+{
+    const char **targets = (const char **) xmalloc(sizeof (char *) * argc);
+    int *lacks = (int *) xmalloc(sizeof (int) * argc);
+    fatelf_index index;
+    uint64_t *result, *bits;
+    uint64_t words, matches = 0;
+    int num_targets = 0;
+    int types = 0;
+    int flags = 0;
+    int count_only = 0;
+    char eol = '\n';
+    int argi;
+    uint32_t i;
+
+    for (argi = 2; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if (strncmp(arg, "--has=", 6) == 0)
+        {
+            lacks[num_targets] = 0;
+            targets[num_targets++] = arg + 6;
+        } // if
+        else if (strncmp(arg, "--lacks=", 8) == 0)
+        {
+            lacks[num_targets] = 1;
+            targets[num_targets++] = arg + 8;
+        } // else if
+        else if (strcmp(arg, "--elf") == 0)
+            types |= (1 << FATELF_PROBE_ELF);
+        else if (strcmp(arg, "--fatelf") == 0)
+            types |= (1 << FATELF_PROBE_FATELF);
+        else if (strcmp(arg, "--rsrc") == 0)
+            flags |= INDEX_HAS_RSRC;
+        else if (strcmp(arg, "--junk") == 0)
+            flags |= INDEX_HAS_JUNK;
+        else if (strcmp(arg, "--count") == 0)
+            count_only = 1;
+        else if ((strcmp(arg, "--null") == 0) || (strcmp(arg, "-0") == 0))
+            eol = '\0';
+        else if (strncmp(arg, "--", 2) == 0)
+            xusage(argv[0]);
+        else
+            break;
+    } // for
+
+    if (argi != argc - 1)
+        xusage(argv[0]);
+    else if (types == 0)
+        types = (1 << FATELF_PROBE_ELF) | (1 << FATELF_PROBE_FATELF);
+
+    xopen_index(argv[argi], &index);
+    words = INDEX_WORDS(index.num_files);
+    result = (uint64_t *) xmalloc((words ? words : 1) * sizeof (uint64_t));
+    bits = (uint64_t *) xmalloc((words ? words : 1) * sizeof (uint64_t));
+
+    // Start with every ELF or FatELF file, then narrow it down by target.
+    for (i = 0; i < index.num_files; i++)
+    {
+        const uint8_t *entry = INDEX_ENTRY(&index, i);
+        if ((types & (1 << entry[80])) && ((entry[82] & flags) == flags))
+            result[i / 64] |= ((uint64_t) 1) << (i % 64);
+    } // for
+
+    for (argi = 0; argi < num_targets; argi++)
+    {
+        uint64_t w;
+        xtarget_bits(&index, targets[argi], bits);
+        for (w = 0; w < words; w++)
+            result[w] &= lacks[argi] ? ~bits[w] : bits[w];
+    } // for
+
+    for (i = 0; i < index.num_files; i++)
+    {
+        if (result[i / 64] & (((uint64_t) 1) << (i % 64)))
+        {
+            matches++;
+            if (!count_only)
+            {
+                index_file file;
+                uint32_t first;
+                decode_file(&index, i, &file, &first);
+                printf("%s%c", file.path, eol);
+            } // if
+        } // if
+    } // for
+
+    if (count_only)
+        printf("%llu\n", (unsigned long long) matches);
+
+    free(bits);
+    free(result);
+    free(lacks);
+    free(targets);
+    close_index(&index);
+    return (matches > 0) ? 0 : 1;
+} // index_query
+
+
+static int index_targets(int argc, const char **argv)
+{
+    fatelf_index index;
+    uint64_t words;
+    uint32_t t;
+
+    if (argc != 3)
+        xusage(argv[0]);
+
+    xopen_index(argv[2], &index);
+    words = INDEX_WORDS(index.num_files);
+    for (t = 0; t < index.num_targets; t++)
+    {
+        const uint8_t *bitmap = index.bitmaps + (((uint64_t) t) * words * 8);
+        char name[FATELF_TARGET_NAME_MAX];
+        int wants = FATELF_WANT_EVERYTHING;
+        uint64_t files = 0;
+        FATELF_record rec;
+        uint64_t i;
+
+        for (i = 0; i < words; i++)
+        {
+            uint64_t word = 0;
+            getui64(bitmap + (i * 8), &word);
+            files += (uint64_t) __builtin_popcountll(word);
+        } // for
+
+        memset(&rec, '\0', sizeof (rec));
+        fatelf_decode_target(index.targets + (t * INDEX_TARGET_SIZE), &rec);
+        printf("%llu\t", (unsigned long long) files);
+        if (get_machine_by_id(rec.machine) == NULL)
+        {
+            printf("machine%u:", (unsigned int) rec.machine);
+            wants &= ~FATELF_WANT_MACHINE;
+        } // if
+        printf("%s\n", fatelf_get_target_name(&rec, wants, name,
+                                              sizeof (name)));
+    } // for
+
+    close_index(&index);
+    return 0;
+} // index_targets
+
+
+int fatelf_index_main(int argc, const char **argv)
+{
+    if (argc < 2)
+        xusage(argv[0]);
+    else if (strcmp(argv[1], "update") == 0)
+        return index_update(argc, argv);
+    else if (strcmp(argv[1], "query") == 0)
+        return index_query(argc, argv);
+    else if (strcmp(argv[1], "targets") == 0)
+        return index_targets(argc, argv);
+
+    xusage(argv[0]);
+    return 1;
+} // fatelf_index_main
+
+
+#if !FATELF_MULTICALL
+int main(int argc, const char **argv)
+{
+    argc = xfatelf_init(argc, argv);
+    return fatelf_index_main(argc, argv);
+} // main
+#endif
+
+// end of fatelf-index.c ...
@@ -9,64 +9,183 @@
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 #include "fatelf-haiku.h"
+#include "fatelf-pack.h"
+
+#include <ctype.h>
+
+static void print_record(const FATELF_record *rec, const unsigned int i,
+                         const int packed)
+{
+    const fatelf_machine_info *machine = get_machine_by_id(rec->machine);
+    const fatelf_osabi_info *osabi = get_osabi_by_id(rec->osabi);
+    char target[FATELF_TARGET_NAME_MAX];
+
+    printf("Binary at index #%d:\n", i);
+    printf("  OSABI %u (%s%s%s) version %u,\n",
+            (unsigned int) rec->osabi, osabi ? osabi->name : "???",
+            osabi ? ": " : "", osabi ? osabi->desc : "",
+            (unsigned int) rec->osabi_version);
+    printf("  %s bits\n", fatelf_get_wordsize_string(rec->word_size));
+    printf("  %s byteorder\n", fatelf_get_byteorder_name(rec->byte_order));
+    printf("  Machine %u (%s%s%s)\n",
+            (unsigned int) rec->machine, machine ? machine->name : "???",
+            machine ? ": " : "", machine ? machine->desc : "");
+    if (packed)
+        printf("  Size %llu, unpacked\n", (unsigned long long) rec->size);
+    else
+    {
+        printf("  Offset %llu\n", (unsigned long long) rec->offset);
+        printf("  Size %llu\n", (unsigned long long) rec->size);
+    } // else
+    printf("  Target name: '%s' or 'record%u'\n",
+           fatelf_get_target_name(rec, FATELF_WANT_EVERYTHING, target,
+                                  sizeof (target)), i);
+} // print_record
+
+
+// A resource type is a four character code, like 'ICON', if it's printable.
+static const char *rsrc_type_name(const uint32_t type, char *buf,
+                                  const size_t buflen)
+{
+    const char code[4] = {
+        (char) (type >> 24), (char) (type >> 16), (char) (type >> 8),
+        (char) type
+    };
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        if (!isprint((unsigned char) code[i]))
+            break;
+    } // for
+
+    if (i == 4)
+        snprintf(buf, buflen, "'%.4s'", code);
+    else
+        snprintf(buf, buflen, "0x%08X", (unsigned int) type);
+    return buf;
+} // rsrc_type_name
+
+
+static void print_resources(const fatelf_view *view)
+{
+    haiku_rsrc_index *index = NULL;
+    fatelf_catch frame;
+    char type[16];
+    uint32_t i;
+
+    // The resources are still there if we can't make sense of their
+    //  table; we just can't list them.
+    fatelf_catch_enter(&frame);
+    if (setjmp(frame.env) != 0)
+    {
+        printf("  Can't list them: %s\n", frame.message);
+        return;
+    } // if
+    index = xhaiku_rsrc_index_view(view);
+    fatelf_catch_leave(&frame);
+
+    if (index == NULL)
+        return;
+
+    for (i = 0; i < index->count; i++)
+    {
+        const haiku_rsrc *rsrc = &index->rsrcs[i];
+        printf("  Resource %s #%d%s%s%s: %llu bytes at offset %llu\n",
+               rsrc_type_name(rsrc->type, type, sizeof (type)),
+               (int) rsrc->id, *rsrc->name ? " \"" : "", rsrc->name,
+               *rsrc->name ? "\"" : "", (unsigned long long) rsrc->size,
+               (unsigned long long) rsrc->offset);
+    } // for
+
+    haiku_rsrc_index_free(index);
+} // print_resources
+
+
+static void fatelf_info_packed(const char *fname, const int fd)
+{
+    fatelf_packed *packed = xfatelf_packed_open(fname, fd);
+    const FATELF_header *header = packed->header;
+    const fatelf_packed_stream *trailer = &packed->streams[header->num_records];
+    unsigned int i = 0;
+
+    fatelf_cleanup_push(fatelf_cleanup_packed, packed);
+
+    printf("%s: packed FatELF file, in %u byte blocks\n", fname,
+           (unsigned int) packed->block_size);
+    printf("%d records.\n", (int) header->num_records);
+    if (trailer->size > 0)
+    {
+        printf("%llu bytes of data after the records, unpacked.\n",
+               (unsigned long long) trailer->size);
+    } // if
+
+    for (i = 0; i < header->num_records; i++)
+        print_record(&header->records[i], i, 1);
+
+    fatelf_cleanup_pop(fatelf_cleanup_packed, packed, 1);
+} // fatelf_info_packed
+
 
 static int fatelf_info(const char *fname)
 {
-    const int fd = xopen(fname, O_RDONLY, 0755);
-    FATELF_header *header = xread_fatelf_header(fname, fd);
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
+    fatelf_view *view;
+    const FATELF_header *header;
     unsigned int i = 0;
     uint64_t junkoffset, junksize;
 
+    if (xfatelf_is_packed(fname, fd))
+    {
+        fatelf_info_packed(fname, fd);
+        xclose_held(fname, fd);
+        return 0;  // success.
+    } // if
+
+    view = xfatelf_view_open(fname, fd);
+    header = view->header;
+    fatelf_cleanup_push(fatelf_cleanup_view, view);
+
     printf("%s: FatELF format version %d\n", fname, (int) header->version);
     printf("%d records.\n", (int) header->num_records);
 
-    if (haiku_find_rsrc(fname, fd, &junkoffset, &junksize))
+    if (haiku_find_rsrc_view(view, &junkoffset, &junksize))
     {
         printf("%llu bytes of shared Haiku resource data at offset %llu.\n",
                (unsigned long long) junksize, (unsigned long long) junkoffset);
+        print_resources(view);
     }
-    else if (xfind_junk(fname, fd, &junkoffset, &junksize))
+    else if (fatelf_view_junk(view, &junkoffset, &junksize))
     {
         printf("%llu bytes of junk appended, starting at offset %llu.\n",
                (unsigned long long) junksize, (unsigned long long) junkoffset);
     } // else if
 
     for (i = 0; i < header->num_records; i++)
-    {
-        const FATELF_record *rec = &header->records[i];
-        const fatelf_machine_info *machine = get_machine_by_id(rec->machine);
-        const fatelf_osabi_info *osabi = get_osabi_by_id(rec->osabi);
-
-        printf("Binary at index #%d:\n", i);
-        printf("  OSABI %u (%s%s%s) version %u,\n",
-                (unsigned int) rec->osabi, osabi ? osabi->name : "???",
-                osabi ? ": " : "", osabi ? osabi->desc : "",
-                (unsigned int) rec->osabi_version);
-        printf("  %s bits\n", fatelf_get_wordsize_string(rec->word_size));
-        printf("  %s byteorder\n", fatelf_get_byteorder_name(rec->byte_order));
-        printf("  Machine %u (%s%s%s)\n",
-                (unsigned int) rec->machine, machine ? machine->name : "???",
-                machine ? ": " : "", machine ? machine->desc : "");
-        printf("  Offset %llu\n", (unsigned long long) rec->offset);
-        printf("  Size %llu\n", (unsigned long long) rec->size);
-        printf("  Target name: '%s' or 'record%u'\n",
-               fatelf_get_target_name(rec, FATELF_WANT_EVERYTHING), i);
-    } // for
+        print_record(&header->records[i], i, 0);
 
-    xclose(fname, fd);
-    free(header);
+    fatelf_cleanup_pop(fatelf_cleanup_view, view, 1);
+    xclose_held(fname, fd);
 
     return 0;  // success.
 } // fatelf_info
 
 
-int main(int argc, const char **argv)
+int fatelf_info_main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
     if (argc != 2)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <fname>", argv[0]);
     return fatelf_info(argv[1]);
+} // fatelf_info_main
+
+
+#if !FATELF_MULTICALL
+int main(int argc, const char **argv)
+{
+    argc = xfatelf_init(argc, argv);
+    return fatelf_info_main(argc, argv);
 } // main
+#endif
 
 // end of fatelf-info.c ...
 
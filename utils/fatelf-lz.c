@@ -0,0 +1,215 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+/* block compression for packed FatELF files... */
+
+#include <stdint.h>
+#include <string.h>
+#include "fatelf-lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 14
+
+static inline uint32_t read32(const uint8_t *ptr)
+{
+    uint32_t retval;
+    memcpy(&retval, ptr, sizeof (retval));
+    return retval;
+} // read32
+
+
+static inline uint32_t hash32(const uint32_t val)
+{
+    return (val * 2654435761U) >> (32 - LZ_HASH_BITS);
+} // hash32
+
+
+// Write a length that didn't fit in its nibble. Returns the new output
+//  position, or zero if it wouldn't fit.
+static size_t put_length(uint8_t *dst, size_t op, const size_t dstlen,
+                         size_t len)
+{
+    while (len >= 255)
+    {
+        if (op >= dstlen)
+            return 0;
+        dst[op++] = 255;
+        len -= 255;
+    } // while
+
+    if (op >= dstlen)
+        return 0;
+    dst[op++] = (uint8_t) len;
+    return op;
+} // put_length
+
+
+// Write one sequence: literals from (lit), then a match, unless this is
+//  the last one and (matchlen) is zero.
+static size_t put_sequence(uint8_t *dst, size_t op, const size_t dstlen,
+                           const uint8_t *lit, const size_t litlen,
+                           const size_t offset, const size_t matchlen)
+{
+    const size_t mlen = matchlen ? (matchlen - LZ_MIN_MATCH) : 0;
+
+    if (op >= dstlen)
+        return 0;
+    dst[op++] = (uint8_t) (((litlen < 15) ? litlen : 15) << 4) |
+                          ((mlen < 15) ? mlen : 15);
+
+    if (litlen >= 15)
+    {
+        if ((op = put_length(dst, op, dstlen, litlen - 15)) == 0)
+            return 0;
+    } // if
+
+    if (op + litlen > dstlen)
+        return 0;
+    memcpy(dst + op, lit, litlen);
+    op += litlen;
+
+    if (matchlen == 0)
+        return op;
+
+    if (op + 2 > dstlen)
+        return 0;
+    dst[op++] = (uint8_t) (offset & 0xFF);
+    dst[op++] = (uint8_t) (offset >> 8);
+
+    if (mlen >= 15)
+        op = put_length(dst, op, dstlen, mlen - 15);  // zero if it won't fit.
+
+    return op;
+} // put_sequence
+
+
+size_t fatelf_lz_compress(const uint8_t *src, const size_t srclen,
+                          uint8_t *dst, const size_t dstlen)
+{
+    // Positions plus one, so zero means "nothing here yet."
+    uint32_t table[1 << LZ_HASH_BITS];
+    size_t anchor = 0;
+    size_t ip = 0;
+    size_t op = 0;
+
+    if (srclen > 0xFFFFFFFE)
+        return 0;  // blocks are never this big.
+
+    memset(table, '\0', sizeof (table));
+
+    while (ip + LZ_MIN_MATCH <= srclen)
+    {
+        const uint32_t seq = read32(src + ip);
+        const uint32_t h = hash32(seq);
+        const size_t ref = table[h];
+        table[h] = (uint32_t) (ip + 1);
+
+        if ((ref != 0) && ((ip - (ref - 1)) <= LZ_MAX_OFFSET) &&
+            (read32(src + ref - 1) == seq))
+        {
+            const size_t match = ref - 1;
+            size_t len = LZ_MIN_MATCH;
+            while ((ip + len < srclen) && (src[match + len] == src[ip + len]))
+                len++;
+
+            op = put_sequence(dst, op, dstlen, src + anchor, ip - anchor,
+                              ip - match, len);
+            if (op == 0)
+                return 0;
+
+            ip += len;
+            anchor = ip;
+            if (ip - 2 + LZ_MIN_MATCH <= srclen)  // helps the next match.
+                table[hash32(read32(src + ip - 2))] = (uint32_t) (ip - 1);
+        } // if
+        else
+        {
+            // Step faster through data that isn't compressing.
+            ip += 1 + ((ip - anchor) >> 6);
+        } // else
+    } // while
+
+    op = put_sequence(dst, op, dstlen, src + anchor, srclen - anchor, 0, 0);
+    return op;
+} // fatelf_lz_compress
+
+
+// Read a length that didn't fit in its nibble, onto (*len). Returns the
+//  new input position, or zero if the block ends first.
+static size_t get_length(const uint8_t *src, size_t ip, const size_t srclen,
+                         size_t *len)
+{
+    uint8_t byte;
+    do
+    {
+        if (ip >= srclen)
+            return 0;
+        byte = src[ip++];
+        *len += byte;
+    } while (byte == 255);
+    return ip;
+} // get_length
+
+
+int fatelf_lz_decompress(const uint8_t *src, const size_t srclen,
+                         uint8_t *dst, const size_t dstlen)
+{
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < srclen)
+    {
+        const uint8_t token = src[ip++];
+        size_t litlen = token >> 4;
+        size_t matchlen = token & 0xF;
+        size_t offset;
+
+        if (litlen == 15)
+        {
+            if ((ip = get_length(src, ip, srclen, &litlen)) == 0)
+                return -1;
+        } // if
+
+        if ((litlen > srclen - ip) || (litlen > dstlen - op))
+            return -1;
+
+        memcpy(dst + op, src + ip, litlen);
+        ip += litlen;
+        op += litlen;
+
+        if (ip == srclen)
+            break;  // the last sequence has no match.
+        else if (srclen - ip < 2)
+            return -1;
+
+        offset = ((size_t) src[ip]) | (((size_t) src[ip + 1]) << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > op))
+            return -1;
+
+        if (matchlen == 15)
+        {
+            if ((ip = get_length(src, ip, srclen, &matchlen)) == 0)
+                return -1;
+        } // if
+
+        matchlen += LZ_MIN_MATCH;
+        if (matchlen > dstlen - op)
+            return -1;
+
+        // This can overlap what it's copying, on purpose, so no memcpy().
+        while (matchlen--)
+        {
+            dst[op] = dst[op - offset];
+            op++;
+        } // while
+    } // while
+
+    return (op == dstlen) ? 0 : -1;
+} // fatelf_lz_decompress
+
+// end of fatelf-lz.c ...
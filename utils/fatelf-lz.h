@@ -0,0 +1,28 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#ifndef FATELF_LZ_H
+#define FATELF_LZ_H
+
+// A small, fast LZ77 block compressor, so packed FatELF files don't need
+//  an outside library. Each block stands alone: a run of sequences, each
+//  a token byte (literal count in the high nibble, match length less four
+//  in the low one; 15 means more length bytes follow, each added on until
+//  one is less than 255), the literals, then a two-byte little endian
+//  offset back to the match. The last sequence is literals only.
+
+// Compress (srclen) bytes into (dst). Returns the compressed size, or zero
+//  if it wouldn't fit in (dstlen) bytes; store the block as-is, then.
+size_t fatelf_lz_compress(const uint8_t *src, const size_t srclen,
+                          uint8_t *dst, const size_t dstlen);
+
+// Decompress a block into exactly (dstlen) bytes. Returns non-zero if the
+//  block is damaged, or doesn't decompress to exactly that size. This
+//  never reads or writes past the ends of either buffer.
+int fatelf_lz_decompress(const uint8_t *src, const size_t srclen,
+                         uint8_t *dst, const size_t dstlen);
+
+#endif /* FATELF_LZ_H */
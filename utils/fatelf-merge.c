@@ -0,0 +1,337 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Merge the ELF binaries from one root filesystem into another, like
+//  merge/merge.sh does, but with a pool of threads and without running
+//  five processes per file.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-walk.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#define MERGE_SKIPPED  0
+#define MERGE_COPIED   1
+#define MERGE_REPLACED 2
+#define MERGE_GLUED    3
+#define MERGE_FAILED   4
+#define MERGE_ACTIONS  5
+
+static const char *action_names[MERGE_ACTIONS] =
+{
+    "skip", "copy", "replace", "glue", "fail"
+};
+
+typedef struct merge_state
+{
+    const char *dest;  // we merge into here...
+    const char *src;   // ...from here, which is what we walk.
+    int dry_run;
+    int verbose;
+    uint64_t counts[MERGE_ACTIONS];
+    uint64_t bytes;  // size of the ELF binaries we merged.
+} merge_state;
+
+
+static char *xjoin_path(const char *root, const char *path)
+{
+    const size_t len = strlen(root) + strlen(path) + 2;
+    char *retval = (char *) xmalloc(len);
+    snprintf(retval, len, "%s/%s", root, path);
+    return retval;
+} // xjoin_path
+
+
+// mkdir -p for everything before the last '/' in (fname). New directories
+//  are 0755, like merge.sh makes them.
+static void xmake_parent_dirs(const char *fname)
+{
+    char *path = xstrdup(fname);
+    char *ptr;
+
+    fatelf_cleanup_push(free, path);
+    for (ptr = strchr(path + 1, '/'); ptr != NULL; ptr = strchr(ptr + 1, '/'))
+    {
+        *ptr = '\0';
+        if ((mkdir(path, 0755) == -1) && (errno != EEXIST))
+        {
+            xfailc(FATELF_EIO, "Failed to create directory '%s': %s",
+                   path, strerror(errno));
+        } // if
+        *ptr = '/';
+    } // for
+    fatelf_cleanup_pop(free, path, 1);
+} // xmake_parent_dirs
+
+
+// cp -a, for a file that isn't in the destination tree yet. It shows up
+//  there all at once, so nothing ever sees half of it.
+static void xmerge_copy(const char *src, const int srcfd,
+                        const struct stat *srcst, const char *dest)
+{
+    const char *slash = strrchr(dest, '/');
+    char *tmp = NULL;
+    int fd;
+
+    if (slash != NULL)  // new directory, too?
+    {
+        char *dir = xstrdup(dest);
+        struct stat st;
+        fatelf_cleanup_push(free, dir);
+        dir[slash - dest] = '\0';
+        if ((*dir != '\0') && (stat(dir, &st) == -1))
+            xmake_parent_dirs(dest);
+        fatelf_cleanup_pop(free, dir, 1);
+    } // if
+
+    fd = xcreate_temp(dest, &tmp);
+    xcopyfile_at(src, srcfd, 0, tmp, fd, 0, (uint64_t) srcst->st_size);
+    xcopy_file_attrs(tmp, fd, srcst, 1);
+    xclose_held(tmp, fd);
+    xrename(tmp, dest);
+    unlink_on_xfail_remove(tmp);
+    fatelf_cleanup_pop(free, tmp, 1);
+} // xmerge_copy
+
+
+// Glue (src) onto the ELF binary at (dest), keeping (dest)'s owner and
+//  permissions, like merge.sh's chmod --reference.
+static void xmerge_glue(const char *src, const char *dest,
+                        const struct stat *destst)
+{
+    const char *bins[2] = { dest, src };
+    char *tmp = NULL;
+    const int fd = xcreate_temp(dest, &tmp);
+    fatelf_ctx *ctx;
+
+    xcopy_file_attrs(tmp, fd, destst, 0);
+    xclose_held(tmp, fd);
+
+    ctx = xfatelf_ctx_create();
+    xfatelf_ctx_finish(ctx, fatelf_glue(ctx, tmp, bins, 2));
+
+    xrename(tmp, dest);
+    unlink_on_xfail_remove(tmp);
+    fatelf_cleanup_pop(free, tmp, 1);
+} // xmerge_glue
+
+
+// Put (src) in place of the record for its target in the FatELF file at
+//  (dest). The new file is built next to it and renamed over, like
+//  merge.sh's mv, so a crash never leaves half of one, and running copies
+//  of the old one keep their own.
+static void xmerge_replace(const char *src, const char *dest,
+                           const struct stat *destst)
+{
+    char *tmp = NULL;
+    const int fd = xcreate_temp(dest, &tmp);
+    fatelf_ctx *ctx;
+
+    xcopy_file_attrs(tmp, fd, destst, 0);
+    xclose_held(tmp, fd);
+
+    ctx = xfatelf_ctx_create();
+    xfatelf_ctx_finish(ctx, fatelf_replace(ctx, tmp, dest, src));
+
+    xrename(tmp, dest);
+    unlink_on_xfail_remove(tmp);
+    fatelf_cleanup_pop(free, tmp, 1);
+} // xmerge_replace
+
+
+// Work out what to do with one file from the source tree, and do it.
+static int xmerge_file(const merge_state *state, const char *path,
+                       const struct stat *srcst)
+{
+    char *src = xjoin_path(state->src, path);
+    char *dest = NULL;
+    fatelf_probe srcprobe;
+    fatelf_probe destprobe;
+    struct stat destst;
+    int action = MERGE_SKIPPED;
+    int srcfd;
+
+    fatelf_cleanup_push(free, src);
+    dest = xjoin_path(state->dest, path);
+    fatelf_cleanup_push(free, dest);
+
+    srcfd = xopen_held(src, O_RDONLY, 0755);
+    xfatelf_probe(src, srcfd, &srcprobe);
+    fatelf_cleanup_push(fatelf_cleanup_probe, &srcprobe);
+
+    if (srcprobe.type != FATELF_PROBE_ELF)
+        action = MERGE_SKIPPED;  // merge.sh only takes plain ELF files.
+    else if (lstat(dest, &destst) == -1)
+    {
+        if (errno != ENOENT)
+            xfailc(FATELF_EIO, "Failed to stat '%s': %s", dest, strerror(errno));
+        action = MERGE_COPIED;
+    } // else if
+    else if (S_ISREG(destst.st_mode))
+    {
+        const int destfd = xopen_held(dest, O_RDONLY, 0755);
+        xfatelf_probe(dest, destfd, &destprobe);
+        xclose_held(dest, destfd);
+
+        if (destprobe.type == FATELF_PROBE_FATELF)
+            action = MERGE_REPLACED;
+        else if ((destprobe.type == FATELF_PROBE_ELF) &&
+                 (!fatelf_record_matches(&destprobe.elf, &srcprobe.elf)))
+            action = MERGE_GLUED;  // merge.sh only checks 32 vs 64 bits.
+        fatelf_probe_free(&destprobe);
+    } // else if
+
+    if (state->dry_run || state->verbose)
+        printf("%s %s\n", action_names[action], path);
+
+    if (!state->dry_run)
+    {
+        if (action == MERGE_COPIED)
+            xmerge_copy(src, srcfd, srcst, dest);
+        else if (action == MERGE_REPLACED)
+            xmerge_replace(src, dest, &destst);
+        else if (action == MERGE_GLUED)
+            xmerge_glue(src, dest, &destst);
+    } // if
+
+    fatelf_cleanup_pop(fatelf_cleanup_probe, &srcprobe, 1);
+    xclose_held(src, srcfd);
+    fatelf_cleanup_pop(free, dest, 1);
+    fatelf_cleanup_pop(free, src, 1);
+    return action;
+} // xmerge_file
+
+
+// The walk callback; this runs on all the walker's threads at once, and
+//  an xfail() only fails the file it happened on.
+static void merge_entry(void *data, const char *path, const int dirfd,
+                        const char *name, const struct stat *st)
+{
+    merge_state *state = (merge_state *) data;
+    fatelf_catch frame;
+    int action;
+
+    (void) dirfd;
+    (void) name;
+
+    if (!S_ISREG(st->st_mode))
+        return;  // symlinks, devices, etc: not ours.
+
+    fatelf_catch_enter(&frame);
+    if (setjmp(frame.env) != 0)
+    {
+        fprintf(stderr, "'%s': %s\n", path, frame.message);
+        __atomic_add_fetch(&state->counts[MERGE_FAILED], 1, __ATOMIC_RELAXED);
+        return;
+    } // if
+
+    action = xmerge_file(state, path, st);
+    fatelf_catch_leave(&frame);
+
+    __atomic_add_fetch(&state->counts[action], 1, __ATOMIC_RELAXED);
+    if (action != MERGE_SKIPPED)
+    {
+        __atomic_add_fetch(&state->bytes, (uint64_t) st->st_size,
+                           __ATOMIC_RELAXED);
+    } // if
+} // merge_entry
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0);
+} // now
+
+
+static void xusage(const char *argv0)
+{
+    xfail("USAGE: %s [--jobs=N] [--dry-run] [--verbose] <dest> <src>"
+          " [subdir...]", argv0);
+} // xusage
+
+
+int fatelf_merge_main(int argc, const char **argv)
+{
+    merge_state state;
+    uint64_t files = 0;
+    uint64_t unreadable = 0;
+    double start, elapsed, mb;
+    int threads = 0;
+    int argi;
+    int i;
+
+    memset(&state, '\0', sizeof (state));
+    for (argi = 1; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if (strncmp(arg, "--jobs=", 7) == 0)
+            threads = xfatelf_parse_jobs(arg + 7);
+        else if (strcmp(arg, "--dry-run") == 0)
+            state.dry_run = 1;
+        else if (strcmp(arg, "--verbose") == 0)
+            state.verbose = 1;
+        else if (strncmp(arg, "--", 2) == 0)
+            xusage(argv[0]);
+        else
+            break;
+    } // for
+
+    if (argc - argi < 2)
+        xusage(argv[0]);
+
+    start = now();
+    for (i = argi + 2; (i == argi + 2) || (i < argc); i++)
+    {
+        const char *subdir = (i < argc) ? argv[i] : NULL;
+        char *dest = subdir ? xjoin_path(argv[argi], subdir) : NULL;
+        char *src = subdir ? xjoin_path(argv[argi + 1], subdir) : NULL;
+        state.dest = dest ? dest : argv[argi];
+        state.src = src ? src : argv[argi + 1];
+        if ((subdir != NULL) && (access(state.src, F_OK) == -1))
+            fprintf(stderr, "Skipping '%s': %s\n", state.src, strerror(errno));
+        else
+            unreadable += xfatelf_walk(state.src, threads, merge_entry, &state);
+        free(dest);
+        free(src);
+    } // for
+    elapsed = now() - start;
+    mb = ((double) state.bytes) / (1024.0 * 1024.0);
+
+    for (i = 0; i < MERGE_ACTIONS; i++)
+        files += state.counts[i];
+
+    printf("%llu files: %llu copied, %llu replaced, %llu glued,"
+           " %llu skipped, %llu failed.\n",
+           (unsigned long long) files,
+           (unsigned long long) state.counts[MERGE_COPIED],
+           (unsigned long long) state.counts[MERGE_REPLACED],
+           (unsigned long long) state.counts[MERGE_GLUED],
+           (unsigned long long) state.counts[MERGE_SKIPPED],
+           (unsigned long long) state.counts[MERGE_FAILED]);
+    printf("%.1f MB merged in %.2f seconds with %d threads"
+           " (%.0f files/s, %.1f MB/s).\n",
+           mb, elapsed, fatelf_walk_threads(threads),
+           (elapsed > 0.0) ? (((double) files) / elapsed) : 0.0,
+           (elapsed > 0.0) ? (mb / elapsed) : 0.0);
+
+    return ((state.counts[MERGE_FAILED] > 0) || (unreadable > 0)) ? 1 : 0;
+} // fatelf_merge_main
+
+
+#if !FATELF_MULTICALL
+int main(int argc, const char **argv)
+{
+    argc = xfatelf_init(argc, argv);
+    return fatelf_merge_main(argc, argv);
+} // main
+#endif
+
+// end of fatelf-merge.c ...
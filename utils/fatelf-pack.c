@@ -0,0 +1,561 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+/* packed (compressed) FatELF files... */
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-pack.h"
+#include "fatelf-haiku.h"
+#include "fatelf-lz.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static uint32_t count_blocks(const uint64_t size, const uint32_t block_size)
+{
+    return (uint32_t) ((size + block_size - 1) / block_size);
+} // count_blocks
+
+
+int xfatelf_is_packed(const char *fname, const int fd)
+{
+    uint8_t buf[4];
+    uint32_t magic = 0;
+    if (xpread(fname, fd, buf, sizeof (buf), 0, 0) < (ssize_t) sizeof (buf))
+        return 0;
+    getui32(buf, &magic);
+    return (magic == FATELF_PACKED_MAGIC);
+} // xfatelf_is_packed
+
+
+fatelf_packed *xfatelf_packed_open(const char *fname, const int fd)
+{
+    const uint64_t fsize = xget_file_size(fname, fd);
+    fatelf_packed *packed = (fatelf_packed *) xmalloc(sizeof (fatelf_packed));
+    uint8_t buf[FATELF_PACKED_HEADER_SIZE(255)];
+    const uint8_t *ptr = buf;
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    uint8_t recs = 0;
+    int i;
+
+    fatelf_cleanup_push(fatelf_cleanup_packed, packed);
+    if (xpread(fname, fd, buf, 16, 0, 0) < 16)
+        xfailc(FATELF_EFORMAT, "'%s' is not a packed FatELF file", fname);
+
+    ptr = getui32(ptr, &magic);
+    ptr = getui16(ptr, &version);
+    ptr = getui8(ptr, &recs);
+    ptr = getui32(ptr + 1, &packed->block_size);
+    if (magic != FATELF_PACKED_MAGIC)
+        xfailc(FATELF_EFORMAT, "'%s' is not a packed FatELF file", fname);
+    else if (version != FATELF_PACKED_VERSION)
+    {
+        xfailc(FATELF_EFORMAT, "'%s' uses an unsupported packed format (%d)",
+               fname, (int) version);
+    } // else if
+
+    if ((packed->block_size < 4096) || (packed->block_size > (64 << 20)))
+        xfailc(FATELF_EFORMAT, "'%s' has a bad block size", fname);
+
+    xpread(fname, fd, buf, FATELF_PACKED_HEADER_SIZE(recs), 0, 1);
+    packed->header = (FATELF_header *) xmalloc(fatelf_header_size(recs));
+    packed->header->magic = FATELF_MAGIC;
+    packed->header->version = FATELF_FORMAT_VERSION;
+    packed->header->num_records = (uint8_t) recs;
+    packed->streams = (fatelf_packed_stream *)
+        xmalloc(sizeof (fatelf_packed_stream) * (recs + 1));
+
+    ptr = buf + 16;
+    for (i = 0; i <= recs; i++)
+    {
+        fatelf_packed_stream *stream = &packed->streams[i];
+        FATELF_record target;
+        uint32_t blocks;
+        uint64_t room;
+
+        ptr = fatelf_decode_target(ptr, &target);
+        ptr = getui64(ptr, &stream->size);
+        ptr = getui64(ptr, &stream->index_offset);
+        ptr = getui32(ptr, &stream->num_blocks);
+        ptr += 4;  // reserved.
+        blocks = count_blocks(stream->size, packed->block_size);
+        room = (stream->index_offset > fsize) ? 0 :
+               (fsize - stream->index_offset);
+        room /= FATELF_PACKED_INDEX_ENTRY_SIZE;
+        if ((stream->num_blocks != blocks) || (room < stream->num_blocks))
+            xfailc(FATELF_EFORMAT, "'%s' has a damaged block index", fname);
+
+        if (i < recs)
+        {
+            FATELF_record *rec = &packed->header->records[i];
+            *rec = target;
+            rec->offset = 0;
+            rec->size = stream->size;
+        } // if
+    } // for
+
+    fatelf_cleanup_pop(fatelf_cleanup_packed, packed, 0);  // caller's now.
+    return packed;
+} // xfatelf_packed_open
+
+
+void fatelf_packed_close(fatelf_packed *packed)
+{
+    if (packed != NULL)
+    {
+        free(packed->header);
+        free(packed->streams);
+        free(packed);
+    } // if
+} // fatelf_packed_close
+
+
+void fatelf_cleanup_packed(void *packed)
+{
+    fatelf_packed_close((fatelf_packed *) packed);
+} // fatelf_cleanup_packed
+
+
+// Unpack block (i) of a stream. What it unpacks to ends up in (raw), or in
+//  (buf) if it was stored as-is; returns which, with its length in (*len).
+static const uint8_t *xunpack_block(const fatelf_packed *packed,
+                                    const fatelf_packed_stream *stream,
+                                    const char *fname, const int fd,
+                                    const uint32_t i, uint8_t *raw,
+                                    uint8_t *buf, size_t *len)
+{
+    const uint64_t entry = stream->index_offset +
+                           (((uint64_t) i) * FATELF_PACKED_INDEX_ENTRY_SIZE);
+    const uint64_t remaining = stream->size -
+                               (((uint64_t) i) * packed->block_size);
+    uint8_t index[FATELF_PACKED_INDEX_ENTRY_SIZE];
+    const uint8_t *ptr = index;
+    uint64_t offset;
+    uint32_t stored, flags;
+
+    *len = (remaining < packed->block_size) ?
+                (size_t) remaining : packed->block_size;
+
+    xpread(fname, fd, index, sizeof (index), entry, 1);
+    ptr = getui64(ptr, &offset);
+    ptr = getui32(ptr, &stored);
+    getui32(ptr, &flags);
+
+    if ((stored > packed->block_size) ||
+        ((flags & FATELF_PACKED_BLOCK_STORED) && (stored != *len)))
+        xfailc(FATELF_EFORMAT, "'%s' has a damaged block index", fname);
+
+    xpread(fname, fd, buf, stored, offset, 1);
+    if (flags & FATELF_PACKED_BLOCK_STORED)
+        return buf;
+    else if (fatelf_lz_decompress(buf, stored, raw, *len) != 0)
+        xfailc(FATELF_EFORMAT, "'%s' has a damaged block", fname);
+    return raw;
+} // xunpack_block
+
+
+// Unpack one stream, a block at a time, to (out)'s file position.
+static void xunpack_stream(const fatelf_packed *packed,
+                           const fatelf_packed_stream *stream,
+                           const char *fname, const int fd, uint8_t *raw,
+                           uint8_t *buf, const char *out, const int outfd)
+{
+    uint32_t i;
+
+    for (i = 0; i < stream->num_blocks; i++)
+    {
+        size_t len = 0;
+        const uint8_t *data = xunpack_block(packed, stream, fname, fd, i,
+                                            raw, buf, &len);
+        xwrite(out, outfd, data, len);
+    } // for
+} // xunpack_stream
+
+
+// Unpack the (len) bytes at (offset) in a stream to (dst), which the
+//  caller checked are all in it.
+static void xunpack_range(const fatelf_packed *packed,
+                          const fatelf_packed_stream *stream,
+                          const char *fname, const int fd, uint8_t *raw,
+                          uint8_t *buf, uint64_t offset, uint64_t len,
+                          uint8_t *dst)
+{
+    while (len > 0)
+    {
+        const uint32_t i = (uint32_t) (offset / packed->block_size);
+        const uint64_t skip = offset % packed->block_size;
+        size_t blocklen = 0;
+        const uint8_t *data = xunpack_block(packed, stream, fname, fd, i,
+                                            raw, buf, &blocklen);
+        const uint64_t cpy = ((blocklen - skip) < len) ?
+                                (blocklen - skip) : len;
+        memcpy(dst, data + skip, (size_t) cpy);
+        dst += cpy;
+        offset += cpy;
+        len -= cpy;
+    } // while
+} // xunpack_range
+
+
+// Tables longer than this, we don't believe.
+#define PACKED_TABLE_MAX (16 * 1024 * 1024)
+
+// Where Haiku resources go in the ELF binary that record (idx) unpacks to.
+//  That binary might be on its way down a pipe, so this gets its header and
+//  tables from the packed file, like xextract_stream() keeps them as they
+//  go by.
+static uint64_t xpacked_rsrc_offset(const fatelf_packed *packed,
+                                    const int idx, const char *fname,
+                                    const int fd, uint8_t *raw, uint8_t *buf)
+{
+    const fatelf_packed_stream *stream = &packed->streams[idx];
+    const uint64_t size = stream->size;
+    const uint64_t prefixlen = (size < FATELF_PROBE_SIZE) ?
+                                    size : FATELF_PROBE_SIZE;
+    uint8_t *prefix = (uint8_t *) xmalloc(prefixlen ? prefixlen : 1);
+    uint8_t *tables[HAIKU_ELF_TABLES];
+    uint64_t offsets[HAIKU_ELF_TABLES];
+    uint64_t lens[HAIKU_ELF_TABLES];
+    uint64_t retval = 0;
+    int ok = 0;
+    int i;
+
+    fatelf_cleanup_push(free, prefix);
+    xunpack_range(packed, stream, fname, fd, raw, buf, 0, prefixlen, prefix);
+
+    memset(tables, '\0', sizeof (tables));
+    if (haiku_elf_rsrc_tables(fname, prefix, prefixlen, offsets, lens))
+    {
+        for (i = 0; i < HAIKU_ELF_TABLES; i++)
+        {
+            if ((lens[i] == 0) || (offsets[i] + lens[i] <= prefixlen))
+                continue;  // nothing else to unpack.
+            else if ((offsets[i] > size) || (lens[i] > size - offsets[i]))
+                continue;  // truncated; haiku_rsrc_offset_tables() fails.
+            else if (lens[i] > PACKED_TABLE_MAX)
+                continue;  // nonsense; ditto.
+
+            tables[i] = (uint8_t *) xmalloc((size_t) lens[i]);
+            fatelf_cleanup_push(free, tables[i]);
+            xunpack_range(packed, stream, fname, fd, raw, buf, offsets[i],
+                          lens[i], tables[i]);
+        } // for
+
+        ok = haiku_rsrc_offset_tables(fname, prefix, prefixlen, size,
+                                      (const uint8_t *const *) tables,
+                                      offsets, lens, &retval);
+    } // if
+
+    for (i = HAIKU_ELF_TABLES; i > 0; i--)
+    {
+        if (tables[i-1] != NULL)
+            fatelf_cleanup_pop(free, tables[i-1], 1);
+    } // for
+    fatelf_cleanup_pop(free, prefix, 1);
+
+    if (!ok)
+    {
+        xfailc(FATELF_EFORMAT,
+               "Could not determine target offset for Haiku resources");
+    } // if
+    return retval;
+} // xpacked_rsrc_offset
+
+
+void xfatelf_packed_extract(const fatelf_packed *packed, const char *fname,
+                            const int fd, const int idx, const char *out,
+                            const int outfd)
+{
+    uint8_t *raw = (uint8_t *) xmalloc(packed->block_size);
+    uint8_t *buf = NULL;
+    const int recs = (int) packed->header->num_records;
+    const fatelf_packed_stream *trailer = &packed->streams[recs];
+    uint8_t look[HAIKU_FAT_RSRC_LOOKAHEAD];
+    uint64_t skip = 0;
+
+    fatelf_cleanup_push(free, raw);
+    buf = (uint8_t *) xmalloc(packed->block_size);
+    fatelf_cleanup_push(free, buf);
+
+    assert((idx >= 0) && (idx < recs));
+    xunpack_stream(packed, &packed->streams[idx], fname, fd, raw, buf,
+                   out, outfd);
+
+    // Haiku resources were packed from where they start, without the
+    //  padding that lined them up in the FatELF file, so they can go where
+    //  this binary wants them, as xfatelf_view_append_junk() puts them.
+    if (trailer->size >= sizeof (look))
+    {
+        xunpack_range(packed, trailer, fname, fd, raw, buf, 0,
+                      sizeof (look), look);
+    } // if
+
+    if ( (trailer->size >= sizeof (look)) &&
+         (haiku_fat_rsrc_stream(0, look, sizeof (look), &skip)) )
+    {
+        const uint64_t size = packed->streams[idx].size;
+        const uint64_t offset = xpacked_rsrc_offset(packed, idx, fname, fd,
+                                                    raw, buf);
+        if (offset >= size)
+            xwrite_zeros(out, outfd, (size_t) (offset - size));
+        else
+            xlseek(out, outfd, (off_t) (offset - size), SEEK_CUR);
+    } // if
+
+    xunpack_stream(packed, trailer, fname, fd, raw, buf, out, outfd);
+
+    fatelf_cleanup_pop(free, buf, 1);
+    fatelf_cleanup_pop(free, raw, 1);
+} // xfatelf_packed_extract
+
+
+// One block on its way into a packed file.
+typedef struct pack_block
+{
+    uint64_t inoff;
+    size_t len;
+    uint8_t *raw;
+    uint8_t *packed;
+    size_t packed_len;
+    int err;  // errno, if reading it failed.
+} pack_block;
+
+typedef struct pack_batch
+{
+    int fd;
+    pack_block *blocks;
+    int count;
+    int next;  // the next block a thread should take.
+} pack_batch;
+
+
+// The compressing threads. These can't xfail(), since there's no catch
+//  frame on them; errors are picked up after they're done.
+static void *pack_thread(void *arg)
+{
+    pack_batch *batch = (pack_batch *) arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+            batch->count)
+    {
+        pack_block *block = &batch->blocks[i];
+        size_t total = 0;
+
+        block->err = 0;
+        while (total < block->len)
+        {
+            const ssize_t br = pread(batch->fd, block->raw + total,
+                                     block->len - total,
+                                     (off_t) (block->inoff + total));
+            if ((br == -1) && (errno == EINTR))
+                continue;
+            else if (br <= 0)
+            {
+                block->err = (br == 0) ? EIO : errno;  // EOF: truncated.
+                break;
+            } // else if
+            total += (size_t) br;
+        } // while
+
+        if (block->err == 0)
+        {
+            block->packed_len = fatelf_lz_compress(block->raw, block->len,
+                                                   block->packed, block->len);
+        } // if
+    } // while
+
+    return NULL;
+} // pack_thread
+
+
+static void run_pack_batch(pack_batch *batch, pthread_t *tids,
+                           const int threads)
+{
+    int started = 0;
+    int i;
+
+    batch->next = 0;
+    for (i = 1; i < threads; i++)
+    {
+        if (pthread_create(&tids[started], NULL, pack_thread, batch) == 0)
+            started++;
+    } // for
+
+    pack_thread(batch);  // this thread helps, too.
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+} // run_pack_batch
+
+
+void xfatelf_pack(const char *fname, const int fd, const char *out,
+                  const int outfd, const int threads)
+{
+    const uint32_t block_size = FATELF_PACKED_BLOCK_SIZE;
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    const int recs = (int) header->num_records;
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const int nthreads = (threads > 0) ? threads : ((cpus > 0) ? (int)cpus : 1);
+    const int maxbatch = nthreads * 4;
+    uint8_t hdr[FATELF_PACKED_HEADER_SIZE(255)];
+    uint64_t inoffs[256];
+    uint64_t sizes[256];
+    uint64_t total_blocks = 0;
+    uint64_t index_offset;
+    uint64_t data_offset;
+    uint8_t *index = NULL;
+    uint8_t *ptr;
+    uint64_t index_size;
+    uint64_t pos = 0;  // how far into stream (s) we've batched.
+    pthread_t *tids = NULL;
+    pack_batch batch;
+    uint64_t junkoff = 0;
+    uint64_t junksize = 0;
+    int s, i;
+
+    fatelf_cleanup_push(free, header);
+
+    // Every record, then whatever follows the last one.
+    for (s = 0; s < recs; s++)
+    {
+        inoffs[s] = header->records[s].offset;
+        sizes[s] = header->records[s].size;
+    } // for
+    if (!fatelf_find_junk(header, xget_file_size(fname, fd), &junkoff,
+                          &junksize))
+        junkoff = junksize = 0;
+
+    // Haiku resources are packed from where they start, without the padding
+    //  that lines them up here; unpacking puts them where the binary that
+    //  comes out wants them.
+    if (junksize >= HAIKU_FAT_RSRC_LOOKAHEAD)
+    {
+        uint8_t look[HAIKU_FAT_RSRC_LOOKAHEAD];
+        uint64_t skip = 0;
+        xpread(fname, fd, look, sizeof (look), junkoff, 1);
+        if (haiku_fat_rsrc_stream(junkoff, look, sizeof (look), &skip))
+        {
+            junkoff += skip;
+            junksize -= skip;
+        } // if
+    } // if
+    inoffs[recs] = junkoff;
+    sizes[recs] = junksize;
+
+    // Lay out the header and the block indexes; the blocks follow them.
+    memset(hdr, '\0', sizeof (hdr));
+    ptr = putui32(hdr, FATELF_PACKED_MAGIC);
+    ptr = putui16(ptr, FATELF_PACKED_VERSION);
+    ptr = putui8(ptr, (uint8_t) recs);
+    ptr = putui8(ptr, 0);
+    ptr = putui32(ptr, block_size);
+    ptr = putui32(ptr, 0);
+
+    index_offset = FATELF_PACKED_HEADER_SIZE(recs);
+    for (s = 0; s <= recs; s++)
+    {
+        const uint32_t blocks = count_blocks(sizes[s], block_size);
+        if (s < recs)
+            ptr = fatelf_encode_target(ptr, &header->records[s]);
+        else
+            ptr = putui64(ptr, 0);  // the trailing data has no target.
+        ptr = putui64(ptr, sizes[s]);
+        ptr = putui64(ptr, index_offset +
+                           (total_blocks * FATELF_PACKED_INDEX_ENTRY_SIZE));
+        ptr = putui32(ptr, blocks);
+        ptr = putui32(ptr, 0);
+        total_blocks += blocks;
+    } // for
+
+    index_size = total_blocks * FATELF_PACKED_INDEX_ENTRY_SIZE;
+    if (index_size != (uint64_t) ((size_t) index_size))
+        xfailc(FATELF_ENOMEM, "'%s' is too big to pack", fname);
+
+    index = (uint8_t *) xmalloc((size_t) index_size + 1);
+    fatelf_cleanup_push(free, index);
+    data_offset = index_offset + index_size;
+
+    // Compress a batch of blocks across the threads, write them out in
+    //  order, repeat. Only one batch is in memory at a time.
+    memset(&batch, '\0', sizeof (batch));
+    batch.fd = fd;
+    tids = (pthread_t *) xmalloc(sizeof (pthread_t) * nthreads);
+    fatelf_cleanup_push(free, tids);
+    batch.blocks = (pack_block *) xmalloc(sizeof (pack_block) * maxbatch);
+    fatelf_cleanup_push(free, batch.blocks);
+    for (i = 0; i < maxbatch; i++)
+    {
+        batch.blocks[i].raw = (uint8_t *) xmalloc(block_size);
+        fatelf_cleanup_push(free, batch.blocks[i].raw);
+        batch.blocks[i].packed = (uint8_t *) xmalloc(block_size);
+        fatelf_cleanup_push(free, batch.blocks[i].packed);
+    } // for
+
+    ptr = index;
+    s = 0;
+    while (s <= recs)
+    {
+        batch.count = 0;
+        while ((s <= recs) && (batch.count < maxbatch))
+        {
+            pack_block *block;
+            uint64_t left;
+
+            if (pos >= sizes[s])  // done with this stream.
+            {
+                s++;
+                pos = 0;
+                continue;
+            } // if
+
+            block = &batch.blocks[batch.count++];
+            left = sizes[s] - pos;
+            block->inoff = inoffs[s] + pos;
+            block->len = (left < block_size) ? (size_t) left : block_size;
+            pos += block->len;
+        } // while
+
+        run_pack_batch(&batch, tids, nthreads);
+
+        for (i = 0; i < batch.count; i++)
+        {
+            const pack_block *block = &batch.blocks[i];
+            const int stored = (block->packed_len == 0);
+            const size_t len = stored ? block->len : block->packed_len;
+
+            if (block->err != 0)
+            {
+                xfailc(FATELF_EIO, "Failed to read '%s': %s",
+                       fname, strerror(block->err));
+            } // if
+
+            xpwrite(out, outfd, stored ? block->raw : block->packed,
+                    len, data_offset);
+            ptr = putui64(ptr, data_offset);
+            ptr = putui32(ptr, (uint32_t) len);
+            ptr = putui32(ptr, stored ? FATELF_PACKED_BLOCK_STORED : 0);
+            data_offset += len;
+        } // for
+    } // while
+
+    xpwrite(out, outfd, hdr, FATELF_PACKED_HEADER_SIZE(recs), 0);
+    xpwrite(out, outfd, index, (size_t) (ptr - index), index_offset);
+
+    for (i = maxbatch - 1; i >= 0; i--)
+    {
+        fatelf_cleanup_pop(free, batch.blocks[i].packed, 1);
+        fatelf_cleanup_pop(free, batch.blocks[i].raw, 1);
+    } // for
+    fatelf_cleanup_pop(free, batch.blocks, 1);
+    fatelf_cleanup_pop(free, tids, 1);
+    fatelf_cleanup_pop(free, index, 1);
+    fatelf_cleanup_pop(free, header, 1);
+} // xfatelf_pack
+
+// end of fatelf-pack.c ...
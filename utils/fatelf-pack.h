@@ -0,0 +1,77 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#ifndef FATELF_PACK_H
+#define FATELF_PACK_H
+
+// Packed FatELF files are for shipping and storing FatELF binaries, not
+//  running them: every record (and any data after the last one, like Haiku
+//  resources) is cut into blocks that are compressed on their own, with an
+//  index, so one record can be pulled out without unpacking the rest, and
+//  without more than a block or two in memory. They have their own magic
+//  number, so no loader will ever mistake one for a FatELF binary.
+//
+// Everything on disk is little endian:
+//
+//   header: uint32 magic, uint16 version, uint8 num_records, uint8 zero,
+//           uint32 block_size, uint32 zero.
+//   then num_records+1 streams: the records in order, then the trailing
+//           data (for Haiku resources, from where they start, without the
+//           padding before them). Each is the record's eight target bytes
+//           (like in a FatELF header; all zero for the trailing data),
+//           uint64 size once unpacked, uint64 offset of its block index,
+//           uint32 block count, uint32 zero.
+//   block indexes: for each block, uint64 offset, uint32 stored size,
+//           uint32 flags. Every block but a stream's last one unpacks to
+//           block_size bytes.
+//   then the blocks themselves.
+
+/* This looks like "FA700E5A" in a hex editor. */
+#define FATELF_PACKED_MAGIC (0x5A0E70FA)
+#define FATELF_PACKED_VERSION (1)
+#define FATELF_PACKED_HEADER_SIZE(recs) (16 + (32 * ((recs) + 1)))
+#define FATELF_PACKED_INDEX_ENTRY_SIZE 16
+
+#define FATELF_PACKED_BLOCK_STORED (1 << 0)  // not compressed at all.
+
+// Blocks are this big by default, unpacked.
+#define FATELF_PACKED_BLOCK_SIZE (256 * 1024)
+
+typedef struct fatelf_packed_stream
+{
+    uint64_t size;
+    uint64_t index_offset;
+    uint32_t num_blocks;
+} fatelf_packed_stream;
+
+typedef struct fatelf_packed
+{
+    uint32_t block_size;
+    FATELF_header *header;  // targets and unpacked sizes; offsets are zero.
+    fatelf_packed_stream *streams;  // num_records of them, then the trailer.
+} fatelf_packed;
+
+// Non-zero if the file starts with the packed magic number.
+int xfatelf_is_packed(const char *fname, const int fd);
+
+// Read and check a packed file's header. fatelf_packed_close() it.
+fatelf_packed *xfatelf_packed_open(const char *fname, const int fd);
+void fatelf_packed_close(fatelf_packed *packed);
+void fatelf_cleanup_packed(void *packed);  // fatelf_packed_close(), cleanup.
+
+// Unpack record (idx), and the trailing data after it, to (out), starting
+//  at its current file position. Haiku resources go where that binary
+//  wants them.
+void xfatelf_packed_extract(const fatelf_packed *packed, const char *fname,
+                            const int fd, const int idx, const char *out,
+                            const int outfd);
+
+// Pack FatELF file (fname) into (out), compressing blocks on (threads)
+//  threads at once; zero means one per CPU.
+void xfatelf_pack(const char *fname, const int fd, const char *out,
+                  const int outfd, const int threads);
+
+#endif /* FATELF_PACK_H */
@@ -0,0 +1,53 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+int fatelf_reorder_main(int argc, const char **argv)
+{
+    fatelf_window_policy window = FATELF_WINDOW_WARN;
+    FATELF_header *header;
+    fatelf_ctx *ctx;
+    const char *fname;
+    int fd;
+
+    if ((argc > 1) && (strncmp(argv[1], "--window=", 9) == 0))
+    {
+        window = xfatelf_parse_window_policy(argv[1] + 9);
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    } // if
+
+    if ((argc != 2) && (argc != 3))  // this could stand to use getopt(), later.
+        xfail("USAGE: %s [--window=POLICY] <in> [targets]", argv[0]);
+
+    fname = argv[1];
+    ctx = xfatelf_ctx_create();
+    xfatelf_ctx_finish(ctx, fatelf_reorder(ctx, fname,
+                                           (argc == 3) ? argv[2] : "default"));
+
+    // Say if the best order still leaves something out of the loader's reach.
+    fd = xopen_held(fname, O_RDONLY, 0755);
+    header = xread_fatelf_header(fname, fd);
+    fatelf_cleanup_push(free, header);
+    xfatelf_warn_loader_window(fname, header, window);
+    fatelf_cleanup_pop(free, header, 1);
+    xclose_held(fname, fd);
+    return 0;  // success.
+} // fatelf_reorder_main
+
+
+#if !FATELF_MULTICALL
+int main(int argc, const char **argv)
+{
+    argc = xfatelf_init(argc, argv);
+    return fatelf_reorder_main(argc, argv);
+} // main
+#endif
+
+// end of fatelf-reorder.c ...
@@ -9,81 +9,34 @@
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 
-static int xfind_fatelf_record_by_elf(const char *fname, const int fd,
-                                      const char *fatfname,
-                                      const FATELF_header *header)
+int fatelf_replace_main(int argc, const char **argv)
 {
-    FATELF_record record;
-    int i;
+    fatelf_ctx *ctx;
+    int rc;
 
-    xread_elf_header(fname, fd, 0, &record);
-    for (i = 0; i < ((int)header->num_records); i++)
-    {
-        if (fatelf_record_matches(&header->records[i], &record))
-            return i;
-    } // for
-
-    xfail("No record matches '%s' in FatELF file '%s'", fname, fatfname);
-    return -1;
-} // xfind_fatelf_record_by_elf
-
-
-static int fatelf_replace(const char *out, const char *fname,
-                          const char *newobj)
-{
-    const int fd = xopen(fname, O_RDONLY, 0755);
-    const int newfd = xopen(newobj, O_RDONLY, 0755);
-    FATELF_header *header = xread_fatelf_header(fname, fd);
-    const int idx = xfind_fatelf_record_by_elf(newobj, newfd, fname, header);
-    const int outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
-    uint64_t offset = FATELF_DISK_FORMAT_SIZE(((int)header->num_records));
-    int i;
-
-    unlink_on_xfail = out;
-
-    // pad out some bytes for the header we'll write at the end...
-    xwrite_zeros(out, outfd, (size_t) offset);
-
-    for (i = 0; i < ((int) header->num_records); i++)
+    if (argc != 4)  // this could stand to use getopt(), later.
     {
-        const uint64_t binary_offset = align_to_page(offset);
-        FATELF_record *rec = &header->records[i];
-
-        // append this binary to the final file, padded to page alignment.
-        xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
-
-        if (i == idx)  // the thing we're replacing...
-            rec->size = xcopyfile(newobj, newfd, out, outfd);
-        else
-            xcopyfile_range(fname, fd, out, outfd, binary_offset, rec->size);
-
-        rec->offset = binary_offset;
-        offset = binary_offset + rec->size;
-    } // for
-
-    // Write the actual FatELF header now...
-    xwrite_fatelf_header(out, outfd, header);
-
-    xappend_junk(fname, fd, out, outfd);
-
-    xclose(out, outfd);
-    xclose(newobj, newfd);
-    xclose(fname, fd);
-    free(header);
-
-    unlink_on_xfail = NULL;
-
+        xfail("USAGE: %s <out> <in> <newelf>\n"
+              "       %s --in-place <in> <newelf>", argv[0], argv[0]);
+    } // if
+
+    ctx = xfatelf_ctx_create();
+    if (strcmp(argv[1], "--in-place") == 0)
+        rc = fatelf_replace_in_place(ctx, argv[2], argv[3]);
+    else
+        rc = fatelf_replace(ctx, argv[1], argv[2], argv[3]);
+    xfatelf_ctx_finish(ctx, rc);
     return 0;  // success.
-} // fatelf_replace
+} // fatelf_replace_main
 
 
+#if !FATELF_MULTICALL
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
-    if (argc != 4)  // this could stand to use getopt(), later.
-        xfail("USAGE: %s <out> <in> <newelf>", argv[0]);
-    return fatelf_replace(argv[1], argv[2], argv[3]);
+    argc = xfatelf_init(argc, argv);
+    return fatelf_replace_main(argc, argv);
 } // main
+#endif
 
 // end of fatelf-replace.c ...
 
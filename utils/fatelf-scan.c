@@ -0,0 +1,309 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Classify every file in a directory tree as ELF, FatELF or neither, from
+//  the first few hundred bytes of each, with a pool of threads. This does
+//  the job of merge/iself.c and merge/is32bitelf.c in one pass.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-walk.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Enough for an ELF header and a FatELF header with 20 records. Bigger
+//  FatELF headers get a second read.
+#define SCAN_READ_SIZE 512
+
+#define SCAN_OTHER  0
+#define SCAN_ELF    1
+#define SCAN_FATELF 2
+#define SCAN_ERROR  3
+#define SCAN_TYPES  4
+
+static const char *type_names[SCAN_TYPES] =
+{
+    "other", "elf", "fatelf", "error"
+};
+
+// Files with more than one link, by device and inode, so we only report
+//  each of them once. Most files only have one link, so this stays small.
+typedef struct scan_inode
+{
+    dev_t dev;
+    ino_t ino;
+} scan_inode;
+
+typedef struct scan_state
+{
+    const char *root;
+    const char *sep;  // "/", unless root already ends with one.
+    char eol;  // '\n', or '\0' for --null.
+    int elf_only;
+    pthread_mutex_t seen_lock;
+    scan_inode *seen;
+    size_t seen_count;
+    size_t seen_alloc;  // always a power of two.
+    uint64_t counts[SCAN_TYPES];
+    uint64_t links;  // hardlinks we skipped.
+} scan_state;
+
+
+static int add_seen(scan_inode *table, const size_t alloc, const dev_t dev,
+                    const ino_t ino)
+{
+    size_t i = fatelf_hash_inode((uint64_t) dev, (uint64_t) ino);
+    i &= alloc - 1;
+    while ((table[i].dev != 0) || (table[i].ino != 0))
+    {
+        if ((table[i].dev == dev) && (table[i].ino == ino))
+            return 0;
+        i = (i + 1) & (alloc - 1);
+    } // while
+    table[i].dev = dev;
+    table[i].ino = ino;
+    return 1;
+} // add_seen
+
+
+// Non-zero if this is the first time we've seen this inode.
+static int first_link(scan_state *state, const struct stat *st)
+{
+    int retval;
+
+    if (st->st_nlink <= 1)
+        return 1;
+
+    pthread_mutex_lock(&state->seen_lock);
+    if ((state->seen_count + 1) * 2 > state->seen_alloc)  // keep it sparse.
+    {
+        const size_t oldalloc = state->seen_alloc;
+        const size_t newalloc = oldalloc ? (oldalloc * 2) : 1024;
+        scan_inode *table = (scan_inode *) calloc(newalloc, sizeof (*table));
+        size_t i;
+        if (table == NULL)
+        {
+            pthread_mutex_unlock(&state->seen_lock);
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        } // if
+        for (i = 0; i < oldalloc; i++)
+        {
+            const scan_inode *item = &state->seen[i];
+            if ((item->dev != 0) || (item->ino != 0))
+                add_seen(table, newalloc, item->dev, item->ino);
+        } // for
+        free(state->seen);
+        state->seen = table;
+        state->seen_alloc = newalloc;
+    } // if
+
+    retval = add_seen(state->seen, state->seen_alloc, st->st_dev, st->st_ino);
+    if (retval)
+        state->seen_count++;
+    pthread_mutex_unlock(&state->seen_lock);
+
+    return retval;
+} // first_link
+
+
+// A target name, even when we don't know the machine's name.
+static void put_target(const FATELF_record *rec)
+{
+    char target[FATELF_TARGET_NAME_MAX];
+    int wants = FATELF_WANT_EVERYTHING;
+
+    if (get_machine_by_id(rec->machine) == NULL)
+    {
+        printf("machine%u:", (unsigned int) rec->machine);
+        wants &= ~FATELF_WANT_MACHINE;
+    } // if
+    fputs(fatelf_get_target_name(rec, wants, target, sizeof (target)), stdout);
+} // put_target
+
+
+// One line per file: type, targets, and the path last, since that's the
+//  only part that might have tabs in it.
+static void report(scan_state *state, const int type, const char *path,
+                   const FATELF_record *elf, const FATELF_header *header)
+{
+    int i;
+
+    if (state->elf_only && ((type == SCAN_OTHER) || (type == SCAN_ERROR)))
+        return;
+
+    flockfile(stdout);
+    printf("%s\t", type_names[type]);
+    if (type == SCAN_ELF)
+        put_target(elf);
+    else if (type == SCAN_FATELF)
+    {
+        for (i = 0; i < (int) header->num_records; i++)
+        {
+            if (i > 0)
+                putchar(',');
+            put_target(&header->records[i]);
+        } // for
+    } // else if
+    else
+        putchar('-');
+    printf("\t%s%s%s%c", state->root, state->sep, path, state->eol);
+    funlockfile(stdout);
+} // report
+
+
+// Read as little of the file as we can get away with and classify it.
+static int xscan_file(scan_state *state, const char *path, const int dirfd,
+                      const char *name)
+{
+    const uint8_t elfmagic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
+    uint8_t buf[FATELF_DISK_FORMAT_SIZE(255)];
+    FATELF_record elf;
+    uint32_t magic = 0;
+    int type = SCAN_OTHER;
+    ssize_t br;
+    int fd;
+
+    fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+        xfailc(FATELF_EIO, "Failed to open '%s': %s", path, strerror(errno));
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(fd));
+
+    br = xpread(path, fd, buf, SCAN_READ_SIZE, 0, 0);
+    if (br >= 4)
+        magic = ((uint32_t) buf[0]) | (((uint32_t) buf[1]) << 8) |
+                (((uint32_t) buf[2]) << 16) | (((uint32_t) buf[3]) << 24);
+
+    if ((br >= 4) && (memcmp(buf, elfmagic, 4) == 0))
+    {
+        type = SCAN_ELF;
+        xdecode_elf_header(path, buf, (uint64_t) br, &elf);
+        report(state, type, path, &elf, NULL);
+    } // if
+    else if ((br >= 8) && (magic == FATELF_MAGIC))
+    {
+        const uint64_t len = FATELF_DISK_FORMAT_SIZE(buf[6]);
+        FATELF_header *header;
+        if (len > (uint64_t) br)
+            br += xpread(path, fd, buf + br, len - br, br, 0);
+        type = SCAN_FATELF;
+        header = xdecode_fatelf_header(path, buf, (uint64_t) br);
+        fatelf_cleanup_push(free, header);
+        report(state, type, path, NULL, header);
+        fatelf_cleanup_pop(free, header, 1);
+    } // else if
+    else
+        report(state, type, path, NULL, NULL);
+
+    fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(fd), 1);
+    return type;
+} // xscan_file
+
+
+static void scan_entry(void *data, const char *path, const int dirfd,
+                       const char *name, const struct stat *st)
+{
+    scan_state *state = (scan_state *) data;
+    fatelf_catch frame;
+    int type;
+
+    if (!S_ISREG(st->st_mode))
+        return;
+    else if (!first_link(state, st))
+    {
+        __atomic_add_fetch(&state->links, 1, __ATOMIC_RELAXED);
+        return;
+    } // else if
+
+    fatelf_catch_enter(&frame);
+    if (setjmp(frame.env) != 0)
+    {
+        fprintf(stderr, "%s\n", frame.message);
+        report(state, SCAN_ERROR, path, NULL, NULL);
+        __atomic_add_fetch(&state->counts[SCAN_ERROR], 1, __ATOMIC_RELAXED);
+        return;
+    } // if
+
+    type = xscan_file(state, path, dirfd, name);
+    fatelf_catch_leave(&frame);
+    __atomic_add_fetch(&state->counts[type], 1, __ATOMIC_RELAXED);
+} // scan_entry
+
+
+static void xusage(const char *argv0)
+{
+    xfail("USAGE: %s [--jobs=N] [--null] [--elf-only] [--quiet]"
+          " <dir> [dir...]", argv0);
+} // xusage
+
+
+int fatelf_scan_main(int argc, const char **argv)
+{
+    scan_state state;
+    uint64_t unreadable = 0;
+    int threads = 0;
+    int quiet = 0;
+    int argi;
+
+    memset(&state, '\0', sizeof (state));
+    state.eol = '\n';
+    for (argi = 1; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if (strncmp(arg, "--jobs=", 7) == 0)
+            threads = xfatelf_parse_jobs(arg + 7);
+        else if ((strcmp(arg, "--null") == 0) || (strcmp(arg, "-0") == 0))
+            state.eol = '\0';
+        else if (strcmp(arg, "--elf-only") == 0)
+            state.elf_only = 1;
+        else if (strcmp(arg, "--quiet") == 0)
+            quiet = 1;
+        else if (strncmp(arg, "--", 2) == 0)
+            xusage(argv[0]);
+        else
+            break;
+    } // for
+
+    if (argi >= argc)
+        xusage(argv[0]);
+
+    pthread_mutex_init(&state.seen_lock, NULL);
+    for (; argi < argc; argi++)
+    {
+        const size_t len = strlen(argv[argi]);
+        state.root = argv[argi];
+        state.sep = (len && (argv[argi][len-1] == '/')) ? "" : "/";
+        unreadable += xfatelf_walk(state.root, threads, scan_entry, &state);
+    } // for
+    pthread_mutex_destroy(&state.seen_lock);
+    free(state.seen);
+
+    if (!quiet)
+    {
+        fflush(stdout);
+        fprintf(stderr, "%llu ELF, %llu FatELF, %llu other, %llu unreadable,"
+                " %llu duplicate links.\n",
+                (unsigned long long) state.counts[SCAN_ELF],
+                (unsigned long long) state.counts[SCAN_FATELF],
+                (unsigned long long) state.counts[SCAN_OTHER],
+                (unsigned long long) (state.counts[SCAN_ERROR] + unreadable),
+                (unsigned long long) state.links);
+    } // if
+
+    return ((state.counts[SCAN_ERROR] > 0) || (unreadable > 0)) ? 1 : 0;
+} // fatelf_scan_main
+
+
+#if !FATELF_MULTICALL
+int main(int argc, const char **argv)
+{
+    argc = xfatelf_init(argc, argv);
+    return fatelf_scan_main(argc, argv);
+} // main
+#endif
+
+// end of fatelf-scan.c ...
@@ -8,25 +8,40 @@
 
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
+#include "fatelf-aio.h"
+#include "fatelf-haiku.h"
+#include "fatelf-pack.h"
 
-static char *make_filename(const char *base, const int wants,
+#include <errno.h>
+
+// (base)-target, or, with a (dir), dir/target.
+static char *make_filename(const char *base, const char *dir, const int wants,
                            const FATELF_record *rec)
 {
-    const char *target = fatelf_get_target_name(rec, wants);
-    const size_t len = strlen(base) + strlen(target) + 2;
-    char *retval = (char *) xmalloc(len);
-    snprintf(retval, len, "%s-%s", base, target);
+    const char *prefix = (dir != NULL) ? dir : base;
+    const char sep = (dir != NULL) ? '/' : '-';
+    char target[FATELF_TARGET_NAME_MAX];
+    size_t len;
+    char *retval;
+
+    fatelf_get_target_name(rec, wants, target, sizeof (target));
+    len = strlen(prefix) + strlen(target) + 2;
+    retval = (char *) xmalloc(len);
+    snprintf(retval, len, "%s%c%s", prefix, sep, target);
     return retval;
 } // make_filename
 
 
-static inline int unsorted(const FATELF_record *a, const FATELF_record *b)
+static int compare_records(const void *_a, const void *_b)
 {
+    const FATELF_record *a = *((const FATELF_record * const *) _a);
+    const FATELF_record *b = *((const FATELF_record * const *) _b);
+
     #define TEST_UNSORTED(field) \
         if (a->field > b->field) \
             return 1; \
         else if (a->field < b->field) \
-            return 0;
+            return -1;
 
     // This is the in order of precedence of fields.
     TEST_UNSORTED(machine);
@@ -38,38 +53,72 @@ static inline int unsorted(const FATELF_record *a, const FATELF_record *b)
     #undef TEST_UNSORTED
 
     return 0;
-} // unsorted
+} // compare_records
+
+
+// Where the data after the records goes in each output: (size) bytes from
+//  (offset) in the input. Haiku resources go where each output ELF wants
+//  them; anything else goes right after the record.
+typedef struct split_junk
+{
+    int is_haiku_rsrc;
+    uint64_t offset;
+    uint64_t size;
+} split_junk;
 
 
-static int fatelf_split(const char *fname)
+static int fatelf_split(const char *fname, const char *dir)
 {
-    const int fd = xopen(fname, O_RDONLY, 0755);
-    FATELF_header *header = xread_fatelf_header(fname, fd);
-    const size_t len = sizeof (FATELF_record *) * header->num_records;
-    FATELF_record **sorted = (FATELF_record **) xmalloc(len);
-    const int maxrecs = header->num_records;
-    int is_sorted = 1;
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
+    fatelf_packed *packed = NULL;
+    fatelf_view *view = NULL;
+    FATELF_header *header = NULL;
+    split_junk junk;
+    size_t len;
+    FATELF_record **sorted;
+    int maxrecs;
+    fatelf_aio *aio = NULL;
+    char **outs = NULL;
+    int *outfds = NULL;
     int i = 0;
 
+    if ((dir != NULL) && (mkdir(dir, 0755) == -1) && (errno != EEXIST))
+    {
+        xfailc(FATELF_EIO, "Failed to create '%s': %s", dir,
+               strerror(errno));
+    } // if
+
+    // Packed files are unpacked a block at a time, straight to each output.
+    //  Anything else is mapped once, and what follows its records is found
+    //  once, for every output.
+    memset(&junk, '\0', sizeof (junk));
+    if (xfatelf_is_packed(fname, fd))
+    {
+        packed = xfatelf_packed_open(fname, fd);
+        fatelf_cleanup_push(fatelf_cleanup_packed, packed);
+        header = packed->header;
+    } // if
+    else
+    {
+        view = xfatelf_view_open(fname, fd);
+        fatelf_cleanup_push(fatelf_cleanup_view, view);
+        header = view->header;
+        if (haiku_find_rsrc_view(view, &junk.offset, &junk.size))
+            junk.is_haiku_rsrc = 1;
+        else if (fatelf_view_junk(view, &junk.offset, &junk.size) == NULL)
+            junk.size = 0;
+    } // else
+
+    len = sizeof (FATELF_record *) * header->num_records;
+    maxrecs = header->num_records;
+    sorted = (FATELF_record **) xmalloc(len ? len : 1);
+    fatelf_cleanup_push(free, sorted);
+
     // Try to keep the filenames as short as possible. To start, sort
     //  the records so we know which items are relevant.
     for (i = 0; i < ((int) header->num_records); i++)
         sorted[i] = &header->records[i];
-
-    do  // bubble sort ftw.
-    {
-        is_sorted = 1;
-        for (i = 0; i < ((int)header->num_records)-1; i++)
-        {
-            if (unsorted(sorted[i], sorted[i+1]))
-            {
-                FATELF_record *tmp = sorted[i];
-                sorted[i] = sorted[i+1];
-                sorted[i+1] = tmp;
-                is_sorted = 0;
-            } // if
-        } // for
-    } while (!is_sorted);
+    qsort(sorted, maxrecs, sizeof (FATELF_record *), compare_records);
 
     // now dump each ELF file, naming it with just the minimum set of
     //  attributes that make it unique. We do this by checking the item
@@ -85,13 +134,18 @@ static int fatelf_split(const char *fname)
     //
     // ...where those "32bits:" parts are superfluous.
 
+    outs = (char **) xmalloc(sizeof (char *) * (maxrecs ? maxrecs : 1));
+    fatelf_cleanup_push(free, outs);
+    outfds = (int *) xmalloc(sizeof (int) * (maxrecs ? maxrecs : 1));
+    fatelf_cleanup_push(free, outfds);
+    if (packed == NULL)
+        aio = xaio_create();
+
     for (i = 0; i < maxrecs; i++)
     {
         const FATELF_record *rec = sorted[i];
         const FATELF_record *prev = (i > 0) ? sorted[i-1] : NULL;
         const FATELF_record *next = (i < maxrecs-1) ? sorted[i+1] : NULL;
-        char *out = NULL;
-        int outfd = -1;
         int wants = 0;
         int unique = 0;
 
@@ -112,31 +166,93 @@ static int fatelf_split(const char *fname)
 
         #undef TEST_WANT
 
-        out = make_filename(fname, wants, rec);
-        outfd = xopen(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
-        unlink_on_xfail = out;
-        xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
-        xappend_junk(fname, fd, out, outfd);
-        xclose(out, outfd);
-        unlink_on_xfail = NULL;
-        free(out);
+        // queue every record, and what follows it, so every output is
+        //  written at once, with positional writes, in one batch.
+        outs[i] = make_filename(fname, dir, wants, rec);
+        fatelf_cleanup_push(free, outs[i]);
+        outfds[i] = xopen_held(outs[i], O_RDWR | O_CREAT | O_TRUNC, 0755);
+        unlink_on_xfail_add(outs[i]);
+        if (packed != NULL)
+        {
+            xfatelf_packed_extract(packed, fname, fd,
+                                   (int) (rec - header->records),
+                                   outs[i], outfds[i]);
+        } // if
+        else
+        {
+            const int idx = (int) (rec - header->records);
+            uint64_t elflen = 0;
+            const uint8_t *elf = xfatelf_view_record(view, idx, &elflen);
+            uint64_t junkoff = rec->size;
+
+            xaio_copy(aio, fname, fd, rec->offset, outs[i], outfds[i], 0,
+                      rec->size);
+
+            if ( (junk.is_haiku_rsrc) &&
+                 (!haiku_rsrc_offset_mem(outs[i], elf, elflen, &junkoff)) )
+            {
+                xfailc(FATELF_EFORMAT,
+                       "Could not determine target offset for Haiku resources");
+            } // if
+
+            if (junk.size > 0)
+            {
+                xaio_copy(aio, fname, fd, junk.offset, outs[i], outfds[i],
+                          junkoff, junk.size);
+            } // if
+        } // else
+    } // for
+
+    if (packed == NULL)
+        xaio_finish(aio);
+
+    for (i = 0; i < maxrecs; i++)
+        xclose_held(outs[i], outfds[i]);
+
+    // Only keep any of them once they're all done.
+    for (i = 0; i < maxrecs; i++)
+    {
+        unlink_on_xfail_remove(outs[i]);
+        fatelf_cleanup_pop(free, outs[i], 1);
     } // for
 
-    free(sorted);
-    xclose(fname, fd);
-    free(header);
+    fatelf_cleanup_pop(free, outfds, 1);
+    fatelf_cleanup_pop(free, outs, 1);
+    fatelf_cleanup_pop(free, sorted, 1);
+    xclose_held(fname, fd);
+    if (packed != NULL)
+        fatelf_cleanup_pop(fatelf_cleanup_packed, packed, 1);
+    else
+        fatelf_cleanup_pop(fatelf_cleanup_view, view, 1);
 
     return 0;  // success.
 } // fatelf_split
 
 
+int fatelf_split_main(int argc, const char **argv)
+{
+    const char *dir = NULL;
+
+    if ((argc == 3) && (strncmp(argv[1], "--output-dir=", 13) == 0))
+    {
+        dir = argv[1] + 13;
+        argv[1] = argv[2];
+        argc--;
+    } // if
+
+    if ((argc != 2) || ((dir != NULL) && (*dir == '\0')))
+        xfail("USAGE: %s [--output-dir=DIR] <in>", argv[0]);
+    return fatelf_split(argv[1], dir);
+} // fatelf_split_main
+
+
+#if !FATELF_MULTICALL
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
-    if (argc != 2)  // this could stand to use getopt(), later.
-        xfail("USAGE: %s <in>", argv[0]);
-    return fatelf_split(argv[1]);
+    argc = xfatelf_init(argc, argv);
+    return fatelf_split_main(argc, argv);
 } // main
+#endif
 
 // end of fatelf-split.c ...
 
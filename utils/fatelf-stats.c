@@ -0,0 +1,358 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+/* performance counters and traces for the FatELF tools... */
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-stats.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Traces stop growing here, so one left on in a huge batch can't eat all
+//  the memory; what's dropped is noted in the trace.
+#define STATS_MAX_EVENTS (1024 * 1024)
+#define STATS_CHUNK_EVENTS 1024
+
+typedef struct stats_event
+{
+    const char *name;
+    char *detail;
+    uint64_t start;
+    uint64_t end;
+} stats_event;
+
+// Events are kept in chunks that never move, so the exit handler can read
+//  them even if another thread is still adding more.
+typedef struct stats_chunk
+{
+    stats_event events[STATS_CHUNK_EVENTS];
+    volatile size_t count;
+    struct stats_chunk *next;
+} stats_chunk;
+
+typedef struct stats_thread
+{
+    uint64_t op_calls[FATELF_OP_COUNT];
+    uint64_t op_syscalls[FATELF_OP_COUNT];
+    uint64_t op_bytes[FATELF_OP_COUNT];
+    uint64_t op_ns[FATELF_OP_COUNT];
+    uint64_t phase_count[FATELF_PHASE_COUNT];
+    uint64_t phase_ns[FATELF_PHASE_COUNT];
+    stats_chunk *first;
+    stats_chunk *last;
+    int tid;
+    struct stats_thread *next;
+} stats_thread;
+
+static const char *op_names[FATELF_OP_COUNT] =
+{
+    "xread", "xwrite", "xpread", "xpwrite", "xlseek", "xwrite_zeros",
+    "xcopyfile", "xaio"
+};
+
+static const char *phase_names[FATELF_PHASE_COUNT] =
+{
+    "command", "file", "header", "probe", "rsrc"
+};
+
+int fatelf_stats_flags = 0;
+static const char *trace_fname = NULL;
+static char *run_name = NULL;
+static uint64_t run_start = 0;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_thread *threads = NULL;
+static int num_threads = 0;
+static uint64_t num_events = 0;
+static uint64_t dropped_events = 0;
+static __thread stats_thread *this_thread = NULL;
+
+
+uint64_t fatelf_stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+} // fatelf_stats_clock
+
+
+// This thread's counters; NULL if we're out of memory, in which case
+//  it just isn't counted.
+static stats_thread *get_thread(void)
+{
+    stats_thread *thread = this_thread;
+    if (thread == NULL)
+    {
+        if ((thread = (stats_thread *) calloc(1, sizeof (*thread))) == NULL)
+            return NULL;
+        pthread_mutex_lock(&threads_lock);
+        thread->tid = ++num_threads;
+        thread->next = threads;
+        threads = thread;
+        pthread_mutex_unlock(&threads_lock);
+        this_thread = thread;
+    } // if
+    return thread;
+} // get_thread
+
+
+static void add_event(stats_thread *thread, const char *name,
+                      const char *detail, const uint64_t start,
+                      const uint64_t end)
+{
+    stats_chunk *chunk = thread->last;
+    stats_event *event;
+
+    if (__atomic_add_fetch(&num_events, 1, __ATOMIC_RELAXED) >
+        STATS_MAX_EVENTS)
+    {
+        __atomic_add_fetch(&dropped_events, 1, __ATOMIC_RELAXED);
+        return;
+    } // if
+
+    if ((chunk == NULL) || (chunk->count == STATS_CHUNK_EVENTS))
+    {
+        if ((chunk = (stats_chunk *) calloc(1, sizeof (*chunk))) == NULL)
+            return;
+        if (thread->last == NULL)
+            thread->first = chunk;
+        else
+            thread->last->next = chunk;
+        thread->last = chunk;
+    } // if
+
+    event = &chunk->events[chunk->count];
+    event->name = name;
+    event->detail = detail ? strdup(detail) : NULL;
+    event->start = start;
+    event->end = end;
+    __atomic_store_n(&chunk->count, chunk->count + 1, __ATOMIC_RELEASE);
+} // add_event
+
+
+void fatelf_stats_op_end(const fatelf_stats_op op, const uint64_t syscalls,
+                         const uint64_t bytes, const uint64_t start)
+{
+    stats_thread *thread = get_thread();
+    const uint64_t end = fatelf_stats_clock();
+
+    if (thread == NULL)
+        return;
+
+    thread->op_calls[op]++;
+    thread->op_syscalls[op] += syscalls;
+    thread->op_bytes[op] += bytes;
+    thread->op_ns[op] += end - start;
+
+    // Copies are big enough, and few enough, to show up in a trace.
+    if ( (fatelf_stats_flags & FATELF_STATS_TRACE) &&
+         ((op == FATELF_OP_COPY) || (op == FATELF_OP_AIO)) )
+        add_event(thread, op_names[op], NULL, start, end);
+} // fatelf_stats_op_end
+
+
+void fatelf_stats_phase_end(const fatelf_stats_phase phase,
+                            const char *detail, const uint64_t start)
+{
+    stats_thread *thread = get_thread();
+    const uint64_t end = fatelf_stats_clock();
+
+    if (thread == NULL)
+        return;
+
+    thread->phase_count[phase]++;
+    thread->phase_ns[phase] += end - start;
+    if (fatelf_stats_flags & FATELF_STATS_TRACE)
+        add_event(thread, phase_names[phase], detail, start, end);
+} // fatelf_stats_phase_end
+
+
+static void write_report(const uint64_t end)
+{
+    uint64_t calls[FATELF_OP_COUNT], syscalls[FATELF_OP_COUNT];
+    uint64_t bytes[FATELF_OP_COUNT], opns[FATELF_OP_COUNT];
+    uint64_t count[FATELF_PHASE_COUNT], phasens[FATELF_PHASE_COUNT];
+    const stats_thread *thread;
+    int i;
+
+    memset(calls, '\0', sizeof (calls));
+    memset(syscalls, '\0', sizeof (syscalls));
+    memset(bytes, '\0', sizeof (bytes));
+    memset(opns, '\0', sizeof (opns));
+    memset(count, '\0', sizeof (count));
+    memset(phasens, '\0', sizeof (phasens));
+
+    for (thread = threads; thread != NULL; thread = thread->next)
+    {
+        for (i = 0; i < FATELF_OP_COUNT; i++)
+        {
+            calls[i] += thread->op_calls[i];
+            syscalls[i] += thread->op_syscalls[i];
+            bytes[i] += thread->op_bytes[i];
+            opns[i] += thread->op_ns[i];
+        } // for
+        for (i = 0; i < FATELF_PHASE_COUNT; i++)
+        {
+            count[i] += thread->phase_count[i];
+            phasens[i] += thread->phase_ns[i];
+        } // for
+    } // for
+
+    fprintf(stderr, "fatelf stats: %.6f seconds, %d thread%s\n",
+            ((double) (end - run_start)) / 1000000000.0, num_threads,
+            (num_threads == 1) ? "" : "s");
+    fprintf(stderr, "  %-14s %10s %10s %16s %12s\n", "primitive", "calls",
+            "syscalls", "bytes", "seconds");
+    for (i = 0; i < FATELF_OP_COUNT; i++)
+    {
+        if (calls[i] == 0)
+            continue;
+        fprintf(stderr, "  %-14s %10llu %10llu %16llu %12.6f\n", op_names[i],
+                (unsigned long long) calls[i],
+                (unsigned long long) syscalls[i],
+                (unsigned long long) bytes[i],
+                ((double) opns[i]) / 1000000000.0);
+    } // for
+
+    fprintf(stderr, "  %-14s %10s %12s\n", "phase", "count", "seconds");
+    for (i = 0; i < FATELF_PHASE_COUNT; i++)
+    {
+        if (count[i] == 0)
+            continue;
+        fprintf(stderr, "  %-14s %10llu %12.6f\n", phase_names[i],
+                (unsigned long long) count[i],
+                ((double) phasens[i]) / 1000000000.0);
+    } // for
+} // write_report
+
+
+static void write_json_string(FILE *io, const char *str)
+{
+    fputc('"', io);
+    for (; *str; str++)
+    {
+        const unsigned char ch = (unsigned char) *str;
+        if ((ch == '"') || (ch == '\\'))
+            fprintf(io, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(io, "\\u%04x", ch);
+        else
+            fputc(ch, io);
+    } // for
+    fputc('"', io);
+} // write_json_string
+
+
+static void write_trace_event(FILE *io, const int pid, const int tid,
+                              const char *name, const char *detail,
+                              const uint64_t start, const uint64_t end)
+{
+    fprintf(io, ",\n{\"name\":\"%s\",\"cat\":\"fatelf\",\"ph\":\"X\","
+                "\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", name, pid,
+            tid, ((double) (start - run_start)) / 1000.0,
+            ((double) (end - start)) / 1000.0);
+    if (detail != NULL)
+    {
+        fprintf(io, ",\"args\":{\"detail\":");
+        write_json_string(io, detail);
+        fputc('}', io);
+    } // if
+    fputc('}', io);
+} // write_trace_event
+
+
+// Chrome's trace event format: complete ("X") events, in microseconds.
+static void write_trace(const uint64_t end)
+{
+    const int pid = (int) getpid();
+    const stats_thread *thread;
+    FILE *io = fopen(trace_fname, "w");
+
+    if (io == NULL)
+    {
+        fprintf(stderr, "Failed to open '%s': %s\n", trace_fname,
+                strerror(errno));
+        return;
+    } // if
+
+    fprintf(io, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"version\":");
+    write_json_string(io, fatelf_build_version);
+    fprintf(io, ",\"dropped_events\":%llu},\n\"traceEvents\":[\n"
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"args\":{\"name\":\"fatelf\"}}",
+            (unsigned long long) dropped_events, pid);
+
+    for (thread = threads; thread != NULL; thread = thread->next)
+    {
+        const stats_chunk *chunk;
+        fprintf(io, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                    "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                pid, thread->tid, thread->tid);
+        for (chunk = thread->first; chunk != NULL; chunk = chunk->next)
+        {
+            const size_t count = __atomic_load_n(&chunk->count,
+                                                 __ATOMIC_ACQUIRE);
+            size_t i;
+            for (i = 0; i < count; i++)
+            {
+                const stats_event *event = &chunk->events[i];
+                write_trace_event(io, pid, thread->tid, event->name,
+                                  event->detail, event->start, event->end);
+            } // for
+        } // for
+    } // for
+
+    // The whole run, on the main thread's row.
+    write_trace_event(io, pid, 1, "run", run_name, run_start, end);
+    fprintf(io, "\n]}\n");
+
+    if (fclose(io) == EOF)
+        fprintf(stderr, "Failed to write '%s': %s\n", trace_fname,
+                strerror(errno));
+} // write_trace
+
+
+static void stats_at_exit(void)
+{
+    const uint64_t end = fatelf_stats_clock();
+    if (fatelf_stats_flags & FATELF_STATS_TRACE)
+        write_trace(end);
+    if (fatelf_stats_flags & FATELF_STATS_COUNT)
+        write_report(end);
+} // stats_at_exit
+
+
+void xfatelf_stats_init(const int flags, const char *tracefile,
+                        const int argc, const char **argv)
+{
+    size_t len = 1;
+    int i;
+
+    if ((flags == 0) || (fatelf_stats_flags != 0))
+        return;  // nothing to do, or already done.
+
+    for (i = 0; i < argc; i++)
+        len += strlen(argv[i]) + 1;
+    run_name = (char *) xmalloc(len);
+    for (i = 0; i < argc; i++)
+    {
+        if (i > 0)
+            strcat(run_name, " ");
+        strcat(run_name, argv[i]);
+    } // for
+
+    trace_fname = tracefile;
+    run_start = fatelf_stats_clock();
+    get_thread();  // so the main thread is always thread 1.
+    if (atexit(stats_at_exit) != 0)
+        xfail("Failed to set up --stats");
+    fatelf_stats_flags = flags;
+} // xfatelf_stats_init
+
+// end of fatelf-stats.c ...
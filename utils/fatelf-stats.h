@@ -0,0 +1,83 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#ifndef FATELF_STATS_H
+#define FATELF_STATS_H
+
+// Counters for where a tool spends its time, for --stats and --trace (or
+//  FATELF_STATS and FATELF_TRACE in the environment). Each thread counts
+//  into its own block, so nothing here takes a lock or shares a cache line
+//  after a thread's first count, and with both off, every hook is one test
+//  of a global. The totals go to stderr when the process exits, and the
+//  trace to a Chrome trace file (load it in chrome://tracing or Perfetto).
+
+// The I/O primitives. xwrite_zeros and xcopyfile include the reads and
+//  writes they make through the others; everything else is one syscall
+//  per try (plus retries after EINTR).
+typedef enum fatelf_stats_op
+{
+    FATELF_OP_READ,  // xread()
+    FATELF_OP_WRITE,  // xwrite()
+    FATELF_OP_PREAD,  // xpread()
+    FATELF_OP_PWRITE,  // xpwrite()
+    FATELF_OP_LSEEK,  // xlseek()
+    FATELF_OP_ZEROS,  // xwrite_zeros() and xpwrite_zeros()
+    FATELF_OP_COPY,  // xcopyfile_range(), xcopyfile_at(), xcopy_stream()
+    FATELF_OP_AIO,  // xaio_finish(), when it has a ring to run.
+    FATELF_OP_COUNT
+} fatelf_stats_op;
+
+// Phases of work. They nest (a command includes its files, a file its
+//  headers), so their times overlap.
+typedef enum fatelf_stats_phase
+{
+    FATELF_PHASE_COMMAND,  // one command of a batch.
+    FATELF_PHASE_FILE,  // one file of a directory walk (merge, scan, index).
+    FATELF_PHASE_HEADER,  // reading and decoding a FatELF or ELF header.
+    FATELF_PHASE_PROBE,  // classifying a file with xfatelf_probe().
+    FATELF_PHASE_RSRC,  // finding Haiku resources.
+    FATELF_PHASE_COUNT
+} fatelf_stats_phase;
+
+#define FATELF_STATS_COUNT (1 << 0)  // --stats
+#define FATELF_STATS_TRACE (1 << 1)  // --trace
+
+extern int fatelf_stats_flags;
+
+uint64_t fatelf_stats_clock(void);  // monotonic nanoseconds.
+
+// The start of something to count, or zero if we aren't counting.
+static inline uint64_t fatelf_stats_start(void)
+{
+    return fatelf_stats_flags ? fatelf_stats_clock() : 0;
+} // fatelf_stats_start
+
+// Only call these if fatelf_stats_flags is set; the macros check for you.
+//  (detail) names what a phase worked on, for the trace; it can be NULL.
+void fatelf_stats_op_end(const fatelf_stats_op op, const uint64_t syscalls,
+                         const uint64_t bytes, const uint64_t start);
+void fatelf_stats_phase_end(const fatelf_stats_phase phase,
+                            const char *detail, const uint64_t start);
+
+#define FATELF_STATS_OP(op, syscalls, bytes, start) \
+    do { \
+        if (fatelf_stats_flags) \
+            fatelf_stats_op_end(op, syscalls, bytes, start); \
+    } while (0)
+
+#define FATELF_STATS_PHASE(phase, detail, start) \
+    do { \
+        if (fatelf_stats_flags) \
+            fatelf_stats_phase_end(phase, detail, start); \
+    } while (0)
+
+// Start counting (FATELF_STATS_* in flags), and write the results at exit.
+//  (tracefile) is where the trace goes, with FATELF_STATS_TRACE. (argv)
+//  names the whole run in the trace. xfatelf_init() calls this.
+void xfatelf_stats_init(const int flags, const char *tracefile,
+                        const int argc, const char **argv);
+
+#endif /* FATELF_STATS_H */
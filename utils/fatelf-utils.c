@@ -8,16 +8,48 @@
 
 /* code shared between all FatELF utilities... */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1  // copy_file_range(), splice(), etc.
+#endif
+
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 #include "fatelf-haiku.h"
+#include "fatelf-stats.h"
 
 #include <errno.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+
+#if FATELF_HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
-const char *unlink_on_xfail = NULL;
-static uint8_t zerobuf[4096];
+#if FATELF_HAVE_FICLONERANGE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+static pthread_mutex_t unlink_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char **unlink_list = NULL;
+static size_t unlink_count = 0;
+static size_t unlink_alloc = 0;
+int fatelf_copy_flags = 0;
+int fatelf_io_policy = FATELF_IO_PREALLOCATE | FATELF_IO_SEQUENTIAL;
+static uint64_t direct_threshold = 128 * 1024 * 1024;
+static uint64_t slack_bytes = 0;
+static uint32_t slack_percent = 0;
+static int align_policy = FATELF_ALIGN_FIXED;
+static uint64_t align_size = 4096;
+static const uint8_t zerobuf[4096];  // never written, so threads can share.
+
+// Every read, write, seek and kernel copy this thread has asked for, so
+//  --stats can say how many a whole xcopyfile_range() took.
+static __thread uint64_t io_syscalls = 0;
 
 
 #ifndef APPID
@@ -73,31 +105,211 @@ const char *fatelf_build_version = MAKEBUILDVERSTRINGLITERAL(APPID, APPREV);
 
 
 
-// Report an error to stderr and terminate immediately with exit(1).
-void xfail(const char *fmt, ...)
+// Catch frames and the cleanup stack belong to one thread each.
+typedef struct cleanup_entry
 {
-    va_list ap;
-    va_start(ap, fmt);
+    fatelf_cleanup_fn fn;
+    void *arg;
+} cleanup_entry;
+
+static __thread fatelf_catch *catch_top = NULL;
+static __thread cleanup_entry *cleanup_stack = NULL;
+static __thread size_t cleanup_count = 0;
+static __thread size_t cleanup_alloc = 0;
+
+
+void fatelf_catch_enter(fatelf_catch *frame)
+{
+    frame->prev = catch_top;
+    frame->cleanup_base = cleanup_count;
+    frame->error = FATELF_OK;
+    frame->sys_errno = 0;
+    frame->message[0] = '\0';
+    catch_top = frame;
+} // fatelf_catch_enter
+
+
+void fatelf_catch_leave(fatelf_catch *frame)
+{
+    assert(catch_top == frame);
+    assert(cleanup_count == frame->cleanup_base);
+    cleanup_count = frame->cleanup_base;
+    catch_top = frame->prev;
+    if (catch_top == NULL)  // don't hold on to this between calls.
+    {
+        free(cleanup_stack);
+        cleanup_stack = NULL;
+        cleanup_alloc = 0;
+    } // if
+} // fatelf_catch_leave
+
+
+void fatelf_cleanup_push(fatelf_cleanup_fn fn, void *arg)
+{
+    if (catch_top == NULL)
+        return;  // xfail() will exit, and the OS cleans up after us.
+    else if (cleanup_count == cleanup_alloc)
+    {
+        const size_t newalloc = cleanup_alloc ? (cleanup_alloc * 2) : 16;
+        void *ptr = realloc(cleanup_stack, newalloc * sizeof (cleanup_entry));
+        if (ptr == NULL)
+        {
+            fn(arg);  // we'd lose track of it, so let it go now.
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        } // if
+        cleanup_stack = (cleanup_entry *) ptr;
+        cleanup_alloc = newalloc;
+    } // else if
+    cleanup_stack[cleanup_count].fn = fn;
+    cleanup_stack[cleanup_count].arg = arg;
+    cleanup_count++;
+} // fatelf_cleanup_push
+
+
+void fatelf_cleanup_pop(fatelf_cleanup_fn fn, void *arg, const int run)
+{
+    size_t i;
+    for (i = cleanup_count; i > 0; i--)
+    {
+        if ((cleanup_stack[i-1].fn == fn) && (cleanup_stack[i-1].arg == arg))
+        {
+            memmove(&cleanup_stack[i-1], &cleanup_stack[i],
+                    (cleanup_count - i) * sizeof (cleanup_entry));
+            cleanup_count--;
+            break;
+        } // if
+    } // for
+
+    if (run)
+        fn(arg);
+} // fatelf_cleanup_pop
+
+
+void fatelf_cleanup_close(void *fd)
+{
+    close((int) (intptr_t) fd);  // don't care if this fails.
+} // fatelf_cleanup_close
+
+
+static void cleanup_unlink(void *fname)
+{
+    unlink((const char *) fname);  // don't care if this fails.
+} // cleanup_unlink
+
+
+static void vxfail(const int err, const char *fmt, va_list ap)
+{
+    // If several threads fail at once, the first one reports and exits,
+    //  and the rest wait here for the process to go away.
+    static pthread_mutex_t fail_lock = PTHREAD_MUTEX_INITIALIZER;
+    fatelf_catch *frame = catch_top;
+    size_t i;
+
+    if (frame != NULL)  // unwind to the library call instead of exiting.
+    {
+        frame->sys_errno = (err == FATELF_EIO) ? errno : 0;
+        frame->error = err;
+        vsnprintf(frame->message, sizeof (frame->message), fmt, ap);
+        while (cleanup_count > frame->cleanup_base)
+        {
+            const cleanup_entry *entry = &cleanup_stack[--cleanup_count];
+            entry->fn(entry->arg);
+        } // while
+        fatelf_catch_leave(frame);
+        longjmp(frame->env, 1);
+    } // if
+
+    pthread_mutex_lock(&fail_lock);
+
     vfprintf(stderr, fmt, ap);
-    va_end(ap);
     fprintf(stderr, "\n");
     fflush(stderr);
 
-    if (unlink_on_xfail != NULL)
-        unlink(unlink_on_xfail);  // don't care if this fails.
-    unlink_on_xfail = NULL;
+    pthread_mutex_lock(&unlink_lock);
+    for (i = 0; i < unlink_count; i++)
+        unlink(unlink_list[i]);  // don't care if this fails.
+    unlink_count = 0;
+    pthread_mutex_unlock(&unlink_lock);
 
     exit(1);
+} // vxfail
+
+
+// Report an error to stderr and terminate immediately with exit(1).
+void xfail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vxfail(FATELF_EFAIL, fmt, ap);
+    va_end(ap);
 } // xfail
 
 
+void xfailc(const int err, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vxfail(err, fmt, ap);
+    va_end(ap);
+} // xfailc
+
+
+void unlink_on_xfail_add(const char *fname)
+{
+    if (catch_top != NULL)  // the library call owns this; don't share it.
+    {
+        fatelf_cleanup_push(cleanup_unlink, (void *) fname);
+        return;
+    } // if
+
+    pthread_mutex_lock(&unlink_lock);
+    if (unlink_count == unlink_alloc)
+    {
+        const size_t newalloc = unlink_alloc ? (unlink_alloc * 2) : 8;
+        void *ptr = realloc(unlink_list, newalloc * sizeof (const char *));
+        if (ptr == NULL)
+        {
+            pthread_mutex_unlock(&unlink_lock);
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        } // if
+        unlink_list = (const char **) ptr;
+        unlink_alloc = newalloc;
+    } // if
+    unlink_list[unlink_count++] = fname;
+    pthread_mutex_unlock(&unlink_lock);
+} // unlink_on_xfail_add
+
+
+void unlink_on_xfail_remove(const char *fname)
+{
+    size_t i;
+
+    if (catch_top != NULL)
+    {
+        fatelf_cleanup_pop(cleanup_unlink, (void *) fname, 0);
+        return;
+    } // if
+
+    pthread_mutex_lock(&unlink_lock);
+    for (i = unlink_count; i > 0; i--)
+    {
+        if (unlink_list[i-1] == fname)
+        {
+            unlink_list[i-1] = unlink_list[--unlink_count];
+            break;
+        } // if
+    } // for
+    pthread_mutex_unlock(&unlink_lock);
+} // unlink_on_xfail_remove
+
+
 // Wrap malloc() with an xfail(), so this returns memory or calls exit().
 // Memory is guaranteed to be initialized to zero.
 void *xmalloc(const size_t len)
 {
     void *retval = calloc(1, len);
     if (retval == NULL)
-        xfail("Out of memory!");
+        xfailc(FATELF_ENOMEM, "Out of memory!");
     return retval;
 } // xmalloc
 
@@ -116,7 +328,7 @@ int xopen(const char *fname, const int flags, const int perms)
 {
     const int retval = open(fname, flags, perms);
     if (retval == -1)
-        xfail("Failed to open '%s': %s", fname, strerror(errno));
+        xfailc(FATELF_EIO, "Failed to open '%s': %s", fname, strerror(errno));
     return retval;
 } // xopen
 
@@ -125,10 +337,17 @@ int xopen(const char *fname, const int flags, const int perms)
 ssize_t xread(const char *fname, const int fd, void *buf,
               const size_t len, const int must_read)
 {
+    const uint64_t start = fatelf_stats_start();
+    uint64_t tries = 1;
     ssize_t rc;
-    while (((rc = read(fd,buf,len)) == -1) && (errno == EINTR)) { /* spin */ }
-    if ( (rc == -1) || ((must_read) && (rc != len)) )
-        xfail("Failed to read '%s': %s", fname, strerror(errno));
+    while (((rc = read(fd,buf,len)) == -1) && (errno == EINTR)) { tries++; }
+    io_syscalls += tries;
+    FATELF_STATS_OP(FATELF_OP_READ, tries, (rc > 0) ? rc : 0, start);
+    if (rc == -1)
+        xfailc(FATELF_EIO, "Failed to read '%s': %s", fname, strerror(errno));
+    else if ((must_read) && (rc != len))
+        xfailc(FATELF_EFORMAT, "Failed to read '%s': unexpected end of file",
+               fname);
     return rc;
 } // xread
 
@@ -137,22 +356,145 @@ ssize_t xread(const char *fname, const int fd, void *buf,
 ssize_t xwrite(const char *fname, const int fd,
                const void *buf, const size_t len)
 {
+    const uint64_t start = fatelf_stats_start();
+    uint64_t tries = 1;
     ssize_t rc;
-    while (((rc = write(fd,buf,len)) == -1) && (errno == EINTR)) { /* spin */ }
+    while (((rc = write(fd,buf,len)) == -1) && (errno == EINTR)) { tries++; }
+    io_syscalls += tries;
+    FATELF_STATS_OP(FATELF_OP_WRITE, tries, (rc > 0) ? rc : 0, start);
     if (rc == -1)
-        xfail("Failed to write '%s': %s", fname, strerror(errno));
+        xfailc(FATELF_EIO, "Failed to write '%s': %s", fname, strerror(errno));
     return rc;
 } // xwrite
 
+// xfail() on error, handle EINTR.
+ssize_t xpread(const char *fname, const int fd, void *buf, const size_t len,
+               const uint64_t offset, const int must_read)
+{
+    const uint64_t start = fatelf_stats_start();
+    uint64_t tries = 1;
+    ssize_t rc;
+    while (((rc = pread(fd, buf, len, (off_t) offset)) == -1) && (errno == EINTR))
+        { tries++; }
+    io_syscalls += tries;
+    FATELF_STATS_OP(FATELF_OP_PREAD, tries, (rc > 0) ? rc : 0, start);
+    if (rc == -1)
+        xfailc(FATELF_EIO, "Failed to read '%s': %s", fname, strerror(errno));
+    else if ((must_read) && (rc != len))
+        xfailc(FATELF_EFORMAT, "Failed to read '%s': unexpected end of file",
+               fname);
+    return rc;
+} // xpread
+
+
+// xfail() on error, handle EINTR. Unlike xwrite(), this finishes short
+//  writes, since there's no file position for the caller to check.
+void xpwrite(const char *fname, const int fd, const void *buf,
+             const size_t len, const uint64_t offset)
+{
+    const uint64_t start = fatelf_stats_start();
+    const uint8_t *ptr = (const uint8_t *) buf;
+    uint64_t tries = 0;
+    size_t done = 0;
+    while (done < len)
+    {
+        const ssize_t rc = pwrite(fd, ptr + done, len - done,
+                                  (off_t) (offset + done));
+        tries++;
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc <= 0)
+            xfailc(FATELF_EIO, "Failed to write '%s': %s",
+                   fname, strerror(errno));
+        done += (size_t) rc;
+    } // while
+    io_syscalls += tries;
+    FATELF_STATS_OP(FATELF_OP_PWRITE, tries, len, start);
+} // xpwrite
+
+
+// If (fd) is a regular file and its position is at or past the end of the
+//  file, extend it by (len) bytes without writing anything, which leaves a
+//  hole. Returns the number of bytes skipped: (len), or zero if we have to
+//  write real zeros (sparse output is off, or we'd be over existing data).
+static size_t skip_zeros(const char *fname, const int fd, const size_t len)
+{
+    struct stat statbuf;
+    off_t pos;
+
+    if (fatelf_copy_flags & FATELF_COPY_NO_SPARSE)
+        return 0;
+    else if ((fstat(fd, &statbuf) == -1) || (!S_ISREG(statbuf.st_mode)))
+        return 0;
+    else if ((pos = lseek(fd, 0, SEEK_CUR)) == -1)
+        return 0;
+    else if (pos < statbuf.st_size)
+        return 0;  // overwriting old data; it really has to become zeros.
+
+    io_syscalls++;
+    if (ftruncate(fd, pos + (off_t) len) == -1)
+        xfailc(FATELF_EIO, "Failed to extend '%s': %s", fname, strerror(errno));
+    xlseek(fname, fd, pos + (off_t) len, SEEK_SET);
+    return len;
+} // skip_zeros
+
+
+// Positional xwrite_zeros(): anything past the current end of a regular file
+//  becomes a hole (unless sparse output is off); anything before it is
+//  overwritten with real zeros.
+void xpwrite_zeros(const char *fname, const int fd, uint64_t offset,
+                   uint64_t len)
+{
+    const uint64_t start = fatelf_stats_start();
+    const uint64_t syscalls = io_syscalls;
+    const uint64_t total = len;
+    struct stat statbuf;
+
+    if ( (!(fatelf_copy_flags & FATELF_COPY_NO_SPARSE)) &&
+         (fstat(fd, &statbuf) == 0) && (S_ISREG(statbuf.st_mode)) )
+    {
+        const uint64_t fsize = (uint64_t) statbuf.st_size;
+        const uint64_t end = offset + len;
+        if (end > fsize)
+        {
+            if (ftruncate(fd, (off_t) end) == -1)
+                xfailc(FATELF_EIO, "Failed to extend '%s': %s",
+                       fname, strerror(errno));
+            len = (offset < fsize) ? (fsize - offset) : 0;
+            io_syscalls++;
+        } // if
+    } // if
+
+    while (len > 0)
+    {
+        const size_t count = (size_t) ((len < sizeof (zerobuf)) ? len : sizeof (zerobuf));
+        xpwrite(fname, fd, zerobuf, count, offset);
+        offset += count;
+        len -= count;
+    } // while
+
+    FATELF_STATS_OP(FATELF_OP_ZEROS, io_syscalls - syscalls, total, start);
+} // xpwrite_zeros
+
+
 // xfail() on error, handle EINTR.
 void xwrite_zeros(const char *fname, const int fd, size_t len)
 {
+    const uint64_t start = fatelf_stats_start();
+    const uint64_t syscalls = io_syscalls;
+    const uint64_t total = len;
+
+    if (len > 0)
+        len -= skip_zeros(fname, fd, len);
+
     while (len > 0)
     {
         const size_t count = (len < sizeof (zerobuf)) ? len : sizeof (zerobuf);
         xwrite(fname, fd, zerobuf, count);
         len -= count;
     } // while
+
+    FATELF_STATS_OP(FATELF_OP_ZEROS, io_syscalls - syscalls, total, start);
 } // xwrite_zeros
 
 // xfail() on error, handle EINTR.
@@ -161,16 +503,95 @@ void xclose(const char *fname, const int fd)
     int rc;
     while ( ((rc = close(fd)) == -1) && (errno == EINTR) ) { /* spin. */ }
     if (rc == -1)
-        xfail("Failed to close '%s': %s", fname, strerror(errno));
+        xfailc(FATELF_EIO, "Failed to close '%s': %s", fname, strerror(errno));
 } // xopen
 
 
+int xopen_held(const char *fname, const int flags, const int perms)
+{
+    const int fd = xopen(fname, flags, perms);
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(fd));
+    return fd;
+} // xopen_held
+
+
+void xclose_held(const char *fname, const int fd)
+{
+    fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(fd), 0);
+    xclose(fname, fd);
+} // xclose_held
+
+
+int xcreate_temp(const char *fname, char **tmpname)
+{
+    const size_t len = strlen(fname) + 8;
+    char *tmp = (char *) xmalloc(len);
+    int fd;
+
+    fatelf_cleanup_push(free, tmp);
+    snprintf(tmp, len, "%s.XXXXXX", fname);
+    if ((fd = mkstemp(tmp)) == -1)
+    {
+        xfailc(FATELF_EIO, "Failed to create temporary file '%s': %s",
+               tmp, strerror(errno));
+    } // if
+    unlink_on_xfail_add(tmp);
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(fd));
+
+    *tmpname = tmp;
+    return fd;
+} // xcreate_temp
+
+
+void xrename(const char *from, const char *to)
+{
+    if (rename(from, to) == -1)
+    {
+        xfailc(FATELF_EIO, "Failed to rename '%s' to '%s': %s",
+               from, to, strerror(errno));
+    } // if
+} // xrename
+
+
+void xcopy_file_attrs(const char *fname, const int fd, const struct stat *st,
+                      const int times)
+{
+    // Only root can give files away, so don't care if this fails. Do it
+    //  first, though: chown can clear the setuid and setgid bits.
+    if (fchown(fd, st->st_uid, st->st_gid) == -1)
+    {
+        // that's okay.
+    } // if
+
+    if (fchmod(fd, st->st_mode & 07777) == -1)
+    {
+        xfailc(FATELF_EIO, "Failed to set permissions on '%s': %s",
+               fname, strerror(errno));
+    } // if
+
+    if (times)
+    {
+        const struct timespec ts[2] = { st->st_atim, st->st_mtim };
+        if (futimens(fd, ts) == -1)
+        {
+            xfailc(FATELF_EIO, "Failed to set timestamps on '%s': %s",
+                   fname, strerror(errno));
+        } // if
+    } // if
+} // xcopy_file_attrs
+
+
 // xfail() on error.
 void xlseek(const char *fname, const int fd,
             const off_t offset, const int whence)
 {
-    if (lseek(fd, offset, whence) == -1)
-        xfail("Failed to seek in '%s': %s", fname, strerror(errno));
+    const uint64_t start = fatelf_stats_start();
+    const off_t rc = lseek(fd, offset, whence);
+    io_syscalls++;
+    FATELF_STATS_OP(FATELF_OP_LSEEK, 1, 0, start);
+    if (rc == -1)
+        xfailc(FATELF_EIO, "Failed to seek in '%s': %s",
+               fname, strerror(errno));
 } // xlseek
 
 
@@ -178,28 +599,43 @@ uint64_t xget_file_size(const char *fname, const int fd)
 {
     struct stat statbuf;
     if (fstat(fd, &statbuf) == -1)
-        xfail("Failed to fstat '%s': %s", fname, strerror(errno));
+        xfailc(FATELF_EIO, "Failed to fstat '%s': %s", fname, strerror(errno));
     return (uint64_t) statbuf.st_size;
 } // xget_file_size
 
 
-static uint8_t copybuf[256 * 1024];
+// Size of the buffer for data that has to pass through user space. Each
+//  thread has its own, so copies can run on several threads at once, and
+//  keeps it until it exits, so a process doing many copies (fatelf --batch,
+//  or a program using libfatelf) doesn't allocate a fresh one every time.
+#define COPYBUF_SIZE (256 * 1024)
 
-// xfail() on error.
-uint64_t xcopyfile(const char *in, const int infd,
-                   const char *out, const int outfd)
+static pthread_key_t copybuf_key;
+static pthread_once_t copybuf_once = PTHREAD_ONCE_INIT;
+
+static void make_copybuf_key(void)
 {
-    uint64_t retval = 0;
-    ssize_t rc = 0;
-    xlseek(in, infd, 0, SEEK_SET);
-    while ( (rc = xread(in, infd, copybuf, sizeof (copybuf), 0)) > 0 )
-    {
-        xwrite(out, outfd, copybuf, rc);
-        retval += (uint64_t) rc;
-    } // while
+    pthread_key_create(&copybuf_key, free);
+} // make_copybuf_key
 
-    return retval;
-} // xcopyfile
+
+// Nothing that uses this buffer may call anything else that does.
+static uint8_t *get_copybuf(void)
+{
+    uint8_t *buf;
+    pthread_once(&copybuf_once, make_copybuf_key);
+    buf = (uint8_t *) pthread_getspecific(copybuf_key);
+    if (buf == NULL)
+    {
+        buf = (uint8_t *) xmalloc(COPYBUF_SIZE);
+        if (pthread_setspecific(copybuf_key, buf) != 0)
+        {
+            free(buf);
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        } // if
+    } // if
+    return buf;
+} // get_copybuf
 
 
 static inline uint64_t minui64(const uint64_t a, const uint64_t b)
@@ -208,253 +644,1275 @@ static inline uint64_t minui64(const uint64_t a, const uint64_t b)
 } // minui64
 
 
-void xcopyfile_range(const char *in, const int infd,
-                     const char *out, const int outfd,
-                     const uint64_t offset, const uint64_t size)
+static inline uint64_t maxui64(const uint64_t a, const uint64_t b)
 {
-    uint64_t remaining = size;
-    xlseek(in, infd, (off_t) offset, SEEK_SET);
-    while (remaining)
-    {
-        const size_t cpysize = minui64(remaining, sizeof (copybuf));
-        xread(in, infd, copybuf, cpysize, 1);
-        xwrite(out, outfd, copybuf, cpysize);
-        remaining -= (uint64_t) cpysize;
-    } // while
-} // xcopyfile_range
+    return (a > b) ? a : b;
+} // maxui64
+
+
+// The kernel copy backends below move data between descriptors without
+//  bouncing it through user space. They read from an explicit offset in
+//  infd, which they never seek, so several threads can copy out of one
+//  input at once. They write at outfd's file position, and advance it, just
+//  like the buffered loop does, so we can drop from one backend to the next
+//  at any point.
+//
+// Each returns the number of bytes it moved, which may be less than what we
+//  asked for (even zero) if the kernel refuses this pair of descriptors. The
+//  remainder is then handed to the next backend, and whatever is left at the
+//  end goes through a buffer. A real I/O error is an xfail(), not a refusal.
+
+#if FATELF_HAVE_COPY_FILE_RANGE || FATELF_HAVE_SENDFILE || \
+    FATELF_HAVE_SPLICE || FATELF_HAVE_FICLONERANGE
+// errno values that mean "can't do this here," not "the disk is broken."
+static int copy_refused(const int err)
+{
+    return ( (err == ENOSYS) || (err == EXDEV) || (err == EINVAL) ||
+             (err == EOPNOTSUPP) || (err == EBADF) || (err == ESPIPE) ||
+             (err == ETXTBSY) || (err == EPERM) );
+} // copy_refused
 
 
-void xread_elf_header(const char *fname, const int fd, const uint64_t offset,
-                      FATELF_record *record)
-{
-    const uint8_t magic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
-    uint8_t buf[20];  // we only care about the first 20 bytes.
-    xlseek(fname, fd, offset, SEEK_SET);
-    xread(fname, fd, buf, sizeof (buf), 1);
-    if (memcmp(magic, buf, sizeof (magic)) != 0)
-        xfail("'%s' is not an ELF binary", fname);
+// largest single request we hand the kernel; Linux clamps to this anyhow.
+#define MAX_KERNEL_COPY ((uint64_t) 0x7FFFF000)
+#endif
 
-    record->osabi = buf[7];
-    record->osabi_version = buf[8];
-    record->word_size = buf[4];
-    record->byte_order = buf[5];
-    record->reserved0 = 0;
-    record->reserved1 = 0;
-    record->offset = 0;
-    record->size = 0;
+#if FATELF_HAVE_COPY_FILE_RANGE
+// cleared if the kernel lacks it. Any thread may clear it; at worst,
+//  another one tries the syscall once more before it notices.
+static volatile int have_copy_file_range = 1;
 
-    if ((record->word_size != FATELF_32BITS) &&
-        (record->word_size != FATELF_64BITS))
+static uint64_t copy_via_copy_file_range(const char *in, const int infd,
+                                         const uint64_t inoff,
+                                         const char *out, const int outfd,
+                                         const uint64_t size)
+{
+    uint64_t copied = 0;
+    while ((have_copy_file_range) && (copied < size))
     {
-        xfail("Unexpected word size (%d) in '%s'", record->word_size, fname);
-    } // if
+        const size_t len = (size_t) minui64(size - copied, MAX_KERNEL_COPY);
+        loff_t inpos = (loff_t) (inoff + copied);
+        const ssize_t rc = copy_file_range(infd, &inpos, outfd, NULL, len, 0);
+        io_syscalls++;
+        if (rc > 0)
+            copied += (uint64_t) rc;
+        else if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc == 0)
+            break;  // EOF, or a filesystem that won't tell us; fall back.
+        else if (copy_refused(errno))
+        {
+            if (errno == ENOSYS)
+                have_copy_file_range = 0;
+            break;
+        } // else if
+        else
+            xfailc(FATELF_EIO, "Failed to copy '%s' to '%s': %s",
+                   in, out, strerror(errno));
+    } // while
 
-    if (record->byte_order == FATELF_BIGENDIAN)
-        record->machine = (((uint16_t)buf[18]) << 8) | (((uint16_t)buf[19]));
-    else if (record->byte_order == FATELF_LITTLEENDIAN)
-        record->machine = (((uint16_t)buf[19]) << 8) | (((uint16_t)buf[18]));
-    else
-    {
-        xfail("Unexpected byte order (%d) in '%s'",
-              (int) record->byte_order, fname);
-    } // else
-} // xread_elf_header
+    return copied;
+} // copy_via_copy_file_range
+#endif
 
 
-size_t fatelf_header_size(const int bincount)
+#if FATELF_HAVE_SENDFILE
+static uint64_t copy_via_sendfile(const char *in, const int infd,
+                                  const uint64_t inoff,
+                                  const char *out, const int outfd,
+                                  const uint64_t size)
 {
-    return (sizeof (FATELF_header) + (sizeof (FATELF_record) * bincount));
-} // fatelf_header_size
+    uint64_t copied = 0;
+    while (copied < size)
+    {
+        const size_t len = (size_t) minui64(size - copied, MAX_KERNEL_COPY);
+        off_t inpos = (off_t) (inoff + copied);
+        const ssize_t rc = sendfile(outfd, infd, &inpos, len);
+        io_syscalls++;
+        if (rc > 0)
+            copied += (uint64_t) rc;
+        else if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if ((rc == 0) || (copy_refused(errno)))
+            break;
+        else
+            xfailc(FATELF_EIO, "Failed to copy '%s' to '%s': %s",
+                   in, out, strerror(errno));
+    } // while
+
+    return copied;
+} // copy_via_sendfile
+#endif
 
 
-// Write a uint8_t to a buffer.
-static inline uint8_t *putui8(uint8_t *ptr, const uint8_t val)
+#if FATELF_HAVE_SPLICE
+static int is_pipe(const int fd)
 {
-    *(ptr++) = val;
-    return ptr;
-} // putui8
+    struct stat statbuf;
+    return ((fstat(fd, &statbuf) == 0) && (S_ISFIFO(statbuf.st_mode)));
+} // is_pipe
 
 
-// Write a native uint16_t to a buffer in littleendian format.
-static inline uint8_t *putui16(uint8_t *ptr, const uint16_t val)
+// splice() one way, handling EINTR. Reads from (*inoff) in infd, and
+//  advances it, unless (inoff) is NULL (infd is a pipe). Returns bytes
+//  moved, 0 on EOF, -1 if the kernel refused, and xfail()s on real errors.
+static ssize_t xsplice(const char *in, const int infd, loff_t *inoff,
+                       const char *out, const int outfd, const size_t len)
 {
-    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
-    return ptr;
-} // putui16
+    ssize_t rc;
+    while ( ((rc = splice(infd, inoff, outfd, NULL, len, SPLICE_F_MOVE)) == -1)
+            && (errno == EINTR) ) { io_syscalls++; }
+    io_syscalls++;
+    if ((rc == -1) && (!copy_refused(errno)))
+        xfailc(FATELF_EIO, "Failed to copy '%s' to '%s': %s",
+               in, out, strerror(errno));
+    return rc;
+} // xsplice
 
 
-// Write a native uint32_t to a buffer in littleendian format.
-static inline uint8_t *putui32(uint8_t *ptr, const uint32_t val)
+// splice() needs a pipe on one end. If neither fd is one, we stage the data
+//  through a pipe of our own, which still never touches user space.
+static uint64_t copy_via_splice(const char *in, const int infd,
+                                const uint64_t inoff,
+                                const char *out, const int outfd,
+                                const uint64_t size)
 {
-    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
-    return ptr;
-} // putui32
+    const int inpipe = is_pipe(infd);
+    loff_t inpos = (loff_t) inoff;
+    loff_t *inposptr = inpipe ? NULL : &inpos;
+    uint64_t copied = 0;
+    int fds[2] = { -1, -1 };
 
+    if ((inpipe) || (is_pipe(outfd)))
+    {
+        while (copied < size)
+        {
+            const size_t len = (size_t) minui64(size - copied, MAX_KERNEL_COPY);
+            const ssize_t rc = xsplice(in, infd, inposptr, out, outfd, len);
+            if (rc <= 0)
+                break;
+            copied += (uint64_t) rc;
+        } // while
+        return copied;
+    } // if
 
-// Write a native uint64_t to a buffer in littleendian format.
-static inline uint8_t *putui64(uint8_t *ptr, const uint64_t val)
-{
-    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 32) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 40) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 48) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 56) & 0xFF));
-    return ptr;
-} // putui64
+    if (pipe(fds) == -1)
+        return 0;  // out of descriptors? Just use the buffered loop.
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(fds[0]));
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(fds[1]));
 
+    while (copied < size)
+    {
+        const size_t len = (size_t) minui64(size - copied, COPYBUF_SIZE);
+        ssize_t staged = xsplice(in, infd, inposptr, "(pipe)", fds[1], len);
+        if (staged <= 0)
+            break;
 
-// Read a uint8_t from a buffer.
-static inline uint8_t *getui8(uint8_t *ptr, uint8_t *val)
-{
-    *val = *ptr;
-    return ptr + sizeof (*val);
-} // getui8
+        while (staged > 0)
+        {
+            const ssize_t rc = xsplice("(pipe)", fds[0], NULL, out, outfd,
+                                       staged);
+            if (rc <= 0)
+            {
+                // already pulled out of infd, so push it through by hand.
+                uint8_t *buf = (uint8_t *) xmalloc(staged);
+                ssize_t br;
+                fatelf_cleanup_push(free, buf);
+                br = xread("(pipe)", fds[0], buf, staged, 1);
+                xwrite(out, outfd, buf, br);
+                fatelf_cleanup_pop(free, buf, 1);
+                copied += (uint64_t) br;
+                staged = -1;  // stop splicing entirely.
+                break;
+            } // if
+            copied += (uint64_t) rc;
+            staged -= rc;
+        } // while
 
+        if (staged < 0)
+            break;
+    } // while
 
-// Read a littleendian uint16_t from a buffer in native format.
-static inline uint8_t *getui16(uint8_t *ptr, uint16_t *val)
-{
-    *val = ( (((uint16_t) ptr[0]) << 0) | (((uint16_t) ptr[1]) << 8) );
-    return ptr + sizeof (*val);
-} // getui16
+    fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(fds[1]), 1);
+    fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(fds[0]), 1);
+    return copied;
+} // copy_via_splice
+#endif
 
 
-// Read a littleendian uint32_t from a buffer in native format.
-static inline uint8_t *getui32(uint8_t *ptr, uint32_t *val)
+#if FATELF_HAVE_FICLONERANGE
+// Share the extents behind the range instead of copying them, on
+//  filesystems that can (btrfs, XFS, etc). Both offsets have to sit on a
+//  filesystem block boundary. A range that runs to the end of the input is
+//  shared whole, partial last block and all, since the kernel allows that
+//  at EOF. Anywhere else, only the whole blocks are shared, and the
+//  unaligned tail is left for the other backends to copy.
+static uint64_t reflink_at(const char *in, const int infd,
+                           const uint64_t inoff, const char *out,
+                           const int outfd, const uint64_t outoff,
+                           const uint64_t size)
 {
-    *val = ( (((uint32_t) ptr[0]) << 0)  |
-             (((uint32_t) ptr[1]) << 8)  |
-             (((uint32_t) ptr[2]) << 16) |
-             (((uint32_t) ptr[3]) << 24) );
-    return ptr + sizeof (*val);
-} // getui32
+    struct file_clone_range range;
+    struct stat instat, outstat;
+    uint64_t blksize, len;
+    int rc;
 
+    if ((fstat(infd, &instat) == -1) || (fstat(outfd, &outstat) == -1))
+        return 0;
+    else if ((!S_ISREG(instat.st_mode)) || (!S_ISREG(outstat.st_mode)))
+        return 0;
 
-// Read a littleendian uint64_t from a buffer in native format.
-static inline uint8_t *getui64(uint8_t *ptr, uint64_t *val)
-{
-    *val = ( (((uint64_t) ptr[0]) << 0)  |
-             (((uint64_t) ptr[1]) << 8)  |
-             (((uint64_t) ptr[2]) << 16) |
-             (((uint64_t) ptr[3]) << 24) |
-             (((uint64_t) ptr[4]) << 32) |
-             (((uint64_t) ptr[5]) << 40) |
-             (((uint64_t) ptr[6]) << 48) |
-             (((uint64_t) ptr[7]) << 56) );
-    return ptr + sizeof (*val);
-} // getui64
+    blksize = (uint64_t) outstat.st_blksize;
+    if ((blksize == 0) || (inoff % blksize) || (outoff % blksize))
+        return 0;
 
+    len = size;
+    if (inoff + size != (uint64_t) instat.st_size)
+        len -= (len % blksize);  // not at EOF, so only share whole blocks.
+    if (len == 0)
+        return 0;  // (a zero length would mean "to EOF" to the kernel.)
 
-void xwrite_fatelf_header(const char *fname, const int fd,
-                          const FATELF_header *header)
-{
-    const size_t buflen = FATELF_DISK_FORMAT_SIZE(header->num_records);
-    uint8_t *buf = (uint8_t *) xmalloc(buflen);
-    uint8_t *ptr = buf;
-    int i;
+    range.src_fd = (int64_t) infd;
+    range.src_offset = inoff;
+    range.src_length = len;
+    range.dest_offset = outoff;
 
-    ptr = putui32(ptr, header->magic);
-    ptr = putui16(ptr, header->version);
-    ptr = putui8(ptr, header->num_records);
-    ptr = putui8(ptr, header->reserved0);
+    while (((rc = ioctl(outfd, FICLONERANGE, &range)) == -1) && (errno == EINTR))
+        { io_syscalls++; }
+    io_syscalls++;
 
-    for (i = 0; i < header->num_records; i++)
+    if (rc == -1)
     {
-        ptr = putui16(ptr, header->records[i].machine);
-        ptr = putui8(ptr, header->records[i].osabi);
-        ptr = putui8(ptr, header->records[i].osabi_version);
-        ptr = putui8(ptr, header->records[i].word_size);
-        ptr = putui8(ptr, header->records[i].byte_order);
-        ptr = putui8(ptr, header->records[i].reserved0);
-        ptr = putui8(ptr, header->records[i].reserved1);
-        ptr = putui64(ptr, header->records[i].offset);
-        ptr = putui64(ptr, header->records[i].size);
-    } // for
-
-    assert(ptr == (buf + buflen));
+        if ((copy_refused(errno)) || (errno == ENOTTY))
+            return 0;
+        xfailc(FATELF_EIO, "Failed to reflink '%s' into '%s': %s",
+               in, out, strerror(errno));
+    } // if
 
-    xlseek(fname, fd, 0, SEEK_SET);  // jump to start of file again.
-    xwrite(fname, fd, buf, buflen);
+    return len;
+} // reflink_at
 
-    free(buf);
-} // xwrite_fatelf_header
 
-// don't forget to free() the returned pointer!
-FATELF_header *xread_fatelf_header(const char *fname, const int fd)
+static uint64_t copy_via_reflink(const char *in, const int infd,
+                                 const uint64_t inoff,
+                                 const char *out, const int outfd,
+                                 const uint64_t size)
+{
+    const off_t outpos = lseek(outfd, 0, SEEK_CUR);
+    uint64_t len;
+
+    if (outpos == -1)
+        return 0;
+
+    len = reflink_at(in, infd, inoff, out, outfd, (uint64_t) outpos, size);
+
+    // the ioctl doesn't move the output's file position, so we do.
+    if (len > 0)
+        xlseek(out, outfd, outpos + (off_t) len, SEEK_SET);
+    return len;
+} // copy_via_reflink
+#endif
+
+
+// Zero runs at least this long in data we have to bounce through user space
+//  anyhow are written with xwrite_zeros(), so they can become holes, too.
+#define SPARSE_MIN_RUN (4 * sizeof (zerobuf))
+
+static void xwrite_sparse(const char *out, const int outfd,
+                          const uint8_t *buf, const size_t len)
+{
+    size_t start = 0;  // first byte we haven't written yet.
+    size_t i = 0;
+
+    if (fatelf_copy_flags & FATELF_COPY_NO_SPARSE)
+    {
+        xwrite(out, outfd, buf, len);
+        return;
+    } // if
+
+    while (i < len)
+    {
+        size_t run = 0;
+        while (i + run < len)
+        {
+            const size_t chunk = minui64(len - (i + run), sizeof (zerobuf));
+            if (memcmp(buf + i + run, zerobuf, chunk) != 0)
+                break;
+            run += chunk;
+        } // while
+
+        if (run >= SPARSE_MIN_RUN)
+        {
+            if (i > start)
+                xwrite(out, outfd, buf + start, i - start);
+            xwrite_zeros(out, outfd, run);
+            start = i + run;
+        } // if
+
+        i += run + sizeof (zerobuf);  // skip the nonzero chunk, too.
+    } // while
+
+    if (start < len)
+        xwrite(out, outfd, buf + start, len - start);
+} // xwrite_sparse
+
+
+// Push (size) bytes from (inoff) in infd to outfd's file position, with the
+//  fastest method the kernel will accept for these two descriptors.
+static void copy_engine(const char *in, const int infd, uint64_t inoff,
+                        const char *out, const int outfd, uint64_t size)
+{
+    #if FATELF_HAVE_FICLONERANGE
+    if ((size) && (fatelf_copy_flags & FATELF_COPY_REFLINK))
+    {
+        const uint64_t len = copy_via_reflink(in, infd, inoff,
+                                              out, outfd, size);
+        inoff += len;
+        size -= len;
+    } // if
+    #endif
+
+    #if FATELF_HAVE_COPY_FILE_RANGE
+    if (size)
+    {
+        const uint64_t len = copy_via_copy_file_range(in, infd, inoff,
+                                                      out, outfd, size);
+        inoff += len;
+        size -= len;
+    } // if
+    #endif
+
+    #if FATELF_HAVE_SENDFILE
+    if (size)
+    {
+        const uint64_t len = copy_via_sendfile(in, infd, inoff,
+                                               out, outfd, size);
+        inoff += len;
+        size -= len;
+    } // if
+    #endif
+
+    #if FATELF_HAVE_SPLICE
+    if (size)
+    {
+        const uint64_t len = copy_via_splice(in, infd, inoff,
+                                             out, outfd, size);
+        inoff += len;
+        size -= len;
+    } // if
+    #endif
+
+    if (size)  // whatever is left goes through user space.
+    {
+        uint8_t *buf = get_copybuf();
+        while (size)
+        {
+            const size_t cpysize = (size_t) minui64(size, COPYBUF_SIZE);
+            xpread(in, infd, buf, cpysize, inoff, 1);
+            xwrite_sparse(out, outfd, buf, cpysize);
+            inoff += (uint64_t) cpysize;
+            size -= (uint64_t) cpysize;
+        } // while
+    } // if
+} // copy_engine
+
+
+// xfail() on error.
+uint64_t xcopyfile(const char *in, const int infd,
+                   const char *out, const int outfd)
+{
+    uint64_t retval = 0;
+    ssize_t rc = 0;
+    struct stat statbuf;
+    uint8_t *buf;
+
+    if (fstat(infd, &statbuf) == -1)
+        xfailc(FATELF_EIO, "Failed to fstat '%s': %s", in, strerror(errno));
+    else if (S_ISREG(statbuf.st_mode))  // we know the length up front.
+    {
+        retval = (uint64_t) statbuf.st_size;
+        xcopyfile_range(in, infd, out, outfd, 0, retval);
+        return retval;
+    } // else if
+
+    // a pipe or something; all we can do is read it until it stops.
+    buf = get_copybuf();
+    while ( (rc = xread(in, infd, buf, COPYBUF_SIZE, 0)) > 0 )
+    {
+        xwrite(out, outfd, buf, rc);
+        retval += (uint64_t) rc;
+    } // while
+
+    return retval;
+} // xcopyfile
+
+
+size_t xread_stream(const char *fname, const int fd, void *buf,
+                    const size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        const ssize_t br = xread(fname, fd, ((uint8_t *) buf) + total,
+                                 len - total, 0);
+        if (br == 0)
+            break;  // EOF.
+        total += (size_t) br;
+    } // while
+    return total;
+} // xread_stream
+
+
+void xskip_stream(const char *fname, const int fd, uint64_t len)
+{
+    uint8_t *buf;
+
+    if ((len > 0) && (lseek(fd, (off_t) len, SEEK_CUR) != -1))
+        return;  // it's seekable after all.
+
+    buf = get_copybuf();
+    while (len > 0)
+    {
+        const size_t count = (size_t) minui64(len, COPYBUF_SIZE);
+        if (xread_stream(fname, fd, buf, count) != count)
+        {
+            xfailc(FATELF_EFORMAT,
+                   "Failed to read '%s': unexpected end of file", fname);
+        } // if
+        len -= (uint64_t) count;
+    } // while
+} // xskip_stream
+
+
+uint64_t xcopy_stream(const char *in, const int infd,
+                      const char *out, const int outfd, const uint64_t size)
+{
+    const uint64_t start = fatelf_stats_start();
+    const uint64_t syscalls = io_syscalls;
+    uint64_t copied = 0;
+    uint8_t *buf;
+
+    #if FATELF_HAVE_SPLICE
+    if (is_pipe(infd))  // the kernel can move pages out of a pipe for us.
+        copied = copy_via_splice(in, infd, 0, out, outfd, size);
+    #endif
+
+    buf = get_copybuf();
+    while (copied < size)
+    {
+        const size_t len = (size_t) minui64(size - copied, COPYBUF_SIZE);
+        const ssize_t br = xread(in, infd, buf, len, 0);
+        if (br == 0)
+            break;  // EOF.
+        xwrite(out, outfd, buf, (size_t) br);
+        copied += (uint64_t) br;
+    } // while
+
+    FATELF_STATS_OP(FATELF_OP_COPY, io_syscalls - syscalls, copied, start);
+    return copied;
+} // xcopy_stream
+
+
+uint64_t sparse_input_size(const int fd)
+{
+    #if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    struct stat statbuf;
+    if ( (!(fatelf_copy_flags & FATELF_COPY_NO_SPARSE)) &&
+         (fstat(fd, &statbuf) == 0) && (S_ISREG(statbuf.st_mode)) &&
+         (((uint64_t) statbuf.st_blocks) * 512 < (uint64_t) statbuf.st_size) )
+    {
+        return (uint64_t) statbuf.st_size;
+    } // if
+    #endif
+    return 0;
+} // sparse_input_size
+
+
+int find_data_extent(const int fd, const uint64_t pos, const uint64_t end,
+                     uint64_t *start, uint64_t *stop)
+{
+    #if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data = lseek(fd, (off_t) pos, SEEK_DATA);
+    off_t hole;
+
+    if ((data == -1) && (errno == ENXIO))
+        return 0;  // nothing but hole from here.
+    else if (data == -1)
+        data = (off_t) pos;  // can't tell; assume it's all data.
+    else if ((uint64_t) data >= end)
+        return 0;
+
+    hole = lseek(fd, data, SEEK_HOLE);
+    if ((hole == -1) || ((uint64_t) hole > end))
+        hole = (off_t) end;
+
+    *start = (uint64_t) data;
+    *stop = (uint64_t) hole;
+    #else
+    *start = pos;
+    *stop = end;
+    #endif
+    return 1;
+} // find_data_extent
+
+
+void fatelf_io_begin(const int infd, const uint64_t inoff, const int outfd,
+                     const uint64_t outoff, const uint64_t size)
+{
+    if (size == 0)
+        return;
+
+    #if FATELF_HAVE_POSIX_FADVISE
+    if (fatelf_io_policy & FATELF_IO_SEQUENTIAL)
+        posix_fadvise(infd, (off_t) inoff, (off_t) size, POSIX_FADV_SEQUENTIAL);
+    if (fatelf_io_policy & FATELF_IO_DROP_CACHE)
+        posix_fadvise(infd, (off_t) inoff, (off_t) size, POSIX_FADV_NOREUSE);
+    #endif
+
+    // Reserve the output's blocks in one go, so the filesystem can keep
+    //  them together instead of growing the file a write at a time. Not for
+    //  sparse inputs, whose holes we want to keep, or for --reflink, which
+    //  would just throw the new blocks away. KEEP_SIZE leaves the file's
+    //  length alone, so writing past the end still works as usual.
+    #if FATELF_HAVE_FALLOCATE
+    if ( (fatelf_io_policy & FATELF_IO_PREALLOCATE) &&
+         (!(fatelf_copy_flags & FATELF_COPY_REFLINK)) &&
+         (sparse_input_size(infd) == 0) )
+    {
+        fallocate(outfd, FALLOC_FL_KEEP_SIZE, (off_t) outoff, (off_t) size);
+    } // if
+    #endif
+} // fatelf_io_begin
+
+
+void fatelf_io_end(const int infd, const uint64_t inoff, const int outfd,
+                   const uint64_t outoff, const uint64_t size)
+{
+    if ((size == 0) || (!(fatelf_io_policy & FATELF_IO_DROP_CACHE)))
+        return;
+
+    // Dirty pages can't be dropped, so push the output to disk first.
+    #if FATELF_HAVE_SYNC_FILE_RANGE
+    sync_file_range(outfd, (off_t) outoff, (off_t) size,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+    #else
+    fdatasync(outfd);
+    #endif
+
+    #if FATELF_HAVE_POSIX_FADVISE
+    posix_fadvise(outfd, (off_t) outoff, (off_t) size, POSIX_FADV_DONTNEED);
+    posix_fadvise(infd, (off_t) inoff, (off_t) size, POSIX_FADV_DONTNEED);
+    #endif
+} // fatelf_io_end
+
+
+// Holes in the input stay holes in the output (if the output is being
+//  appended to; see skip_zeros()). We ask the filesystem where the data is
+//  with SEEK_DATA/SEEK_HOLE and only copy that. A fully-allocated input
+//  skips the search, since it can't have any holes to find.
+void xcopyfile_range(const char *in, const int infd,
+                     const char *out, const int outfd,
+                     const uint64_t offset, const uint64_t size)
+{
+    uint64_t pos = offset;
+    const uint64_t end = offset + size;
+    const uint64_t fsize = sparse_input_size(infd);
+    const off_t outpos = lseek(outfd, 0, SEEK_CUR);  // -1 for pipes.
+    const uint64_t start = fatelf_stats_start();
+    const uint64_t syscalls = io_syscalls;
+
+    // O_DIRECT needs explicit offsets; leave the position where we would.
+    //  (xcopyfile_at() counts this one for --stats.)
+    if ((outpos != -1) && (fatelf_want_direct(size)))
+    {
+        xcopyfile_at(in, infd, offset, out, outfd, (uint64_t) outpos, size);
+        xlseek(out, outfd, outpos + (off_t) size, SEEK_SET);
+        return;
+    } // if
+
+    if (outpos != -1)
+        fatelf_io_begin(infd, offset, outfd, (uint64_t) outpos, size);
+
+    if (fsize > 0)
+    {
+        // past EOF is a short read, and the dense copy below reports that.
+        const uint64_t sparse_end = minui64(end, fsize);
+        uint64_t start, stop;
+
+        while ( (pos < sparse_end) &&
+                (find_data_extent(infd, pos, sparse_end, &start, &stop)) )
+        {
+            if (start > pos)
+                xwrite_zeros(out, outfd, (size_t) (start - pos));
+            copy_engine(in, infd, start, out, outfd, stop - start);
+            pos = stop;
+        } // while
+
+        if (pos < sparse_end)  // ends in a hole.
+        {
+            xwrite_zeros(out, outfd, (size_t) (sparse_end - pos));
+            pos = sparse_end;
+        } // if
+    } // if
+
+    copy_engine(in, infd, pos, out, outfd, end - pos);
+
+    if (outpos != -1)
+        fatelf_io_end(infd, offset, outfd, (uint64_t) outpos, size);
+
+    FATELF_STATS_OP(FATELF_OP_COPY, io_syscalls - syscalls, size, start);
+} // xcopyfile_range
+
+
+int fatelf_want_direct(const uint64_t size)
+{
+    #ifdef O_DIRECT
+    return ( (direct_threshold > 0) && (size >= direct_threshold) &&
+             (!(fatelf_copy_flags & FATELF_COPY_REFLINK)) );
+    #else
+    return 0;
+    #endif
+} // fatelf_want_direct
+
+
+static void copy_buffered_at(const char *in, const int infd, uint64_t inoff,
+                             const char *out, const int outfd,
+                             uint64_t outoff, uint64_t size, uint8_t *buf,
+                             const size_t buflen)
+{
+    while (size)
+    {
+        const size_t cpysize = (size_t) minui64(size, buflen);
+        xpread(in, infd, buf, cpysize, inoff, 1);
+        xpwrite(out, outfd, buf, cpysize, outoff);
+        inoff += cpysize;
+        outoff += cpysize;
+        size -= cpysize;
+    } // while
+} // copy_buffered_at
+
+
+#ifdef O_DIRECT
+#define DIRECT_CHUNK (4 * 1024 * 1024)
+
+// How offsets, lengths and buffers have to be aligned for O_DIRECT on
+//  (fd): what statx() says, or else the logical block size of the device
+//  the file is on. Zero if the file can't do direct I/O at all.
+static uint64_t direct_align(const int fd)
+{
+    #if FATELF_HAVE_STATX && defined(STATX_DIOALIGN)
+    struct statx stx;
+    uint64_t align;
+    #endif
+    unsigned int blksize = 0;
+    char path[96];
+    struct stat st;
+    FILE *io;
+
+    #if FATELF_HAVE_STATX && defined(STATX_DIOALIGN)
+    if ( (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0) &&
+         (stx.stx_mask & STATX_DIOALIGN) )
+    {
+        align = maxui64(stx.stx_dio_offset_align, stx.stx_dio_mem_align);
+        if ((stx.stx_dio_offset_align == 0) || (align & (align - 1)))
+            return 0;  // the filesystem says it can't, or makes no sense.
+        return align;
+    } // if
+    #endif
+
+    if (fstat(fd, &st) == -1)
+        return 0;
+
+    // A partition has no queue of its own; its disk's is one level up.
+    snprintf(path, sizeof (path), "/sys/dev/block/%u:%u/queue/"
+             "logical_block_size", major(st.st_dev), minor(st.st_dev));
+    if ((io = fopen(path, "r")) == NULL)
+    {
+        snprintf(path, sizeof (path), "/sys/dev/block/%u:%u/../queue/"
+                 "logical_block_size", major(st.st_dev), minor(st.st_dev));
+        io = fopen(path, "r");
+    } // if
+
+    if (io != NULL)
+    {
+        if (fscanf(io, "%u", &blksize) != 1)
+            blksize = 0;
+        fclose(io);
+    } // if
+
+    // Not a block device we can see (tmpfs, network, ...): a page is
+    //  enough for anything that takes O_DIRECT at all.
+    if ((blksize < 512) || (blksize & (blksize - 1)))
+        return 4096;
+    return blksize;
+} // direct_align
+
+
+// Open a second descriptor on the file behind (fd) with O_DIRECT set, so
+//  the caller's own descriptor (which may be shared with other threads, or
+//  with whoever handed it to us) keeps its file status flags. This goes
+//  through /proc so it finds the same inode even if the name has moved or
+//  gone. Returns -1 if the file or the filesystem won't allow it.
+static int open_direct(const int fd, const int mode)
+{
+    char path[64];
+    int rc;
+
+    snprintf(path, sizeof (path), "/proc/self/fd/%d", fd);
+    while (((rc = open(path, mode | O_DIRECT | O_CLOEXEC)) == -1) &&
+           (errno == EINTR)) { /* try again. */ }
+    return rc;
+} // open_direct
+
+// Move whole aligned blocks through private O_DIRECT descriptors on both
+//  files, so they go straight between the disk and our buffer instead of
+//  through the page cache. Returns how many bytes were copied; this stops
+//  early (and leaves the rest to the caller) if the filesystem won't do
+//  direct I/O, or at a short read.
+static uint64_t copy_direct_blocks(const int infd, const uint64_t inoff,
+                                   const int outfd, const uint64_t outoff,
+                                   const uint64_t size, uint8_t *buf)
+{
+    const int dinfd = open_direct(infd, O_RDONLY);
+    int doutfd;
+    uint64_t done = 0;
+
+    if (dinfd == -1)
+        return 0;
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(dinfd));
+
+    doutfd = open_direct(outfd, O_WRONLY);
+    if (doutfd == -1)
+    {
+        fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(dinfd), 1);
+        return 0;
+    } // if
+    fatelf_cleanup_push(fatelf_cleanup_close, FATELF_FD_ARG(doutfd));
+
+    while (done < size)
+    {
+        const size_t len = (size_t) minui64(size - done, DIRECT_CHUNK);
+        size_t written = 0;
+        ssize_t rc;
+
+        while (((rc = pread(dinfd, buf, len, (off_t) (inoff + done))) == -1) &&
+               (errno == EINTR)) { io_syscalls++; }
+        io_syscalls++;
+        if (rc != (ssize_t) len)
+            break;  // unsupported or past EOF; the caller's copy will see.
+
+        while (written < len)
+        {
+            rc = pwrite(doutfd, buf + written, len - written,
+                        (off_t) (outoff + done + written));
+            io_syscalls++;
+            if ((rc == -1) && (errno == EINTR))
+                continue;
+            else if (rc <= 0)
+                break;  // the caller's copy will retry, and report errors.
+            written += (size_t) rc;
+        } // while
+
+        done += written;
+        if (written < len)
+            break;
+    } // while
+
+    fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(doutfd), 1);
+    fatelf_cleanup_pop(fatelf_cleanup_close, FATELF_FD_ARG(dinfd), 1);
+    return done;
+} // copy_direct_blocks
+#endif
+
+
+// Copy the block-aligned middle of a range with O_DIRECT, and the unaligned
+//  head and tail (and anything direct I/O refused) through the page cache.
+static void copy_direct_at(const char *in, const int infd, uint64_t inoff,
+                           const char *out, const int outfd, uint64_t outoff,
+                           uint64_t size)
+{
+    #ifdef O_DIRECT
+    const uint64_t inalign = direct_align(infd);
+    const uint64_t outalign = direct_align(outfd);
+    const uint64_t align = (inalign && outalign) ?
+                                maxui64(inalign, outalign) : 0;
+    void *ptr = NULL;
+    uint8_t *buf;
+
+    // A chunk is a multiple of any block size we'll see, so the buffer only
+    //  has to start aligned.
+    if (posix_memalign(&ptr, (size_t) maxui64(align, 4096), DIRECT_CHUNK))
+        xfailc(FATELF_ENOMEM, "Out of memory!");
+    buf = (uint8_t *) ptr;
+    fatelf_cleanup_push(free, buf);
+
+    // Both sides have to be aligned at once, so their offsets have to agree
+    //  on where blocks start. They do for records, which start on pages.
+    if ((align != 0) && (align <= DIRECT_CHUNK) &&
+        ((inoff % align) == (outoff % align)))
+    {
+        const uint64_t head = minui64(size, (align - (inoff % align)) % align);
+        const uint64_t blocks = ((size - head) / align) * align;
+        uint64_t done;
+
+        copy_buffered_at(in, infd, inoff, out, outfd, outoff, head,
+                         buf, DIRECT_CHUNK);
+        inoff += head;
+        outoff += head;
+        size -= head;
+
+        done = copy_direct_blocks(infd, inoff, outfd, outoff, blocks, buf);
+        inoff += done;
+        outoff += done;
+        size -= done;
+    } // if
+
+    copy_buffered_at(in, infd, inoff, out, outfd, outoff, size,
+                     buf, DIRECT_CHUNK);
+    fatelf_cleanup_pop(free, buf, 1);
+    #else
+    assert(0 && "shouldn't be here without O_DIRECT");
+    #endif
+} // copy_direct_at
+
+
+// Positional version of copy_engine(): copy_file_range() can take explicit
+//  offsets, but sendfile() and splice() can't, so those are skipped. With
+//  (direct) set, data goes around the page cache instead.
+static void copy_engine_at(const char *in, const int infd, uint64_t inoff,
+                           const char *out, const int outfd, uint64_t outoff,
+                           uint64_t size, const int direct)
+{
+    if (direct)
+    {
+        copy_direct_at(in, infd, inoff, out, outfd, outoff, size);
+        return;
+    } // if
+
+    #if FATELF_HAVE_FICLONERANGE
+    if ((size) && (fatelf_copy_flags & FATELF_COPY_REFLINK))
+    {
+        const uint64_t len = reflink_at(in, infd, inoff, out, outfd,
+                                        outoff, size);
+        inoff += len;
+        outoff += len;
+        size -= len;
+    } // if
+    #endif
+
+    #if FATELF_HAVE_COPY_FILE_RANGE
+    while ((size) && (have_copy_file_range))
+    {
+        loff_t inpos = (loff_t) inoff;
+        loff_t outpos = (loff_t) outoff;
+        const size_t len = (size_t) minui64(size, MAX_KERNEL_COPY);
+        const ssize_t rc = copy_file_range(infd, &inpos, outfd, &outpos, len, 0);
+        io_syscalls++;
+        if (rc > 0)
+        {
+            inoff += (uint64_t) rc;
+            outoff += (uint64_t) rc;
+            size -= (uint64_t) rc;
+        } // if
+        else if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc == 0)
+            break;
+        else if (copy_refused(errno))
+        {
+            if (errno == ENOSYS)
+                have_copy_file_range = 0;
+            break;
+        } // else if
+        else
+            xfailc(FATELF_EIO, "Failed to copy '%s' to '%s': %s",
+                   in, out, strerror(errno));
+    } // while
+    #endif
+
+    if (size)
+    {
+        copy_buffered_at(in, infd, inoff, out, outfd, outoff, size,
+                         get_copybuf(), COPYBUF_SIZE);
+    } // if
+} // copy_engine_at
+
+
+void xcopyfile_at(const char *in, const int infd, const uint64_t inoff,
+                  const char *out, const int outfd, const uint64_t outoff,
+                  const uint64_t size)
+{
+    uint64_t pos = inoff;
+    const uint64_t end = inoff + size;
+    const uint64_t fsize = sparse_input_size(infd);
+    const int direct = fatelf_want_direct(size);
+    const uint64_t start = fatelf_stats_start();
+    const uint64_t syscalls = io_syscalls;
+
+    fatelf_io_begin(infd, inoff, outfd, outoff, size);
+
+    if (fsize > 0)
+    {
+        const uint64_t sparse_end = minui64(end, fsize);
+        uint64_t start, stop;
+
+        while ( (pos < sparse_end) &&
+                (find_data_extent(infd, pos, sparse_end, &start, &stop)) )
+        {
+            if (start > pos)
+                xpwrite_zeros(out, outfd, outoff + (pos - inoff), start - pos);
+            copy_engine_at(in, infd, start, out, outfd,
+                           outoff + (start - inoff), stop - start, direct);
+            pos = stop;
+        } // while
+
+        if (pos < sparse_end)  // ends in a hole.
+        {
+            xpwrite_zeros(out, outfd, outoff + (pos - inoff), sparse_end - pos);
+            pos = sparse_end;
+        } // if
+    } // if
+
+    copy_engine_at(in, infd, pos, out, outfd, outoff + (pos - inoff),
+                   end - pos, direct);
+
+    fatelf_io_end(infd, inoff, outfd, outoff, size);
+    FATELF_STATS_OP(FATELF_OP_COPY, io_syscalls - syscalls, size, start);
+} // xcopyfile_at
+
+
+void xdecode_elf_header(const char *fname, const uint8_t *buf,
+                        const uint64_t buflen, FATELF_record *record)
+{
+    const uint8_t magic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
+    // we only care about the first 20 bytes.
+    if ((buflen < 20) || (memcmp(magic, buf, sizeof (magic)) != 0))
+        xfailc(FATELF_EFORMAT, "'%s' is not an ELF binary", fname);
+
+    record->osabi = buf[7];
+    record->osabi_version = buf[8];
+    record->word_size = buf[4];
+    record->byte_order = buf[5];
+    record->reserved0 = 0;
+    record->reserved1 = 0;
+    record->offset = 0;
+    record->size = 0;
+
+    if ((record->word_size != FATELF_32BITS) &&
+        (record->word_size != FATELF_64BITS))
+    {
+        xfailc(FATELF_EFORMAT, "Unexpected word size (%d) in '%s'",
+               record->word_size, fname);
+    } // if
+
+    if (record->byte_order == FATELF_BIGENDIAN)
+        record->machine = (((uint16_t)buf[18]) << 8) | (((uint16_t)buf[19]));
+    else if (record->byte_order == FATELF_LITTLEENDIAN)
+        record->machine = (((uint16_t)buf[19]) << 8) | (((uint16_t)buf[18]));
+    else
+    {
+        xfailc(FATELF_EFORMAT, "Unexpected byte order (%d) in '%s'",
+               (int) record->byte_order, fname);
+    } // else
+} // xdecode_elf_header
+
+
+void xread_elf_header(const char *fname, const int fd, const uint64_t offset,
+                      FATELF_record *record)
+{
+    const uint64_t start = fatelf_stats_start();
+    uint8_t buf[20];  // we only care about the first 20 bytes.
+    xpread(fname, fd, buf, sizeof (buf), offset, 1);
+    xdecode_elf_header(fname, buf, sizeof (buf), record);
+    FATELF_STATS_PHASE(FATELF_PHASE_HEADER, fname, start);
+} // xread_elf_header
+
+
+size_t fatelf_header_size(const int bincount)
+{
+    return (sizeof (FATELF_header) + (sizeof (FATELF_record) * bincount));
+} // fatelf_header_size
+
+
+uint8_t *fatelf_encode_target(uint8_t *ptr, const FATELF_record *rec)
+{
+    ptr = putui16(ptr, rec->machine);
+    ptr = putui8(ptr, rec->osabi);
+    ptr = putui8(ptr, rec->osabi_version);
+    ptr = putui8(ptr, rec->word_size);
+    ptr = putui8(ptr, rec->byte_order);
+    ptr = putui8(ptr, rec->reserved0);
+    ptr = putui8(ptr, rec->reserved1);
+    return ptr;
+} // fatelf_encode_target
+
+
+const uint8_t *fatelf_decode_target(const uint8_t *ptr, FATELF_record *rec)
+{
+    ptr = getui16(ptr, &rec->machine);
+    ptr = getui8(ptr, &rec->osabi);
+    ptr = getui8(ptr, &rec->osabi_version);
+    ptr = getui8(ptr, &rec->word_size);
+    ptr = getui8(ptr, &rec->byte_order);
+    ptr = getui8(ptr, &rec->reserved0);
+    ptr = getui8(ptr, &rec->reserved1);
+    return ptr;
+} // fatelf_decode_target
+
+
+uint8_t *fatelf_encode_record(uint8_t *ptr, const FATELF_record *rec)
+{
+    ptr = fatelf_encode_target(ptr, rec);
+    ptr = putui64(ptr, rec->offset);
+    ptr = putui64(ptr, rec->size);
+    return ptr;
+} // fatelf_encode_record
+
+
+const uint8_t *fatelf_decode_record(const uint8_t *ptr, FATELF_record *rec)
+{
+    ptr = fatelf_decode_target(ptr, rec);
+    ptr = getui64(ptr, &rec->offset);
+    ptr = getui64(ptr, &rec->size);
+    return ptr;
+} // fatelf_decode_record
+
+
+void fatelf_encode_header(const FATELF_header *header, uint8_t *buf)
 {
-    FATELF_header *header = NULL;
-    uint8_t buf[8];
-    uint8_t *fullbuf = NULL;
     uint8_t *ptr = buf;
+    int i;
+
+    ptr = putui32(ptr, header->magic);
+    ptr = putui16(ptr, header->version);
+    ptr = putui8(ptr, header->num_records);
+    ptr = putui8(ptr, header->reserved0);
+
+    for (i = 0; i < header->num_records; i++)
+        ptr = fatelf_encode_record(ptr, &header->records[i]);
+
+    assert(ptr == (buf + FATELF_DISK_FORMAT_SIZE(header->num_records)));
+} // fatelf_encode_header
+
+
+void xwrite_fatelf_header(const char *fname, const int fd,
+                          const FATELF_header *header)
+{
+    const size_t buflen = FATELF_DISK_FORMAT_SIZE(header->num_records);
+    uint8_t *buf = (uint8_t *) xmalloc(buflen);
+
+    fatelf_encode_header(header, buf);
+    fatelf_cleanup_push(free, buf);
+    xlseek(fname, fd, 0, SEEK_SET);  // jump to start of file again.
+    xwrite(fname, fd, buf, buflen);
+    fatelf_cleanup_pop(free, buf, 1);
+} // xwrite_fatelf_header
+
+// Make sure the first 8 bytes of a file look like a FatELF header we can
+//  handle, and return the number of records it claims to have.
+static uint8_t xcheck_fatelf_magic(const char *fname, const uint8_t *buf)
+{
+    const uint8_t *ptr = buf;
     uint32_t magic = 0;
     uint16_t version = 0;
     uint8_t bincount = 0;
-    uint8_t reserved0 = 0;
-    size_t buflen = 0;
-    int i = 0;
 
-    xlseek(fname, fd, 0, SEEK_SET);  // just in case.
-    xread(fname, fd, buf, sizeof (buf), 1);
     ptr = getui32(ptr, &magic);
     ptr = getui16(ptr, &version);
     ptr = getui8(ptr, &bincount);
-    ptr = getui8(ptr, &reserved0);
 
     if (magic != FATELF_MAGIC)
-        xfail("'%s' is not a FatELF binary.", fname);
+        xfailc(FATELF_EFORMAT, "'%s' is not a FatELF binary.", fname);
     else if (version != 1)
-        xfail("'%s' uses an unknown FatELF version.", fname);
-    
-    buflen = FATELF_DISK_FORMAT_SIZE(bincount) - sizeof (buf);
-    ptr = fullbuf = (uint8_t *) xmalloc(buflen);
-    xread(fname, fd, fullbuf, buflen, 1);
+        xfailc(FATELF_EFORMAT, "'%s' uses an unknown FatELF version.", fname);
+
+    return bincount;
+} // xcheck_fatelf_magic
+
+
+// don't forget to free() the returned pointer!
+FATELF_header *xdecode_fatelf_header(const char *fname, const uint8_t *buf,
+                                     const uint64_t buflen)
+{
+    FATELF_header *header = NULL;
+    const uint8_t *ptr = buf;
+    uint8_t bincount = 0;
+    int i = 0;
+
+    if (buflen < FATELF_DISK_FORMAT_SIZE(0))
+        xfailc(FATELF_EFORMAT, "'%s' is not a FatELF binary.", fname);
+
+    bincount = xcheck_fatelf_magic(fname, buf);
+    if (buflen < FATELF_DISK_FORMAT_SIZE(bincount))
+        xfailc(FATELF_EFORMAT, "Failed to read '%s': truncated FatELF header",
+               fname);
 
     header = (FATELF_header *) xmalloc(fatelf_header_size(bincount));
-    header->magic = magic;
-    header->version = version;
-    header->num_records = bincount;
-    header->reserved0 = reserved0;
+    ptr = getui32(ptr, &header->magic);
+    ptr = getui16(ptr, &header->version);
+    ptr = getui8(ptr, &header->num_records);
+    ptr = getui8(ptr, &header->reserved0);
 
     for (i = 0; i < bincount; i++)
-    {
-        ptr = getui16(ptr, &header->records[i].machine);
-        ptr = getui8(ptr, &header->records[i].osabi);
-        ptr = getui8(ptr, &header->records[i].osabi_version);
-        ptr = getui8(ptr, &header->records[i].word_size);
-        ptr = getui8(ptr, &header->records[i].byte_order);
-        ptr = getui8(ptr, &header->records[i].reserved0);
-        ptr = getui8(ptr, &header->records[i].reserved1);
-        ptr = getui64(ptr, &header->records[i].offset);
-        ptr = getui64(ptr, &header->records[i].size);
-    } // for
+        ptr = fatelf_decode_record(ptr, &header->records[i]);
 
-    assert(ptr == (fullbuf + buflen));
+    assert(ptr == (buf + FATELF_DISK_FORMAT_SIZE(bincount)));
+
+    return header;
+} // xdecode_fatelf_header
 
-    free(fullbuf);
+
+// don't forget to free() the returned pointer!
+FATELF_header *xread_fatelf_header(const char *fname, const int fd)
+{
+    // Read enough for the biggest header there can be, all at once; the
+    //  decoder checks that we got as much as this one needs.
+    const size_t maxlen = FATELF_DISK_FORMAT_SIZE(0xFF);
+    const uint64_t start = fatelf_stats_start();
+    uint8_t *buf = (uint8_t *) xmalloc(maxlen);
+    FATELF_header *header;
+    ssize_t br;
+
+    fatelf_cleanup_push(free, buf);
+    br = xpread(fname, fd, buf, maxlen, 0, 0);
+    header = xdecode_fatelf_header(fname, buf, (uint64_t) br);
+    fatelf_cleanup_pop(free, buf, 1);
+    FATELF_STATS_PHASE(FATELF_PHASE_HEADER, fname, start);
     return header;
 } // xread_fatelf_header
 
 
-uint64_t align_to_page(const uint64_t offset)
+uint64_t fatelf_record_slack(const uint64_t size)
+{
+    return slack_bytes + ((size / 100) * slack_percent);
+} // fatelf_record_slack
+
+
+uint64_t fatelf_align_offset(const uint64_t offset, const uint64_t align)
+{
+    return (offset + (align - 1)) & ~(align - 1);
+} // fatelf_align_offset
+
+
+// The biggest page a kernel for (machine) might use; records have to be
+//  aligned to it to be mapped straight out of the file.
+static uint64_t machine_page_size(const uint16_t machine)
+{
+    switch (machine)
+    {
+        case 8:  // mips
+        case 10:  // mips_rs3_le
+        case 21:  // ppc64
+        case 50:  // ia64
+        case 183:  // aarch64
+            return 64 * 1024;
+        case 2:  // sparc
+        case 18:  // sparc32plus
+        case 41:  // alpha
+        case 43:  // sparcv9
+        case 0x9026:  // alpha, the old way.
+            return 8 * 1024;
+    } // switch
+    return 4096;
+} // machine_page_size
+
+
+// An unsigned field of (len) bytes from an ELF header or table.
+static uint64_t get_elf_uint(const uint8_t *ptr, const size_t len,
+                             const int bigendian)
+{
+    uint64_t retval = 0;
+    size_t i;
+    for (i = 0; i < len; i++)
+        retval = (retval << 8) | ptr[bigendian ? i : ((len - 1) - i)];
+    return retval;
+} // get_elf_uint
+
+
+// The largest p_align of any PT_LOAD segment in the ELF binary at (offset)
+//  in (fname), or zero if we can't tell. Anything that isn't a power of two
+//  doesn't count; the loader would refuse it anyway.
+static uint64_t xelf_load_align(const char *fname, const int fd,
+                                const uint64_t offset,
+                                const FATELF_record *rec)
+{
+    const int is64 = (rec->word_size == FATELF_64BITS);
+    const int be = (rec->byte_order == FATELF_BIGENDIAN);
+    const size_t entsize = is64 ? 56 : 32;
+    const size_t wordsize = is64 ? 8 : 4;
+    uint8_t ehdr[64];
+    uint8_t *phdrs;
+    uint64_t phoff, phentsize, phnum, len;
+    uint64_t retval = 0;
+    uint64_t i;
+
+    if (xpread(fname, fd, ehdr, sizeof (ehdr), offset, 0) < (is64 ? 64 : 52))
+        return 0;  // not even a whole ELF header.
+
+    phoff = get_elf_uint(ehdr + (is64 ? 32 : 28), wordsize, be);
+    phentsize = get_elf_uint(ehdr + (is64 ? 54 : 42), 2, be);
+    phnum = get_elf_uint(ehdr + (is64 ? 56 : 44), 2, be);
+    if ((phentsize < entsize) || (phnum == 0xFFFF) || (phoff > rec->size))
+        return 0;  // PN_XNUM, or nonsense.
+
+    // Only the entries that fit in the record count, and they all come in
+    //  one read.
+    if ((rec->size - phoff) < entsize)
+        return 0;
+    else if (phnum > (((rec->size - phoff - entsize) / phentsize) + 1))
+        phnum = ((rec->size - phoff - entsize) / phentsize) + 1;
+    if (phnum == 0)
+        return 0;
+    len = ((phnum - 1) * phentsize) + entsize;
+    phdrs = (uint8_t *) xmalloc((size_t) len);
+    fatelf_cleanup_push(free, phdrs);
+    xpread(fname, fd, phdrs, (size_t) len, offset + phoff, 1);
+
+    for (i = 0; i < phnum; i++)
+    {
+        const uint8_t *phdr = phdrs + (i * phentsize);
+        uint64_t align;
+        if (get_elf_uint(phdr, 4, be) != 1)  // not PT_LOAD?
+            continue;
+        align = get_elf_uint(phdr + (is64 ? 48 : 28), wordsize, be);
+        if (((align & (align - 1)) == 0) && (align > retval))
+            retval = align;
+    } // for
+
+    fatelf_cleanup_pop(free, phdrs, 1);
+    return retval;
+} // xelf_load_align
+
+
+uint64_t xfatelf_record_align(const char *fname, const int fd,
+                              const uint64_t offset,
+                              const FATELF_record *rec)
 {
-    const size_t pagesize = 4096;  // !!! FIXME: hardcoded pagesize.
-    const size_t overflow = (offset % pagesize);
-    return overflow ? (offset + (pagesize - overflow)) : offset;
-} // align_to_page
+    uint64_t align;
+
+    if (align_policy == FATELF_ALIGN_FIXED)
+        return align_size;
+    else if (align_policy == FATELF_ALIGN_ARCH)
+        return machine_page_size(rec->machine);
+
+    // The linker sets p_align to the biggest page it expects, or bigger, so
+    //  the text can be backed by huge pages. Past 1G, it's just wasteful.
+    align = xelf_load_align(fname, fd, offset, rec);
+    if (align < 4096)
+        return 4096;
+    else if (align > (1024 * 1024 * 1024))
+        return 1024 * 1024 * 1024;
+    return align;
+} // xfatelf_record_align
 
 
 // !!! FIXME: these names/descs aren't set in stone.
 // List from: http://www.sco.com/developers/gabi/latest/ch4.eheader.html
 static const fatelf_machine_info machines[] =
 {
-    // MUST BE SORTED BY ID!
+    // Keep this sorted by id. Where two entries share a name, the first
+    //  one wins when looking up by name.
     { 0, "none", "No machine" },
     { 1, "m32", "AT&T WE 32100" },
     { 2, "sparc", "SPARC" },
@@ -507,7 +1965,6 @@ static const fatelf_machine_info machines[] =
     { 68, "st7", "STMicroelectronics ST7" },
     { 69, "68hc16", "Motorola MC68HC16" },
     { 70, "68hc11", "Motorola MC68HC11" },
-    { 70, "68hc11", "Motorola MC68HC11" },
     { 71, "68hc08", "Motorola MC68HC08" },
     { 72, "68hc05", "Motorola MC68HC05" },
     { 73, "svx", "Silicon Graphics SVx" },
@@ -548,9 +2005,10 @@ static const fatelf_machine_info machines[] =
     { 108, "sep", "Sharp embedded microprocessor" },
     { 109, "arca", "Arca RISC Microprocessor" },
     { 110, "unicore", "Microprocessor series from PKU-Unity Ltd. and MPRC of Peking University" },
+    { 183, "aarch64", "ARM 64-bit" },
     { 0x9026, "alpha", "Digital Alpha" },  // linux headers use this.
-    { 0x9080, "v850", "NEC v850" },  // old tools use this, apparently.
     { 0x9041, "m32r", "Mitsubishi M32R" },  // old tools use this, apparently.
+    { 0x9080, "v850", "NEC v850" },  // old tools use this, apparently.
     { 0xA390, "s390", "IBM System/390" },  // legacy value.
     { 0xBEEF, "mn10300", "Matsushita MN10300" },  // old tools.
 };
@@ -560,7 +2018,7 @@ static const fatelf_machine_info machines[] =
 // List from: http://www.sco.com/developers/gabi/latest/ch4.eheader.html
 static const fatelf_osabi_info osabis[] =
 {
-    // MUST BE SORTED BY ID!
+    // Keep this sorted by id.
     { 0, "sysv", "UNIX System V" },
     { 1, "hpux", "Hewlett-Packard HP-UX" },
     { 2, "netbsd", "NetBSD" },
@@ -582,207 +2040,502 @@ static const fatelf_osabi_info osabis[] =
 };
 
 
-const fatelf_machine_info *get_machine_by_id(const uint16_t id)
+// Lookup tables for machines[] and osabis[], built once: ids index straight
+//  into them (except a few legacy machine ids, which get a tiny hash table),
+//  and names go through a hash table. Each slot holds an index plus one, so
+//  zero means nothing is there.
+#define NUM_MACHINES (sizeof (machines) / sizeof (machines[0]))
+#define NUM_OSABIS (sizeof (osabis) / sizeof (osabis[0]))
+#define MACHINE_DIRECT_IDS 256  // machine ids below this are a direct index.
+#define LEGACY_SLOTS 16  // all powers of two, at least twice the entries.
+#define MACHINE_NAME_SLOTS 512
+#define OSABI_NAME_SLOTS 64
+
+static pthread_once_t lookup_once = PTHREAD_ONCE_INIT;
+static uint8_t machine_by_id[MACHINE_DIRECT_IDS];
+static uint8_t machine_by_legacy_id[LEGACY_SLOTS];
+static uint8_t machine_by_name[MACHINE_NAME_SLOTS];
+static uint8_t osabi_by_id[256];
+static uint8_t osabi_by_name[OSABI_NAME_SLOTS];
+
+static uint32_t hash_name(const char *name)
+{
+    uint32_t hash = 2166136261U;  // FNV-1a.
+    while (*name)
+        hash = (hash ^ (uint8_t) *(name++)) * 16777619U;
+    return hash;
+} // hash_name
+
+
+static inline uint32_t hash_id(const uint16_t id)
+{
+    return (((uint32_t) id) * 2654435761U) >> 16;
+} // hash_id
+
+
+static void build_lookup_tables(void)
+{
+    uint32_t slot;
+    size_t i;
+
+    assert(NUM_MACHINES < 255);
+    for (i = 0; i < NUM_MACHINES; i++)
+    {
+        const fatelf_machine_info *info = &machines[i];
+        uint8_t *idtable = machine_by_id;
+        uint32_t idmask = 0xFFFFFFFF;
+
+        if (info->id < MACHINE_DIRECT_IDS)
+            slot = info->id;
+        else
+        {
+            idtable = machine_by_legacy_id;
+            idmask = LEGACY_SLOTS - 1;
+            slot = hash_id(info->id) & idmask;
+            while ( (idtable[slot]) &&
+                    (machines[idtable[slot] - 1].id != info->id) )
+                slot = (slot + 1) & idmask;
+        } // else
+
+        if (!idtable[slot])  // first one wins.
+            idtable[slot] = (uint8_t) (i + 1);
+
+        slot = hash_name(info->name) & (MACHINE_NAME_SLOTS - 1);
+        while ( (machine_by_name[slot]) &&
+                (strcmp(machines[machine_by_name[slot] - 1].name,
+                        info->name) != 0) )
+            slot = (slot + 1) & (MACHINE_NAME_SLOTS - 1);
+        if (!machine_by_name[slot])
+            machine_by_name[slot] = (uint8_t) (i + 1);
+    } // for
+
+    assert(NUM_OSABIS * 2 <= OSABI_NAME_SLOTS);
+    for (i = 0; i < NUM_OSABIS; i++)
+    {
+        const fatelf_osabi_info *info = &osabis[i];
+        if (!osabi_by_id[info->id])
+            osabi_by_id[info->id] = (uint8_t) (i + 1);
+
+        slot = hash_name(info->name) & (OSABI_NAME_SLOTS - 1);
+        while ( (osabi_by_name[slot]) &&
+                (strcmp(osabis[osabi_by_name[slot] - 1].name,
+                        info->name) != 0) )
+            slot = (slot + 1) & (OSABI_NAME_SLOTS - 1);
+        if (!osabi_by_name[slot])
+            osabi_by_name[slot] = (uint8_t) (i + 1);
+    } // for
+} // build_lookup_tables
+
+
+const fatelf_machine_info *get_machine_by_id(const uint16_t id)
+{
+    uint32_t slot;
+
+    pthread_once(&lookup_once, build_lookup_tables);
+    if (id < MACHINE_DIRECT_IDS)
+    {
+        slot = machine_by_id[id];
+        return slot ? &machines[slot - 1] : NULL;
+    } // if
+
+    slot = hash_id(id) & (LEGACY_SLOTS - 1);
+    while (machine_by_legacy_id[slot])
+    {
+        const uint8_t idx = machine_by_legacy_id[slot] - 1;
+        const fatelf_machine_info *info = &machines[idx];
+        if (info->id == id)
+            return info;
+        slot = (slot + 1) & (LEGACY_SLOTS - 1);
+    } // while
+
+    return NULL;
+} // get_machine_by_id
+
+
+const fatelf_machine_info *get_machine_by_name(const char *name)
+{
+    uint32_t slot;
+
+    pthread_once(&lookup_once, build_lookup_tables);
+    slot = hash_name(name) & (MACHINE_NAME_SLOTS - 1);
+    while (machine_by_name[slot])
+    {
+        const fatelf_machine_info *info = &machines[machine_by_name[slot] - 1];
+        if (strcmp(info->name, name) == 0)
+            return info;
+        slot = (slot + 1) & (MACHINE_NAME_SLOTS - 1);
+    } // while
+
+    return NULL;
+} // get_machine_by_name
+
+
+const fatelf_osabi_info *get_osabi_by_id(const uint8_t id)
+{
+    pthread_once(&lookup_once, build_lookup_tables);
+    return osabi_by_id[id] ? &osabis[osabi_by_id[id] - 1] : NULL;
+} // get_osabi_by_id
+
+
+const fatelf_osabi_info *get_osabi_by_name(const char *name)
+{
+    uint32_t slot;
+
+    pthread_once(&lookup_once, build_lookup_tables);
+    slot = hash_name(name) & (OSABI_NAME_SLOTS - 1);
+    while (osabi_by_name[slot])
+    {
+        const fatelf_osabi_info *info = &osabis[osabi_by_name[slot] - 1];
+        if (strcmp(info->name, name) == 0)
+            return info;
+        slot = (slot + 1) & (OSABI_NAME_SLOTS - 1);
+    } // while
+
+    return NULL;
+} // get_osabi_by_name
+
+
+static int parse_abi_version_string(const char *str)
+{
+    long num = 0;
+    char *endptr = NULL;
+    const char *prefix = "osabiver";
+    const size_t prefix_len = 8;
+    assert(strlen(prefix) == prefix_len);
+    if (strncmp(str, prefix, prefix_len) != 0)
+        return -1;
+
+    str += prefix_len;
+    num = strtol(str, &endptr, 0);
+    return ( ((endptr == str) || (*endptr != '\0')) ? -1 : ((int) num) );
+} // parse_abi_version_string
+
+
+// Fill in the field of (target) that one piece of a target string names.
+static void xcompile_target_part(fatelf_target *target, const char *str)
+{
+    FATELF_record *rec = &target->rec;
+    const fatelf_osabi_info *osabi = NULL;
+    const fatelf_machine_info *machine = NULL;
+    int abiver = 0;
+
+    if (*str == '\0')
+    {
+        // no-op for empty string.
+    } // if
+    else if ((strcmp(str,"be")==0) || (strcmp(str,"bigendian")==0))
+    {
+        target->wants |= FATELF_WANT_BYTEORDER;
+        rec->byte_order = FATELF_BIGENDIAN;
+    } // if
+    else if ((strcmp(str,"le")==0) || (strcmp(str,"littleendian")==0))
+    {
+        target->wants |= FATELF_WANT_BYTEORDER;
+        rec->byte_order = FATELF_LITTLEENDIAN;
+    } // else if
+    else if (strcmp(str,"32bit") == 0)
+    {
+        target->wants |= FATELF_WANT_WORDSIZE;
+        rec->word_size = FATELF_32BITS;
+    } // else if
+    else if (strcmp(str,"64bit") == 0)
+    {
+        target->wants |= FATELF_WANT_WORDSIZE;
+        rec->word_size = FATELF_64BITS;
+    } // else if
+    else if ((machine = get_machine_by_name(str)) != NULL)
+    {
+        target->wants |= FATELF_WANT_MACHINE;
+        rec->machine = machine->id;
+    } // else if
+    else if ((osabi = get_osabi_by_name(str)) != NULL)
+    {
+        target->wants |= FATELF_WANT_OSABI;
+        rec->osabi = osabi->id;
+    } // else if
+    else if ((abiver = parse_abi_version_string(str)) != -1)
+    {
+        target->wants |= FATELF_WANT_OSABIVER;
+        rec->osabi_version = (uint8_t) abiver;
+    } // else if
+    else
+    {
+        xfailc(FATELF_EINVAL, "Unknown target '%s'", str);
+    } // else
+} // xcompile_target_part
+
+
+void xfatelf_compile_target(const char *str, fatelf_target *target)
+{
+    const char *ptr = str;
+    char part[64];
+
+    memset(target, '\0', sizeof (*target));
+    target->name = str;
+
+    if (strncmp(str, "record", 6) == 0)
+    {
+        char *endptr = NULL;
+        const long num = strtol(str+6, &endptr, 0);
+        if ((endptr != str+6) && (*endptr == '\0'))  // a numeric index?
+        {
+            target->by_index = 1;
+            target->index = num;
+            return;
+        } // if
+    } // if
+
+    while (1)
+    {
+        const char *end = strchr(ptr, ':');
+        const size_t len = end ? (size_t) (end - ptr) : strlen(ptr);
+        if (len >= sizeof (part))  // can't be anything we know.
+            xfailc(FATELF_EINVAL, "Unknown target '%.*s'", (int) len, ptr);
+        memcpy(part, ptr, len);
+        part[len] = '\0';
+        xcompile_target_part(target, part);
+        if (end == NULL)
+            break;  // we're done.
+        ptr = end + 1;
+    } // while
+} // xfatelf_compile_target
+
+
+int fatelf_target_matches(const fatelf_target *target,
+                          const FATELF_record *prec)
+{
+    const FATELF_record *rec = &target->rec;
+    const int wants = target->wants;
+
+    if (target->by_index)
+        return 0;  // this names a position, not a target.
+    else if ((wants & FATELF_WANT_MACHINE) && (rec->machine != prec->machine))
+        return 0;
+    else if ((wants & FATELF_WANT_OSABI) && (rec->osabi != prec->osabi))
+        return 0;
+    else if ((wants & FATELF_WANT_OSABIVER) &&
+             (rec->osabi_version != prec->osabi_version))
+        return 0;
+    else if ((wants & FATELF_WANT_WORDSIZE) &&
+             (rec->word_size != prec->word_size))
+        return 0;
+    else if ((wants & FATELF_WANT_BYTEORDER) &&
+             (rec->byte_order != prec->byte_order))
+        return 0;
+    return 1;
+} // fatelf_target_matches
+
+
+int xfatelf_target_find(const fatelf_target *target,
+                        const FATELF_header *header)
+{
+    int retval = -1;
+    int i = 0;
+
+    if (target->by_index)
+    {
+        const long recs = (long) header->num_records;
+        if ((target->index < 0) || (target->index >= recs))
+        {
+            xfailc(FATELF_ENOTFOUND,
+                   "No record #%ld in FatELF header (max %d)",
+                   target->index, (int) recs - 1);
+        } // if
+        return (int) target->index;
+    } // if
+
+    for (i = 0; i < ((int) header->num_records); i++)
+    {
+        if (!fatelf_target_matches(target, &header->records[i]))
+            continue;
+
+        if (retval != -1)
+            xfailc(FATELF_EAMBIGUOUS, "Ambiguous target '%s'", target->name);
+        retval = i;
+    } // for
+
+    return retval;
+} // xfatelf_target_find
+
+
+int xfind_fatelf_record(const FATELF_header *header, const char *target)
+{
+    fatelf_target compiled;
+    xfatelf_compile_target(target, &compiled);
+    return xfatelf_target_find(&compiled, header);
+} // xfind_fatelf_record
+
+
+int fatelf_record_matches(const FATELF_record *a, const FATELF_record *b)
+{
+    return ( (a->machine == b->machine) &&
+             (a->osabi == b->osabi) &&
+             (a->osabi_version == b->osabi_version) &&
+             (a->word_size == b->word_size) &&
+             (a->byte_order == b->byte_order) );
+} // fatelf_record_matches
+
+
+fatelf_order *xfatelf_compile_order(const char *str)
 {
-    int i;
-    for (i = 0; i < (sizeof (machines) / sizeof (machines[0])); i++)
-    {
-        if (machines[i].id == id)
-            return &machines[i];
-        else if (machines[i].id > id)
-            break;  // not found (sorted by id).
-    } // for
+    fatelf_order *order = (fatelf_order *) xmalloc(sizeof (fatelf_order));
+    const char *cptr;
+    char *ptr;
+    int count = 1;
 
-    return NULL;
-} // get_machine_by_id
+    if (strcmp(str, "default") == 0)
+        str = FATELF_DEFAULT_ORDER;
 
+    for (cptr = str; *cptr; cptr++)
+        count += (*cptr == ',');
 
-const fatelf_machine_info *get_machine_by_name(const char *name)
-{
-    int i;
-    for (i = 0; i < (sizeof (machines) / sizeof (machines[0])); i++)
+    memset(order, '\0', sizeof (*order));
+    fatelf_cleanup_push(fatelf_cleanup_order, order);
+    order->names = xstrdup(str);
+    order->targets = (fatelf_target *) xmalloc(sizeof (fatelf_target) * count);
+
+    for (ptr = order->names; ptr != NULL; )
     {
-        if (strcmp(machines[i].name, name) == 0)
-            return &machines[i];
+        char *end = strchr(ptr, ',');
+        if (end != NULL)
+            *(end++) = '\0';
+        if (*ptr == '\0')
+            xfailc(FATELF_EINVAL, "Empty target in order '%s'", str);
+        xfatelf_compile_target(ptr, &order->targets[order->count]);
+        if (order->targets[order->count].by_index)
+        {
+            xfailc(FATELF_EINVAL,
+                   "'%s' names a record's position, not a target", ptr);
+        } // if
+        order->count++;
+        ptr = end;
     } // for
 
-    return NULL;
-} // get_machine_by_name
+    return order;
+} // xfatelf_compile_order
 
 
-const fatelf_osabi_info *get_osabi_by_id(const uint8_t id)
+void fatelf_cleanup_order(void *_order)
 {
-    int i;
-    for (i = 0; i < (sizeof (osabis) / sizeof (osabis[0])); i++)
-    {
-        if (osabis[i].id == id)
-            return &osabis[i];
-        else if (osabis[i].id > id)
-            break;  // not found (sorted by id).
-    } // for
-
-    return NULL;
-} // get_osabi_by_id
+    fatelf_order *order = (fatelf_order *) _order;
+    free(order->targets);
+    free(order->names);
+    free(order);
+} // fatelf_cleanup_order
 
 
-const fatelf_osabi_info *get_osabi_by_name(const char *name)
+int fatelf_order_rank(const fatelf_order *order, const FATELF_record *rec)
 {
     int i;
-    for (i = 0; i < (sizeof (osabis) / sizeof (osabis[0])); i++)
+    for (i = 0; i < order->count; i++)
     {
-        if (strcmp(osabis[i].name, name) == 0)
-            return &osabis[i];
+        if (fatelf_target_matches(&order->targets[i], rec))
+            break;
     } // for
-
-    return NULL;
-} // get_osabi_by_name
-
-
-static int parse_abi_version_string(const char *str)
-{
-    long num = 0;
-    char *endptr = NULL;
-    const char *prefix = "osabiver";
-    const size_t prefix_len = 8;
-    assert(strlen(prefix) == prefix_len);
-    if (strncmp(str, prefix, prefix_len) != 0)
-        return -1;
-
-    str += prefix_len;
-    num = strtol(str, &endptr, 0);
-    return ( ((endptr == str) || (*endptr != '\0')) ? -1 : ((int) num) );
-} // parse_abi_version_string
+    return i;
+} // fatelf_order_rank
 
 
-static int xfind_fatelf_record_by_fields(const FATELF_header *header,
-                                         const char *target)
+void fatelf_order_records(const fatelf_order *order,
+                          const FATELF_header *header, int *perm)
 {
-    char *buf = xstrdup(target);
-    const fatelf_osabi_info *osabi = NULL;
-    const fatelf_machine_info *machine = NULL;
-    FATELF_record rec;
-    int wants = 0;
-    int abiver = 0;
-    char *str = buf;
-    char *ptr = buf;
-    int retval = -1;
-    int i = 0;
+    const int total = (int) header->num_records;
+    int ranks[0xFF];
+    int i, j;
 
-    while (1)
+    // An insertion sort is stable, and there are never more than 255.
+    for (i = 0; i < total; i++)
     {
-        const char ch = *ptr;
-        if ((ch == ':') || (ch == '\0'))
+        const int rank = fatelf_order_rank(order, &header->records[i]);
+        for (j = i; (j > 0) && (ranks[j-1] > rank); j--)
         {
-            *ptr = '\0';
+            ranks[j] = ranks[j-1];
+            perm[j] = perm[j-1];
+        } // for
+        ranks[j] = rank;
+        perm[j] = i;
+    } // for
+} // fatelf_order_records
 
-            if (ptr == str)
-            {
-                // no-op for empty string.
-            } // if
-            else if ((strcmp(str,"be")==0) || (strcmp(str,"bigendian")==0))
-            {
-                wants |= FATELF_WANT_BYTEORDER;
-                rec.byte_order = FATELF_BIGENDIAN;
-            } // if
-            else if ((strcmp(str,"le")==0) || (strcmp(str,"littleendian")==0))
-            {
-                wants |= FATELF_WANT_BYTEORDER;
-                rec.byte_order = FATELF_LITTLEENDIAN;
-            } // else if
-            else if (strcmp(str,"32bit") == 0)
-            {
-                wants |= FATELF_WANT_WORDSIZE;
-                rec.word_size = FATELF_32BITS;
-            } // else if
-            else if (strcmp(str,"64bit") == 0)
-            {
-                wants |= FATELF_WANT_WORDSIZE;
-                rec.word_size = FATELF_64BITS;
-            } // else if
-            else if ((machine = get_machine_by_name(str)) != NULL)
-            {
-                wants |= FATELF_WANT_MACHINE;
-                rec.machine = machine->id;
-            } // else if
-            else if ((osabi = get_osabi_by_name(str)) != NULL)
-            {
-                wants |= FATELF_WANT_OSABI;
-                rec.osabi = osabi->id;
-            } // else if
-            else if ((abiver = parse_abi_version_string(str)) != -1)
-            {
-                wants |= FATELF_WANT_OSABIVER;
-                rec.osabi_version = (uint8_t) abiver;
-            } // else if
-            else
-            {
-                xfail("Unknown target '%s'", str);
-            } // else
 
-            if (ch == '\0')
-                break;  // we're done.
+void fatelf_permute_records(FATELF_header *header, const int *perm)
+{
+    const int total = (int) header->num_records;
+    FATELF_record records[0xFF];
+    int i;
+
+    memcpy(records, header->records, sizeof (FATELF_record) * total);
+    for (i = 0; i < total; i++)
+        header->records[i] = records[perm[i]];
+} // fatelf_permute_records
 
-            str = ptr + 1;
-        } // if
 
-        ptr++;
-    } // while
+fatelf_window_policy xfatelf_parse_window_policy(const char *str)
+{
+    if (strcmp(str, "ignore") == 0)
+        return FATELF_WINDOW_IGNORE;
+    else if (strcmp(str, "warn") == 0)
+        return FATELF_WINDOW_WARN;
+    else if (strcmp(str, "fail") == 0)
+        return FATELF_WINDOW_FAIL;
+    xfailc(FATELF_EINVAL, "Unknown window policy '%s'", str);
+    return FATELF_WINDOW_FAIL;  // shouldn't hit this.
+} // xfatelf_parse_window_policy
+
+
+int xfatelf_check_loader_window(const char *fname,
+                                const FATELF_header *header,
+                                const fatelf_window_policy policy,
+                                char *warning, const size_t warnlen)
+{
+    const int total = (int) header->num_records;
+    const int first = FATELF_LOADER_WINDOW;
+    char names[(FATELF_TARGET_NAME_MAX + 4) * 3 + 32];
+    size_t len = 0;
+    int i;
 
-    free(buf);
+    if (total <= first)
+        return 0;
+    else if (policy == FATELF_WINDOW_IGNORE)
+        return 1;
 
-    for (i = 0; i < ((int) header->num_records); i++)
+    // Name a few of them, to say what moving them to the front would fix.
+    for (i = first; (i < total) && (i < first + 3); i++)
     {
-        const FATELF_record *prec = &header->records[i];
-        if ((wants & FATELF_WANT_MACHINE) && (rec.machine != prec->machine))
-            continue;
-        else if ((wants & FATELF_WANT_OSABI) && (rec.osabi != prec->osabi))
-            continue;
-        else if ((wants & FATELF_WANT_OSABIVER) && (rec.osabi_version != prec->osabi_version))
-            continue;
-        else if ((wants & FATELF_WANT_WORDSIZE) && (rec.word_size != prec->word_size))
-            continue;
-        else if ((wants & FATELF_WANT_BYTEORDER) && (rec.byte_order != prec->byte_order))
-            continue;
-
-        if (retval != -1)
-            xfail("Ambiguous target '%s'", target);
-        retval = i;
+        char target[FATELF_TARGET_NAME_MAX];
+        fatelf_get_target_name(&header->records[i], FATELF_WANT_EVERYTHING,
+                               target, sizeof (target));
+        len += snprintf(names + len, sizeof (names) - len, "%s'%s'",
+                        (i == first) ? "" : ", ", target);
     } // for
 
-    return retval;
-} // xfind_fatelf_record_by_fields
-
+    if (i < total)
+        snprintf(names + len, sizeof (names) - len, " or %d more", total - i);
 
-int xfind_fatelf_record(const FATELF_header *header, const char *target)
-{
-    if (strncmp(target, "record", 6) == 0)
+    if (policy == FATELF_WINDOW_FAIL)
     {
-        char *endptr = NULL;
-        const long num = strtol(target+6, &endptr, 0);
-        if ((endptr != target+6) && (*endptr == '\0'))  // a numeric index?
-        {
-            const long recs = (long) header->num_records;
-            if ((num < 0) || (num > recs))
-            {
-                xfail("No record #%ld in FatELF header (max %d)",
-                      num, (int) recs);
-            } // if
-            return (int) num;
-        } // if
+        xfailc(FATELF_EINVAL, "'%s' has %d records, but the kernel's loader"
+               " only sees the first %d, so it can't run %s", fname, total,
+               first, names);
     } // if
 
-    return xfind_fatelf_record_by_fields(header, target);
-} // xfind_fatelf_record
+    snprintf(warning, warnlen, "'%s' has %d records, but the kernel's loader"
+             " only sees the first %d, so it can't run %s", fname, total,
+             first, names);
+    return 1;
+} // xfatelf_check_loader_window
 
 
-int fatelf_record_matches(const FATELF_record *a, const FATELF_record *b)
+void xfatelf_warn_loader_window(const char *fname,
+                                const FATELF_header *header,
+                                const fatelf_window_policy policy)
 {
-    return ( (a->machine == b->machine) &&
-             (a->osabi == b->osabi) &&
-             (a->osabi_version == b->osabi_version) &&
-             (a->word_size == b->word_size) &&
-             (a->byte_order == b->byte_order) );
-} // fatelf_record_matches
+    char warning[(FATELF_TARGET_NAME_MAX + 4) * 3 + 256];
+    if ((xfatelf_check_loader_window(fname, header, policy, warning,
+                                     sizeof (warning))) &&
+        (policy == FATELF_WINDOW_WARN))
+        fprintf(stderr, "Warning: %s\n", warning);
+} // xfatelf_warn_loader_window
 
 
 int find_furthest_record(const FATELF_header *header)
@@ -850,110 +2603,569 @@ const char *fatelf_get_wordsize_target_name(const uint8_t wordsize)
 
 
 
-const char *fatelf_get_target_name(const FATELF_record *rec, const int wants)
+// Tack ":str" onto the target name in (buffer), or just "str" if it's
+//  the first part. Whatever doesn't fit is cut off.
+static void add_target_part(char *buffer, const size_t buflen,
+                            const char *str)
+{
+    const size_t len = strlen(buffer);
+    if (len < buflen)
+        snprintf(buffer + len, buflen - len, "%s%s", len ? ":" : "", str);
+} // add_target_part
+
+
+const char *fatelf_get_target_name(const FATELF_record *rec, const int wants,
+                                   char *buffer, const size_t buflen)
 {
-    // !!! FIXME: this code is sort of stinky.
-    static char buffer[128];
     const fatelf_osabi_info *osabi = get_osabi_by_id(rec->osabi);
     const fatelf_machine_info *machine = get_machine_by_id(rec->machine);
     const char *order = fatelf_get_byteorder_target_name(rec->byte_order);
     const char *wordsize = fatelf_get_wordsize_target_name(rec->word_size);
 
+    if (buflen == 0)
+        return buffer;
+
     buffer[0] = '\0';
 
     if ((wants & FATELF_WANT_MACHINE) && (machine))
-    {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, machine->name);
-    } // if
+        add_target_part(buffer, buflen, machine->name);
 
     if ((wants & FATELF_WANT_WORDSIZE) && (wordsize))
-    {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, wordsize);
-    } // if
+        add_target_part(buffer, buflen, wordsize);
 
     if ((wants & FATELF_WANT_BYTEORDER) && (order))
-    {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, order);
-    } // if
+        add_target_part(buffer, buflen, order);
 
     if ((wants & FATELF_WANT_OSABI) && (osabi))
-    {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, osabi->name);
-    } // if
+        add_target_part(buffer, buflen, osabi->name);
 
     if (wants & FATELF_WANT_OSABIVER)
     {
         char tmp[32];
-        if (buffer[0])
-            strcat(buffer, ":");
         snprintf(tmp, sizeof (tmp), "osabiver%d", (int) rec->osabi_version);
-        strcat(buffer, tmp);
+        add_target_part(buffer, buflen, tmp);
     } // if
 
     return buffer;
 } // fatelf_get_target_name
 
 
-int xfind_junk(const char *fname, const int fd, uint64_t *offset,
-               uint64_t *size)
+int fatelf_find_junk(const FATELF_header *header, const uint64_t fsize,
+                     uint64_t *offset, uint64_t *size)
 {
-    FATELF_header *header = xread_fatelf_header(fname, fd);
     const int furthest = find_furthest_record(header);
 
     if (furthest >= 0)  // presumably, we failed elsewhere, but oh well.
     {
-        const uint64_t fsize = xget_file_size(fname, fd);
         const FATELF_record *rec = &header->records[furthest];
         const uint64_t edge = rec->offset + rec->size;
         if (fsize > edge)
         {
             *offset = edge;
             *size = fsize - edge;
-
-            free(header);
             return 1;
         } // if
     } // if
 
-    free(header);
     return 0;
-} // xfind_junk
+} // fatelf_find_junk
 
 
-void xappend_junk(const char *fname, const int fd, const char *out,
-                  const int outfd)
+// Copy junk at (offset, size) from (fname) to the end of (out), or Haiku
+//  resources to (outoff), where the output ELF or FatELF file expects them.
+static void append_junk(const char *fname, const int fd,
+                        const char *out, const int outfd,
+                        const int is_haiku_rsrc, const uint64_t outoff,
+                        const uint64_t offset, const uint64_t size)
 {
-    uint64_t offset, size;
-    if (haiku_find_rsrc(fname, fd, &offset, &size)) {
-        uint64_t outoff;
-        if (!haiku_rsrc_offset(out, outfd, &outoff))
-            xfail("Could not determine target offset for Haiku resources");
-
+    if (is_haiku_rsrc)
         xlseek(out, outfd, outoff, SEEK_SET);
-        xcopyfile_range(fname, fd, out, outfd, offset, size);
-    } else {
-        if (xfind_junk(fname, fd, &offset, &size))
-            xcopyfile_range(fname, fd, out, outfd, offset, size);
-    }
+    xcopyfile_range(fname, fd, out, outfd, offset, size);
+} // append_junk
+
+
+static void xrsrc_offset_failed(void)
+{
+    xfailc(FATELF_EFORMAT,
+           "Could not determine target offset for Haiku resources");
+} // xrsrc_offset_failed
+
+
+void xappend_junk(const fatelf_probe *probe, const char *fname,
+                  const int fd, const char *out, const int outfd,
+                  const FATELF_header *outheader)
+{
+    if (probe->has_rsrc)
+    {
+        uint64_t outoff = 0;
+        if (!haiku_fat_rsrc_offset(outheader, &outoff))
+            xrsrc_offset_failed();
+        append_junk(fname, fd, out, outfd, 1, outoff, probe->rsrc_offset,
+                    probe->rsrc_size);
+    } // if
+    else if (probe->has_junk)
+    {
+        append_junk(fname, fd, out, outfd, 0, 0, probe->junk_offset,
+                    probe->junk_size);
+    } // else if
 } // xappend_junk
 
 
-void xfatelf_init(int argc, const char **argv)
+uint64_t xread_prefix(const char *fname, const int fd, uint8_t *buf,
+                      uint64_t *fsize)
+{
+    const ssize_t br = xpread(fname, fd, buf, FATELF_PROBE_SIZE, 0, 0);
+
+    // A short read means we have the whole file, so we know how big it is.
+    if (br < FATELF_PROBE_SIZE)
+        *fsize = (uint64_t) br;
+    else
+        *fsize = xget_file_size(fname, fd);
+
+    return (uint64_t) br;
+} // xread_prefix
+
+
+void xfatelf_probe_fatelf(const char *fname, const int fd,
+                          fatelf_probe *probe)
+{
+    xfatelf_probe(fname, fd, probe);
+    if (probe->type != FATELF_PROBE_FATELF)
+    {
+        fatelf_probe_free(probe);
+        xfailc(FATELF_EFORMAT, "'%s' is not a FatELF binary.", fname);
+    } // if
+} // xfatelf_probe_fatelf
+
+
+void xfatelf_probe(const char *fname, const int fd, fatelf_probe *probe)
+{
+    const uint64_t start = fatelf_stats_start();
+    uint8_t *buf = (uint8_t *) xmalloc(FATELF_PROBE_SIZE);
+    const uint8_t elfmagic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
+    uint64_t buflen;
+    uint32_t magic = 0;
+
+    memset(probe, '\0', sizeof (*probe));
+    fatelf_cleanup_push(free, buf);
+    fatelf_cleanup_push(fatelf_cleanup_probe, probe);
+    buflen = xread_prefix(fname, fd, buf, &probe->file_size);
+    if (buflen >= sizeof (magic))
+        getui32(buf, &magic);
+
+    if ((buflen >= sizeof (elfmagic)) && (memcmp(buf, elfmagic, 4) == 0))
+    {
+        probe->type = FATELF_PROBE_ELF;
+        xdecode_elf_header(fname, buf, buflen, &probe->elf);
+    } // if
+    else if (magic == FATELF_MAGIC)
+    {
+        probe->type = FATELF_PROBE_FATELF;
+        probe->header = xdecode_fatelf_header(fname, buf, buflen);
+        probe->has_junk = fatelf_find_junk(probe->header, probe->file_size,
+                                           &probe->junk_offset,
+                                           &probe->junk_size);
+    } // else if
+
+    if (probe->type != FATELF_PROBE_OTHER)
+    {
+        probe->has_rsrc = haiku_find_rsrc_prefix(fname, fd, buf, buflen,
+                                                 probe->file_size,
+                                                 &probe->rsrc_offset,
+                                                 &probe->rsrc_size);
+    } // if
+
+    if (probe->type == FATELF_PROBE_ELF)
+    {
+        // The ELF ends where its resources start; anything after them
+        //  isn't part of it either.
+        probe->elf.size = probe->file_size;
+        if (probe->has_rsrc)
+            probe->elf.size = probe->rsrc_offset;
+    } // if
+
+    fatelf_cleanup_pop(fatelf_cleanup_probe, probe, 0);  // caller's now.
+    fatelf_cleanup_pop(free, buf, 1);
+    FATELF_STATS_PHASE(FATELF_PHASE_PROBE, fname, start);
+} // xfatelf_probe
+
+
+void fatelf_probe_free(fatelf_probe *probe)
+{
+    free(probe->header);
+    probe->header = NULL;
+} // fatelf_probe_free
+
+
+void fatelf_cleanup_probe(void *probe)
+{
+    fatelf_probe_free((fatelf_probe *) probe);
+} // fatelf_cleanup_probe
+
+
+// Files we don't read into memory are at most this big; past that, they
+//  have to be mmap()able.
+#define FATELF_MAP_READ_MAX (256 * 1024 * 1024)
+
+// Touching a page of a mapped file that another process has truncated away
+//  raises SIGBUS, in the thread that touched it. Each thread only reads the
+//  files it mapped itself, so it keeps its own list of them, and the
+//  handler never needs a lock: the list only changes outside of any access
+//  to the mappings, in the same thread. In a catch frame, that fault becomes
+//  an xfail() like any other failure to read; without one, we report it and
+//  exit, since nothing else we could call there is async-signal-safe.
+//  Faults anywhere else go to whatever handler was there before us.
+static __thread fatelf_mapping *live_maps = NULL;
+static pthread_once_t sigbus_once = PTHREAD_ONCE_INIT;
+static struct sigaction prev_sigbus;
+
+static void map_sigbus_exit(const char *fname)
+{
+    static const char before[] = "'";
+    static const char after[] = "' was truncated while it was being read\n";
+    ssize_t rc;  // nothing to do about it if these fail.
+    rc = write(2, before, sizeof (before) - 1);
+    rc = write(2, fname, strlen(fname));
+    rc = write(2, after, sizeof (after) - 1);
+    (void) rc;
+    _exit(1);
+} // map_sigbus_exit
+
+static void map_sigbus(int sig, siginfo_t *info, void *context)
+{
+    const uint8_t *addr = (const uint8_t *) info->si_addr;
+    const fatelf_mapping *map;
+
+    for (map = live_maps; map != NULL; map = map->next)
+    {
+        if ((addr >= map->ptr) && (addr < map->ptr + map->size))
+        {
+            if (catch_top == NULL)
+                map_sigbus_exit(map->fname);
+            xfail("'%s' was truncated while it was being read", map->fname);
+        } // if
+    } // for
+
+    // Not ours. Let it do what it would have done without us.
+    if (prev_sigbus.sa_flags & SA_SIGINFO)
+        prev_sigbus.sa_sigaction(sig, info, context);
+    else if ((prev_sigbus.sa_handler != SIG_DFL) &&
+             (prev_sigbus.sa_handler != SIG_IGN))
+        prev_sigbus.sa_handler(sig);
+    else  // returning faults again, and this time it kills us.
+        sigaction(sig, &prev_sigbus, NULL);
+} // map_sigbus
+
+
+static void install_sigbus(void)
+{
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof (sa));
+    sa.sa_sigaction = map_sigbus;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;  // we longjmp() out of it.
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, &prev_sigbus);
+} // install_sigbus
+
+
+static void track_mapping(fatelf_mapping *map)
+{
+    pthread_once(&sigbus_once, install_sigbus);
+    map->next = live_maps;
+    live_maps = map;
+} // track_mapping
+
+
+static void untrack_mapping(fatelf_mapping *map)
+{
+    fatelf_mapping **prev;
+
+    for (prev = &live_maps; *prev != NULL; prev = &(*prev)->next)
+    {
+        if (*prev == map)
+        {
+            *prev = map->next;
+            break;
+        } // if
+    } // for
+} // untrack_mapping
+
+
+static void cleanup_mapping(void *map)
+{
+    unmap_file((fatelf_mapping *) map);
+} // cleanup_mapping
+
+
+void xmap_file(const char *fname, const int fd, fatelf_mapping *map)
+{
+    void *ptr;
+
+    map->size = xget_file_size(fname, fd);
+    map->ptr = NULL;
+    map->mapped = 0;
+    map->fname = fname;
+    map->next = NULL;
+
+    if (map->size == 0)
+        return;  // mmap() won't do zero bytes, and there's nothing to read.
+    else if (map->size != (uint64_t) ((size_t) map->size))
+        xfailc(FATELF_ENOMEM, "'%s' is too big to map into memory", fname);
+
+    // Private, so nothing another process writes to the file shows up here
+    //  halfway through; the SIGBUS handler covers it getting shorter.
+    ptr = mmap(NULL, (size_t) map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED)
+    {
+        map->ptr = (const uint8_t *) ptr;
+        map->mapped = 1;
+        track_mapping(map);
+
+        // It might have shrunk between the fstat() and the mmap().
+        fatelf_cleanup_push(cleanup_mapping, map);
+        if (xget_file_size(fname, fd) < map->size)
+            xfail("'%s' was truncated while it was being read", fname);
+        fatelf_cleanup_pop(cleanup_mapping, map, 0);
+        return;
+    } // if
+
+    // not mappable (odd filesystem, etc)? Pull it into memory instead, if
+    //  that won't take too much of it.
+    if (map->size > FATELF_MAP_READ_MAX)
+    {
+        xfailc(FATELF_ENOMEM, "'%s' can't be mapped, and is too big to read"
+               " into memory", fname);
+    } // if
+
+    ptr = xmalloc((size_t) map->size);
+    fatelf_cleanup_push(free, ptr);
+    xlseek(fname, fd, 0, SEEK_SET);
+    xread(fname, fd, ptr, (size_t) map->size, 1);
+    fatelf_cleanup_pop(free, ptr, 0);
+    map->ptr = (const uint8_t *) ptr;
+} // xmap_file
+
+
+void unmap_file(fatelf_mapping *map)
+{
+    if (map->mapped)
+    {
+        untrack_mapping(map);
+        munmap((void *) map->ptr, (size_t) map->size);
+    } // if
+    else
+    {
+        free((void *) map->ptr);
+    } // else
+    map->ptr = NULL;
+    map->size = 0;
+    map->mapped = 0;
+} // unmap_file
+
+
+fatelf_view *xfatelf_view_open(const char *fname, const int fd)
+{
+    const uint64_t start = fatelf_stats_start();
+    fatelf_view *view = (fatelf_view *) xmalloc(sizeof (fatelf_view));
+    view->fname = fname;
+    view->fd = fd;
+    fatelf_cleanup_push(fatelf_cleanup_view, view);  // all zeros is okay.
+    xmap_file(fname, fd, &view->map);
+    view->header = xdecode_fatelf_header(fname, view->map.ptr, view->map.size);
+    fatelf_cleanup_pop(fatelf_cleanup_view, view, 0);
+    FATELF_STATS_PHASE(FATELF_PHASE_HEADER, fname, start);
+    return view;
+} // xfatelf_view_open
+
+
+void fatelf_view_close(fatelf_view *view)
+{
+    if (view != NULL)
+    {
+        unmap_file(&view->map);
+        free(view->header);
+        free(view);
+    } // if
+} // fatelf_view_close
+
+
+void fatelf_cleanup_view(void *view)
+{
+    fatelf_view_close((fatelf_view *) view);
+} // fatelf_cleanup_view
+
+
+const uint8_t *xfatelf_view_record(const fatelf_view *view, const int idx,
+                                   uint64_t *len)
+{
+    const FATELF_record *rec = &view->header->records[idx];
+    assert((idx >= 0) && (idx < (int) view->header->num_records));
+    if ( (rec->offset > view->map.size) ||
+         (rec->size > view->map.size - rec->offset) )
+    {
+        xfailc(FATELF_EFORMAT, "Record #%d runs past the end of '%s'",
+               idx, view->fname);
+    } // if
+
+    *len = rec->size;
+    return view->map.ptr + rec->offset;
+} // xfatelf_view_record
+
+
+const uint8_t *fatelf_view_junk(const fatelf_view *view, uint64_t *offset,
+                                uint64_t *len)
+{
+    if (!fatelf_find_junk(view->header, view->map.size, offset, len))
+        return NULL;
+    return view->map.ptr + *offset;
+} // fatelf_view_junk
+
+
+void xfatelf_view_append_junk(const fatelf_view *view, const int idx,
+                              const char *out, const int outfd)
+{
+    uint64_t offset, size;
+    if (haiku_find_rsrc_view(view, &offset, &size))
+    {
+        // (out) is a copy of record (idx), which we still have mapped.
+        uint64_t len = 0;
+        uint64_t outoff = 0;
+        const uint8_t *elf = xfatelf_view_record(view, idx, &len);
+        if (!haiku_rsrc_offset_mem(out, elf, len, &outoff))
+            xrsrc_offset_failed();
+        append_junk(view->fname, view->fd, out, outfd, 1, outoff,
+                    offset, size);
+    } // if
+    else if (fatelf_view_junk(view, &offset, &size) != NULL)
+    {
+        append_junk(view->fname, view->fd, out, outfd, 0, 0, offset, size);
+    } // else if
+} // xfatelf_view_append_junk
+
+
+// Sizes on the command line are a byte count with an optional K or M
+//  suffix. Returns zero if (str) isn't one, else stores it in (val).
+static int parse_size(const char *str, uint64_t *val)
+{
+    char *end = NULL;
+    const unsigned long long num = strtoull(str, &end, 10);
+
+    if ((end == str) || (*str == '-'))
+        return 0;
+    else if (*end == '\0')
+        *val = (uint64_t) num;
+    else if (strcmp(end, "K") == 0)
+        *val = ((uint64_t) num) * 1024;
+    else if (strcmp(end, "M") == 0)
+        *val = ((uint64_t) num) * 1024 * 1024;
+    else
+        return 0;
+    return 1;
+} // parse_size
+
+
+// "--align=" takes a size, "arch" or "elf".
+static void xparse_align(const char *str)
+{
+    uint64_t val = 0;
+
+    if (strcmp(str, "arch") == 0)
+        align_policy = FATELF_ALIGN_ARCH;
+    else if (strcmp(str, "elf") == 0)
+        align_policy = FATELF_ALIGN_ELF;
+    else if ((!parse_size(str, &val)) || (val < 4096) || (val & (val - 1)))
+        xfailc(FATELF_EINVAL, "Bad --align value '%s'", str);
+    else
+    {
+        align_policy = FATELF_ALIGN_FIXED;
+        align_size = val;
+    } // else
+} // xparse_align
+
+
+// "--slack=" takes a size, or a percentage of each record's size.
+static void xparse_slack(const char *str)
 {
-    memset(zerobuf, '\0', sizeof (zerobuf));  // just in case.
+    char *end = NULL;
+    const unsigned long long val = strtoull(str, &end, 10);
+
+    if ((end != str) && (*str != '-') && (strcmp(end, "%") == 0))
+    {
+        slack_bytes = 0;
+        slack_percent = (uint32_t) val;
+        return;
+    } // if
+
+    slack_percent = 0;
+    if (!parse_size(str, &slack_bytes))
+        xfailc(FATELF_EINVAL, "Bad --slack value '%s'", str);
+} // xparse_slack
+
+
+int xfatelf_init(int argc, const char **argv)
+{
+    const char *env = getenv("FATELF_STATS");
+    const char *tracefile = getenv("FATELF_TRACE");
+    int stats = 0;
+    int i;
+
+    if ((env != NULL) && (*env != '\0') && (strcmp(env, "0") != 0))
+        stats |= FATELF_STATS_COUNT;
+
     if ((argc >= 2) && (strcmp(argv[1], "--version") == 0))
     {
         printf("%s\n", fatelf_build_version);
         exit(0);
     } // if
+
+    // Global options come before anything a specific tool wants.
+    while (argc >= 2)
+    {
+        const char *arg = argv[1];
+        if (strcmp(arg, "--reflink") == 0)
+            fatelf_copy_flags |= FATELF_COPY_REFLINK;
+        else if (strcmp(arg, "--no-sparse") == 0)
+            fatelf_copy_flags |= FATELF_COPY_NO_SPARSE;
+        else if (strcmp(arg, "--no-io-uring") == 0)
+            fatelf_copy_flags |= FATELF_COPY_NO_IO_URING;
+        else if (strncmp(arg, "--slack=", 8) == 0)
+            xparse_slack(arg + 8);
+        else if (strncmp(arg, "--align=", 8) == 0)
+            xparse_align(arg + 8);
+        else if (strcmp(arg, "--direct-threshold=off") == 0)
+            direct_threshold = 0;
+        else if (strncmp(arg, "--direct-threshold=", 19) == 0)
+        {
+            if (!parse_size(arg + 19, &direct_threshold))
+                xfailc(FATELF_EINVAL, "Bad --direct-threshold value '%s'",
+                       arg + 19);
+        } // else if
+        else if (strcmp(arg, "--io-policy=default") == 0)
+            fatelf_io_policy = FATELF_IO_PREALLOCATE | FATELF_IO_SEQUENTIAL;
+        else if (strcmp(arg, "--io-policy=nocache") == 0)
+            fatelf_io_policy = FATELF_IO_PREALLOCATE | FATELF_IO_SEQUENTIAL |
+                               FATELF_IO_DROP_CACHE;
+        else if (strcmp(arg, "--io-policy=none") == 0)
+            fatelf_io_policy = 0;
+        else if (strncmp(arg, "--io-policy=", 12) == 0)
+            xfailc(FATELF_EINVAL, "Unknown I/O policy '%s'", arg + 12);
+        else if (strcmp(arg, "--stats") == 0)
+            stats |= FATELF_STATS_COUNT;
+        else if (strncmp(arg, "--trace=", 8) == 0)
+            tracefile = arg + 8;
+        else
+            break;  // not ours; leave it for the tool.
+
+        for (i = 1; i < argc; i++)
+            argv[i] = argv[i+1];  // (argv[argc] is NULL, so this is safe.)
+        argc--;
+    } // while
+
+    if ((tracefile != NULL) && (*tracefile != '\0'))
+        stats |= FATELF_STATS_TRACE;
+    xfatelf_stats_init(stats, tracefile, argc, argv);
+
+    return argc;
 } // xfatelf_init
 
 // end of fatelf-utils.c ...
@@ -15,8 +15,11 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdint.h>
+#include <setjmp.h>
 
 #include "fatelf.h"
+#include "libfatelf.h"
 
 #if !FATELF_UTILS
 #error Do not include this file outside of FatELF.
@@ -28,9 +31,23 @@
 #define FATELF_ISPRINTF(x,y)
 #endif
 
-extern const char *unlink_on_xfail;
 extern const char *fatelf_build_version;
 
+// How xcopyfile() and xcopyfile_range() move data. xfatelf_init() sets
+//  these from global command line options.
+#define FATELF_COPY_REFLINK   (1 << 0)  // share extents instead of copying.
+#define FATELF_COPY_NO_SPARSE (1 << 1)  // write zeros out instead of holes.
+#define FATELF_COPY_NO_IO_URING (1 << 2)  // batched copies run synchronously.
+extern int fatelf_copy_flags;
+
+// What the copy functions tell the kernel about the data they move. The
+//  default policy is PREALLOCATE|SEQUENTIAL; xfatelf_init() sets this from
+//  --io-policy.
+#define FATELF_IO_PREALLOCATE (1 << 0)  // fallocate() output ranges first.
+#define FATELF_IO_SEQUENTIAL  (1 << 1)  // read ahead aggressively on inputs.
+#define FATELF_IO_DROP_CACHE  (1 << 2)  // don't leave copies in page cache.
+extern int fatelf_io_policy;
+
 #define FATELF_WANT_MACHINE   (1 << 0)
 #define FATELF_WANT_OSABI     (1 << 1)
 #define FATELF_WANT_OSABIVER  (1 << 2)
@@ -68,6 +85,90 @@ extern const char *fatelf_build_version;
     (uint64_t)(((uint64_t)(x) & (uint64_t) 0x00ff000000000000ULL) >> 40) | \
     (uint64_t)(((uint64_t)(x) & (uint64_t) 0xff00000000000000ULL) >> 56) ))
 
+// Write a uint8_t to a buffer.
+static inline uint8_t *putui8(uint8_t *ptr, const uint8_t val)
+{
+    *(ptr++) = val;
+    return ptr;
+} // putui8
+
+
+// Write a native uint16_t to a buffer in littleendian format.
+static inline uint8_t *putui16(uint8_t *ptr, const uint16_t val)
+{
+    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
+    return ptr;
+} // putui16
+
+
+// Write a native uint32_t to a buffer in littleendian format.
+static inline uint8_t *putui32(uint8_t *ptr, const uint32_t val)
+{
+    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
+    return ptr;
+} // putui32
+
+
+// Write a native uint64_t to a buffer in littleendian format.
+static inline uint8_t *putui64(uint8_t *ptr, const uint64_t val)
+{
+    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 32) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 40) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 48) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 56) & 0xFF));
+    return ptr;
+} // putui64
+
+
+// Read a uint8_t from a buffer.
+static inline const uint8_t *getui8(const uint8_t *ptr, uint8_t *val)
+{
+    *val = *ptr;
+    return ptr + sizeof (*val);
+} // getui8
+
+
+// Read a littleendian uint16_t from a buffer in native format.
+static inline const uint8_t *getui16(const uint8_t *ptr, uint16_t *val)
+{
+    *val = ( (((uint16_t) ptr[0]) << 0) | (((uint16_t) ptr[1]) << 8) );
+    return ptr + sizeof (*val);
+} // getui16
+
+
+// Read a littleendian uint32_t from a buffer in native format.
+static inline const uint8_t *getui32(const uint8_t *ptr, uint32_t *val)
+{
+    *val = ( (((uint32_t) ptr[0]) << 0)  |
+             (((uint32_t) ptr[1]) << 8)  |
+             (((uint32_t) ptr[2]) << 16) |
+             (((uint32_t) ptr[3]) << 24) );
+    return ptr + sizeof (*val);
+} // getui32
+
+
+// Read a littleendian uint64_t from a buffer in native format.
+static inline const uint8_t *getui64(const uint8_t *ptr, uint64_t *val)
+{
+    *val = ( (((uint64_t) ptr[0]) << 0)  |
+             (((uint64_t) ptr[1]) << 8)  |
+             (((uint64_t) ptr[2]) << 16) |
+             (((uint64_t) ptr[3]) << 24) |
+             (((uint64_t) ptr[4]) << 32) |
+             (((uint64_t) ptr[5]) << 40) |
+             (((uint64_t) ptr[6]) << 48) |
+             (((uint64_t) ptr[7]) << 56) );
+    return ptr + sizeof (*val);
+} // getui64
+
 typedef struct fatelf_machine_info
 {
     uint16_t id;
@@ -84,11 +185,107 @@ typedef struct fatelf_osabi_info
 } fatelf_osabi_info;
 
 
-// all functions that start with 'x' may call exit() on error!
+// A whole file, read-only, in memory. Usually mmap()ed. Don't copy one
+//  that's mapped; xmap_file() keeps track of where it is.
+typedef struct fatelf_mapping
+{
+    const uint8_t *ptr;
+    uint64_t size;
+    int mapped;  // non-zero if (ptr) came from mmap(), zero if malloc().
+    const char *fname;  // to name it if the file is truncated under us.
+    struct fatelf_mapping *next;  // the other files this thread mapped.
+} fatelf_mapping;
+
+
+// A FatELF file mapped once, with its header decoded, so tools can look at
+//  records and trailing data without seeking and reading over and over.
+typedef struct fatelf_view
+{
+    const char *fname;
+    int fd;  // still owned by the caller; for copying data out of the file.
+    fatelf_mapping map;
+    FATELF_header *header;
+} fatelf_view;
+
+
+// How much of the start of a file xfatelf_probe() reads in one go. Enough
+//  for any FatELF header, and the headers of most ELF files.
+#define FATELF_PROBE_SIZE (64 * 1024)
 
-// Report an error to stderr and terminate immediately with exit(1).
+#define FATELF_PROBE_OTHER  0
+#define FATELF_PROBE_ELF    1
+#define FATELF_PROBE_FATELF 2
+
+// Everything we can tell about a file from the start of it.
+typedef struct fatelf_probe
+{
+    int type;  // one of FATELF_PROBE_*
+    uint64_t file_size;
+    FATELF_record elf;  // ELF files: the target. offset is 0, size is
+                        //  the file, less any Haiku resources.
+    FATELF_header *header;  // FatELF files: the header. NULL otherwise.
+    int has_rsrc;  // non-zero if there are Haiku resources at...
+    uint64_t rsrc_offset;
+    uint64_t rsrc_size;
+    int has_junk;  // FatELF files: non-zero if there's data past the
+    uint64_t junk_offset;  //  last record (resources included).
+    uint64_t junk_size;
+} fatelf_probe;
+
+
+// all functions that start with 'x' may call exit() on error! (Or, inside
+//  a catch frame, longjmp() out of there; see fatelf_catch.)
+
+// Report an error to stderr and terminate immediately with exit(1). Inside
+//  a catch frame, unwind to it instead (see fatelf_catch, below).
 void xfail(const char *fmt, ...) FATELF_ISPRINTF(1,2);
 
+// xfail(), saying what kind of failure this is with one of the FATELF_E*
+//  codes from libfatelf.h. Plain xfail() is FATELF_EFAIL.
+void xfailc(const int err, const char *fmt, ...) FATELF_ISPRINTF(2,3);
+
+// libfatelf runs the x functions inside a catch frame, so they can fail
+//  without taking the process down. Call fatelf_catch_enter(), then
+//  setjmp(frame->env). While the frame is the innermost one on this thread,
+//  xfail() runs everything pushed on this thread's cleanup stack since
+//  the frame was entered (newest first), records the error in the frame,
+//  leaves it, and longjmp()s back; nothing is printed. If the x functions
+//  return normally instead, call fatelf_catch_leave(). Frames nest.
+#define FATELF_ERROR_MAX 256
+
+typedef struct fatelf_catch
+{
+    jmp_buf env;
+    struct fatelf_catch *prev;
+    size_t cleanup_base;
+    int error;  // one of FATELF_E*
+    int sys_errno;  // errno when xfail() was called.
+    char message[FATELF_ERROR_MAX];
+} fatelf_catch;
+
+void fatelf_catch_enter(fatelf_catch *frame);
+void fatelf_catch_leave(fatelf_catch *frame);
+
+// Anything that's held across a call that might xfail() gets pushed here,
+//  so a catch frame can release it. Pushing does nothing outside of a
+//  frame, where xfail() exits anyway. Popping removes the newest entry
+//  matching (fn, arg), wherever it is on the stack, and then calls fn(arg)
+//  if (run) is non-zero, whether or not there's a frame.
+typedef void (*fatelf_cleanup_fn)(void *arg);
+void fatelf_cleanup_push(fatelf_cleanup_fn fn, void *arg);
+void fatelf_cleanup_pop(fatelf_cleanup_fn fn, void *arg, const int run);
+
+// A cleanup that closes a file descriptor, passed as FATELF_FD_ARG(fd).
+#define FATELF_FD_ARG(fd) ((void *) (intptr_t) (fd))
+void fatelf_cleanup_close(void *fd);
+
+// Files for xfail() to delete, so we don't leave half-written output behind.
+//  Any thread can add and remove them; (fname) is matched by pointer, and
+//  must stay valid until it's removed. Inside a catch frame, these go on
+//  the thread's cleanup stack instead, and only that frame deletes them.
+void unlink_on_xfail_add(const char *fname);
+void unlink_on_xfail_remove(const char *fname);
+
 // Wrap malloc() with an xfail(), so this returns memory or calls exit().
 // Memory is guaranteed to be initialized to zero.
 void *xmalloc(const size_t len);
@@ -105,48 +302,219 @@ ssize_t xwrite(const char *fname, const int fd,
 void xclose(const char *fname, const int fd);
 void xlseek(const char *fname, const int fd, const off_t o, const int whence);
 
-// This writes len null bytes to (fd).
+// xopen(), with the descriptor on the cleanup stack until xclose_held().
+int xopen_held(const char *fname, const int flags, const int perms);
+void xclose_held(const char *fname, const int fd);
+
+// Create an empty file in the same directory as (fname), to be renamed
+//  over it with xrename() once it's complete. The name is stored in
+//  (*tmpname); xfail() deletes the file until unlink_on_xfail_remove() is
+//  called on it, and the name is on the cleanup stack, so release it after
+//  that with fatelf_cleanup_pop(free, name, 1). Returns a descriptor that
+//  goes to xclose_held().
+int xcreate_temp(const char *fname, char **tmpname);
+
+// rename(), with an xfail() on error.
+void xrename(const char *from, const char *to);
+
+// Give (fd) the permissions in (st), and its owner, too, if we're allowed
+//  to change that. If (times), set its timestamps to the ones in (st).
+void xcopy_file_attrs(const char *fname, const int fd, const struct stat *st,
+                      const int times);
+
+// Positional I/O; these don't use or move the file position.
+ssize_t xpread(const char *fname, const int fd, void *buf, const size_t len,
+               const uint64_t offset, const int must_read);
+void xpwrite(const char *fname, const int fd, const void *buf,
+             const size_t len, const uint64_t offset);
+
+// This writes len null bytes to (fd). If that would extend a regular file,
+//  it leaves a hole instead of writing anything, unless sparse output is off.
 void xwrite_zeros(const char *fname, const int fd, size_t len);
 
+// Write (len) null bytes at (offset) in (fd), without moving the file
+//  position. Like xwrite_zeros(), this leaves a hole past the end of file.
+void xpwrite_zeros(const char *fname, const int fd, uint64_t offset,
+                   uint64_t len);
+
 // copy file from infd to current seek position in outfd, until infd's EOF.
+//  infd's file position is only used if it isn't a regular file.
 uint64_t xcopyfile(const char *in, const int infd,
                    const char *out, const int outfd);
 
-// copy file from infd to current offset in outfd, for size bytes.
+// copy file from (offset) in infd to current offset in outfd, for size
+//  bytes. This doesn't use or move infd's file position.
 void xcopyfile_range(const char *in, const int infd,
                      const char *out, const int outfd,
                      const uint64_t offset, const uint64_t size);
 
+// copy (size) bytes from (inoff) in infd to (outoff) in outfd. This neither
+//  uses nor moves either file position.
+void xcopyfile_at(const char *in, const int infd, const uint64_t inoff,
+                  const char *out, const int outfd, const uint64_t outoff,
+                  const uint64_t size);
+
+// For descriptors that can only be read front to back, like a pipe: read
+//  until (len) bytes are in (buf) or EOF, and return how many there are.
+size_t xread_stream(const char *fname, const int fd, void *buf,
+                    const size_t len);
+
+// Read past (len) bytes of (fd) from its file position, xfail()ing if it
+//  ends first.
+void xskip_stream(const char *fname, const int fd, uint64_t len);
+
+// Copy up to (size) bytes from infd's file position to outfd's. Returns
+//  the number copied, which is less than (size) only if infd ended first.
+uint64_t xcopy_stream(const char *in, const int infd,
+                      const char *out, const int outfd, const uint64_t size);
+
+// Apply the I/O policy to a copy of (size) bytes from (inoff) in infd to
+//  (outoff) in outfd: call fatelf_io_begin() before any of it is copied,
+//  and fatelf_io_end() after. The copy functions do this for you. These are
+//  only hints; failures are ignored.
+void fatelf_io_begin(const int infd, const uint64_t inoff, const int outfd,
+                     const uint64_t outoff, const uint64_t size);
+void fatelf_io_end(const int infd, const uint64_t inoff, const int outfd,
+                   const uint64_t outoff, const uint64_t size);
+
+// Non-zero if a copy of (size) bytes is big enough to bypass the page cache
+//  with O_DIRECT (see --direct-threshold). xcopyfile_range() and
+//  xcopyfile_at() check this themselves.
+int fatelf_want_direct(const uint64_t size);
+
+// If sparse copies are on and (fd) is a regular file that might have holes,
+//  return its size, so the caller can look for them. Zero otherwise.
+uint64_t sparse_input_size(const int fd);
+
+// Find the first run of data in [pos, end) of (fd), and put its bounds in
+//  (start, stop). Returns zero if the rest of the range is a hole.
+int find_data_extent(const int fd, const uint64_t pos, const uint64_t end,
+                     uint64_t *start, uint64_t *stop);
+
 // get the length of an open file in bytes.
 uint64_t xget_file_size(const char *fname, const int fd);
 
-// read the parts of an ELF header we care about.
+// read the parts of an ELF header we care about. Doesn't use or move the
+//  file position.
 void xread_elf_header(const char *fname, const int fd, const uint64_t offset,
                       FATELF_record *rec);
 
+// ...or decode them from an ELF header that's already in memory.
+void xdecode_elf_header(const char *fname, const uint8_t *buf,
+                        const uint64_t buflen, FATELF_record *rec);
+
 // How many bytes to allocate for a FATELF_header.
 size_t fatelf_header_size(const int bincount);
 
+// Read the first FATELF_PROBE_SIZE bytes of (fd), or all of it if it's
+//  smaller, into (buf) with a single pread(). Returns the number of bytes
+//  read, and puts the size of the file in (*fsize).
+uint64_t xread_prefix(const char *fname, const int fd, uint8_t *buf,
+                      uint64_t *fsize);
+
+// Classify (fd), and decode its headers, from one read of the start of the
+//  file. Only tables that lie past that (ELF section headers, usually) cost
+//  another read. Doesn't use or move the file position.
+void xfatelf_probe(const char *fname, const int fd, fatelf_probe *probe);
+
+// xfatelf_probe(), but xfail()s unless (fd) is an unpacked FatELF file.
+//  The probe then has everything about the file's layout that rewriting
+//  it needs: the header, and where its junk or resources are, so pass it
+//  around rather than reading them again.
+void xfatelf_probe_fatelf(const char *fname, const int fd,
+                          fatelf_probe *probe);
+
+// Release anything xfatelf_probe() handed out.
+void fatelf_probe_free(fatelf_probe *probe);
+void fatelf_cleanup_probe(void *probe);  // fatelf_probe_free(), as a cleanup.
+
+// Encode or decode the 8 bytes of a FatELF record that name its target
+//  (machine through reserved1), returning the pointer just past them.
+uint8_t *fatelf_encode_target(uint8_t *ptr, const FATELF_record *rec);
+const uint8_t *fatelf_decode_target(const uint8_t *ptr, FATELF_record *rec);
+
+// Encode or decode a whole 24-byte FatELF record, target plus offset and
+//  size, returning the pointer just past it.
+uint8_t *fatelf_encode_record(uint8_t *ptr, const FATELF_record *rec);
+const uint8_t *fatelf_decode_record(const uint8_t *ptr, FATELF_record *rec);
+
+// Encode (header) into the FATELF_DISK_FORMAT_SIZE(header->num_records)
+//  bytes at (buf), as it would be on disk.
+void fatelf_encode_header(const FATELF_header *header, uint8_t *buf);
+
 // Put FatELF header to disk. Will seek to 0 first.
 void xwrite_fatelf_header(const char *fname, const int fd,
                           const FATELF_header *header);
 
-// Get FatELF header from disk. Will seek to 0 first.
+// Get FatELF header from disk. Doesn't use or move the file position.
 // don't forget to free() the returned pointer!
 FATELF_header *xread_fatelf_header(const char *fname, const int fd);
 
-// Locate non-FatELF data at the end of a FatELF file fd. Returns non-zero if
-// junk found, and fills in offset and size.
-int xfind_junk(const char *fname, const int fd, uint64_t *offset,
-              uint64_t *size);
-
-// Write non-FatELF data at the end of FatELF file fd to current position in
-//  outfd.
-void xappend_junk(const char *fname, const int fd,
-                  const char *out, const int outfd);
-
-// Align a value to the page size.
-uint64_t align_to_page(const uint64_t offset);
+// Decode a FatELF header from the (buflen) bytes at the start of a file.
+// don't forget to free() the returned pointer!
+FATELF_header *xdecode_fatelf_header(const char *fname, const uint8_t *buf,
+                                     const uint64_t buflen);
+
+// Locate non-FatELF data at the end of a FatELF file of (fsize) bytes with
+// (header): whatever lies past the record that reaches furthest into it.
+// Returns non-zero if junk found, and fills in offset and size.
+int fatelf_find_junk(const FATELF_header *header, const uint64_t fsize,
+                     uint64_t *offset, uint64_t *size);
+
+// Write non-FatELF data at the end of FatELF file fd, as (probe) found it,
+//  to current position in outfd. Haiku resources go where FatELF file
+//  outfd, whose header is (outheader), expects them instead.
+void xappend_junk(const fatelf_probe *probe, const char *fname,
+                  const int fd, const char *out, const int outfd,
+                  const FATELF_header *outheader);
+
+// Map the whole file (fd) into memory, read-only. If the file is truncated
+//  while it's mapped, touching the part that's gone xfail()s. Falls back
+//  to reading it into an allocated buffer if it can't be mmap()ed, for
+//  files up to 256 megabytes.
+void xmap_file(const char *fname, const int fd, fatelf_mapping *map);
+
+// Release anything xmap_file() handed out.
+void unmap_file(fatelf_mapping *map);
+
+// Map a FatELF file and decode its header. (fd) must stay open until
+//  fatelf_view_close(). xfail()s if this isn't a FatELF file.
+fatelf_view *xfatelf_view_open(const char *fname, const int fd);
+void fatelf_view_close(fatelf_view *view);
+void fatelf_cleanup_view(void *view);  // fatelf_view_close(), as a cleanup.
+
+// Get a pointer to the bytes of record (idx), and its length. xfail()s if
+//  the record runs past the end of the file.
+const uint8_t *xfatelf_view_record(const fatelf_view *view, const int idx,
+                                   uint64_t *len);
+
+// Get a pointer to the non-FatELF data at the end of the file, and its
+//  offset and length. NULL if there's no junk.
+const uint8_t *fatelf_view_junk(const fatelf_view *view, uint64_t *offset,
+                                uint64_t *len);
+
+// xappend_junk(), for a mapped file, when outfd is a copy of record (idx).
+void xfatelf_view_append_junk(const fatelf_view *view, const int idx,
+                              const char *out, const int outfd);
+
+// Bytes of free space to leave after a record of (size) bytes when laying
+//  out a FatELF file (see --slack), so it can be replaced in place later.
+uint64_t fatelf_record_slack(const uint64_t size);
+
+// Round (offset) up to a multiple of (align), a power of two.
+uint64_t fatelf_align_offset(const uint64_t offset, const uint64_t align);
+
+// How records are aligned in the files we lay out. xfatelf_init() sets this
+//  from --align; fixed 4K is the default, and the least any policy gives.
+#define FATELF_ALIGN_FIXED 0  // every record to the same size.
+#define FATELF_ALIGN_ARCH  1  // each to its machine's biggest page size.
+#define FATELF_ALIGN_ELF   2  // each to its largest PT_LOAD's p_align.
+
+// The alignment the --align policy wants for (rec), whose ELF binary
+//  starts at (offset) in (fname), open as (fd), for the ELF policy.
+uint64_t xfatelf_record_align(const char *fname, const int fd,
+                              const uint64_t offset,
+                              const FATELF_record *rec);
 
 // find the record closest to the end of the file. -1 on error!
 int find_furthest_record(const FATELF_header *header);
@@ -156,8 +524,11 @@ const fatelf_machine_info *get_machine_by_name(const char *name);
 const fatelf_osabi_info *get_osabi_by_id(const uint8_t id);
 const fatelf_osabi_info *get_osabi_by_name(const char *name);
 
-// Returns a string that can be used to target a specific record.
-const char *fatelf_get_target_name(const FATELF_record *rec, const int wants);
+// Writes a string that can be used to target a specific record into
+//  (buffer), and returns it. FATELF_TARGET_NAME_MAX bytes is always enough.
+#define FATELF_TARGET_NAME_MAX 128
+const char *fatelf_get_target_name(const FATELF_record *rec, const int wants,
+                                   char *buffer, const size_t buflen);
 
 // these return static strings of english words.
 const char *fatelf_get_wordsize_string(const uint8_t wordsize);
@@ -169,11 +540,120 @@ const char *fatelf_get_wordsize_target_name(const uint8_t wordsize);
 //  various formats.
 int xfind_fatelf_record(const FATELF_header *header, const char *target);
 
+// A target string, parsed once, to match against as many records (and
+//  headers) as you like without parsing it again.
+typedef struct fatelf_target
+{
+    const char *name;  // the string it came from; must outlive this.
+    int by_index;  // non-zero for "recordN"; (index) is N.
+    long index;
+    int wants;  // FATELF_WANT_* flags for the fields of (rec) to check.
+    FATELF_record rec;
+} fatelf_target;
+
+// Parse (str), in any form xfind_fatelf_record() takes, into (target).
+void xfatelf_compile_target(const char *str, fatelf_target *target);
+
+// non-zero if (rec) has every field (target) names. "recordN" targets name
+//  a position, not fields, so they never match here.
+int fatelf_target_matches(const fatelf_target *target,
+                          const FATELF_record *rec);
+
+// xfind_fatelf_record(), for a compiled target.
+int xfatelf_target_find(const fatelf_target *target,
+                        const FATELF_header *header);
+
 // non-zero if all pertinent fields in a match b.
 int fatelf_record_matches(const FATELF_record *a, const FATELF_record *b);
 
-// Call this at the start of main().
-void xfatelf_init(int argc, const char **argv);
+// Loaders try a file's records in the order its header lists them, and the
+//  kernel only reads the first 128 bytes of a file to pick one: the FatELF
+//  header and the first five records. It can't run a record past those.
+#define FATELF_LOADER_WINDOW ((128 - FATELF_DISK_FORMAT_SIZE(0)) / 24)
+
+// What "--order=default" means: the most common hosts first.
+#define FATELF_DEFAULT_ORDER "x86_64,i386,arm,ppc64:le,ppc64,ppc"
+
+// A comma-separated list of targets, most wanted first, compiled.
+typedef struct fatelf_order
+{
+    int count;
+    fatelf_target *targets;
+    char *names;  // (targets) point into this.
+} fatelf_order;
+
+// Parse (str), or FATELF_DEFAULT_ORDER if it's "default". The returned
+//  order is on the cleanup stack; pop it with fatelf_cleanup_order().
+fatelf_order *xfatelf_compile_order(const char *str);
+void fatelf_cleanup_order(void *order);
+
+// The first target in (order) that (rec) matches, or order->count if none.
+int fatelf_order_rank(const fatelf_order *order, const FATELF_record *rec);
+
+// Fill (perm) with the indices of (header)'s records, best ranked first,
+//  and records that rank the same in the order they're already in.
+void fatelf_order_records(const fatelf_order *order,
+                          const FATELF_header *header, int *perm);
+
+// Put (header)'s records in the order fatelf_order_records() gave.
+void fatelf_permute_records(FATELF_header *header, const int *perm);
+
+// What to do about records past FATELF_LOADER_WINDOW.
+typedef enum fatelf_window_policy
+{
+    FATELF_WINDOW_IGNORE,
+    FATELF_WINDOW_WARN,  // the tool says so on stderr.
+    FATELF_WINDOW_FAIL  // xfail().
+} fatelf_window_policy;
+
+// Parse the POLICY of a "--window=POLICY" option.
+fatelf_window_policy xfatelf_parse_window_policy(const char *str);
+
+// Fail on, or describe in (warning), any record of FatELF file (fname)
+//  that the kernel's loader won't see. Returns non-zero if there were any;
+//  (warning) only holds something if (policy) is FATELF_WINDOW_WARN. This
+//  is library code, so it's up to the tool to print that.
+int xfatelf_check_loader_window(const char *fname,
+                                const FATELF_header *header,
+                                const fatelf_window_policy policy,
+                                char *warning, const size_t warnlen);
+
+// xfatelf_check_loader_window(), with any warning on stderr, for the tools.
+void xfatelf_warn_loader_window(const char *fname,
+                                const FATELF_header *header,
+                                const fatelf_window_policy policy);
+
+// fatelf_ctx_create(), for the tools. xfail()s if out of memory.
+fatelf_ctx *xfatelf_ctx_create(void);
+
+// fatelf_glue(), but it also hands back the header it wrote, so the tools
+//  can check it without reading it again. free() (*header).
+int fatelf_glue_header(fatelf_ctx *ctx, const char *out, const char **bins,
+                       const int bincount, FATELF_header **header);
+
+// Destroy (ctx), and if (rc), returned by the last libfatelf call made with
+//  it, says that call failed, xfail() with its message.
+void xfatelf_ctx_finish(fatelf_ctx *ctx, const int rc);
+
+// The tools' main()s, for argv that xfatelf_init() has already stripped
+//  of global options. The fatelf multi-call binary runs these.
+int fatelf_glue_main(int argc, const char **argv);
+int fatelf_info_main(int argc, const char **argv);
+int fatelf_extract_main(int argc, const char **argv);
+int fatelf_replace_main(int argc, const char **argv);
+int fatelf_remove_main(int argc, const char **argv);
+int fatelf_verify_main(int argc, const char **argv);
+int fatelf_split_main(int argc, const char **argv);
+int fatelf_validate_main(int argc, const char **argv);
+int fatelf_merge_main(int argc, const char **argv);
+int fatelf_scan_main(int argc, const char **argv);
+int fatelf_index_main(int argc, const char **argv);
+int fatelf_reorder_main(int argc, const char **argv);
+
+// Call this at the start of main(). This handles --version, and removes any
+//  global options (--reflink, --io-policy, etc) from the front of argv. Returns
+//  the new argc.
+int xfatelf_init(int argc, const char **argv);
 
 // end of fatelf-utils.h ...
 
@@ -9,12 +9,16 @@
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 
-static int fatelf_validate(const char *fname)
+static int fatelf_validate(const char *fname,
+                           const fatelf_window_policy window)
 {
-    const int fd = xopen(fname, O_RDONLY, 0755);
-    FATELF_header *header = xread_fatelf_header(fname, fd);
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
+    fatelf_view *view = xfatelf_view_open(fname, fd);
+    const FATELF_header *header = view->header;
     int i;
 
+    fatelf_cleanup_push(fatelf_cleanup_view, view);
+
     if (header->reserved0 != 0)
         xfail("FatELF header reserved field isn't zero.");
 
@@ -22,6 +26,9 @@ static int fatelf_validate(const char *fname)
     {
         const FATELF_record *rec = &header->records[i];
         FATELF_record elfrec;
+        const uint8_t *elf;
+        uint64_t elflen;
+        uint64_t align;
 
         if (rec->reserved0 != 0)
             xfail("Reserved0 field is not zero in record #%d", i);
@@ -35,8 +42,6 @@ static int fatelf_validate(const char *fname)
             xfail("Unknown byte order #%d in record #%d", (int) rec->byte_order, i);
         else if (!fatelf_get_wordsize_target_name(rec->word_size))
             xfail("Unknown word size #%d in record #%d", (int) rec->word_size, i);
-        else if (rec->offset != align_to_page(rec->offset))
-            xfail("Unaligned binary in record #%d", i);
         else if ((rec->offset + rec->size) < rec->offset)
         {
             xfail("Bogus offset+size (%llu + %llu) in record #%d",
@@ -51,24 +56,51 @@ static int fatelf_validate(const char *fname)
 
         // !!! FIXME: check for overlap between records?
 
-        xread_elf_header(fname, fd, rec->offset, &elfrec);
+        elf = xfatelf_view_record(view, i, &elflen);  // fails if truncated.
+        align = xfatelf_record_align(fname, fd, rec->offset, rec);
+        if (rec->offset != fatelf_align_offset(rec->offset, align))
+        {
+            xfail("Binary in record #%d isn't aligned to %llu bytes", i,
+                  (unsigned long long) align);
+        } // if
+
+        xdecode_elf_header(fname, elf, elflen, &elfrec);
         if (!fatelf_record_matches(rec, &elfrec))
             xfail("ELF header differs from FatELF data in record #%d", i);
     } // for
 
-    xclose(fname, fd);
-    free(header);
+    xfatelf_warn_loader_window(fname, header, window);
+
+    fatelf_cleanup_pop(fatelf_cleanup_view, view, 1);
+    xclose_held(fname, fd);
     return 0;  // success
 } // fatelf_validate
 
 
-int main(int argc, const char **argv)
+int fatelf_validate_main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    fatelf_window_policy window = FATELF_WINDOW_WARN;
+
+    if ((argc == 3) && (strncmp(argv[1], "--window=", 9) == 0))
+    {
+        window = xfatelf_parse_window_policy(argv[1] + 9);
+        argv[1] = argv[2];
+        argc--;
+    } // if
+
     if (argc != 2)  // this could stand to use getopt(), later.
-        xfail("USAGE: %s <in>", argv[0]);
-    return fatelf_validate(argv[1]);
+        xfail("USAGE: %s [--window=POLICY] <in>", argv[0]);
+    return fatelf_validate(argv[1], window);
+} // fatelf_validate_main
+
+
+#if !FATELF_MULTICALL
+int main(int argc, const char **argv)
+{
+    argc = xfatelf_init(argc, argv);
+    return fatelf_validate_main(argc, argv);
 } // main
+#endif
 
 // end of fatelf-validate.c ...
 
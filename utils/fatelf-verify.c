@@ -9,24 +9,100 @@
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 
-static int fatelf_verify(const char *fname, const char *target)
+static int xverify_file(const char *fname, const fatelf_target *target)
 {
-    const int fd = xopen(fname, O_RDONLY, 0755);
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
     FATELF_header *header = xread_fatelf_header(fname, fd);
-    const int recidx = xfind_fatelf_record(header, target);
-    xclose(fname, fd);
-    free(header);
+    int recidx;
+
+    fatelf_cleanup_push(free, header);
+    recidx = xfatelf_target_find(target, header);
+    xclose_held(fname, fd);
+    fatelf_cleanup_pop(free, header, 1);
     return (recidx < 0);
-} // fatelf_verify
+} // xverify_file
+
+
+// Check one of many files; a file that can't be checked is reported, but
+//  doesn't stop the rest.
+static int verify_file(const char *fname, const fatelf_target *target,
+                       const int quiet)
+{
+    fatelf_catch frame;
+    int retval;
+
+    fatelf_catch_enter(&frame);
+    if (setjmp(frame.env) != 0)
+    {
+        fprintf(stderr, "%s\n", frame.message);
+        retval = 1;
+    } // if
+    else
+    {
+        retval = xverify_file(fname, target);
+        fatelf_catch_leave(&frame);
+    } // else
+
+    if (retval && !quiet)
+        printf("%s\n", fname);
+    return retval;
+} // verify_file
+
+
+static void xusage(const char *argv0)
+{
+    xfail("USAGE: %s <in> <target>\n"
+          "       %s --target=TARGET [--quiet] <in> [in...]", argv0, argv0);
+} // xusage
+
+
+int fatelf_verify_main(int argc, const char **argv)
+{
+    const char *targetstr = NULL;
+    fatelf_target target;
+    int failures = 0;
+    int quiet = 0;
+    int argi;
+
+    for (argi = 1; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if (strncmp(arg, "--target=", 9) == 0)
+            targetstr = arg + 9;
+        else if (strcmp(arg, "--quiet") == 0)
+            quiet = 1;
+        else if (strncmp(arg, "--", 2) == 0)
+            xusage(argv[0]);
+        else
+            break;
+    } // for
+
+    if (targetstr == NULL)  // the original form: one file, then a target.
+    {
+        if ((argi != 1) || (argc != 3))
+            xusage(argv[0]);
+        xfatelf_compile_target(argv[2], &target);
+        return xverify_file(argv[1], &target);
+    } // if
+
+    if (argi >= argc)
+        xusage(argv[0]);
+
+    xfatelf_compile_target(targetstr, &target);
+    for (; argi < argc; argi++)
+        failures += verify_file(argv[argi], &target, quiet);
+
+    return (failures > 0) ? 1 : 0;
+} // fatelf_verify_main
 
 
+#if !FATELF_MULTICALL
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
-    if (argc != 3)  // this could stand to use getopt(), later.
-        xfail("USAGE: %s <in> <target>", argv[0]);
-    return fatelf_verify(argv[1], argv[2]);
+    argc = xfatelf_init(argc, argv);
+    return fatelf_verify_main(argc, argv);
 } // main
+#endif
 
 // end of fatelf-verify.c ...
 
@@ -0,0 +1,451 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+/* parallel directory tree walks... */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1  // statx()
+#endif
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-walk.h"
+#include "fatelf-stats.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define FATELF_HAVE_GETDENTS64 1
+#define WALK_DENTS_SIZE (64 * 1024)
+typedef struct walk_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} walk_dirent64;
+#endif
+
+// Each thread has its own queue of directories, by their paths relative
+//  to the root. It works from the back of its own, so it goes depth first
+//  and the queue stays short, and when that's empty, it steals from the
+//  front of someone else's, which is where the biggest untouched subtrees
+//  are.
+typedef struct walk_deque
+{
+    pthread_mutex_t lock;
+    char **paths;
+    size_t head;  // paths[head] to paths[tail-1] are queued.
+    size_t tail;
+    size_t alloc;
+} walk_deque;
+
+struct walk_state;
+
+typedef struct walk_worker
+{
+    struct walk_state *state;
+    int index;
+    walk_deque deque;
+    char *path;  // scratch space for entry paths.
+    size_t pathalloc;
+    #if FATELF_HAVE_GETDENTS64
+    uint8_t *dents;
+    #endif
+} walk_worker;
+
+typedef struct walk_state
+{
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    int idle;  // threads waiting on idle_cond.
+    uint64_t queued;  // directories sitting in a deque.
+    uint64_t pending;  // directories queued or being read right now.
+    walk_worker *workers;
+    int num_workers;
+    const char *root;
+    int rootfd;
+    fatelf_walk_fn fn;
+    void *data;
+    uint64_t failures;
+} walk_state;
+
+
+static void queue_dir(walk_worker *worker, const char *path, const size_t len)
+{
+    walk_state *state = worker->state;
+    walk_deque *deque = &worker->deque;
+    char *copy = (char *) xmalloc(len + 1);
+    memcpy(copy, path, len);
+
+    __atomic_add_fetch(&state->pending, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->alloc)
+    {
+        if (deque->head > 0)  // slide down over what's been stolen.
+        {
+            memmove(deque->paths, deque->paths + deque->head,
+                    (deque->tail - deque->head) * sizeof (char *));
+            deque->tail -= deque->head;
+            deque->head = 0;
+        } // if
+        else
+        {
+            const size_t newalloc = deque->alloc ? (deque->alloc * 2) : 64;
+            void *ptr = realloc(deque->paths, newalloc * sizeof (char *));
+            if (ptr == NULL)
+            {
+                pthread_mutex_unlock(&deque->lock);
+                xfailc(FATELF_ENOMEM, "Out of memory!");
+            } // if
+            deque->paths = (char **) ptr;
+            deque->alloc = newalloc;
+        } // else
+    } // if
+    deque->paths[deque->tail++] = copy;
+    pthread_mutex_unlock(&deque->lock);
+
+    __atomic_add_fetch(&state->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&state->idle, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&state->idle_lock);
+        pthread_cond_signal(&state->idle_cond);
+        pthread_mutex_unlock(&state->idle_lock);
+    } // if
+} // queue_dir
+
+
+// Take the newest directory from our own deque, or (steal) the oldest.
+static char *dequeue_dir(walk_deque *deque, const int steal)
+{
+    char *retval = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head != deque->tail)
+    {
+        if (steal)
+            retval = deque->paths[deque->head++];
+        else
+            retval = deque->paths[--deque->tail];
+        if (deque->head == deque->tail)
+            deque->head = deque->tail = 0;
+    } // if
+    pthread_mutex_unlock(&deque->lock);
+
+    return retval;
+} // dequeue_dir
+
+
+static char *next_dir(walk_worker *worker)
+{
+    walk_state *state = worker->state;
+    char *retval = dequeue_dir(&worker->deque, 0);
+    int i;
+
+    for (i = 1; (retval == NULL) && (i < state->num_workers); i++)
+    {
+        const int victim = (worker->index + i) % state->num_workers;
+        retval = dequeue_dir(&state->workers[victim].deque, 1);
+    } // for
+
+    if (retval != NULL)
+        __atomic_sub_fetch(&state->queued, 1, __ATOMIC_SEQ_CST);
+
+    return retval;
+} // next_dir
+
+
+// statx() can skip syncing with a network server for attributes we don't
+//  need to be exact, but the callbacks want a struct stat.
+static int walk_stat(const int dirfd, const char *name, struct stat *st)
+{
+    #if FATELF_HAVE_STATX
+    struct statx stx;
+    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT |
+              AT_STATX_DONT_SYNC, STATX_BASIC_STATS, &stx) == -1)
+        return -1;
+
+    memset(st, '\0', sizeof (*st));
+    st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st->st_ino = stx.stx_ino;
+    st->st_mode = stx.stx_mode;
+    st->st_nlink = stx.stx_nlink;
+    st->st_uid = stx.stx_uid;
+    st->st_gid = stx.stx_gid;
+    st->st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    st->st_size = (off_t) stx.stx_size;
+    st->st_blksize = stx.stx_blksize;
+    st->st_blocks = stx.stx_blocks;
+    st->st_atim.tv_sec = stx.stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+    return 0;
+    #else
+    return fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+    #endif
+} // walk_stat
+
+
+// Handle one entry of directory (dirpath), open as (fd). Subdirectories
+//  are queued; (is_dir) is -1 if we don't know yet whether this is one.
+static void walk_entry(walk_worker *worker, const char *dirpath,
+                       const size_t dirlen, const int fd, const char *name,
+                       const int is_dir)
+{
+    walk_state *state = worker->state;
+    const size_t namelen = strlen(name);
+    size_t len = 0;
+    struct stat st;
+
+    if ((name[0] == '.') && ((name[1] == '\0') ||
+                             ((name[1] == '.') && (name[2] == '\0'))))
+        return;
+
+    if (dirlen + namelen + 2 > worker->pathalloc)
+    {
+        worker->pathalloc = dirlen + namelen + 256;
+        free(worker->path);
+        worker->path = (char *) xmalloc(worker->pathalloc);
+    } // if
+
+    if (dirlen)
+    {
+        memcpy(worker->path, dirpath, dirlen);
+        worker->path[dirlen] = '/';
+        len = dirlen + 1;
+    } // if
+    memcpy(worker->path + len, name, namelen + 1);
+    len += namelen;
+
+    if (is_dir == 1)  // no need to stat it.
+        queue_dir(worker, worker->path, len);
+    else if (walk_stat(fd, name, &st) == -1)
+        return;  // gone already?
+    else if (S_ISDIR(st.st_mode))
+        queue_dir(worker, worker->path, len);
+    else
+    {
+        const uint64_t start = fatelf_stats_start();
+        state->fn(state->data, worker->path, fd, name, &st);
+        FATELF_STATS_PHASE(FATELF_PHASE_FILE, worker->path, start);
+    } // else
+} // walk_entry
+
+
+// Read one directory: queue its subdirectories, and hand everything else
+//  to the callback.
+static void walk_dir_entries(walk_worker *worker, const char *dirpath)
+{
+    walk_state *state = worker->state;
+    const size_t dirlen = strlen(dirpath);
+    const int fd = openat(state->rootfd, dirlen ? dirpath : ".",
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int rc = 0;
+
+    if (fd == -1)
+        rc = -1;
+    else
+    {
+    #if FATELF_HAVE_GETDENTS64
+        // Big batches of entries straight from the kernel, with their types,
+        //  so directories don't need a stat at all.
+        long br;
+        while ((br = syscall(SYS_getdents64, fd, worker->dents,
+                             WALK_DENTS_SIZE)) > 0)
+        {
+            long pos = 0;
+            while (pos < br)
+            {
+                const walk_dirent64 *dent;
+                dent = (const walk_dirent64 *) (worker->dents + pos);
+                pos += dent->d_reclen;
+                if (dent->d_type == DT_UNKNOWN)
+                    walk_entry(worker, dirpath, dirlen, fd, dent->d_name, -1);
+                else
+                {
+                    walk_entry(worker, dirpath, dirlen, fd, dent->d_name,
+                               (dent->d_type == DT_DIR) ? 1 : 0);
+                } // else
+            } // while
+        } // while
+        rc = (br == -1) ? -1 : 0;
+        close(fd);
+    #else
+        DIR *dirp = fdopendir(fd);
+        struct dirent *dent;
+        if (dirp == NULL)
+        {
+            rc = -1;
+            close(fd);
+        } // if
+        else
+        {
+            while ((dent = readdir(dirp)) != NULL)
+                walk_entry(worker, dirpath, dirlen, fd, dent->d_name, -1);
+            closedir(dirp);  // closes (fd), too.
+        } // else
+    #endif
+    } // else
+
+    if (rc == -1)
+    {
+        fprintf(stderr, "Can't read '%s/%s': %s\n", state->root, dirpath,
+                strerror(errno));
+        __atomic_add_fetch(&state->failures, 1, __ATOMIC_RELAXED);
+    } // if
+} // walk_dir_entries
+
+
+static void *walk_thread(void *arg)
+{
+    walk_worker *worker = (walk_worker *) arg;
+    walk_state *state = worker->state;
+
+    while (1)
+    {
+        char *dir = next_dir(worker);
+        if (dir != NULL)
+        {
+            walk_dir_entries(worker, dir);
+            free(dir);
+            if (__atomic_sub_fetch(&state->pending, 1, __ATOMIC_SEQ_CST) == 0)
+            {
+                pthread_mutex_lock(&state->idle_lock);
+                pthread_cond_broadcast(&state->idle_cond);
+                pthread_mutex_unlock(&state->idle_lock);
+            } // if
+            continue;
+        } // if
+
+        // Nothing to steal. Wait for more, unless nobody's busy, in which
+        //  case nothing more is coming and we're done.
+        pthread_mutex_lock(&state->idle_lock);
+        __atomic_add_fetch(&state->idle, 1, __ATOMIC_SEQ_CST);
+        while ((__atomic_load_n(&state->queued, __ATOMIC_SEQ_CST) == 0) &&
+               (__atomic_load_n(&state->pending, __ATOMIC_SEQ_CST) > 0))
+            pthread_cond_wait(&state->idle_cond, &state->idle_lock);
+        __atomic_sub_fetch(&state->idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&state->idle_lock);
+
+        if (__atomic_load_n(&state->pending, __ATOMIC_SEQ_CST) == 0)
+            break;
+    } // while
+
+    return NULL;
+} // walk_thread
+
+
+int fatelf_walk_threads(const int threads)
+{
+    long cpus;
+    if (threads > 0)
+        return threads;
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? (int) cpus : 1;
+} // fatelf_walk_threads
+
+
+int xfatelf_parse_jobs(const char *str)
+{
+    char *end = NULL;
+    const long val = strtol(str, &end, 10);
+    if ((end == str) || (*end != '\0') || (val < 0) || (val > 1024))
+        xfail("Invalid --jobs: '%s'", str);
+    return (int) val;
+} // xfatelf_parse_jobs
+
+
+size_t fatelf_hash_inode(const uint64_t dev, const uint64_t ino)
+{
+    uint64_t x = ino ^ (dev << 32) ^ (dev >> 32);
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return (size_t) x;
+} // fatelf_hash_inode
+
+
+uint64_t xfatelf_walk(const char *root, int threads, fatelf_walk_fn fn,
+                      void *data)
+{
+    pthread_t *tids;
+    walk_state state;
+    int started = 0;
+    int i;
+
+    memset(&state, '\0', sizeof (state));
+    state.root = root;
+    state.fn = fn;
+    state.data = data;
+    state.rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (state.rootfd == -1)
+        xfailc(FATELF_EIO, "Failed to open '%s': %s", root, strerror(errno));
+
+    threads = fatelf_walk_threads(threads);
+    state.num_workers = threads;
+    state.workers = (walk_worker *) xmalloc(sizeof (walk_worker) * threads);
+    for (i = 0; i < threads; i++)
+    {
+        walk_worker *worker = &state.workers[i];
+        worker->state = &state;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+    #if FATELF_HAVE_GETDENTS64
+        worker->dents = (uint8_t *) xmalloc(WALK_DENTS_SIZE);
+    #endif
+    } // for
+
+    pthread_mutex_init(&state.idle_lock, NULL);
+    pthread_cond_init(&state.idle_cond, NULL);
+    queue_dir(&state.workers[0], "", 0);
+
+    // This thread is worker zero, so start one fewer.
+    tids = (pthread_t *) xmalloc(sizeof (pthread_t) * threads);
+    for (i = 1; i < threads; i++)
+    {
+        if (pthread_create(&tids[started], NULL, walk_thread,
+                           &state.workers[i]) == 0)
+            started++;
+    } // for
+
+    walk_thread(&state.workers[0]);
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    for (i = 0; i < threads; i++)
+    {
+        walk_worker *worker = &state.workers[i];
+        pthread_mutex_destroy(&worker->deque.lock);
+        free(worker->deque.paths);
+        free(worker->path);
+    #if FATELF_HAVE_GETDENTS64
+        free(worker->dents);
+    #endif
+    } // for
+
+    free(state.workers);
+    free(tids);
+    pthread_cond_destroy(&state.idle_cond);
+    pthread_mutex_destroy(&state.idle_lock);
+    close(state.rootfd);
+
+    return state.failures;
+} // xfatelf_walk
+
+// end of fatelf-walk.c ...
@@ -0,0 +1,38 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#ifndef FATELF_WALK_H
+#define FATELF_WALK_H
+
+// Walk a directory tree with a pool of threads. Directories are read by
+//  whichever thread is free, and every other entry (files, symlinks, etc)
+//  is handed to the callback on the thread that found it, so the callback
+//  runs on many threads at once. Symlinks are never followed.
+//
+// (path) is the entry's path relative to the root ("usr/bin/ls"), and
+//  (dirfd, name) can open it with openat(). Neither is valid after the
+//  callback returns. (st) is from fstatat(), without following symlinks.
+typedef void (*fatelf_walk_fn)(void *data, const char *path, const int dirfd,
+                               const char *name, const struct stat *st);
+
+// Walk (root) with (threads) threads; zero means one per CPU. Directories
+//  that can't be read are reported on stderr and skipped. Returns the
+//  number of those, after every callback has returned. xfail()s if (root)
+//  itself can't be opened.
+uint64_t xfatelf_walk(const char *root, int threads, fatelf_walk_fn fn,
+                      void *data);
+
+// How many threads xfatelf_walk() uses for (threads).
+int fatelf_walk_threads(const int threads);
+
+// Parse the N of a "--jobs=N" option: 0 (one per CPU) to 1024.
+int xfatelf_parse_jobs(const char *str);
+
+// Mix a file's device and inode numbers into a hash table index, for the
+//  tools that keep track of the files a walk has seen.
+size_t fatelf_hash_inode(const uint64_t dev, const uint64_t ino);
+
+#endif /* FATELF_WALK_H */
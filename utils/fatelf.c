@@ -0,0 +1,371 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Every FatELF tool in one binary. "fatelf glue out a b" does what
+//  "fatelf-glue out a b" does, and so does running this through a link
+//  named fatelf-glue. "fatelf --batch" runs a whole stream of commands in
+//  one process, and keeps going when one of them fails.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-stats.h"
+
+#include <errno.h>
+
+typedef struct fatelf_command
+{
+    const char *name;
+    int (*fn)(int argc, const char **argv);
+} fatelf_command;
+
+static const fatelf_command commands[] =
+{
+    { "glue", fatelf_glue_main },
+    { "info", fatelf_info_main },
+    { "extract", fatelf_extract_main },
+    { "replace", fatelf_replace_main },
+    { "remove", fatelf_remove_main },
+    { "verify", fatelf_verify_main },
+    { "split", fatelf_split_main },
+    { "validate", fatelf_validate_main },
+    { "merge", fatelf_merge_main },
+    { "scan", fatelf_scan_main },
+    { "index", fatelf_index_main },
+    { "reorder", fatelf_reorder_main },
+};
+
+
+static const fatelf_command *find_command(const char *name)
+{
+    size_t i;
+    for (i = 0; i < (sizeof (commands) / sizeof (commands[0])); i++)
+    {
+        if (strcmp(commands[i].name, name) == 0)
+            return &commands[i];
+    } // for
+    return NULL;
+} // find_command
+
+
+// One command from a batch, as a run of null-terminated arguments in (buf).
+//  The buffers are kept from one command to the next.
+typedef struct batch_op
+{
+    char *buf;
+    size_t buflen;
+    size_t bufalloc;
+    const char **argv;
+    int argc;
+    int argvalloc;
+} batch_op;
+
+
+static void xbatch_append(batch_op *op, const char *str, const size_t len)
+{
+    if (op->buflen + len + 1 > op->bufalloc)
+    {
+        size_t newalloc = op->bufalloc ? op->bufalloc : 256;
+        void *ptr;
+        while (op->buflen + len + 1 > newalloc)
+            newalloc *= 2;
+        if ((ptr = realloc(op->buf, newalloc)) == NULL)
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        op->buf = (char *) ptr;
+        op->bufalloc = newalloc;
+    } // if
+    memcpy(op->buf + op->buflen, str, len);
+    op->buflen += len;
+    op->buf[op->buflen] = '\0';
+} // xbatch_append
+
+
+static void xbatch_end_arg(batch_op *op)
+{
+    xbatch_append(op, "", 0);
+    op->buflen++;  // keep the null terminator.
+    op->argc++;
+} // xbatch_end_arg
+
+
+// Point argv at each argument in (buf), now that it won't move again.
+static void xbatch_make_argv(batch_op *op)
+{
+    const char *ptr = op->buf;
+    int i;
+
+    if (op->argc + 1 > op->argvalloc)
+    {
+        const int newalloc = op->argc + 16;
+        void *mem = realloc(op->argv, newalloc * sizeof (const char *));
+        if (mem == NULL)
+            xfailc(FATELF_ENOMEM, "Out of memory!");
+        op->argv = (const char **) mem;
+        op->argvalloc = newalloc;
+    } // if
+
+    for (i = 0; i < op->argc; i++)
+    {
+        op->argv[i] = ptr;
+        ptr += strlen(ptr) + 1;
+    } // for
+    op->argv[op->argc] = NULL;
+} // xbatch_make_argv
+
+
+// Split a line into arguments: whitespace separates them, and single
+//  quotes, double quotes and backslashes work like they do in sh. Blank
+//  lines and lines that start with '#' have no arguments. Returns NULL on
+//  success, or what's wrong with the line.
+static const char *xbatch_split_line(batch_op *op, const char *line)
+{
+    const char *ptr = line;
+
+    op->buflen = 0;
+    op->argc = 0;
+
+    while ((*ptr == ' ') || (*ptr == '\t'))
+        ptr++;
+    if (*ptr == '#')
+        return NULL;  // a comment.
+
+    while (1)
+    {
+        int inarg = 0;
+        char quote = '\0';
+
+        while ((*ptr == ' ') || (*ptr == '\t') || (*ptr == '\r'))
+            ptr++;
+
+        while (*ptr)
+        {
+            const char ch = *ptr;
+            if (quote == '\'')
+            {
+                if (ch == '\'')
+                    quote = '\0';
+                else
+                    xbatch_append(op, ptr, 1);
+            } // if
+            else if ((ch == '\\') && (quote != '\'') && (ptr[1] != '\0'))
+            {
+                ptr++;
+                xbatch_append(op, ptr, 1);
+            } // else if
+            else if (quote == '"')
+            {
+                if (ch == '"')
+                    quote = '\0';
+                else
+                    xbatch_append(op, ptr, 1);
+            } // else if
+            else if ((ch == '\'') || (ch == '"'))
+                quote = ch;
+            else if ((ch == ' ') || (ch == '\t') || (ch == '\r'))
+                break;
+            else
+                xbatch_append(op, ptr, 1);
+            inarg = 1;
+            ptr++;
+        } // while
+
+        if (quote != '\0')
+            return "Unterminated quote";
+        else if (!inarg)
+            return NULL;  // end of the line.
+
+        xbatch_end_arg(op);
+    } // while
+} // xbatch_split_line
+
+
+// The whole command line, to name a command in a --trace; NULL otherwise.
+static char *trace_command_name(const int argc, const char **argv)
+{
+    size_t len = 1;
+    char *retval;
+    int i;
+
+    if ((fatelf_stats_flags & FATELF_STATS_TRACE) == 0)
+        return NULL;
+
+    for (i = 0; i < argc; i++)
+        len += strlen(argv[i]) + 1;
+    retval = (char *) xmalloc(len);
+    retval[0] = '\0';
+    for (i = 0; i < argc; i++)
+    {
+        if (i > 0)
+            strcat(retval, " ");
+        strcat(retval, argv[i]);
+    } // for
+    return retval;
+} // trace_command_name
+
+
+// Run one command inside a catch frame, so an xfail() in it comes back
+//  here instead of exiting. Reports how it went on stdout, and returns
+//  non-zero if it worked.
+static int run_batch_op(const unsigned long opnum, const int argc,
+                        const char **argv)
+{
+    const fatelf_command *cmd = find_command(argv[0]);
+    const uint64_t start = fatelf_stats_start();
+    char *name = NULL;
+    fatelf_catch frame;
+    int rc;
+
+    if (cmd == NULL)
+    {
+        printf("%lu failed: Unknown command '%s'\n", opnum, argv[0]);
+        fflush(stdout);
+        return 0;
+    } // if
+
+    name = trace_command_name(argc, argv);
+    fatelf_catch_enter(&frame);
+    if (setjmp(frame.env) != 0)
+    {
+        FATELF_STATS_PHASE(FATELF_PHASE_COMMAND, name, start);
+        free(name);
+        printf("%lu failed: %s\n", opnum, frame.message);
+        fflush(stdout);
+        return 0;
+    } // if
+
+    rc = cmd->fn(argc, argv);
+    fatelf_catch_leave(&frame);
+    FATELF_STATS_PHASE(FATELF_PHASE_COMMAND, name, start);
+    free(name);
+
+    if (rc != 0)
+        printf("%lu failed: %s exited with status %d\n", opnum, argv[0], rc);
+    else
+        printf("%lu ok\n", opnum);
+    fflush(stdout);
+    return (rc == 0);
+} // run_batch_op
+
+
+// Commands come one per line, or, with (nulls), as null-terminated
+//  arguments with an empty one (or the end of the input) after each
+//  command. Returns the exit status for the whole batch.
+static int xrun_batch(const char *fname, const int nulls)
+{
+    FILE *io = stdin;
+    batch_op op;
+    char *line = NULL;
+    size_t linealloc = 0;
+    unsigned long opnum = 0;
+    int failed = 0;
+    int done = 0;
+
+    if ((fname != NULL) && (strcmp(fname, "-") != 0))
+    {
+        if ((io = fopen(fname, "r")) == NULL)
+            xfailc(FATELF_EIO, "Failed to open '%s': %s", fname, strerror(errno));
+    } // if
+
+    memset(&op, '\0', sizeof (op));
+    while (!done)
+    {
+        const char *err = NULL;
+        ssize_t len;
+
+        op.buflen = 0;
+        op.argc = 0;
+
+        if (nulls)
+        {
+            while ((len = getdelim(&line, &linealloc, '\0', io)) > 0)
+            {
+                if ((len == 1) && (line[0] == '\0'))
+                    break;  // empty argument: end of this command.
+                xbatch_append(&op, line, strlen(line));
+                xbatch_end_arg(&op);
+            } // while
+            done = (len <= 0);
+        } // if
+        else
+        {
+            if ((len = getline(&line, &linealloc, io)) <= 0)
+                break;
+            if (line[len-1] == '\n')
+                line[len-1] = '\0';
+            err = xbatch_split_line(&op, line);
+        } // else
+
+        if (ferror(io))
+            xfailc(FATELF_EIO, "Failed to read '%s'", fname ? fname : "-");
+
+        if (err != NULL)
+        {
+            printf("%lu failed: %s\n", ++opnum, err);
+            fflush(stdout);
+            failed = 1;
+        } // if
+        else if (op.argc > 0)
+        {
+            xbatch_make_argv(&op);
+            if (!run_batch_op(++opnum, op.argc, op.argv))
+                failed = 1;
+        } // else if
+    } // while
+
+    if (io != stdin)
+        fclose(io);
+    free(line);
+    free(op.buf);
+    free(op.argv);
+
+    return failed;
+} // xrun_batch
+
+
+static void xusage(const char *argv0)
+{
+    xfail("USAGE: %s [options] <command> [args...]\n"
+          "       %s [options] --batch [--null] [file]\n"
+          "\n"
+          "commands: glue, info, extract, replace, remove, verify, split,\n"
+          "          validate, merge, scan, index, reorder", argv0, argv0);
+} // xusage
+
+
+int main(int argc, const char **argv)
+{
+    const char *base = strrchr(argv[0], '/');
+    const fatelf_command *cmd = NULL;
+
+    base = (base != NULL) ? (base + 1) : argv[0];
+    argc = xfatelf_init(argc, argv);
+
+    // Run through a link named after one of the tools? Be that tool.
+    if ((strncmp(base, "fatelf-", 7) == 0) && ((cmd = find_command(base + 7))))
+        return cmd->fn(argc, argv);
+    else if (argc < 2)
+        xusage(argv[0]);
+    else if (strcmp(argv[1], "--batch") == 0)
+    {
+        int nulls = 0;
+        int i = 2;
+        if ((i < argc) && ((strcmp(argv[i], "--null") == 0) ||
+                           (strcmp(argv[i], "-0") == 0)))
+        {
+            nulls = 1;
+            i++;
+        } // if
+
+        if (i < argc - 1)
+            xusage(argv[0]);
+        return xrun_batch((i < argc) ? argv[i] : NULL, nulls);
+    } // else if
+    else if ((cmd = find_command(argv[1])) == NULL)
+        xfail("Unknown command '%s'", argv[1]);
+
+    return cmd->fn(argc - 1, &argv[1]);
+} // main
+
+// end of fatelf.c ...
@@ -0,0 +1,1174 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// The library side of the FatELF utilities. Each entry point does its work
+//  with the same x functions the command line tools use, inside a catch
+//  frame, so an xfail() anywhere below it unwinds back here (releasing
+//  whatever was on the cleanup stack) and becomes a return code.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+#include "fatelf-aio.h"
+#include "fatelf-haiku.h"
+#include "fatelf-pack.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+struct fatelf_ctx
+{
+    int error;
+    int sys_errno;
+    char message[FATELF_ERROR_MAX];
+    char *order;  // fatelf_ctx_set_order(), or NULL.
+};
+
+
+static int api_failed(fatelf_ctx *ctx, const fatelf_catch *frame)
+{
+    // xfail() already left the frame before it jumped back to us.
+    ctx->error = frame->error;
+    ctx->sys_errno = frame->sys_errno;
+    memcpy(ctx->message, frame->message, sizeof (ctx->message));
+    return frame->error;
+} // api_failed
+
+
+static int api_succeeded(fatelf_ctx *ctx, fatelf_catch *frame,
+                         const int retval)
+{
+    fatelf_catch_leave(frame);
+    ctx->error = FATELF_OK;
+    ctx->sys_errno = 0;
+    ctx->message[0] = '\0';
+    return retval;
+} // api_succeeded
+
+
+// Every entry point starts with LIBFATELF_BEGIN and returns through
+//  LIBFATELF_END. Nothing set between the two may be used after a failure,
+//  since setjmp() doesn't preserve it.
+#define LIBFATELF_BEGIN(ctx) \
+    fatelf_catch frame; \
+    if ((ctx) == NULL) \
+        return FATELF_EINVAL; \
+    fatelf_catch_enter(&frame); \
+    if (setjmp(frame.env) != 0) \
+        return api_failed(ctx, &frame)
+
+#define LIBFATELF_END(ctx, retval) \
+    return api_succeeded(ctx, &frame, retval)
+
+
+// xfind_fatelf_record(), but not finding anything is an error here.
+static int xfind_record(const FATELF_header *header, const char *target)
+{
+    const int retval = xfind_fatelf_record(header, target);
+    if (retval < 0)
+        xfailc(FATELF_ENOTFOUND, "No record matches target '%s'", target);
+    return retval;
+} // xfind_record
+
+
+static int xfind_record_by_elf(const char *fname, const int fd,
+                               const char *fatfname,
+                               const FATELF_header *header)
+{
+    FATELF_record record;
+    int i;
+
+    xread_elf_header(fname, fd, 0, &record);
+    for (i = 0; i < ((int)header->num_records); i++)
+    {
+        if (fatelf_record_matches(&header->records[i], &record))
+            return i;
+    } // for
+
+    xfailc(FATELF_ENOTFOUND, "No record matches '%s' in FatELF file '%s'",
+           fname, fatfname);
+    return -1;
+} // xfind_record_by_elf
+
+
+// Where a glued file's Haiku resources come from, if anywhere.
+typedef struct glue_rsrc
+{
+    int idx;  // the binary they're in, or -1 for none.
+    uint64_t offset;
+    uint64_t size;
+} glue_rsrc;
+
+
+// Sort the records of a glued file by (order), and the binaries they come
+//  from, (fds) and (names), with them.
+static void xglue_order(const char *order, FATELF_header *header, int *fds,
+                        const char **names, glue_rsrc *resource)
+{
+    const int total = (int) header->num_records;
+    fatelf_order *compiled = xfatelf_compile_order(order);
+    const char *oldnames[0xFF];
+    int oldfds[0xFF];
+    int perm[0xFF];
+    int i;
+
+    fatelf_order_records(compiled, header, perm);
+    fatelf_permute_records(header, perm);
+    memcpy(oldfds, fds, sizeof (int) * total);
+    memcpy(oldnames, names, sizeof (char *) * total);
+
+    for (i = 0; i < total; i++)
+    {
+        fds[i] = oldfds[perm[i]];
+        names[i] = oldnames[perm[i]];
+    } // for
+
+    // the resources still come from the first binary on the command line.
+    for (i = 0; (resource->idx >= 0) && (i < total); i++)
+    {
+        if (perm[i] == resource->idx)
+        {
+            resource->idx = i;
+            break;
+        } // if
+    } // for
+
+    fatelf_cleanup_pop(fatelf_cleanup_order, compiled, 1);
+} // xglue_order
+
+
+// Open and probe every binary, and lay out the whole FatELF file before a
+//  byte of it is written. The binaries' descriptors go in (fds), and their
+//  names in (names), both in the order the records will be in (which is
+//  the order of (bins), unless there's an (order) to sort them by). The
+//  binaries and the returned header are on the cleanup stack.
+static FATELF_header *xglue_layout(const char **bins, const int bincount,
+                                   const char *order, int *fds,
+                                   const char **names, glue_rsrc *resource)
+{
+    int i = 0;
+    FATELF_header *header;
+    uint64_t offset = FATELF_DISK_FORMAT_SIZE(bincount);
+    uint64_t slack = 0;
+
+    if (bincount == 0)
+        xfailc(FATELF_EINVAL, "Nothing to do.");
+    else if (bincount > 0xFF)
+        xfailc(FATELF_EINVAL, "Too many binaries (max is 255).");
+
+    header = (FATELF_header *) xmalloc(fatelf_header_size(bincount));
+    fatelf_cleanup_push(free, header);
+    header->magic = FATELF_MAGIC;
+    header->version = FATELF_FORMAT_VERSION;
+    header->num_records = bincount;
+
+    resource->idx = -1;
+    for (i = 0; i < bincount; i++)
+    {
+        int j = 0;
+        const char *fname = bins[i];
+        const int fd = xopen_held(fname, O_RDONLY, 0755);
+        FATELF_record *record = &header->records[i];
+        fatelf_probe probe;
+
+        fds[i] = fd;
+        names[i] = fname;
+        xfatelf_probe(fname, fd, &probe);
+        fatelf_cleanup_push(fatelf_cleanup_probe, &probe);
+        if (probe.type != FATELF_PROBE_ELF)
+            xfailc(FATELF_EFORMAT, "'%s' is not an ELF binary", fname);
+        *record = probe.elf;  // this also knows the size, less resources.
+
+        // make sure we don't have a duplicate target.
+        for (j = 0; j < i; j++)
+        {
+            if (fatelf_record_matches(record, &header->records[j]))
+            {
+                xfailc(FATELF_EDUPLICATE,
+                       "'%s' and '%s' are for the same target.",
+                       bins[j], fname);
+            } // if
+        } // for
+
+        // Haiku resource data isn't part of the record; remember it.
+        if ((probe.has_rsrc) && (resource->idx == -1))
+        {
+            resource->idx = i;
+            resource->offset = probe.rsrc_offset;
+            resource->size = probe.rsrc_size;
+        } // if
+
+        fatelf_cleanup_pop(fatelf_cleanup_probe, &probe, 1);
+    } // for
+
+    if (order != NULL)
+        xglue_order(order, header, fds, names, resource);
+
+    for (i = 0; i < bincount; i++)
+    {
+        FATELF_record *record = &header->records[i];
+        const uint64_t align = xfatelf_record_align(names[i], fds[i], 0,
+                                                    record);
+        record->offset = fatelf_align_offset(offset + slack, align);
+        offset = record->offset + record->size;
+        slack = fatelf_record_slack(record->size);
+    } // for
+
+    return header;
+} // xglue_layout
+
+
+// Returns the header it wrote; free() it.
+static FATELF_header *xglue(const char *out, const char **bins,
+                            const int bincount, const char *order)
+{
+    int i = 0;
+    int *fds = (int *) xmalloc(sizeof (int) * (bincount ? bincount : 1));
+    const char **names;
+    FATELF_header *header;
+    glue_rsrc resource;
+    int outfd;
+    uint64_t offset;
+    fatelf_aio *aio = NULL;
+
+    fatelf_cleanup_push(free, fds);
+    names = (const char **) xmalloc(sizeof (char *) *
+                                    (bincount ? bincount : 1));
+    fatelf_cleanup_push(free, names);
+    outfd = xopen_held(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
+    unlink_on_xfail_add(out);
+
+    // Lay out the whole file first, so every copy can be queued at once.
+    header = xglue_layout(bins, bincount, order, fds, names, &resource);
+
+    // Write the actual FatELF header now...
+    xwrite_fatelf_header(out, outfd, header);
+    offset = FATELF_DISK_FORMAT_SIZE(bincount);
+
+    // ...then queue up each binary, padded to its alignment. We only move
+    //  the file position past each record; the batch fills them in.
+    aio = xaio_create();
+    for (i = 0; i < bincount; i++)
+    {
+        const FATELF_record *record = &header->records[i];
+        xwrite_zeros(out, outfd, (size_t) (record->offset - offset));
+        xaio_copy(aio, names[i], fds[i], 0, out, outfd, record->offset,
+                  record->size);
+        offset = record->offset + record->size;
+        xlseek(out, outfd, (off_t) offset, SEEK_SET);
+    } // for
+    xaio_finish(aio);
+
+    // rather then perform any complex merging of resources, we select the
+    // resources from the first file.
+    if (resource.idx >= 0)
+    {
+        const char *fname = names[resource.idx];
+        const int fd = fds[resource.idx];
+
+        if (haiku_fat_rsrc_offset(header, &offset))
+        {
+            xlseek(out, outfd, offset, SEEK_SET);
+            xcopyfile_range(fname, fd, out, outfd, resource.offset,
+                            resource.size);
+        } // if
+    } // if
+
+    // done with the binaries!
+    for (i = 0; i < bincount; i++)
+        xclose_held(names[i], fds[i]);
+
+    xclose_held(out, outfd);
+    fatelf_cleanup_pop(free, header, 0);  // caller's now.
+    fatelf_cleanup_pop(free, names, 1);
+    fatelf_cleanup_pop(free, fds, 1);
+
+    unlink_on_xfail_remove(out);
+    return header;
+} // xglue
+
+
+// xglue(), but (outfd) is only ever written front to back, so it can be a
+//  pipe: the header comes from memory, padding is real zeros, and each
+//  record is copied in order, straight after the last.
+static void xglue_stream(const char *out, const int outfd, const char **bins,
+                         const int bincount, const char *order)
+{
+    int i = 0;
+    int *fds = (int *) xmalloc(sizeof (int) * (bincount ? bincount : 1));
+    const char **names;
+    FATELF_header *header;
+    glue_rsrc resource;
+    uint8_t *buf;
+    uint64_t buflen;
+    uint64_t offset;
+
+    fatelf_cleanup_push(free, fds);
+    names = (const char **) xmalloc(sizeof (char *) *
+                                    (bincount ? bincount : 1));
+    fatelf_cleanup_push(free, names);
+    header = xglue_layout(bins, bincount, order, fds, names, &resource);
+
+    buflen = FATELF_DISK_FORMAT_SIZE(bincount);
+    buf = (uint8_t *) xmalloc(buflen);
+    fatelf_cleanup_push(free, buf);
+    fatelf_encode_header(header, buf);
+    xwrite(out, outfd, buf, buflen);
+    offset = buflen;
+
+    for (i = 0; i < bincount; i++)
+    {
+        const FATELF_record *record = &header->records[i];
+        xwrite_zeros(out, outfd, (size_t) (record->offset - offset));
+        xcopyfile_range(names[i], fds[i], out, outfd, 0, record->size);
+        offset = record->offset + record->size;
+    } // for
+
+    // The resources go where they would in xglue(), which we can work out
+    //  from the header alone.
+    if (resource.idx >= 0)
+    {
+        uint64_t rsrc;
+        if (haiku_rsrc_offset_mem(out, buf, buflen, &rsrc))
+        {
+            xwrite_zeros(out, outfd, (size_t) (rsrc - offset));
+            xcopyfile_range(names[resource.idx], fds[resource.idx], out,
+                            outfd, resource.offset, resource.size);
+        } // if
+    } // if
+
+    for (i = 0; i < bincount; i++)
+        xclose_held(names[i], fds[i]);
+
+    fatelf_cleanup_pop(free, buf, 1);
+    fatelf_cleanup_pop(free, header, 1);
+    fatelf_cleanup_pop(free, names, 1);
+    fatelf_cleanup_pop(free, fds, 1);
+} // xglue_stream
+
+
+// Extracting from a packed file unpacks the record, and the data after it.
+static void xextract_packed(const char *out, const char *fname, const int fd,
+                            const char *target)
+{
+    fatelf_packed *packed = xfatelf_packed_open(fname, fd);
+    int recidx;
+    int outfd;
+
+    fatelf_cleanup_push(fatelf_cleanup_packed, packed);
+    recidx = xfind_record(packed->header, target);
+    outfd = xopen_held(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
+    unlink_on_xfail_add(out);
+
+    xfatelf_packed_extract(packed, fname, fd, recidx, out, outfd);
+    xclose_held(out, outfd);
+    fatelf_cleanup_pop(fatelf_cleanup_packed, packed, 1);
+
+    unlink_on_xfail_remove(out);
+} // xextract_packed
+
+
+static void xextract(const char *out, const char *fname, const char *target)
+{
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
+    fatelf_view *view;
+    int recidx;
+    int outfd;
+    const FATELF_record *rec;
+    uint64_t len = 0;
+
+    if (xfatelf_is_packed(fname, fd))
+    {
+        xextract_packed(out, fname, fd, target);
+        xclose_held(fname, fd);
+        return;
+    } // if
+
+    view = xfatelf_view_open(fname, fd);
+    fatelf_cleanup_push(fatelf_cleanup_view, view);
+    recidx = xfind_record(view->header, target);
+    outfd = xopen_held(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
+    rec = &view->header->records[recidx];
+
+    unlink_on_xfail_add(out);
+
+    xfatelf_view_record(view, recidx, &len);  // make sure it's all there.
+    xcopyfile_range(fname, fd, out, outfd, rec->offset, len);
+    xfatelf_view_append_junk(view, recidx, out, outfd);
+    xclose_held(out, outfd);
+    fatelf_cleanup_pop(fatelf_cleanup_view, view, 1);
+    xclose_held(fname, fd);
+
+    unlink_on_xfail_remove(out);
+} // xextract
+
+
+// A record's ELF program and section header tables, kept as the record
+//  streams past, so Haiku resources can be placed after it without reading
+//  the output back. The tables can't be bigger than this unless they're
+//  nonsense.
+#define STREAM_TABLE_MAX (16 * 1024 * 1024)
+
+typedef struct stream_tables
+{
+    uint8_t *data[HAIKU_ELF_TABLES];  // NULL if we don't need to keep it.
+    uint64_t offsets[HAIKU_ELF_TABLES];
+    uint64_t lens[HAIKU_ELF_TABLES];
+} stream_tables;
+
+static void cleanup_stream_tables(void *_tables)
+{
+    stream_tables *tables = (stream_tables *) _tables;
+    int i;
+    for (i = 0; i < HAIKU_ELF_TABLES; i++)
+        free(tables->data[i]);
+} // cleanup_stream_tables
+
+
+// Find the tables of a (size)-byte record from its first (prefixlen) bytes,
+//  and make room for the ones that aren't all there.
+static void xstream_tables_init(const char *in, const uint8_t *prefix,
+                                const uint64_t prefixlen,
+                                const uint64_t size, stream_tables *tables)
+{
+    int i;
+
+    if (!haiku_elf_rsrc_tables(in, prefix, prefixlen, tables->offsets,
+                               tables->lens))
+        return;  // not ELF; we'll have nowhere to put resources anyhow.
+
+    for (i = 0; i < HAIKU_ELF_TABLES; i++)
+    {
+        const uint64_t offset = tables->offsets[i];
+        const uint64_t len = tables->lens[i];
+        if ((len == 0) || (offset + len <= prefixlen))
+            continue;  // nothing to keep.
+        else if ((offset > size) || (len > size - offset))
+            continue;  // truncated; we'll fail if we need it.
+        else if (len > STREAM_TABLE_MAX)
+            continue;  // nonsense; ditto.
+
+        tables->data[i] = (uint8_t *) xmalloc((size_t) len);
+        if (offset < prefixlen)
+        {
+            memcpy(tables->data[i], prefix + offset,
+                   (size_t) (prefixlen - offset));
+        } // if
+    } // for
+} // xstream_tables_init
+
+
+// xcopy_stream() from (pos) to (end) in the record, keeping any bytes of
+//  (tables) as they go by. Returns how far we got.
+static uint64_t xcopy_stream_tables(const char *in, const int infd,
+                                    const char *out, const int outfd,
+                                    uint64_t pos, const uint64_t end,
+                                    stream_tables *tables)
+{
+    while (pos < end)
+    {
+        uint64_t next = end;  // where we next start or stop keeping bytes.
+        uint64_t want, got;
+        int inside = -1;
+        int i;
+
+        for (i = 0; i < HAIKU_ELF_TABLES; i++)
+        {
+            const uint64_t start = tables->offsets[i];
+            const uint64_t stop = start + tables->lens[i];
+            if (tables->data[i] == NULL)
+                continue;
+            else if ((pos >= start) && (pos < stop))
+            {
+                if (inside == -1)
+                    inside = i;
+                if (stop < next)
+                    next = stop;
+            } // else if
+            else if ((start > pos) && (start < next))
+                next = start;
+        } // for
+
+        want = next - pos;
+        if (inside == -1)
+            got = xcopy_stream(in, infd, out, outfd, want);
+        else
+        {
+            // Read straight into the table, then share with any other
+            //  table that overlaps it.
+            const uint64_t base = tables->offsets[inside];
+            const uint8_t *ptr = tables->data[inside] + (pos - base);
+            got = xread_stream(in, infd, tables->data[inside] + (pos - base),
+                               (size_t) want);
+            xwrite(out, outfd, ptr, got);
+            for (i = 0; i < HAIKU_ELF_TABLES; i++)
+            {
+                const uint64_t start = tables->offsets[i];
+                const uint64_t stop = start + tables->lens[i];
+                const uint64_t from = (start > pos) ? start : pos;
+                const uint64_t to = (stop < pos + got) ? stop : pos + got;
+                if ((i != inside) && (tables->data[i] != NULL) && (from < to))
+                {
+                    memcpy(tables->data[i] + (from - start),
+                           ptr + (from - pos), (size_t) (to - from));
+                } // if
+            } // for
+        } // else
+
+        pos += got;
+        if (got < want)
+            break;  // hit the end of the file.
+    } // while
+
+    return pos;
+} // xcopy_stream_tables
+
+
+// Where the Haiku resources from (in) go in the (rec) we extracted, whose
+//  first (prefixlen) bytes are still in (prefix).
+static uint64_t xstream_rsrc_offset(const char *in, const FATELF_record *rec,
+                                    const uint8_t *prefix,
+                                    const uint64_t prefixlen,
+                                    const stream_tables *tables)
+{
+    uint64_t retval = 0;
+
+    if (haiku_rsrc_offset_tables(in, prefix, prefixlen, rec->size,
+                                 (const uint8_t *const *) tables->data,
+                                 tables->offsets, tables->lens, &retval))
+        return retval;
+
+    xfailc(FATELF_EFORMAT,
+           "Could not determine target offset for Haiku resources");
+    return 0;
+} // xstream_rsrc_offset
+
+
+// A pipe can't be read twice, so the index is held in memory; past this,
+//  we don't believe it.
+#define HAIKU_RSRC_STREAM_INDEX_MAX (16 * 1024 * 1024)
+
+// Copy the Haiku resources that start with the (gotlen) bytes at (got),
+//  and go on in (infd), to (outfd): just as many bytes as their index says
+//  they have, so whatever's after them is left behind, as xextract() does.
+//  If the index doesn't hold together, copy to the end, to be safe.
+static void xcopy_rsrc_stream(const char *in, const int infd,
+                              const char *out, const int outfd,
+                              const uint8_t *got, const uint64_t gotlen)
+{
+    uint64_t len = HAIKU_RSRC_HEADER_SIZE;
+    uint8_t *buf = (uint8_t *) xmalloc(len);
+    uint64_t span, size = UINT64_MAX;
+
+    fatelf_cleanup_push(free, buf);
+    memcpy(buf, got, gotlen);
+    len = gotlen + xread_stream(in, infd, buf + gotlen, len - gotlen);
+    span = haiku_rsrc_index_span(buf, len);
+    if ((span > len) && (span <= HAIKU_RSRC_STREAM_INDEX_MAX))
+    {
+        uint8_t *index = (uint8_t *) xmalloc(span);
+        memcpy(index, buf, len);
+        fatelf_cleanup_pop(free, buf, 1);
+        buf = index;
+        fatelf_cleanup_push(free, buf);
+        len += xread_stream(in, infd, buf + len, span - len);
+    } // if
+
+    if ((!haiku_rsrc_size_mem(buf, len, &size)) || (size < len))
+        size = UINT64_MAX;
+    else
+        size -= len;
+
+    xwrite(out, outfd, buf, len);
+    xcopy_stream(in, infd, out, outfd, size);
+    fatelf_cleanup_pop(free, buf, 1);
+} // xcopy_rsrc_stream
+
+
+// xextract(), in one forward pass over (infd), so it can be a pipe: skip
+//  to the record, copy it, then skip to the end of the furthest record and
+//  copy whatever comes after it. Nothing but the header, the start of the
+//  record and its ELF header tables is held in memory. (outfd) is written
+//  front to back, too, unless Haiku resources belong somewhere else.
+static void xextract_stream(const char *out, const int outfd,
+                            const char *in, const int infd,
+                            const char *target)
+{
+    uint8_t look[HAIKU_FAT_RSRC_LOOKAHEAD];
+    FATELF_header *header;
+    const FATELF_record *rec;
+    const FATELF_record *furthest;
+    stream_tables tables;
+    uint8_t *buf;
+    uint8_t *prefix;
+    uint64_t prefixlen;
+    uint64_t pos, edge, skip;
+    uint64_t copied = 0;
+    uint32_t magic;
+    size_t len;
+    int recidx;
+
+    // A packed file has to be read out of order; that's fine if we can.
+    if ((lseek(infd, 0, SEEK_CUR) != -1) && (xfatelf_is_packed(in, infd)))
+    {
+        fatelf_packed *packed = xfatelf_packed_open(in, infd);
+        fatelf_cleanup_push(fatelf_cleanup_packed, packed);
+        recidx = xfind_record(packed->header, target);
+        xfatelf_packed_extract(packed, in, infd, recidx, out, outfd);
+        fatelf_cleanup_pop(fatelf_cleanup_packed, packed, 1);
+        return;
+    } // if
+
+    buf = (uint8_t *) xmalloc(FATELF_DISK_FORMAT_SIZE(0xFF));
+    fatelf_cleanup_push(free, buf);
+    len = xread_stream(in, infd, buf, 8);
+    magic = ((uint32_t) buf[0]) | (((uint32_t) buf[1]) << 8) |
+            (((uint32_t) buf[2]) << 16) | (((uint32_t) buf[3]) << 24);
+    if ((len == 8) && (magic == FATELF_PACKED_MAGIC))
+    {
+        xfailc(FATELF_EINVAL, "'%s' is a packed FatELF file, which can't be"
+               " read front to back", in);
+    } // if
+    else if (len == 8)
+    {
+        const size_t hdrlen = FATELF_DISK_FORMAT_SIZE(buf[6]);
+        len += xread_stream(in, infd, buf + 8, hdrlen - 8);
+    } // else if
+
+    header = xdecode_fatelf_header(in, buf, len);
+    fatelf_cleanup_pop(free, buf, 1);
+    fatelf_cleanup_push(free, header);
+
+    recidx = xfind_record(header, target);
+    rec = &header->records[recidx];
+    pos = FATELF_DISK_FORMAT_SIZE(header->num_records);
+    if (rec->offset < pos)
+        xfailc(FATELF_EFORMAT, "Record #%d overlaps the header of '%s'",
+               recidx, in);
+    furthest = &header->records[find_furthest_record(header)];
+    edge = furthest->offset + furthest->size;
+
+    // Keep the start of the record, and the ELF tables that follow it, so
+    //  we know where Haiku resources go without reading (out) back, which
+    //  we can't do to a pipe. Those tables are found before anything is
+    //  written, so we never leave half a binary behind for that.
+    xskip_stream(in, infd, rec->offset - pos);
+    prefixlen = (rec->size < FATELF_PROBE_SIZE) ? rec->size : FATELF_PROBE_SIZE;
+    prefix = (uint8_t *) xmalloc(prefixlen ? prefixlen : 1);
+    fatelf_cleanup_push(free, prefix);
+    memset(&tables, '\0', sizeof (tables));
+    fatelf_cleanup_push(cleanup_stream_tables, &tables);
+    if (xread_stream(in, infd, prefix, prefixlen) == prefixlen)
+    {
+        if (prefixlen < rec->size)
+            xstream_tables_init(in, prefix, prefixlen, rec->size, &tables);
+        xwrite(out, outfd, prefix, prefixlen);
+        copied = xcopy_stream_tables(in, infd, out, outfd, prefixlen,
+                                     rec->size, &tables);
+    } // if
+
+    if (copied != rec->size)
+        xfailc(FATELF_EFORMAT, "Record #%d runs past the end of '%s'",
+               recidx, in);
+
+    // Then anything past the furthest record, as xappend_junk() would.
+    xskip_stream(in, infd, edge - (rec->offset + rec->size));
+    len = xread_stream(in, infd, look, sizeof (look));
+    if (haiku_fat_rsrc_stream(edge, look, len, &skip))
+    {
+        const uint64_t offset = xstream_rsrc_offset(in, rec, prefix,
+                                                    prefixlen, &tables);
+        if (offset >= rec->size)
+            xwrite_zeros(out, outfd, (size_t) (offset - rec->size));
+        else
+            xlseek(out, outfd, (off_t) offset, SEEK_SET);
+        xcopy_rsrc_stream(in, infd, out, outfd, look + skip, len - skip);
+    } // if
+    else
+    {
+        xwrite(out, outfd, look, len);
+        xcopy_stream(in, infd, out, outfd, UINT64_MAX);
+    } // else
+
+    fatelf_cleanup_pop(cleanup_stream_tables, &tables, 1);
+    fatelf_cleanup_pop(free, prefix, 1);
+    fatelf_cleanup_pop(free, header, 1);
+} // xextract_stream
+
+
+static void xpack(const char *out, const char *fname)
+{
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
+    const int outfd = xopen_held(out, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    unlink_on_xfail_add(out);
+    xfatelf_pack(fname, fd, out, outfd, 0);
+    xclose_held(out, outfd);
+    xclose_held(fname, fd);
+    unlink_on_xfail_remove(out);
+} // xpack
+
+
+static void xremove(const char *out, const char *fname, const char *target)
+{
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
+    FATELF_header *header;
+    fatelf_probe probe;
+    int idx;
+    int outfd;
+    uint64_t offset;
+    uint64_t slack = 0;
+    int i;
+
+    // One look at the file tells us where its records and junk are.
+    xfatelf_probe_fatelf(fname, fd, &probe);
+    fatelf_cleanup_push(fatelf_cleanup_probe, &probe);
+    header = probe.header;
+    offset = FATELF_DISK_FORMAT_SIZE(((int)header->num_records));
+    idx = xfind_record(header, target);
+    outfd = xopen_held(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
+
+    unlink_on_xfail_add(out);
+
+    // pad out some bytes for the header we'll write at the end...
+    xwrite_zeros(out, outfd, (size_t) offset);
+
+    for (i = 0; i < ((int) header->num_records); i++)
+    {
+        if (i != idx)  // not the thing we're removing?
+        {
+            FATELF_record *rec = &header->records[i];
+            const uint64_t align = xfatelf_record_align(fname, fd,
+                                                        rec->offset, rec);
+            const uint64_t binary_offset = fatelf_align_offset(offset + slack,
+                                                               align);
+
+            // append this binary to the final file, padded to alignment.
+            xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
+            xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
+
+            rec->offset = binary_offset;
+            offset = binary_offset + rec->size;
+            slack = fatelf_record_slack(rec->size);
+        } // if
+    } // for
+
+    // remove the record we chopped out.
+    header->num_records--;
+    if (idx < ((int) header->num_records))
+    {
+        void *dst = &header->records[idx];
+        const void *src = &header->records[idx+1];
+        const size_t count = (header->num_records - idx);
+        memmove(dst, src, sizeof (FATELF_record) * count);
+    } // if
+
+    // Write the actual FatELF header now...
+    xwrite_fatelf_header(out, outfd, header);
+
+    // ...which moved the file position, so junk goes after the last record.
+    xlseek(out, outfd, (off_t) offset, SEEK_SET);
+    xappend_junk(&probe, fname, fd, out, outfd, header);
+
+    xclose_held(out, outfd);
+    xclose_held(fname, fd);
+    fatelf_cleanup_pop(fatelf_cleanup_probe, &probe, 1);
+
+    unlink_on_xfail_remove(out);
+} // xremove
+
+
+static void xreplace(const char *out, const char *fname, const char *newobj)
+{
+    const int fd = xopen_held(fname, O_RDONLY, 0755);
+    const int newfd = xopen_held(newobj, O_RDONLY, 0755);
+    FATELF_header *header;
+    fatelf_probe probe;
+    int idx;
+    int outfd;
+    uint64_t offset;
+    uint64_t slack = 0;
+    int i;
+
+    xfatelf_probe_fatelf(fname, fd, &probe);
+    fatelf_cleanup_push(fatelf_cleanup_probe, &probe);
+    header = probe.header;
+    offset = FATELF_DISK_FORMAT_SIZE(((int)header->num_records));
+    idx = xfind_record_by_elf(newobj, newfd, fname, header);
+    outfd = xopen_held(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
+
+    unlink_on_xfail_add(out);
+
+    // pad out some bytes for the header we'll write at the end...
+    xwrite_zeros(out, outfd, (size_t) offset);
+
+    for (i = 0; i < ((int) header->num_records); i++)
+    {
+        FATELF_record *rec = &header->records[i];
+        uint64_t binary_offset;
+
+        if (i == idx)  // the thing we're replacing...
+        {
+            rec->size = xget_file_size(newobj, newfd);
+            binary_offset = xfatelf_record_align(newobj, newfd, 0, rec);
+        } // if
+        else
+        {
+            binary_offset = xfatelf_record_align(fname, fd, rec->offset, rec);
+        } // else
+        binary_offset = fatelf_align_offset(offset + slack, binary_offset);
+
+        // append this binary to the final file, padded to alignment.
+        xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
+
+        if (i == idx)
+            rec->size = xcopyfile(newobj, newfd, out, outfd);
+        else
+            xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
+
+        rec->offset = binary_offset;
+        offset = binary_offset + rec->size;
+        slack = fatelf_record_slack(rec->size);
+    } // for
+
+    // Write the actual FatELF header now...
+    xwrite_fatelf_header(out, outfd, header);
+
+    // ...which moved the file position, so junk goes after the last record.
+    xlseek(out, outfd, (off_t) offset, SEEK_SET);
+    xappend_junk(&probe, fname, fd, out, outfd, header);
+
+    xclose_held(out, outfd);
+    xclose_held(newobj, newfd);
+    xclose_held(fname, fd);
+    fatelf_cleanup_pop(fatelf_cleanup_probe, &probe, 1);
+
+    unlink_on_xfail_remove(out);
+} // xreplace
+
+
+// Can record (idx) become (newsize) bytes without moving anything else in a
+//  file of (fsize) bytes? It can grow up to the next record (into the
+//  alignment padding and any slack reserved by --slack), or without limit if
+//  nothing follows it. Junk at the end of the file is found by where the
+//  last record ends, so that record has to stay the same size if there is
+//  any.
+static int fits_in_place(const FATELF_header *header, const int idx,
+                         const uint64_t fsize, const uint64_t newsize)
+{
+    const FATELF_record *rec = &header->records[idx];
+    uint64_t limit = 0;  // zero means nothing follows this record.
+    int i;
+
+    for (i = 0; i < ((int) header->num_records); i++)
+    {
+        const uint64_t other = header->records[i].offset;
+        if ((i != idx) && (other >= rec->offset) && ((!limit) || (other < limit)))
+            limit = other;
+    } // for
+
+    if (limit)
+        return (newsize <= (limit - rec->offset));
+    else if (fsize > (rec->offset + rec->size))
+        return (newsize == rec->size);
+    return 1;
+} // fits_in_place
+
+
+// Rewrite (fname) with the replacement made, in a temporary file that is
+//  renamed over the original when it's complete.
+static void xreplace_rewrite(const char *fname, const char *newobj)
+{
+    char *tmp = NULL;
+    const int fd = xcreate_temp(fname, &tmp);
+    struct stat statbuf;
+
+    if (stat(fname, &statbuf) == 0)
+        xcopy_file_attrs(tmp, fd, &statbuf, 0);
+    xclose_held(tmp, fd);
+
+    xreplace(tmp, fname, newobj);
+
+    xrename(tmp, fname);
+    unlink_on_xfail_remove(tmp);
+    fatelf_cleanup_pop(free, tmp, 1);
+} // xreplace_rewrite
+
+
+// Overwrite just the replaced record and the header, if the new ELF fits
+//  where the old one was. Otherwise, fall back to rewriting the whole file.
+static void xreplace_in_place(const char *fname, const char *newobj)
+{
+    const int fd = xopen_held(fname, O_RDWR, 0755);
+    const int newfd = xopen_held(newobj, O_RDONLY, 0755);
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    int idx;
+    uint64_t fsize, newsize, oldend, align;
+    FATELF_record *rec;
+    FATELF_record newrec;
+
+    fatelf_cleanup_push(free, header);
+    idx = xfind_record_by_elf(newobj, newfd, fname, header);
+    fsize = xget_file_size(fname, fd);
+    newsize = xget_file_size(newobj, newfd);
+    rec = &header->records[idx];
+    oldend = rec->offset + rec->size;
+
+    // The new binary might want more alignment than the old one had, too.
+    newrec = *rec;
+    newrec.size = newsize;
+    align = xfatelf_record_align(newobj, newfd, 0, &newrec);
+
+    if ( (!fits_in_place(header, idx, fsize, newsize)) ||
+         (fatelf_align_offset(rec->offset, align) != rec->offset) )
+    {
+        xclose_held(newobj, newfd);
+        xclose_held(fname, fd);
+        fatelf_cleanup_pop(free, header, 1);
+        xreplace_rewrite(fname, newobj);
+        return;
+    } // if
+
+    // New data first, then the header that points at it.
+    xcopyfile_at(newobj, newfd, 0, fname, fd, rec->offset, newsize);
+    if (newsize < rec->size)
+    {
+        const uint64_t newend = rec->offset + newsize;
+        if (oldend >= fsize)  // we're the end of the file; just chop it.
+        {
+            if (ftruncate(fd, (off_t) newend) == -1)
+            {
+                xfailc(FATELF_EIO, "Failed to truncate '%s': %s",
+                       fname, strerror(errno));
+            } // if
+        } // if
+        else  // don't leave the tail of the old binary in the slack.
+        {
+            xpwrite_zeros(fname, fd, newend, oldend - newend);
+        } // else
+    } // if
+
+    rec->size = newsize;
+    xwrite_fatelf_header(fname, fd, header);
+
+    xclose_held(newobj, newfd);
+    xclose_held(fname, fd);
+    fatelf_cleanup_pop(free, header, 1);
+} // xreplace_in_place
+
+
+// Records can be listed in any order, whatever order their binaries are in,
+//  so this only has to rewrite the header.
+static void xreorder(const char *fname, const char *order)
+{
+    const int fd = xopen_held(fname, O_RDWR, 0755);
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    fatelf_order *compiled;
+    int perm[0xFF];
+
+    fatelf_cleanup_push(free, header);
+    compiled = xfatelf_compile_order(order);
+    fatelf_order_records(compiled, header, perm);
+    fatelf_permute_records(header, perm);
+    xwrite_fatelf_header(fname, fd, header);
+
+    fatelf_cleanup_pop(fatelf_cleanup_order, compiled, 1);
+    xclose_held(fname, fd);
+    fatelf_cleanup_pop(free, header, 1);
+} // xreorder
+
+
+fatelf_ctx *fatelf_ctx_create(void)
+{
+    return (fatelf_ctx *) calloc(1, sizeof (fatelf_ctx));
+} // fatelf_ctx_create
+
+
+void fatelf_ctx_destroy(fatelf_ctx *ctx)
+{
+    if (ctx != NULL)
+        free(ctx->order);
+    free(ctx);
+} // fatelf_ctx_destroy
+
+
+int fatelf_ctx_set_order(fatelf_ctx *ctx, const char *order)
+{
+    char *copy = NULL;
+    LIBFATELF_BEGIN(ctx);
+    if (order != NULL)
+    {
+        fatelf_order *compiled = xfatelf_compile_order(order);  // check it.
+        fatelf_cleanup_pop(fatelf_cleanup_order, compiled, 1);
+        copy = xstrdup(order);
+    } // if
+    free(ctx->order);
+    ctx->order = copy;
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_ctx_set_order
+
+
+int fatelf_ctx_error(const fatelf_ctx *ctx)
+{
+    return ctx->error;
+} // fatelf_ctx_error
+
+
+int fatelf_ctx_errno(const fatelf_ctx *ctx)
+{
+    return ctx->sys_errno;
+} // fatelf_ctx_errno
+
+
+const char *fatelf_ctx_message(const fatelf_ctx *ctx)
+{
+    return ctx->message;
+} // fatelf_ctx_message
+
+
+int fatelf_read_header(fatelf_ctx *ctx, const char *fname, const int fd,
+                       FATELF_header **header)
+{
+    LIBFATELF_BEGIN(ctx);
+    *header = xread_fatelf_header(fname, fd);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_read_header
+
+
+int fatelf_write_header(fatelf_ctx *ctx, const char *fname, const int fd,
+                        const FATELF_header *header)
+{
+    LIBFATELF_BEGIN(ctx);
+    xwrite_fatelf_header(fname, fd, header);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_write_header
+
+
+void fatelf_free_header(FATELF_header *header)
+{
+    free(header);
+} // fatelf_free_header
+
+
+int fatelf_find_record(fatelf_ctx *ctx, const FATELF_header *header,
+                       const char *target)
+{
+    int idx;
+    LIBFATELF_BEGIN(ctx);
+    idx = xfind_record(header, target);
+    LIBFATELF_END(ctx, idx);
+} // fatelf_find_record
+
+
+int fatelf_glue(fatelf_ctx *ctx, const char *out, const char **bins,
+                const int bincount)
+{
+    LIBFATELF_BEGIN(ctx);
+    free(xglue(out, bins, bincount, ctx->order));
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_glue
+
+
+int fatelf_glue_header(fatelf_ctx *ctx, const char *out, const char **bins,
+                       const int bincount, FATELF_header **header)
+{
+    LIBFATELF_BEGIN(ctx);
+    *header = xglue(out, bins, bincount, ctx->order);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_glue_header
+
+
+int fatelf_extract(fatelf_ctx *ctx, const char *out, const char *in,
+                   const char *target)
+{
+    LIBFATELF_BEGIN(ctx);
+    xextract(out, in, target);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_extract
+
+
+int fatelf_glue_stream(fatelf_ctx *ctx, const char *out, const int outfd,
+                       const char **bins, const int bincount)
+{
+    LIBFATELF_BEGIN(ctx);
+    xglue_stream(out, outfd, bins, bincount, ctx->order);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_glue_stream
+
+
+int fatelf_extract_stream(fatelf_ctx *ctx, const char *out, const int outfd,
+                          const char *in, const int infd, const char *target)
+{
+    LIBFATELF_BEGIN(ctx);
+    xextract_stream(out, outfd, in, infd, target);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_extract_stream
+
+
+int fatelf_pack(fatelf_ctx *ctx, const char *out, const char *in)
+{
+    LIBFATELF_BEGIN(ctx);
+    xpack(out, in);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_pack
+
+
+int fatelf_remove(fatelf_ctx *ctx, const char *out, const char *in,
+                  const char *target)
+{
+    LIBFATELF_BEGIN(ctx);
+    xremove(out, in, target);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_remove
+
+
+int fatelf_replace(fatelf_ctx *ctx, const char *out, const char *in,
+                   const char *newelf)
+{
+    LIBFATELF_BEGIN(ctx);
+    xreplace(out, in, newelf);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_replace
+
+
+int fatelf_replace_in_place(fatelf_ctx *ctx, const char *fname,
+                            const char *newelf)
+{
+    LIBFATELF_BEGIN(ctx);
+    xreplace_in_place(fname, newelf);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_replace_in_place
+
+
+int fatelf_reorder(fatelf_ctx *ctx, const char *fname, const char *order)
+{
+    LIBFATELF_BEGIN(ctx);
+    xreorder(fname, order);
+    LIBFATELF_END(ctx, FATELF_OK);
+} // fatelf_reorder
+
+
+fatelf_ctx *xfatelf_ctx_create(void)
+{
+    fatelf_ctx *ctx = fatelf_ctx_create();
+    if (ctx == NULL)
+        xfailc(FATELF_ENOMEM, "Out of memory!");
+    return ctx;
+} // xfatelf_ctx_create
+
+
+void xfatelf_ctx_finish(fatelf_ctx *ctx, const int rc)
+{
+    if (rc < 0)
+    {
+        char message[FATELF_ERROR_MAX];
+        memcpy(message, ctx->message, sizeof (message));
+        fatelf_ctx_destroy(ctx);
+        xfailc(rc, "%s", message);
+    } // if
+    fatelf_ctx_destroy(ctx);
+} // xfatelf_ctx_finish
+
+// end of libfatelf.c ...